@@ -0,0 +1,395 @@
+#include <math.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../includes/results_table.cpp"
+
+using namespace std;
+
+#define PLOT_WIDTH 800
+#define PLOT_HEIGHT 500
+#define PLOT_MARGIN 70
+#define PLOT_LEGEND 220
+#define NUM_PLOT_COLORS 10
+const char* PLOT_COLORS[NUM_PLOT_COLORS] = {"#1f77b4", "#ff7f0e", "#2ca02c", "#d62728", "#9467bd", "#8c564b", "#e377c2", "#7f7f7f", "#bcbd22", "#17becf"};
+
+/**
+ * Block time distribution and derived rates of one configuration at one threshold
+ */
+struct ThresholdStats {
+    size_t config;
+    size_t threshold;
+    size_t blocks;
+    double mean;
+    double stddev;
+    double min;
+    double p10;
+    double median;
+    double p90;
+    double max;
+    double hashrate;    // expected hashes per second
+    double speedup;     // baseline mean block time / mean block time, 0 without a baseline
+    double efficiency;  // speedup per thread
+};
+
+/**
+ * Totals of one configuration over all its blocks
+ */
+struct ConfigStats {
+    size_t blocks;
+    size_t max_threshold;
+    double time;        // sum of the block times
+    double hashes;      // sum of the expected hashes
+    double hashrate;    // hashes / time
+    double speedup;     // hashrate / baseline hashrate, 0 without a baseline
+    double efficiency;  // speedup per thread
+};
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Value at quantile q of sorted values, interpolated between neighbours
+ */
+static double quantile(const double* sorted, size_t n, double q) {
+    double at = q * (n - 1);
+    size_t lo = (size_t)at;
+    size_t hi = (lo + 1 < n) ? lo + 1 : lo;
+    return sorted[lo] + (sorted[hi] - sorted[lo]) * (at - lo);
+}
+
+/**
+ * @brief Mean block time of the baseline configurations at a threshold
+ *
+ * @return double - 0 if no baseline block has that threshold
+ */
+static double baseline_mean(ResultsTable& table, const int* is_baseline, size_t threshold) {
+    double sum = 0.0;
+    size_t n = 0;
+    for (size_t r = 0; r < table.num_rows; r++) {
+        if (is_baseline[table.row_config[r]] && table.row_threshold[r] == threshold) {
+            sum += table.row_block_time[r];
+            n++;
+        }
+    }
+    return n ? sum / n : 0.0;
+}
+
+/**
+ * @brief Groups the rows by configuration and threshold
+ *
+ * @param table
+ * @param is_baseline - per configuration
+ * @param out - malloc'd, ordered by configuration then threshold
+ * @return size_t - number of groups
+ */
+size_t threshold_stats(ResultsTable& table, const int* is_baseline, ThresholdStats** out) {
+    size_t max_threshold = 0;
+    for (size_t r = 0; r < table.num_rows; r++) {
+        if (table.row_threshold[r] > max_threshold) {
+            max_threshold = table.row_threshold[r];
+        }
+    }
+    ThresholdStats* stats = (ThresholdStats*)malloc(sizeof(ThresholdStats) * (table.num_configs * (max_threshold + 1) + 1));
+    double* times = (double*)malloc(sizeof(double) * (table.num_rows + 1));
+    size_t num_stats = 0;
+    for (size_t c = 0; c < table.num_configs; c++) {
+        for (size_t t = 0; t <= max_threshold; t++) {
+            size_t n = 0;
+            for (size_t r = 0; r < table.num_rows; r++) {
+                if (table.row_config[r] == c && table.row_threshold[r] == t) {
+                    times[n++] = table.row_block_time[r];
+                }
+            }
+            if (n == 0) {
+                continue;
+            }
+            qsort(times, n, sizeof(double), compare_doubles);
+            ThresholdStats* s = &stats[num_stats++];
+            memset(s, 0, sizeof(ThresholdStats));
+            s->config = c;
+            s->threshold = t;
+            s->blocks = n;
+            double sum = 0.0, sum_sq = 0.0;
+            for (size_t i = 0; i < n; i++) {
+                sum += times[i];
+                sum_sq += times[i] * times[i];
+            }
+            s->mean = sum / n;
+            s->stddev = n > 1 ? sqrt(fmax(0.0, (sum_sq - n * s->mean * s->mean) / (n - 1))) : 0.0;
+            s->min = times[0];
+            s->p10 = quantile(times, n, 0.1);
+            s->median = quantile(times, n, 0.5);
+            s->p90 = quantile(times, n, 0.9);
+            s->max = times[n - 1];
+            s->hashrate = s->mean > 0 ? ResultsTable::expectedHashes(t) / s->mean : 0.0;
+            double base = baseline_mean(table, is_baseline, t);
+            if (base > 0 && s->mean > 0) {
+                s->speedup = base / s->mean;
+                s->efficiency = s->speedup / table.configs[c].threads;
+            }
+        }
+    }
+    free(times);
+    *out = stats;
+    return num_stats;
+}
+
+/**
+ * @brief Totals per configuration. The effective hashrate is the expected work of the blocks found over the time taken,
+ * so it compares runs that reached different thresholds.
+ *
+ * @param table
+ * @param is_baseline - per configuration
+ * @return ConfigStats* - malloc'd, one per configuration
+ */
+ConfigStats* config_stats(ResultsTable& table, const int* is_baseline) {
+    ConfigStats* stats = (ConfigStats*)calloc(table.num_configs + 1, sizeof(ConfigStats));
+    double base_hashes = 0.0, base_time = 0.0;
+    for (size_t r = 0; r < table.num_rows; r++) {
+        ConfigStats* s = &stats[table.row_config[r]];
+        double hashes = ResultsTable::expectedHashes(table.row_threshold[r]);
+        s->blocks++;
+        s->time += table.row_block_time[r];
+        s->hashes += hashes;
+        if (table.row_threshold[r] > s->max_threshold) {
+            s->max_threshold = table.row_threshold[r];
+        }
+        if (is_baseline[table.row_config[r]]) {
+            base_hashes += hashes;
+            base_time += table.row_block_time[r];
+        }
+    }
+    double base_rate = base_time > 0 ? base_hashes / base_time : 0.0;
+    for (size_t c = 0; c < table.num_configs; c++) {
+        ConfigStats* s = &stats[c];
+        s->hashrate = s->time > 0 ? s->hashes / s->time : 0.0;
+        if (base_rate > 0) {
+            s->speedup = s->hashrate / base_rate;
+            s->efficiency = s->speedup / table.configs[c].threads;
+        }
+    }
+    return stats;
+}
+
+/**
+ * @brief Opens dir/name for writing
+ */
+static FILE* open_output(const char* dir, const char* name) {
+    size_t len = strlen(dir) + strlen(name) + 2;
+    char* path = (char*)malloc(len);
+    snprintf(path, len, "%s/%s", dir, name);
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        printf("Cannot write %s\n", path);
+    }
+    free(path);
+    return f;
+}
+
+/**
+ * @brief Writes the table and both summaries as CSV
+ *
+ * @return int - 0 on success
+ */
+int write_csv(const char* dir, ResultsTable& table, ThresholdStats* stats, size_t num_stats, ConfigStats* totals) {
+    FILE* f = open_output(dir, "blocks.csv");
+    if (f == NULL) {
+        return -1;
+    }
+    fprintf(f, "config,kind,threads,run,block_id,threshold,nonce,block_time,total_time\n");
+    for (size_t r = 0; r < table.num_rows; r++) {
+        ResultsConfig* c = &table.configs[table.row_config[r]];
+        fprintf(f, "%s,%s,%lu,%s,%lu,%lu,%lu,%.6lf,%.6lf\n", c->name, RUN_KIND_NAMES[c->kind], c->threads, table.runs[table.row_run[r]].name, table.row_block_id[r], table.row_threshold[r], table.row_nonce[r], table.row_block_time[r], table.row_total_time[r]);
+    }
+    fclose(f);
+
+    f = open_output(dir, "thresholds.csv");
+    if (f == NULL) {
+        return -1;
+    }
+    fprintf(f, "config,kind,threads,threshold,blocks,mean,stddev,min,p10,median,p90,max,hashrate,speedup,efficiency\n");
+    for (size_t i = 0; i < num_stats; i++) {
+        ThresholdStats* s = &stats[i];
+        ResultsConfig* c = &table.configs[s->config];
+        fprintf(f, "%s,%s,%lu,%lu,%lu,%.6lf,%.6lf,%.6lf,%.6lf,%.6lf,%.6lf,%.6lf,%.1lf,%.4lf,%.4lf\n", c->name, RUN_KIND_NAMES[c->kind], c->threads, s->threshold, s->blocks, s->mean, s->stddev, s->min, s->p10, s->median, s->p90, s->max, s->hashrate, s->speedup, s->efficiency);
+    }
+    fclose(f);
+
+    f = open_output(dir, "configs.csv");
+    if (f == NULL) {
+        return -1;
+    }
+    fprintf(f, "config,kind,threads,runs,blocks,max_threshold,time,hashrate,speedup,efficiency\n");
+    for (size_t c = 0; c < table.num_configs; c++) {
+        ResultsConfig* config = &table.configs[c];
+        ConfigStats* s = &totals[c];
+        fprintf(f, "%s,%s,%lu,%lu,%lu,%lu,%.6lf,%.1lf,%.4lf,%.4lf\n", config->name, RUN_KIND_NAMES[config->kind], config->threads, config->runs, s->blocks, s->max_threshold, s->time, s->hashrate, s->speedup, s->efficiency);
+    }
+    fclose(f);
+    return 0;
+}
+
+/**
+ * @brief Plots one line per configuration over the thresholds as SVG
+ *
+ * @param dir
+ * @param name - file name
+ * @param title
+ * @param y_label
+ * @param log_y - logarithmic y axis
+ * @param field - offset of the plotted ThresholdStats member
+ * @return int - 0 on success
+ */
+int write_plot(const char* dir, const char* name, const char* title, const char* y_label, int log_y, size_t field, ResultsTable& table, ThresholdStats* stats, size_t num_stats) {
+    double x_max = 1.0, y_min = INFINITY, y_max = -INFINITY;
+    for (size_t i = 0; i < num_stats; i++) {
+        double y = *(double*)((char*)&stats[i] + field);
+        if (y <= 0 && log_y) {
+            continue;
+        }
+        y = log_y ? log10(y) : y;
+        y_min = fmin(y_min, y);
+        y_max = fmax(y_max, y);
+        x_max = fmax(x_max, (double)stats[i].threshold);
+    }
+    if (y_min > y_max) {
+        return 0;  // nothing to plot
+    }
+    if (log_y) {
+        y_min = floor(y_min);
+        y_max = ceil(y_max);
+    } else {
+        y_min = fmin(0.0, y_min);
+    }
+    if (y_max <= y_min) {
+        y_max = y_min + 1.0;
+    }
+    FILE* f = open_output(dir, name);
+    if (f == NULL) {
+        return -1;
+    }
+    const double w = PLOT_WIDTH - 2 * PLOT_MARGIN, h = PLOT_HEIGHT - 2 * PLOT_MARGIN;
+#define PLOT_X(x) (PLOT_MARGIN + (x) / x_max * w)
+#define PLOT_Y(y) (PLOT_MARGIN + h - ((y) - y_min) / (y_max - y_min) * h)
+    fprintf(f, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" font-family=\"sans-serif\" font-size=\"12\">\n", PLOT_WIDTH + PLOT_LEGEND, PLOT_HEIGHT);
+    fprintf(f, "<rect width=\"100%%\" height=\"100%%\" fill=\"white\"/>\n");
+    fprintf(f, "<text x=\"%d\" y=\"30\" font-size=\"16\">%s</text>\n", PLOT_MARGIN, title);
+    fprintf(f, "<line x1=\"%d\" y1=\"%.1lf\" x2=\"%.1lf\" y2=\"%.1lf\" stroke=\"black\"/>\n", PLOT_MARGIN, PLOT_MARGIN + h, PLOT_MARGIN + w, PLOT_MARGIN + h);
+    fprintf(f, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%.1lf\" stroke=\"black\"/>\n", PLOT_MARGIN, PLOT_MARGIN, PLOT_MARGIN, PLOT_MARGIN + h);
+    for (size_t t = 0; t <= (size_t)x_max; t++) {
+        fprintf(f, "<text x=\"%.1lf\" y=\"%.1lf\" text-anchor=\"middle\">%lu</text>\n", PLOT_X(t), PLOT_MARGIN + h + 18, t);
+    }
+    fprintf(f, "<text x=\"%.1lf\" y=\"%d\" text-anchor=\"middle\">threshold (leading zero hex digits)</text>\n", PLOT_MARGIN + w / 2, PLOT_HEIGHT - 20);
+    const int ticks = log_y ? (int)(y_max - y_min) : 5;
+    for (int i = 0; i <= ticks; i++) {
+        double y = y_min + (y_max - y_min) * i / ticks;
+        fprintf(f, "<line x1=\"%d\" y1=\"%.1lf\" x2=\"%.1lf\" y2=\"%.1lf\" stroke=\"#dddddd\"/>\n", PLOT_MARGIN, PLOT_Y(y), PLOT_MARGIN + w, PLOT_Y(y));
+        fprintf(f, "<text x=\"%d\" y=\"%.1lf\" text-anchor=\"end\">%g</text>\n", PLOT_MARGIN - 6, PLOT_Y(y) + 4, log_y ? pow(10.0, y) : y);
+    }
+    fprintf(f, "<text transform=\"translate(18,%.1lf) rotate(-90)\" text-anchor=\"middle\">%s</text>\n", PLOT_MARGIN + h / 2, y_label);
+    size_t legend = 0;
+    for (size_t c = 0; c < table.num_configs; c++) {
+        const char* color = PLOT_COLORS[c % NUM_PLOT_COLORS];
+        int points = 0;
+        for (size_t i = 0; i < num_stats; i++) {
+            double y = *(double*)((char*)&stats[i] + field);
+            if (stats[i].config != c || (log_y && y <= 0)) {
+                continue;
+            }
+            y = log_y ? log10(y) : y;
+            if (points++ == 0) {
+                fprintf(f, "<polyline fill=\"none\" stroke=\"%s\" stroke-width=\"2\" points=\"", color);
+            }
+            fprintf(f, "%.1lf,%.1lf ", PLOT_X(stats[i].threshold), PLOT_Y(y));
+        }
+        if (points > 0) {
+            fprintf(f, "\"/>\n");
+            const double y = PLOT_MARGIN + 16.0 * legend++;
+            fprintf(f, "<rect x=\"%.1lf\" y=\"%.1lf\" width=\"12\" height=\"12\" fill=\"%s\"/>\n", PLOT_MARGIN + w + 20, y - 10, color);
+            fprintf(f, "<text x=\"%.1lf\" y=\"%.1lf\">%s</text>\n", PLOT_MARGIN + w + 38, y, table.configs[c].name);
+        }
+    }
+#undef PLOT_X
+#undef PLOT_Y
+    fprintf(f, "</svg>\n");
+    fclose(f);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    // Ingests miner logs into one table and summarizes them per configuration and threshold.
+    // Usage: btc_results.exe [-s baseline_prefix] [-o out_dir] [[-c config] path]...
+    // A path is a log file (text output or --telemetry JSON lines) or a directory of them. Logs are grouped by their file
+    // name without the run number, or under the name given with -c for the paths after it. Configurations starting with
+    // baseline_prefix (default hpc_serial) are the baseline for speedup and efficiency. -o writes CSV files and SVG plots.
+    ResultsTable table;
+    const char* baseline = "hpc_serial";
+    const char* out_dir = NULL;
+    const char* config_name = NULL;
+    int opt;
+    // Leading '-' keeps the paths in order with the -c options between them
+    while ((opt = getopt(argc, argv, "-s:o:c:")) != -1) {
+        switch (opt) {
+            case 's': baseline = optarg; break;
+            case 'o': out_dir = optarg; break;
+            case 'c': config_name = optarg; break;
+            case 1:
+                if (table.ingest(optarg, config_name) < 0) {
+                    return 1;
+                }
+                break;
+            default:
+                printf("Usage: %s [-s baseline_prefix] [-o out_dir] [[-c config] path]...\n", argv[0]);
+                return 1;
+        }
+    }
+    if (table.num_rows == 0) {
+        printf("No blocks found\n");
+        return 1;
+    }
+
+    int* is_baseline = (int*)calloc(table.num_configs + 1, sizeof(int));
+    int have_baseline = 0;
+    for (size_t c = 0; c < table.num_configs; c++) {
+        is_baseline[c] = strncmp(table.configs[c].name, baseline, strlen(baseline)) == 0;
+        have_baseline |= is_baseline[c];
+    }
+    ThresholdStats* stats = NULL;
+    size_t num_stats = threshold_stats(table, is_baseline, &stats);
+    ConfigStats* totals = config_stats(table, is_baseline);
+
+    printf("Blocks: %lu\tRuns: %lu\tConfigurations: %lu\tBaseline: %s\n", table.num_rows, table.num_runs, table.num_configs, have_baseline ? baseline : "none");
+    printf("\n%-24s %-8s %7s %5s %6s %9s %12s %12s %8s %10s\n", "Config", "Kind", "Threads", "Runs", "Blocks", "Max thr", "Time (s)", "MH/s", "Speedup", "Efficiency");
+    for (size_t c = 0; c < table.num_configs; c++) {
+        ResultsConfig* config = &table.configs[c];
+        ConfigStats* s = &totals[c];
+        printf("%-24s %-8s %7lu %5lu %6lu %9lu %12.3lf %12.4lf %8.2lf %10.3lf\n", config->name, RUN_KIND_NAMES[config->kind], config->threads, config->runs, s->blocks, s->max_threshold, s->time, s->hashrate / 1e6, s->speedup, s->efficiency);
+    }
+    printf("\n%-24s %9s %6s %12s %12s %12s %12s %12s %8s %10s\n", "Config", "Threshold", "Blocks", "Mean (s)", "Median (s)", "P10 (s)", "P90 (s)", "MH/s", "Speedup", "Efficiency");
+    for (size_t i = 0; i < num_stats; i++) {
+        ThresholdStats* s = &stats[i];
+        printf("%-24s %9lu %6lu %12.6lf %12.6lf %12.6lf %12.6lf %12.4lf %8.2lf %10.3lf\n", table.configs[s->config].name, s->threshold, s->blocks, s->mean, s->median, s->p10, s->p90, s->hashrate / 1e6, s->speedup, s->efficiency);
+    }
+
+    int rc = 0;
+    if (out_dir != NULL) {
+        mkdir(out_dir, 0755);
+        rc |= write_csv(out_dir, table, stats, num_stats, totals);
+        rc |= write_plot(out_dir, "block_time.svg", "Mean block time", "seconds", 1, offsetof(ThresholdStats, mean), table, stats, num_stats);
+        rc |= write_plot(out_dir, "hashrate.svg", "Effective hashrate", "hashes/s", 1, offsetof(ThresholdStats, hashrate), table, stats, num_stats);
+        if (have_baseline) {
+            rc |= write_plot(out_dir, "speedup.svg", "Speedup over the baseline", "speedup", 0, offsetof(ThresholdStats, speedup), table, stats, num_stats);
+        }
+        if (rc == 0) {
+            printf("\nWrote blocks.csv, thresholds.csv, configs.csv and plots to %s\n", out_dir);
+        }
+    }
+    free(stats);
+    free(totals);
+    free(is_baseline);
+    return rc ? 1 : 0;
+}
@@ -6,11 +6,8 @@ echo "Start job"
 make clean
 make
 
-# run executable in background and get the PID of the process
-./btc_miner_gpu.exe > local_gpu1_10m6.out 2>&1 &
-MINER_PID=$!
-sleep $TIMEOUT
-kill -2 $MINER_PID
+# the run controller stops the miner after TIMEOUT seconds of mining, then drains it and prints the run summary
+./btc_miner_gpu.exe -l $TIMEOUT > local_gpu1_10m6.out 2>&1
 
 make clean
 echo "End job after $TIMEOUT seconds"
@@ -1,5 +1,6 @@
 /**
- * Blockchain class. Used to store the data for the entire blockchain like a linked list.
+ * Blockchain class. Stores the blocks as a tree: every block links to its parent and children, and the best chain
+ * (most cumulative work, first seen on ties) is also linked through next from head to the current tip.
 */
 class Blockchain {
    public:
@@ -7,16 +8,30 @@ class Blockchain {
     class Block {
        public:
         size_t block_id;
-        char *prev_digest;
+        unsigned char prev_digest[SHA256_DIGEST_LENGTH];  // binary, hex only in the preimage and in output
         char *data;
         size_t threshold;
         size_t nonce;
-        Block *next;
+        unsigned char format;  // chain format version the nonce was encoded with
+        unsigned char pooled;  // from block_slab, else malloc
+        Block *next;           // successor on the best chain, or on the branch the block was last best on
+        Block *parent;         // NULL for the oldest block in memory
+        Block *first_child;    // children are linked through next_sibling
+        Block *next_sibling;
+        double work;           // expected hashes of the chain up to and including this block
     };
     Block *head;
     Block *current;
-    size_t num_blocks;
+    size_t num_blocks;  // blocks in memory on the best chain
+    size_t num_stale;   // blocks in memory off the best chain
+    size_t reorgs;
+    size_t max_reorg_depth;  // most blocks disconnected by one reorg
     size_t block_counter;
+    unsigned char nonce_format;  // chain format version for new blocks
+    char tip_hex[2 * SHA256_DIGEST_LENGTH + 1];  // prev_digest of the current block as hex, for printing
+    void (*append_hook)(void *arg, Block *block);  // called with every appended block, e.g. to export it
+    void *append_hook_arg;
+    size_t max_resident;  // older blocks are dropped from memory beyond this many, 0 keeps all
 
     Blockchain();
     ~Blockchain();
@@ -25,12 +40,23 @@ class Blockchain {
     int isEmpty() { return (head == NULL); }
     size_t getCurrentBlockId() { return current->block_id; }
     Block *getCurrentBlock() { return current; }
-    char *getPrevDigest() { return current->prev_digest; }
+    const char *getPrevDigest() { return tip_hex; }
     size_t getSize() { return num_blocks; }
+    void setNonceFormat(unsigned char format) { nonce_format = format; }
+    unsigned char getNonceFormat() { return nonce_format; }
+    void setAppendHook(void (*hook)(void *arg, Block *block), void *arg) {
+        append_hook = hook;
+        append_hook_arg = arg;
+    }
+    void setMaxResident(size_t max_resident) { this->max_resident = max_resident; }
     void appendBlock(const char *prev_digest, const char *data, size_t threshold, size_t nonce);
+    Block *addBlock(Block *parent, const char *prev_digest, const char *data, size_t threshold, size_t nonce);
+    Block *findBlock(const unsigned char *digest);
     int thresholdMet(const char *digest, size_t &threshold);
-    char *getString(size_t &cur_nonce);
-    char *size_t_to_string(size_t num);
+    int shareMet(const char *digest, size_t share_threshold);
+    char *getString(size_t &cur_nonce) { return getString(current, cur_nonce); }
+    char *getString(Block *block, size_t &cur_nonce);
+    char *size_t_to_string(size_t num, unsigned char min_digits = 1);
 
 #if RUN_ON_TARGET
 #pragma omp declare target
@@ -38,27 +64,46 @@ class Blockchain {
     int t_isEmpty() { return (head == NULL); }
     size_t t_getCurrentBlockId() { return current->block_id; }
     Block *t_getCurrentBlock() { return current; }
-    char *t_getPrevDigest() { return current->prev_digest; }
+    const char *t_getPrevDigest() { return tip_hex; }
     size_t t_getSize() { return num_blocks; }
     void t_appendBlock(const char *prev_digest, const char *data, size_t threshold, size_t nonce);
     int t_thresholdMet(const char *digest, size_t &threshold);
     // char *t_getString(size_t &cur_nonce, Block *current);
-    char *t_makeString(size_t &cur_nonce, size_t block_id, const char *prev_digest, const char *data, size_t threshold);
-    char *t_size_t_to_string(size_t num);
+    char *t_makeString(size_t &cur_nonce, size_t block_id, const char *prev_digest, const char *data, size_t threshold, unsigned char format = NONCE_FORMAT_ASCII);
+    char *t_size_t_to_string(size_t num, unsigned char min_digits = 1);
 #if RUN_ON_TARGET
 #pragma omp end declare target
 #endif
+
+   private:
+    HugeSlab block_slab;  // block nodes, on huge pages where available
+    void switchTip(Block *tip);
+    size_t freeBranch(Block *block);
+    void freeBlock(Block *block);
 };
 
+/**
+ * @brief Work of a block: the expected number of hashes to meet its threshold
+ */
+inline double block_work(size_t threshold) { return ldexp(1.0, 4 * (int)threshold); }
+
 /**
  * @brief Construct a new Blockchain object
  *
  */
-Blockchain::Blockchain() {
+Blockchain::Blockchain() : block_slab(sizeof(Block), "chain") {
     head = NULL;
     current = NULL;
     num_blocks = 0;
+    num_stale = 0;
+    reorgs = 0;
+    max_reorg_depth = 0;
     block_counter = 0;
+    nonce_format = NONCE_FORMAT_ASCII;
+    tip_hex[0] = '\0';
+    append_hook = NULL;
+    append_hook_arg = NULL;
+    max_resident = 0;
 }
 
 /**
@@ -80,26 +125,156 @@ Blockchain::~Blockchain() {
  * @param nonce
  */
 void Blockchain::appendBlock(const char *prev_digest, const char *data, size_t threshold, size_t nonce) {
-    Block *new_block = (Block *)malloc(sizeof(Block));
-    new_block->block_id = block_counter;
+    addBlock(current, prev_digest, data, threshold, nonce);
+}
+
+/**
+ * @brief Adds a block below parent. It becomes the tip if its chain has more work than the current one, otherwise it
+ * stays on a side branch. Blocks that join the best chain go to the append hook in chain order.
+ *
+ * @param parent - a block in memory, NULL only for the first block
+ * @param prev_digest - digest of the solution, hex
+ * @param data
+ * @param threshold
+ * @param nonce
+ * @return Block* - the new block, NULL if parent is NULL on a non-empty chain
+ */
+Blockchain::Block *Blockchain::addBlock(Block *parent, const char *prev_digest, const char *data, size_t threshold, size_t nonce) {
+    if (parent == NULL && !isEmpty()) {
+        return NULL;
+    }
+    Block *new_block = (Block *)block_slab.take();
+    unsigned char pooled = 1;
+    if (new_block == NULL) {
+        new_block = (Block *)malloc(sizeof(Block));
+        pooled = 0;
+    }
+    new_block->pooled = pooled;
+    // Extending the tip keeps the counter's height, which a resumed chain sets past its missing blocks
+    new_block->block_id = (parent == NULL || parent == current) ? block_counter : parent->block_id + 1;
     new_block->nonce = nonce;
-    // deep copy the strings
-    new_block->prev_digest = (char *)calloc(strlen(prev_digest) + 1, sizeof(char));
+    // Digests are kept in binary. Anything that is not a full hex digest is stored as zeros
+    if (strlen(prev_digest) != 2 * SHA256_DIGEST_LENGTH || !hex_decode(prev_digest, SHA256_DIGEST_LENGTH, new_block->prev_digest)) {
+        memset(new_block->prev_digest, 0, SHA256_DIGEST_LENGTH);
+    }
+    // deep copy the data
     new_block->data = (char *)calloc(strlen(data) + 1, sizeof(char));
-    strcpy(new_block->prev_digest, prev_digest);
     strcpy(new_block->data, data);
     new_block->threshold = threshold;
+    new_block->format = nonce_format;
     new_block->next = NULL;
+    new_block->parent = parent;
+    new_block->first_child = NULL;
+    new_block->next_sibling = NULL;
+    new_block->work = block_work(threshold);
 
     if (isEmpty()) {
         head = new_block;
         current = new_block;
+        num_blocks++;
+        block_counter = new_block->block_id + 1;
+        hex_encode(current->prev_digest, SHA256_DIGEST_LENGTH, tip_hex);
+        tip_hex[2 * SHA256_DIGEST_LENGTH] = '\0';
+        if (append_hook != NULL) {
+            append_hook(append_hook_arg, new_block);
+        }
+        return new_block;
+    }
+    new_block->work += parent->work;
+    new_block->next_sibling = parent->first_child;
+    parent->first_child = new_block;
+    // Ties keep the tip that was there first
+    if (new_block->work > current->work) {
+        switchTip(new_block);
     } else {
-        current->next = new_block;
-        current = new_block;
+        num_stale++;
+    }
+    // Blocks already handed to the hook need not stay in memory
+    while (max_resident > 0 && num_blocks > max_resident) {
+        removeBlock();
+    }
+    return new_block;
+}
+
+/**
+ * @brief Makes tip the end of the best chain. Walks back from both tips to their common ancestor and relinks next along
+ * the new branch, so the cost is the depth of the reorg, not the length of the chain.
+ *
+ * @param tip - a block with more work than current
+ */
+void Blockchain::switchTip(Block *tip) {
+    Block *old_side = current;
+    Block *new_side = tip;
+    size_t disconnected = 0, connected = 0;
+    while (old_side->block_id > new_side->block_id) {
+        old_side = old_side->parent;
+        disconnected++;
+    }
+    while (new_side->block_id > old_side->block_id) {
+        new_side = new_side->parent;
+        connected++;
+    }
+    while (old_side != new_side) {
+        old_side = old_side->parent;
+        new_side = new_side->parent;
+        disconnected++;
+        connected++;
+    }
+    Block *fork = new_side;
+    for (Block *block = tip; block != fork; block = block->parent) {
+        block->parent->next = block;
+    }
+    tip->next = NULL;
+    current = tip;
+    block_counter = tip->block_id + 1;
+    num_blocks += connected - disconnected;
+    num_stale += disconnected;
+    num_stale -= connected - 1;  // the new tip was never counted
+    if (disconnected > 0) {
+        reorgs++;
+        if (disconnected > max_reorg_depth) {
+            max_reorg_depth = disconnected;
+        }
+    }
+    hex_encode(current->prev_digest, SHA256_DIGEST_LENGTH, tip_hex);
+    tip_hex[2 * SHA256_DIGEST_LENGTH] = '\0';
+    if (append_hook != NULL) {
+        for (Block *block = fork->next; block != NULL; block = block->next) {
+            append_hook(append_hook_arg, block);
+        }
     }
-    num_blocks++;
-    block_counter++;
+}
+
+/**
+ * @brief Finds the block in memory that was created by the solution with the given digest
+ *
+ * @param digest - binary
+ * @return Block* - NULL if it is not in memory
+ */
+Blockchain::Block *Blockchain::findBlock(const unsigned char *digest) {
+    if (isEmpty()) {
+        return NULL;
+    }
+    // Nearly every lookup is for the job the miners just solved
+    if (memcmp(current->prev_digest, digest, SHA256_DIGEST_LENGTH) == 0) {
+        return current;
+    }
+    // Depth first over the whole tree, children pushed after their parent
+    Block **stack = (Block **)malloc(sizeof(Block *) * (num_blocks + num_stale));
+    size_t count = 0;
+    stack[count++] = head;
+    Block *found = NULL;
+    while (count > 0 && found == NULL) {
+        Block *block = stack[--count];
+        if (memcmp(block->prev_digest, digest, SHA256_DIGEST_LENGTH) == 0) {
+            found = block;
+        }
+        for (Block *child = block->first_child; child != NULL; child = child->next_sibling) {
+            stack[count++] = child;
+        }
+    }
+    free(stack);
+    return found;
 }
 
 /**
@@ -112,42 +287,88 @@ void Blockchain::appendBlock(const char *prev_digest, const char *data, size_t t
  */
 void Blockchain::t_appendBlock(const char *prev_digest, const char *data, size_t threshold, size_t nonce) {
     Block *new_block = (Block *)malloc(sizeof(Block));
+    new_block->pooled = 0;
     new_block->block_id = block_counter;
     new_block->nonce = nonce;
-    // deep copy the strings
-    new_block->prev_digest = (char *)calloc(strlen(prev_digest) + 1, sizeof(char));
+    // Digests are kept in binary. Anything that is not a full hex digest is stored as zeros
+    if (strlen(prev_digest) != 2 * SHA256_DIGEST_LENGTH || !hex_decode_scalar(prev_digest, SHA256_DIGEST_LENGTH, new_block->prev_digest)) {
+        memset(new_block->prev_digest, 0, SHA256_DIGEST_LENGTH);
+    }
+    // deep copy the data
     new_block->data = (char *)calloc(strlen(data) + 1, sizeof(char));
-    strcpy(new_block->prev_digest, prev_digest);
     strcpy(new_block->data, data);
     new_block->threshold = threshold;
+    new_block->format = nonce_format;
     new_block->next = NULL;
+    new_block->parent = current;
+    new_block->first_child = NULL;
+    new_block->next_sibling = NULL;
+    new_block->work = block_work(threshold);
 
     if (t_isEmpty()) {
         head = new_block;
         current = new_block;
     } else {
+        new_block->work += current->work;
+        current->first_child = new_block;
         current->next = new_block;
         current = new_block;
     }
+    hex_encode_scalar(current->prev_digest, SHA256_DIGEST_LENGTH, tip_hex);
+    tip_hex[2 * SHA256_DIGEST_LENGTH] = '\0';
     num_blocks++;
     block_counter++;
 }
 
 /**
- * @brief Removes a block from the front of the blockchain.
+ * @brief Removes a block from the front of the blockchain, with the side branches that fork off it.
  *
  */
 void Blockchain::removeBlock() {
     if (!isEmpty()) {
         Block *temp = head;
         head = head->next;
-        free(temp->prev_digest);
-        free(temp->data);
-        free(temp);
+        for (Block *child = temp->first_child; child != NULL;) {
+            Block *sibling = child->next_sibling;
+            if (child != head) {
+                num_stale -= freeBranch(child);
+            }
+            child = sibling;
+        }
+        if (head != NULL) {
+            head->parent = NULL;
+        }
+        freeBlock(temp);
         num_blocks--;
     }
 }
 
+/**
+ * @brief Frees a side branch
+ *
+ * @param block - root of the branch, off the best chain
+ * @return size_t - blocks freed
+ */
+size_t Blockchain::freeBranch(Block *block) {
+    size_t freed = 0;
+    for (Block *child = block->first_child; child != NULL;) {
+        Block *sibling = child->next_sibling;
+        freed += freeBranch(child);
+        child = sibling;
+    }
+    freeBlock(block);
+    return freed + 1;
+}
+
+void Blockchain::freeBlock(Block *block) {
+    free(block->data);
+    if (block->pooled) {
+        block_slab.give(block);
+    } else {
+        free(block);
+    }
+}
+
 /**
  * @brief Checks if the digest has exactly threshold number of leading zeros.
  *
@@ -207,33 +428,56 @@ int Blockchain::t_thresholdMet(const char *digest, size_t &threshold) {
 }
 
 /**
- * @brief Returns the string representation of the current block.
+ * @brief Checks if the digest has at least share_threshold leading zeros. Shares are the easy targets used to measure
+ * hashrate, so unlike blocks any digest with more zeros also counts.
  *
+ * @param digest
+ * @param share_threshold
+ * @return true - 1
+ * @return false - 0
+ */
+int Blockchain::shareMet(const char *digest, size_t share_threshold) {
+    for (size_t i = 0; i < share_threshold; i++) {
+        if (digest[i] != '0') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Returns the preimage of a block to mine on top of block with the given nonce
+ *
+ * @param block - usually the current block
+ * @param cur_nonce
  * @return char*
  */
-char *Blockchain::getString(size_t &cur_nonce) {
+char *Blockchain::getString(Block *block, size_t &cur_nonce) {
     // * original
     // char *str = (char *)malloc(sizeof(char) * (1 + SIZE_T_STR_BYTES + 1 + strlen(current->prev_digest) + 1 + strlen(current->data) + 1 + SIZE_T_STR_BYTES + 1 + SIZE_T_STR_BYTES + 2));
     // sprintf(str, "[%lu|%s|%s|%lu|%lu]", current->block_id, current->prev_digest, current->data, current->threshold, cur_nonce);
 
     // * without sprintf
-    char *str_nonce = size_t_to_string(cur_nonce);
-    char *str_block_id = size_t_to_string(current->block_id);
-    char *str_threshold = size_t_to_string(current->threshold);
+    char *str_nonce = size_t_to_string(cur_nonce, nonce_format == NONCE_FORMAT_FIXED ? NONCE_FIXED_DIGITS : 1);
+    char *str_block_id = size_t_to_string(block->block_id);
+    char *str_threshold = size_t_to_string(block->threshold);
     size_t str_nonce_len = strlen(str_nonce);
     size_t str_block_id_len = strlen(str_block_id);
     size_t str_threshold_len = strlen(str_threshold);
-    size_t str_prev_digest_len = strlen(current->prev_digest);
-    size_t str_data_len = strlen(current->data);
+    size_t str_prev_digest_len = 2 * SHA256_DIGEST_LENGTH;
+    size_t str_data_len = strlen(block->data);
     size_t str_len = str_block_id_len + str_prev_digest_len + str_data_len + str_threshold_len + str_nonce_len + 11;
 
     char *str = (char *)calloc(str_len + 1, sizeof(char));
     strcpy(str, "[");
     strcat(str, str_block_id);
     strcat(str, "|");
-    strcat(str, current->prev_digest);
+    // The preimage is where the binary digest becomes hex
+    size_t at = strlen(str);
+    hex_encode(block->prev_digest, SHA256_DIGEST_LENGTH, str + at);
+    str[at + str_prev_digest_len] = '\0';
     strcat(str, "|");
-    strcat(str, current->data);
+    strcat(str, block->data);
     strcat(str, "|");
     strcat(str, str_threshold);
     strcat(str, "|");
@@ -246,14 +490,15 @@ char *Blockchain::getString(size_t &cur_nonce) {
     return str;
 }
 
-char *Blockchain::size_t_to_string(size_t num) {
+char *Blockchain::size_t_to_string(size_t num, unsigned char min_digits) {
     unsigned char num_digits = 1;
     size_t temp = num;
     while (temp /= 10) {
         num_digits++;
     }
+    unsigned char num_zeros = (min_digits > num_digits) ? min_digits - num_digits : 0;
 
-    char *str = (char *)calloc(num_digits + 1, sizeof(char));
+    char *str = (char *)calloc(num_digits + num_zeros + 1, sizeof(char));
     if (num == 0) {
         strcpy(str, "0");
     } else {
@@ -265,6 +510,9 @@ char *Blockchain::size_t_to_string(size_t num) {
             i++;
         }
     }
+    // Zero padding for fixed width nonces. Becomes leading after the reversal
+    memset(str + num_digits, '0', num_zeros);
+    num_digits += num_zeros;
     str[num_digits] = '\0';
 
     // convert to Little Endian
@@ -293,13 +541,13 @@ char *Blockchain::size_t_to_string(size_t num) {
  *
  * @return char*
  */
-char *Blockchain::t_makeString(size_t &cur_nonce, size_t block_id, const char *prev_digest, const char *data, size_t threshold) {
+char *Blockchain::t_makeString(size_t &cur_nonce, size_t block_id, const char *prev_digest, const char *data, size_t threshold, unsigned char format) {
     // * original
     // char *str = (char *)malloc(sizeof(char) * (1 + SIZE_T_STR_BYTES + 1 + strlen(prev_digest) + 1 + strlen(data) + 1 + SIZE_T_STR_BYTES + 1 + SIZE_T_STR_BYTES + 2));
     // sprintf(str, "[%lu|%s|%s|%lu|%lu]", block_id, prev_digest, data, threshold, cur_nonce);
 
     // * without sprintf
-    char *str_nonce = t_size_t_to_string(cur_nonce);
+    char *str_nonce = t_size_t_to_string(cur_nonce, format == NONCE_FORMAT_FIXED ? NONCE_FIXED_DIGITS : 1);
     char *str_block_id = t_size_t_to_string(block_id);
     char* str_threshold = t_size_t_to_string(threshold);
     size_t str_nonce_len = strlen(str_nonce);
@@ -328,14 +576,15 @@ char *Blockchain::t_makeString(size_t &cur_nonce, size_t block_id, const char *p
     return str;
 }
 
-char *Blockchain::t_size_t_to_string(size_t num) {
+char *Blockchain::t_size_t_to_string(size_t num, unsigned char min_digits) {
     unsigned char num_digits = 1;
     size_t temp = num;
     while (temp /= 10) {
         num_digits++;
     }
+    unsigned char num_zeros = (min_digits > num_digits) ? min_digits - num_digits : 0;
 
-    char *str = (char *)calloc(num_digits + 1, sizeof(char));
+    char *str = (char *)calloc(num_digits + num_zeros + 1, sizeof(char));
     if (num == 0) {
         strcpy(str, "0");
     } else {
@@ -347,6 +596,9 @@ char *Blockchain::t_size_t_to_string(size_t num) {
             i++;
         }
     }
+    // Zero padding for fixed width nonces. Becomes leading after the reversal
+    memset(str + num_digits, '0', num_zeros);
+    num_digits += num_zeros;
     str[num_digits] = '\0';
 
     // convert to Little Endian
@@ -365,9 +617,24 @@ char *Blockchain::t_size_t_to_string(size_t num) {
  */
 void Blockchain::print() {
     Block *temp = head;
-    printf("\nBlockchain with %lu blocks:\n", num_blocks);
+    char prev_digest[2 * SHA256_DIGEST_LENGTH + 1];
+    prev_digest[2 * SHA256_DIGEST_LENGTH] = '\0';
+    if (head != NULL && head->block_id > 0) {
+        printf("\nBlockchain with %lu blocks, last %lu in memory:\n", block_counter, num_blocks);
+    } else {
+        printf("\nBlockchain with %lu blocks:\n", num_blocks);
+    }
+    if (num_stale > 0 || reorgs > 0) {
+        printf("Forks: %lu stale blocks in memory\tReorgs: %lu\tDeepest reorg: %lu blocks\n", num_stale, reorgs, max_reorg_depth);
+    }
     while (temp != NULL) {
-        printf("[%lu|%s|%s|%lu|%lu]\n\n", temp->block_id, temp->prev_digest, temp->data, temp->threshold, temp->nonce);
+        hex_encode(temp->prev_digest, SHA256_DIGEST_LENGTH, prev_digest);
+        if (temp->format == NONCE_FORMAT_ASCII) {
+            printf("[%lu|%s|%s|%lu|%lu]\n\n", temp->block_id, prev_digest, temp->data, temp->threshold, temp->nonce);
+        } else {
+            // Tag blocks of newer formats so a verifier knows how to rebuild their preimage
+            printf("[%lu|%s|%s|%lu|%lu] v%u\n\n", temp->block_id, prev_digest, temp->data, temp->threshold, temp->nonce, temp->format);
+        }
         temp = temp->next;
     }
 }
@@ -1,7 +1,11 @@
 #ifndef BLOCKCHAIN_H
 #define BLOCKCHAIN_H
 
+#include <math.h>
+
 #include "defs.h"
+#include "hex.cpp"
+#include "huge_pages.cpp"
 #include "Blockchain.cpp"
 
 #endif
@@ -0,0 +1,319 @@
+// Startup autotuner. A short calibration benchmarks the hasher backends, the number of mining threads (one per core
+// with SMT off, one per hardware thread with SMT on, and the old default) and the scheduler batch size, one stage at a
+// time, each stage starting from the winner of the one before. The result is cached in a per-host profile so later
+// startups skip the calibration.
+#ifndef AUTOTUNE_CPP
+#define AUTOTUNE_CPP
+
+#include <sched.h>
+#include <unistd.h>
+
+#include "nonce_hasher.cpp"
+#include "numa.cpp"
+#include "utils.h"
+#include "work_stealing.cpp"
+
+#define TUNE_MAGIC "BTC_PROFILE"
+#define TUNE_VERSION 1
+#define TUNE_DEFAULT_TIME 3.0  // seconds the whole calibration may take
+#define TUNE_MAX_THREAD_CANDIDATES 3
+#define TUNE_NUM_BATCHES 4
+const size_t TUNE_BATCHES[TUNE_NUM_BATCHES] = {16, WS_BATCH, 256, 1024};
+
+static volatile unsigned char tune_sink;  // keeps the trial digests observable so no hash is optimized away
+
+/**
+ * Mining configuration picked by the tuner
+ */
+struct TuneProfile {
+    int backend;      // HasherBackend
+    size_t batch;     // nonces per scheduler batch
+    size_t threads;   // mining threads
+    int smt;          // 0: threads are placed one per core
+    double hashrate;  // measured during calibration, H/s
+};
+
+/**
+ * Autotuner class. Loads, measures and saves the TuneProfile of this host.
+ */
+class Autotuner {
+   public:
+    Autotuner(const char *profile_path, double budget, size_t default_threads);
+    int select(TuneProfile &profile, int force, const char *prev_digest, const char *data, unsigned char format);
+    void printProfile(const TuneProfile &profile);
+
+    int from_cache;
+    double calibration_time;
+
+   private:
+    char path[512];
+    char host_key[512];
+    double budget;
+    size_t default_threads;
+    size_t logical_cpus;
+    size_t physical_cores;
+    const char *prev_digest;
+    const char *data;
+    unsigned char format;
+
+    int load(TuneProfile &profile);
+    void save(const TuneProfile &profile);
+    void calibrate(TuneProfile &profile);
+    double trial(int backend, size_t threads, int smt, size_t batch, double seconds);
+    const char *smtName(int smt) { return physical_cores == logical_cpus ? "n/a" : (smt ? "on" : "off"); }
+};
+
+/**
+ * @brief Construct a new Autotuner object
+ *
+ * @param profile_path - NULL for ~/.btc_miner_<hostname>.profile
+ * @param budget - seconds the calibration may take
+ * @param default_threads - thread count used without tuning, always one of the candidates
+ */
+Autotuner::Autotuner(const char *profile_path, double budget, size_t default_threads) {
+    char host[256] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    if (profile_path != NULL) {
+        snprintf(path, sizeof(path), "%s", profile_path);
+    } else {
+        const char *home = getenv("HOME");
+        snprintf(path, sizeof(path), "%s/.btc_miner_%s.profile", home != NULL ? home : ".", host);
+    }
+    this->budget = budget > 0 ? budget : TUNE_DEFAULT_TIME;
+    this->default_threads = default_threads;
+
+    NumaTopology all;
+    all.discover();
+    logical_cpus = all.numCpus();
+    physical_cores = all.dropSiblings();
+
+    // A profile only holds for the machine and thread limit it was measured with
+    char model[256] = "unknown";
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (f != NULL) {
+        char line[512];
+        while (fgets(line, sizeof(line), f) != NULL) {
+            char *colon = strchr(line, ':');
+            if (strncmp(line, "model name", 10) == 0 && colon != NULL) {
+                snprintf(model, sizeof(model), "%s", colon + 2);
+                model[strcspn(model, "\n")] = '\0';
+                break;
+            }
+        }
+        fclose(f);
+    }
+    snprintf(host_key, sizeof(host_key), "%s|%s|%lu cpus|%d threads", host, model, logical_cpus, omp_get_max_threads());
+    from_cache = 0;
+    calibration_time = 0.0;
+}
+
+/**
+ * @brief Reads the profile if it was measured on this host
+ *
+ * @return int - 1 if profile was loaded
+ */
+int Autotuner::load(TuneProfile &profile) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    char magic[32];
+    char key[512];
+    char backend[32];
+    unsigned int version = 0;
+    TuneProfile loaded;
+    int ok = fscanf(f, "%31s %u\n", magic, &version) == 2 && strcmp(magic, TUNE_MAGIC) == 0 && version == TUNE_VERSION;
+    ok = ok && fscanf(f, "host %511[^\n]\n", key) == 1 && strcmp(key, host_key) == 0;
+    ok = ok && fscanf(f, "backend %31s\nbatch %lu\nthreads %lu\nsmt %d\nhashrate %lf", backend, &loaded.batch, &loaded.threads, &loaded.smt, &loaded.hashrate) == 5;
+    fclose(f);
+    loaded.backend = ok ? hasher_backend_from_name(backend) : -1;
+    if (loaded.backend < 0 || loaded.threads == 0 || loaded.batch == 0) {
+        return 0;
+    }
+    profile = loaded;
+    return 1;
+}
+
+/**
+ * @brief Writes the profile through a temporary file, so a concurrent startup never reads half of it
+ */
+void Autotuner::save(const TuneProfile &profile) {
+    char tmp_path[520];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        printf("Cannot write tuning profile %s\n", tmp_path);
+        return;
+    }
+    fprintf(f, "%s %d\nhost %s\n", TUNE_MAGIC, TUNE_VERSION, host_key);
+    fprintf(f, "backend %s\nbatch %lu\nthreads %lu\nsmt %d\nhashrate %.0lf\n", HASHER_BACKEND_NAMES[profile.backend], profile.batch, profile.threads, profile.smt, profile.hashrate);
+    fclose(f);
+    if (rename(tmp_path, path) != 0) {
+        printf("Cannot replace tuning profile %s\n", path);
+    }
+}
+
+/**
+ * @brief Hashrate of one configuration. Threads take batch nonces at a time from a shared counter, like they take
+ * batches from their deques, and are pinned the way the miner would pin them.
+ *
+ * @param backend
+ * @param threads
+ * @param smt - 0 to place the threads one per core
+ * @param batch
+ * @param seconds
+ * @return double - H/s
+ */
+double Autotuner::trial(int backend, size_t threads, int smt, size_t batch, double seconds) {
+    NumaTopology topology;
+    topology.discover();
+    if (!smt) {
+        topology.dropSiblings();
+    }
+    topology.place(threads);
+    size_t next_nonce = 0;
+    double hashrate = 0.0;
+    unsigned char sink = 0;
+#pragma omp parallel num_threads(threads) reduction(+ : hashrate) reduction(^ : sink)
+    {
+        topology.pinThread(omp_get_thread_num());
+        NonceHasher hasher(backend);
+        hasher.setJob(1, prev_digest, data, 1, format);
+        unsigned char digest[SHA256_DIGEST_LENGTH];
+        size_t hashes = 0;
+#pragma omp barrier
+        const double t_start = omp_get_wtime();
+        const double t_end = t_start + seconds;
+        double t_now = t_start;
+        while (t_now < t_end) {
+            const size_t begin = __atomic_fetch_add(&next_nonce, batch, __ATOMIC_RELAXED);
+            for (size_t nonce = begin; nonce < begin + batch; nonce++) {
+                hasher.hash(nonce, digest);
+                sink ^= digest[0];
+            }
+            hashes += batch;
+            t_now = omp_get_wtime();
+        }
+        hashrate += hashes / (t_now - t_start);
+    }
+    tune_sink = sink;
+    return hashrate;
+}
+
+/**
+ * @brief Measures backends, then thread counts, then batch sizes within the time budget
+ *
+ * @param profile - best configuration found
+ */
+void Autotuner::calibrate(TuneProfile &profile) {
+    // Thread counts: the old default, one per core (SMT off) and one per hardware thread (SMT on)
+    size_t max_threads = omp_get_max_threads();
+    size_t thread_counts[TUNE_MAX_THREAD_CANDIDATES];
+    int smt_modes[TUNE_MAX_THREAD_CANDIDATES];
+    size_t num_thread_candidates = 0;
+    const size_t candidates[TUNE_MAX_THREAD_CANDIDATES] = {default_threads, physical_cores, logical_cpus};
+    const int modes[TUNE_MAX_THREAD_CANDIDATES] = {1, physical_cores == logical_cpus, 1};
+    for (size_t i = 0; i < TUNE_MAX_THREAD_CANDIDATES; i++) {
+        size_t threads = candidates[i] < max_threads ? candidates[i] : max_threads;
+        int duplicate = 0;
+        for (size_t j = 0; j < num_thread_candidates; j++) {
+            duplicate |= thread_counts[j] == threads && smt_modes[j] == modes[i];
+        }
+        if (threads > 0 && !duplicate) {
+            thread_counts[num_thread_candidates] = threads;
+            smt_modes[num_thread_candidates++] = modes[i];
+        }
+    }
+    // The starting point is measured once and carried through the stages
+    const size_t num_trials = NUM_HASHER_BACKENDS + (num_thread_candidates - 1) + (TUNE_NUM_BATCHES - 1);
+    const double seconds = budget / num_trials;
+
+    profile.backend = HASHER_MIDSTATE;
+    profile.threads = thread_counts[0];
+    profile.smt = smt_modes[0];
+    profile.batch = WS_BATCH;
+    profile.hashrate = 0.0;
+    for (int backend = 0; backend < NUM_HASHER_BACKENDS; backend++) {
+        double hashrate = trial(backend, profile.threads, profile.smt, profile.batch, seconds);
+        printf("Autotune: %-8s\t%lu threads (SMT %s)\tbatch %lu\t%.3lf MH/s\n", HASHER_BACKEND_NAMES[backend], profile.threads, smtName(profile.smt), profile.batch, hashrate / 1e6);
+        if (hashrate > profile.hashrate) {
+            profile.backend = backend;
+            profile.hashrate = hashrate;
+        }
+    }
+    const size_t base_threads = profile.threads;
+    const int base_smt = profile.smt;
+    for (size_t i = 0; i < num_thread_candidates; i++) {
+        if (thread_counts[i] == base_threads && smt_modes[i] == base_smt) {
+            continue;
+        }
+        double hashrate = trial(profile.backend, thread_counts[i], smt_modes[i], profile.batch, seconds);
+        printf("Autotune: %-8s\t%lu threads (SMT %s)\tbatch %lu\t%.3lf MH/s\n", HASHER_BACKEND_NAMES[profile.backend], thread_counts[i], smtName(smt_modes[i]), profile.batch, hashrate / 1e6);
+        if (hashrate > profile.hashrate) {
+            profile.threads = thread_counts[i];
+            profile.smt = smt_modes[i];
+            profile.hashrate = hashrate;
+        }
+    }
+    const size_t base_batch = profile.batch;
+    for (size_t i = 0; i < TUNE_NUM_BATCHES; i++) {
+        if (TUNE_BATCHES[i] == base_batch) {
+            continue;
+        }
+        double hashrate = trial(profile.backend, profile.threads, profile.smt, TUNE_BATCHES[i], seconds);
+        printf("Autotune: %-8s\t%lu threads (SMT %s)\tbatch %lu\t%.3lf MH/s\n", HASHER_BACKEND_NAMES[profile.backend], profile.threads, smtName(profile.smt), TUNE_BATCHES[i], hashrate / 1e6);
+        if (hashrate > profile.hashrate) {
+            profile.batch = TUNE_BATCHES[i];
+            profile.hashrate = hashrate;
+        }
+    }
+}
+
+/**
+ * @brief Loads the cached profile of this host, or calibrates and caches a new one
+ *
+ * @param profile - output
+ * @param force - calibrate even if there is a cached profile
+ * @param prev_digest - job the calibration hashes, hex
+ * @param data
+ * @param format - chain format version of the nonce
+ * @return int - 1 if the profile came from the cache
+ */
+int Autotuner::select(TuneProfile &profile, int force, const char *prev_digest, const char *data, unsigned char format) {
+    if (!force && load(profile)) {
+        from_cache = 1;
+        return 1;
+    }
+    this->prev_digest = prev_digest;
+    this->data = data;
+    this->format = format;
+
+    // The trials pin the calling thread. Threads started later inherit its mask, so put it back afterwards
+    cpu_set_t mask;
+    int have_mask = sched_getaffinity(0, sizeof(mask), &mask) == 0;
+    double t_start = omp_get_wtime();
+    calibrate(profile);
+    calibration_time = omp_get_wtime() - t_start;
+    if (have_mask) {
+        sched_setaffinity(0, sizeof(mask), &mask);
+    }
+    save(profile);
+    return 0;
+}
+
+/**
+ * @brief Prints the chosen configuration and where it came from
+ *
+ * @param profile
+ */
+void Autotuner::printProfile(const TuneProfile &profile) {
+    printf("Tuned: %s hasher, %lu threads (SMT %s), batch %lu\tExpected: %.3lf MH/s\t", HASHER_BACKEND_NAMES[profile.backend], profile.threads, smtName(profile.smt), profile.batch, profile.hashrate / 1e6);
+    if (from_cache) {
+        printf("(profile %s)\n", path);
+    } else {
+        printf("(calibrated in %.2lf s, saved to %s)\n", calibration_time, path);
+    }
+}
+
+#endif
@@ -0,0 +1,659 @@
+// Block-found pipeline. A found nonce goes through verify -> persist -> publish-next-job -> log as tasks on a small
+// executor thread, so mining threads hand the nonce off and keep hashing. The next job is published as soon as the
+// block is verified and appended; logging overlaps with mining of the next block. With a verifier pool, the verify
+// stage waits for a quorum of independent verdicts instead of recomputing the digest itself. A second nonce for a job
+// that is already solved, or for the job before the current one, is not dropped: it is verified against the block the
+// miner actually hashed and kept as a fork, and the chain switches to it if it ever carries more work.
+#ifndef BLOCK_PIPELINE_CPP
+#define BLOCK_PIPELINE_CPP
+
+#include <pthread.h>
+
+#include "difficulty.cpp"
+#include "numa.cpp"
+#include "perf_counters.cpp"
+#include "sha256_openssl.cpp"
+#include "shares.cpp"
+#include "trace.cpp"
+#include "utils.h"
+#include "verifier_pool.cpp"
+#include "work_stealing.cpp"
+
+#define PIPELINE_QUEUE 64
+
+enum PipelineStage { STAGE_VERIFY, STAGE_PERSIST, STAGE_PUBLISH, STAGE_LOG };
+const char *PIPELINE_STAGE_NAMES[] = {"verify", "persist", "publish", "log"};
+
+/**
+ * One block moving through the pipeline. Each stage fills in what the next one needs.
+ */
+struct PipelineTask {
+    PipelineStage stage;
+    size_t generation;
+    size_t nonce;
+    size_t threshold;
+    unsigned char parent[SHA256_DIGEST_LENGTH];  // prev_digest of the block the job extended
+    int sibling;                                 // another nonce already claimed the job
+    int tid;
+    double t_found;
+    double t_block_start;  // when the miners started on this block's job
+    char *data_to_hash;
+    char *digest;
+};
+
+/**
+ * A candidate out for verification. Keeps its own copy of the preimage until every verifier has answered.
+ */
+struct PendingVerify {
+    int used;
+    int decided;
+    size_t tag;
+    size_t accepts;
+    size_t rejects;
+    size_t returned;
+    PipelineTask task;
+};
+
+/**
+ * BlockPipeline class. Owns the job generation and the threshold of the local chain; only the executor thread
+ * changes the chain.
+ */
+class BlockPipeline {
+   public:
+    BlockPipeline(Blockchain &blockchain, NumaTopology &topology, WorkStealingScheduler &scheduler, ShareStats &shares, size_t threshold, omp_lock_t *lock_print);
+    ~BlockPipeline();
+    void start(double t_start_global);
+    void stop();
+    size_t getGeneration() { return __atomic_load_n(&generation, __ATOMIC_ACQUIRE); }
+    /**
+     * @brief The current job. Miners read only this snapshot, never the chain
+     */
+    const NumaJob *getJob() { return __atomic_load_n(&job, __ATOMIC_ACQUIRE); }
+    size_t getThreshold() { return __atomic_load_n(&threshold, __ATOMIC_RELAXED); }
+    int isSolved(size_t gen) { return __atomic_load_n(&found_generation, __ATOMIC_RELAXED) == gen; }
+    int submit(size_t gen, const char *parent, size_t nonce, int tid);
+    void setVerifiers(VerifierPool *verifiers, size_t quorum);
+    void setPublishHook(void (*hook)(void *arg, size_t generation, size_t threshold), void *arg) {
+        publish_hook = hook;
+        publish_hook_arg = arg;
+    }
+    void setPerf(PerfCounters *perf, size_t slot) {
+        this->perf = perf;
+        perf_slot = slot;
+    }
+    void setTelemetry(FILE *telemetry, size_t num_threads) {
+        this->telemetry = telemetry;
+        telemetry_threads = num_threads;
+    }
+    void setDifficulty(const DifficultyPolicy &difficulty) { this->difficulty = difficulty; }
+    void setBlockHook(int (*hook)(void *arg), void *arg) {
+        block_hook = hook;
+        block_hook_arg = arg;
+    }
+    void printStats();
+    static void notifyExecutor(void *arg);
+
+   private:
+    Blockchain &blockchain;
+    NumaTopology &topology;
+    WorkStealingScheduler &scheduler;
+    ShareStats &shares;
+    omp_lock_t *lock_print;
+    size_t generation;
+    size_t threshold;
+    size_t found_generation;  // generation a miner claimed, so only one nonce per job extends the chain
+    size_t sibling_generation;  // generation of the last fork candidate, at most one per job
+    size_t job_threshold[PIPELINE_QUEUE];  // threshold of each recent generation, at generation % PIPELINE_QUEUE
+    NumaJob *job;                          // published job, older ones on its retired list
+    double t_start_global;
+    double t_block_start;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t space;  // a submit waits here until the queue has room for its task and every later stage
+    int running;
+    PipelineTask queue[PIPELINE_QUEUE];
+    size_t head;
+    size_t count;
+    size_t dropped;  // tasks lost to a full queue, 0 unless the admission bound in submit() is broken
+    size_t wakeups;  // bumped by verifiers after pushing a result
+
+    VerifierPool *verifiers;
+    size_t quorum;  // accepting verdicts needed out of verifiers->num_verifiers
+    PendingVerify pending[PIPELINE_QUEUE];
+    size_t num_pending;  // changed by the executor, read by submit()
+    size_t next_tag;
+
+    void (*publish_hook)(void *arg, size_t generation, size_t threshold);  // sees each new job before the miners do
+    void *publish_hook_arg;
+
+    PerfCounters *perf;  // counts the executor's stages in perf_slot, if set
+    size_t perf_slot;
+
+    FILE *telemetry;  // one JSON line per accepted block, if set
+    size_t telemetry_threads;
+
+    DifficultyPolicy difficulty;   // threshold of each published job
+    int (*block_hook)(void *arg);  // counts each new tip, 0: the run ends and no next job is published
+    void *block_hook_arg;
+
+    // stats, executor thread only
+    size_t blocks;
+    size_t rejected;
+    size_t stale;  // verified but not on the best chain
+    double total_publish_latency;
+    double max_publish_latency;
+    double total_log_latency;
+    size_t validations;
+    double total_validation_latency;
+    double max_validation_latency;
+
+    void verifyInline(PipelineTask &task);
+    void drainVerdicts();
+    void pushBack(PipelineTask &task);
+    void pushFront(PipelineTask &task);
+    void pushSubmitted(PipelineTask &task);
+    void run(PipelineTask &task);
+    void publishJob(size_t gen);
+    static void *executorLoop(void *arg);
+};
+
+/**
+ * @brief Construct a new Block Pipeline object
+ *
+ * @param blockchain
+ * @param topology - node job copies and cursors to reset on a new job
+ * @param scheduler
+ * @param shares - for the share hashrate line of the log stage
+ * @param threshold - leading zeros of the first job
+ * @param lock_print
+ */
+BlockPipeline::BlockPipeline(Blockchain &blockchain, NumaTopology &topology, WorkStealingScheduler &scheduler, ShareStats &shares, size_t threshold, omp_lock_t *lock_print)
+    : blockchain(blockchain), topology(topology), scheduler(scheduler), shares(shares) {
+    this->lock_print = lock_print;
+    this->threshold = threshold;
+    generation = 1;
+    found_generation = 0;
+    sibling_generation = 0;
+    memset(job_threshold, 0, sizeof(job_threshold));
+    job_threshold[generation % PIPELINE_QUEUE] = threshold;
+    job = NULL;
+    publishJob(generation);
+    t_start_global = t_block_start = 0.0;
+    running = 0;
+    head = count = 0;
+    dropped = 0;
+    wakeups = 0;
+    verifiers = NULL;
+    quorum = 0;
+    memset(pending, 0, sizeof(pending));
+    num_pending = 0;
+    next_tag = 1;
+    publish_hook = NULL;
+    publish_hook_arg = NULL;
+    perf = NULL;
+    perf_slot = 0;
+    telemetry = NULL;
+    telemetry_threads = 0;
+    difficulty.kind = DIFFICULTY_INCREMENT;
+    difficulty.max_threshold = SHA256_BITS;
+    block_hook = NULL;
+    block_hook_arg = NULL;
+    blocks = rejected = stale = 0;
+    total_publish_latency = max_publish_latency = total_log_latency = 0.0;
+    validations = 0;
+    total_validation_latency = max_validation_latency = 0.0;
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&ready, NULL);
+    pthread_cond_init(&space, NULL);
+}
+
+/**
+ * @brief Destroy the Block Pipeline object
+ *
+ */
+BlockPipeline::~BlockPipeline() {
+    while (job != NULL) {
+        NumaJob *retired = job->retired;
+        free(job->prev_digest);
+        free(job->data);
+        free(job);
+        job = retired;
+    }
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&ready);
+    pthread_cond_destroy(&space);
+}
+
+/**
+ * @brief Starts the executor thread
+ *
+ * @param t_start_global
+ */
+void BlockPipeline::start(double t_start_global) {
+    this->t_start_global = t_start_global;
+    t_block_start = t_start_global;
+    running = 1;
+    pthread_create(&thread, NULL, executorLoop, this);
+}
+
+/**
+ * @brief Runs the queued tasks to completion, then joins the executor thread
+ *
+ */
+void BlockPipeline::stop() {
+    pthread_mutex_lock(&lock);
+    running = 0;
+    pthread_cond_signal(&ready);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+}
+
+/**
+ * @brief Queues a task behind the others. Executor side: it replaces the task being run, so the admission bound of
+ * pushSubmitted() leaves it room. A full queue is a bug; the task is counted and reported rather than overwriting one.
+ */
+void BlockPipeline::pushBack(PipelineTask &task) {
+    TRACE_LOCK(pthread_mutex_lock(&lock), "pipeline lock wait");
+    if (count < PIPELINE_QUEUE) {
+        queue[(head + count) % PIPELINE_QUEUE] = task;
+        count++;
+    } else {
+        dropped++;
+        printf("ERROR: Block pipeline queue full, %s task of nonce %lu dropped\n", PIPELINE_STAGE_NAMES[task.stage], task.nonce);
+    }
+    pthread_cond_signal(&ready);
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Queues a task ahead of the others. Used for the stages on the path to the next job. Same room guarantee as
+ * pushBack().
+ */
+void BlockPipeline::pushFront(PipelineTask &task) {
+    TRACE_LOCK(pthread_mutex_lock(&lock), "pipeline lock wait");
+    if (count < PIPELINE_QUEUE) {
+        head = (head + PIPELINE_QUEUE - 1) % PIPELINE_QUEUE;
+        queue[head] = task;
+        count++;
+    } else {
+        dropped++;
+        printf("ERROR: Block pipeline queue full, %s task of nonce %lu dropped\n", PIPELINE_STAGE_NAMES[task.stage], task.nonce);
+    }
+    pthread_cond_signal(&ready);
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Queues a new task from submit() ahead of the others, waiting for room first. Tasks are only created here: each
+ * later stage replaces the task the executor popped, or moves one out of the pending verifications. So admitting a task
+ * only while the queued, pending and running ones leave a free slot bounds the queue for every stage after it, and the
+ * executor never has to wait on itself.
+ */
+void BlockPipeline::pushSubmitted(PipelineTask &task) {
+    TRACE_LOCK(pthread_mutex_lock(&lock), "pipeline lock wait");
+    while (count + __atomic_load_n(&num_pending, __ATOMIC_ACQUIRE) + 1 >= PIPELINE_QUEUE) {
+        pthread_cond_wait(&space, &lock);
+    }
+    head = (head + PIPELINE_QUEUE - 1) % PIPELINE_QUEUE;
+    queue[head] = task;
+    count++;
+    pthread_cond_signal(&ready);
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Hands a nonce whose digest met the threshold to the pipeline. The first nonce of the current generation
+ * extends the chain; one more nonce per generation, for the current or the previous job, enters as a fork candidate.
+ * The caller keeps mining either way.
+ *
+ * @param gen - job generation the nonce was found for
+ * @param parent - prev_digest of the block the job extended, hex
+ * @param nonce
+ * @param tid
+ * @return int - 1 if the nonce entered the pipeline
+ */
+int BlockPipeline::submit(size_t gen, const char *parent, size_t nonce, int tid) {
+    const size_t latest = getGeneration();
+    int sibling = 0;
+    size_t seen = __atomic_load_n(&found_generation, __ATOMIC_RELAXED);
+    if (seen == gen || gen != latest || !__atomic_compare_exchange_n(&found_generation, &seen, gen, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        seen = __atomic_load_n(&sibling_generation, __ATOMIC_RELAXED);
+        if (gen + 1 < latest || seen >= gen || !__atomic_compare_exchange_n(&sibling_generation, &seen, gen, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return 0;
+        }
+        sibling = 1;
+    }
+    PipelineTask task;
+    memset(&task, 0, sizeof(task));
+    if (!hex_decode(parent, SHA256_DIGEST_LENGTH, task.parent)) {
+        return 0;
+    }
+    task.stage = STAGE_VERIFY;
+    task.generation = gen;
+    task.nonce = nonce;
+    task.threshold = job_threshold[gen % PIPELINE_QUEUE];
+    task.sibling = sibling;
+    task.tid = tid;
+    task.t_found = omp_get_wtime();
+    pushSubmitted(task);
+    return 1;
+}
+
+/**
+ * @brief Runs one stage of a task and queues the next stage
+ *
+ * @param task
+ */
+void BlockPipeline::run(PipelineTask &task) {
+    switch (task.stage) {
+        case STAGE_VERIFY: {
+            TRACE_SCOPE_ARG("verify", task.nonce);
+            Blockchain::Block *parent = blockchain.findBlock(task.parent);
+            if (parent == NULL) {
+                // Too old to attach anywhere, its parent was dropped from memory
+                stale++;
+                if (!task.sibling) {
+                    __atomic_store_n(&found_generation, task.generation - 1, __ATOMIC_RELEASE);
+                }
+                break;
+            }
+            task.data_to_hash = blockchain.getString(parent, task.nonce);
+            if (verifiers == NULL) {
+                verifyInline(task);
+                break;
+            }
+            // Out to every verifier. drainVerdicts() moves the task on once the quorum is decided
+            PendingVerify *slot = NULL;
+            for (size_t i = 0; i < PIPELINE_QUEUE && slot == NULL; i++) {
+                if (!pending[i].used) {
+                    slot = &pending[i];
+                }
+            }
+            if (slot == NULL) {
+                verifyInline(task);
+                break;
+            }
+            memset(slot, 0, sizeof(PendingVerify));
+            slot->used = 1;
+            slot->tag = next_tag++;
+            slot->task = task;
+            __atomic_add_fetch(&num_pending, 1, __ATOMIC_RELEASE);
+            verifiers->submit(slot->tag, slot->task.data_to_hash, task.threshold);
+            break;
+        }
+        case STAGE_PERSIST: {
+            TRACE_SCOPE_ARG("appendBlock", task.nonce);
+            Blockchain::Block *parent = blockchain.findBlock(task.parent);
+            Blockchain::Block *block = NULL;
+            if (parent != NULL) {
+                block = blockchain.addBlock(parent, (const char *)task.digest, (const char *)task.data_to_hash, task.threshold, task.nonce);
+            }
+            if (block != NULL && block == blockchain.getCurrentBlock()) {
+                task.stage = STAGE_PUBLISH;
+                pushFront(task);
+                break;
+            }
+            // Not enough work to become the tip. The miners stay on their job
+            stale++;
+            TRACE_LOCK(omp_set_lock(lock_print), "print lock wait");
+            printf("Stale block: \t\t\t%s\tNonce: %lu\tTID: %d\t%s\n", task.digest, task.nonce, task.tid, block != NULL ? "kept as a fork" : "parent dropped from memory");
+            omp_unset_lock(lock_print);
+            if (!task.sibling) {
+                __atomic_store_n(&found_generation, task.generation - 1, __ATOMIC_RELEASE);
+            }
+            free(task.data_to_hash);
+            free(task.digest);
+            break;
+        }
+        case STAGE_PUBLISH: {
+            // A fork that took over publishes on top of the current generation, not its own
+            const size_t next = getGeneration() + 1;
+            TRACE_SCOPE_ARG("publish", next);
+            __atomic_store_n(&threshold, difficulty.next(task.threshold), __ATOMIC_RELAXED);
+            job_threshold[next % PIPELINE_QUEUE] = getThreshold();
+            if (publish_hook != NULL) {
+                publish_hook(publish_hook_arg, next, getThreshold());
+            }
+            if (block_hook != NULL && !block_hook(block_hook_arg)) {
+                // Last block of the run. The next job is recorded (checkpoint) but not handed to the miners
+                task.t_block_start = t_block_start;
+                task.stage = STAGE_LOG;
+                pushBack(task);
+                break;
+            }
+            // Restart every node's nonces, then publish the new job. The only cross-node writes. The generation moves
+            // first, so a miner that already sees the new job never submits it as older than the latest one
+            double t_now = omp_get_wtime();
+            topology.resetCursors();
+            scheduler.jobStarted(next, t_now);
+            __atomic_store_n(&generation, next, __ATOMIC_RELEASE);
+            publishJob(next);
+            task.t_block_start = t_block_start;
+            t_block_start = t_now;
+            double latency = t_now - task.t_found;
+            total_publish_latency += latency;
+            if (latency > max_publish_latency) {
+                max_publish_latency = latency;
+            }
+            task.stage = STAGE_LOG;
+            pushBack(task);
+            break;
+        }
+        case STAGE_LOG: {
+            TRACE_SCOPE_ARG("print", task.nonce);
+            TRACE_LOCK(omp_set_lock(lock_print), "print lock wait");
+            printf("Digest accepted: \t\t%s\tNonce: %lu\tTID: %d\n", task.digest, task.nonce, task.tid);
+            print_new_block_info(task.t_block_start, t_start_global, task.digest, task.nonce, task.data_to_hash, task.tid);
+            shares.printEstimate("Share hashrate:", t_start_global, omp_get_wtime());
+            print_current_block_info(blockchain, task.nonce);
+            omp_unset_lock(lock_print);
+            if (telemetry != NULL) {
+                // Block time up to the find, without the verify and persist stages
+                fprintf(telemetry, "{\"block_id\":%llu,\"threshold\":%lu,\"nonce\":%lu,\"tid\":%d,\"threads\":%lu,\"block_time\":%.6lf,\"total_time\":%.6lf}\n", strtoull(task.data_to_hash + 1, NULL, 10), task.threshold, task.nonce, task.tid, telemetry_threads, task.t_found - task.t_block_start, task.t_found - t_start_global);
+                fflush(telemetry);
+            }
+            blocks++;
+            total_log_latency += omp_get_wtime() - task.t_found;
+            free(task.data_to_hash);
+            free(task.digest);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Snapshots the chain tip and the threshold of generation gen as the job the miners read. Executor thread (or
+ * the constructor) only, as it reads the chain.
+ *
+ * @param gen
+ */
+void BlockPipeline::publishJob(size_t gen) {
+    Blockchain::Block *tip = blockchain.getCurrentBlock();
+    NumaJob *fresh = (NumaJob *)malloc(sizeof(NumaJob));
+    fresh->generation = gen;
+    fresh->threshold = job_threshold[gen % PIPELINE_QUEUE];
+    fresh->block_id = tip->block_id;
+    fresh->block_threshold = tip->threshold;
+    fresh->nonce = tip->nonce;
+    fresh->prev_digest = hex_string(tip->prev_digest, SHA256_DIGEST_LENGTH);
+    fresh->data = strdup(tip->data);
+    fresh->retired = job;
+    __atomic_store_n(&job, fresh, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Uses a verifier pool for the verify stage. Every candidate is checked by all verifiers, quorum of them must
+ * accept it.
+ *
+ * @param verifiers - started with notifyExecutor and this pipeline
+ * @param quorum - between 1 and verifiers->num_verifiers
+ */
+void BlockPipeline::setVerifiers(VerifierPool *verifiers, size_t quorum) {
+    this->verifiers = verifiers;
+    this->quorum = quorum;
+}
+
+/**
+ * @brief Wakes the executor after a verifier pushed a result
+ *
+ * @param arg - BlockPipeline*
+ */
+void BlockPipeline::notifyExecutor(void *arg) {
+    BlockPipeline *pipeline = (BlockPipeline *)arg;
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->wakeups++;
+    pthread_cond_signal(&pipeline->ready);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+/**
+ * @brief Verify stage without a verifier pool: recompute with the OpenSSL hasher on the executor thread
+ *
+ * @param task - data_to_hash is set
+ */
+void BlockPipeline::verifyInline(PipelineTask &task) {
+    task.digest = double_sha256((const char *)task.data_to_hash);
+    if (!blockchain.thresholdMet((const char *)task.digest, task.threshold)) {
+        omp_set_lock(lock_print);
+        printf("ERROR: Digest rejected: %s\tNonce: %lu\tTID: %d\n", task.digest, task.nonce, task.tid);
+        omp_unset_lock(lock_print);
+        rejected++;
+        free(task.data_to_hash);
+        free(task.digest);
+        // Reopen the job so the miners can submit another nonce
+        if (!task.sibling) {
+            __atomic_store_n(&found_generation, task.generation - 1, __ATOMIC_RELEASE);
+        }
+        return;
+    }
+    task.stage = STAGE_PERSIST;
+    pushFront(task);
+}
+
+/**
+ * @brief Tallies the verdicts from the completion queue. A candidate moves on to persist once quorum verifiers accepted
+ * it, and is rejected once too many refused it for the quorum to be reached.
+ *
+ */
+void BlockPipeline::drainVerdicts() {
+    VerifyResult result;
+    while (verifiers != NULL && verifiers->poll(result)) {
+        PendingVerify *slot = NULL;
+        for (size_t i = 0; i < PIPELINE_QUEUE && slot == NULL; i++) {
+            if (pending[i].used && pending[i].tag == result.tag) {
+                slot = &pending[i];
+            }
+        }
+        if (slot == NULL) {
+            continue;
+        }
+        slot->returned++;
+        if (result.accepted) {
+            slot->accepts++;
+        } else {
+            slot->rejects++;
+        }
+        if (!slot->decided && (slot->accepts >= quorum || slot->rejects > verifiers->num_verifiers - quorum)) {
+            slot->decided = 1;
+            double latency = result.t_done - result.t_submit;
+            validations++;
+            total_validation_latency += latency;
+            if (latency > max_validation_latency) {
+                max_validation_latency = latency;
+            }
+            PipelineTask task = slot->task;
+            if (slot->accepts >= quorum) {
+                // The pending slot keeps its preimage for the verifiers still working on it
+                task.data_to_hash = strdup(slot->task.data_to_hash);
+                task.digest = strdup(result.digest);
+                task.stage = STAGE_PERSIST;
+                pushFront(task);
+            } else {
+                omp_set_lock(lock_print);
+                printf("ERROR: Digest rejected by %lu of %lu verifiers: %s\tNonce: %lu\tTID: %d\n", slot->rejects, verifiers->num_verifiers, result.digest, task.nonce, task.tid);
+                omp_unset_lock(lock_print);
+                rejected++;
+                if (!task.sibling) {
+                    __atomic_store_n(&found_generation, task.generation - 1, __ATOMIC_RELEASE);
+                }
+            }
+        }
+        if (slot->returned == verifiers->num_verifiers) {
+            free(slot->task.data_to_hash);
+            slot->used = 0;
+            __atomic_sub_fetch(&num_pending, 1, __ATOMIC_RELEASE);
+            pthread_mutex_lock(&lock);
+            pthread_cond_broadcast(&space);
+            pthread_mutex_unlock(&lock);
+        }
+    }
+}
+
+/**
+ * @brief Executor thread. Pops tasks until stopped and the queue is empty.
+ *
+ * @param arg - BlockPipeline*
+ * @return void* - NULL
+ */
+void *BlockPipeline::executorLoop(void *arg) {
+    BlockPipeline *pipeline = (BlockPipeline *)arg;
+    size_t seen_wakeups = 0;
+    TRACE_THREAD("pipeline", -1);
+    if (pipeline->perf != NULL) {
+        pipeline->perf->openThread(pipeline->perf_slot);
+    }
+    while (1) {
+        pipeline->drainVerdicts();
+        pthread_mutex_lock(&pipeline->lock);
+        while (pipeline->count == 0 && pipeline->wakeups == seen_wakeups && (pipeline->running || pipeline->num_pending > 0)) {
+            pthread_cond_wait(&pipeline->ready, &pipeline->lock);
+        }
+        seen_wakeups = pipeline->wakeups;
+        if (pipeline->count == 0) {
+            int done = !pipeline->running && pipeline->num_pending == 0;
+            pthread_mutex_unlock(&pipeline->lock);
+            if (done) {
+                break;
+            }
+            continue;
+        }
+        PipelineTask task = pipeline->queue[pipeline->head];
+        pipeline->head = (pipeline->head + 1) % PIPELINE_QUEUE;
+        pipeline->count--;
+        pthread_cond_broadcast(&pipeline->space);
+        pthread_mutex_unlock(&pipeline->lock);
+        if (pipeline->perf != NULL) {
+            pipeline->perf->begin(pipeline->perf_slot);
+            pipeline->run(task);
+            pipeline->perf->end(pipeline->perf_slot, PERF_PHASE_HANDOFF, 0);
+        } else {
+            pipeline->run(task);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Prints how long the pipeline took from a found nonce to the next job and to the finished log line
+ *
+ */
+void BlockPipeline::printStats() {
+    if (dropped > 0) {
+        printf("\nERROR: Block pipeline dropped %lu tasks on a full queue\n", dropped);
+    }
+    if (blocks == 0) {
+        printf("\nBlock pipeline: no blocks\n");
+        return;
+    }
+    printf("\nBlock pipeline: %lu blocks, %lu rejected, %lu stale\tFound to next job: avg %.1lf us, max %.1lf us\tFound to logged: avg %.1lf us\n", blocks, rejected, stale, total_publish_latency / blocks * 1e6, max_publish_latency * 1e6, total_log_latency / blocks * 1e6);
+    if (blockchain.reorgs > 0) {
+        printf("Reorgs: %lu\tDeepest: %lu blocks\n", blockchain.reorgs, blockchain.max_reorg_depth);
+    }
+    if (validations > 0) {
+        printf("Validation (quorum %lu of %lu): avg %.1lf us, max %.1lf us\n", quorum, verifiers->num_verifiers, total_validation_latency / validations * 1e6, max_validation_latency * 1e6);
+    }
+}
+
+#endif
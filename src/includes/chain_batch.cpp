@@ -0,0 +1,318 @@
+// Batch mode: many independent chains mined at once. A thread whose chain is between blocks (or finished) moves to the
+// chain with the fewest threads instead of waiting, so no core idles during a block handoff.
+#ifndef CHAIN_BATCH_CPP
+#define CHAIN_BATCH_CPP
+
+#include "sha256_midstate.cpp"
+#include "sha256_openssl.cpp"
+#include "shares.cpp"
+#include "utils.h"
+
+#define BATCH_NONCE_CHUNK 256
+
+/**
+ * Immutable snapshot of a chain tip. Replaced, never modified, when the chain grows. Carries its own nonce cursor, so a
+ * new job never needs a cursor reset.
+ */
+struct BatchJob {
+    size_t cursor;
+    size_t generation;
+    size_t block_id;
+    size_t block_threshold;
+    size_t threshold;  // leading zeros the next block needs
+    char *prev_digest;
+    char *data;
+    BatchJob *retired;
+};
+
+/**
+ * One chain of the batch. The finder of a block claims solved_generation, verifies, appends and publishes the next job.
+ */
+struct alignas(CACHE_LINE_BYTES) BatchChain {
+    BatchJob *job;
+    size_t solved_generation;
+    size_t num_workers;  // threads currently mining this chain
+    size_t blocks_found;
+    int done;
+    double t_done;
+    Blockchain *blockchain;
+};
+
+/**
+ * Per-thread counters, one cache line each.
+ */
+struct alignas(CACHE_LINE_BYTES) BatchThread {
+    size_t hashes;
+    size_t switches;
+};
+
+/**
+ * ChainBatch class. Mines num_chains chains with different genesis data until each has blocks_per_chain new blocks.
+ */
+class ChainBatch {
+   public:
+    ChainBatch(size_t num_chains, size_t blocks_per_chain, size_t num_threads, unsigned char nonce_format);
+    ~ChainBatch();
+    void work(int tid, unsigned char &running);
+    void printReport(double t_elapsed);
+    int isDone() { return chainsDone() == num_chains; }
+    size_t chainsDone() { return __atomic_load_n(&chains_done, __ATOMIC_ACQUIRE); }
+    size_t totalHashes();
+    static size_t hashSource(void *arg) { return ((ChainBatch *)arg)->totalHashes(); }
+    void setBlockHook(int (*hook)(void *arg), void *arg) {
+        block_hook = hook;
+        block_hook_arg = arg;
+    }
+
+    size_t num_chains;
+    size_t blocks_per_chain;
+
+   private:
+    size_t num_threads;
+    size_t chains_done;
+    BatchChain *chains;
+    BatchThread *threads;
+    double t_begin;
+    int (*block_hook)(void *arg);  // called per appended block, 0 to stop publishing jobs
+    void *block_hook_arg;
+
+    void publishJob(BatchChain *chain, size_t threshold);
+    size_t pickChain(size_t current);
+    void blockFound(size_t chain_idx, BatchJob *job, size_t nonce, int tid);
+};
+
+/**
+ * @brief Construct a new Chain Batch object. Every chain gets its own genesis block.
+ *
+ * @param num_chains
+ * @param blocks_per_chain - blocks to mine on each chain after the genesis block
+ * @param num_threads
+ * @param nonce_format - chain format version of every chain
+ */
+ChainBatch::ChainBatch(size_t num_chains, size_t blocks_per_chain, size_t num_threads, unsigned char nonce_format) {
+    this->num_chains = num_chains;
+    this->blocks_per_chain = blocks_per_chain;
+    this->num_threads = num_threads;
+    chains_done = 0;
+    block_hook = NULL;
+    block_hook_arg = NULL;
+    chains = new BatchChain[num_chains];
+    threads = new BatchThread[num_threads];
+    memset(threads, 0, sizeof(BatchThread) * num_threads);
+    for (size_t i = 0; i < num_chains; i++) {
+        BatchChain *chain = &chains[i];
+        memset(chain, 0, sizeof(BatchChain));
+        chain->blockchain = new Blockchain();
+        chain->blockchain->setNonceFormat(nonce_format);
+        // Different genesis data per chain, i.e. per simulated scenario
+        char genesis_data[128];
+        snprintf(genesis_data, sizeof(genesis_data), "[BLOCK ID|PREVIOUS DIGEST|DATA|THRESHOLD|NONCE] scenario %lu", i);
+        char *genesis_digest = double_sha256(genesis_data);
+        chain->blockchain->appendBlock(genesis_digest, genesis_data, 0, 0);
+        free(genesis_digest);
+        publishJob(chain, 1);
+    }
+    t_begin = omp_get_wtime();
+}
+
+/**
+ * @brief Destroy the Chain Batch object
+ *
+ */
+ChainBatch::~ChainBatch() {
+    for (size_t i = 0; i < num_chains; i++) {
+        BatchJob *job = chains[i].job;
+        while (job != NULL) {
+            BatchJob *retired = job->retired;
+            free(job->prev_digest);
+            free(job->data);
+            free(job);
+            job = retired;
+        }
+        delete chains[i].blockchain;
+    }
+    delete[] chains;
+    delete[] threads;
+}
+
+/**
+ * @brief Publishes a snapshot of the chain's tip as its next job. Old jobs stay on the retired list until exit since
+ * other threads may still be hashing them.
+ *
+ * @param chain
+ * @param threshold - leading zeros the next block needs
+ */
+void ChainBatch::publishJob(BatchChain *chain, size_t threshold) {
+    Blockchain::Block *tip = chain->blockchain->getCurrentBlock();
+    BatchJob *job = (BatchJob *)malloc(sizeof(BatchJob));
+    job->cursor = 0;
+    job->generation = (chain->job == NULL) ? 1 : chain->job->generation + 1;
+    job->block_id = tip->block_id;
+    job->block_threshold = tip->threshold;
+    job->threshold = threshold;
+    job->prev_digest = hex_string(tip->prev_digest, SHA256_DIGEST_LENGTH);
+    job->data = strdup(tip->data);
+    job->retired = chain->job;
+    __atomic_store_n(&chain->job, job, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Picks the unfinished, unsolved chain with the fewest threads, starting the scan after the current chain
+ *
+ * @param current
+ * @return size_t - chain index, current if no other chain has work
+ */
+size_t ChainBatch::pickChain(size_t current) {
+    size_t best = current;
+    size_t best_workers = (size_t)-1;
+    for (size_t k = 1; k <= num_chains; k++) {
+        size_t i = (current + k) % num_chains;
+        BatchChain *chain = &chains[i];
+        BatchJob *job = __atomic_load_n(&chain->job, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&chain->done, __ATOMIC_RELAXED) || __atomic_load_n(&chain->solved_generation, __ATOMIC_RELAXED) == job->generation) {
+            continue;
+        }
+        size_t workers = __atomic_load_n(&chain->num_workers, __ATOMIC_RELAXED);
+        if (workers < best_workers) {
+            best = i;
+            best_workers = workers;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Handles a candidate block of one chain. The first thread to claim the job generation verifies the nonce with
+ * the OpenSSL hasher, appends the block and publishes the next job. Others drop their duplicate.
+ *
+ * @param chain_idx
+ * @param job - the job the nonce was found for
+ * @param nonce
+ * @param tid
+ */
+void ChainBatch::blockFound(size_t chain_idx, BatchJob *job, size_t nonce, int tid) {
+    BatchChain *chain = &chains[chain_idx];
+    size_t seen = __atomic_load_n(&chain->solved_generation, __ATOMIC_RELAXED);
+    if (seen == job->generation || !__atomic_compare_exchange_n(&chain->solved_generation, &seen, job->generation, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return;
+    }
+    // Only the claiming thread touches the chain until the next job is published
+    Blockchain *blockchain = chain->blockchain;
+    char *data_to_hash = blockchain->getString(nonce);
+    char *digest = double_sha256((const char *)data_to_hash);
+    size_t threshold = job->threshold;
+    if (!blockchain->thresholdMet((const char *)digest, threshold)) {
+#pragma omp critical(print)
+        printf("ERROR: Chain %lu digest rejected: %s\tNonce: %lu\tTID: %d\n", chain_idx, digest, nonce, tid);
+        // Reopen the job
+        __atomic_store_n(&chain->solved_generation, seen, __ATOMIC_RELEASE);
+    } else {
+        blockchain->appendBlock((const char *)digest, (const char *)data_to_hash, threshold, nonce);
+        chain->blocks_found++;
+#pragma omp critical(print)
+        printf("Chain: %lu\tBlock: %lu\tThreshold: %lu\tNonce: %lu\tDigest: %s\tTID: %d\n", chain_idx, blockchain->getCurrentBlockId(), threshold, nonce, digest, tid);
+        if (chain->blocks_found >= blocks_per_chain) {
+            chain->t_done = omp_get_wtime();
+            __atomic_store_n(&chain->done, 1, __ATOMIC_RELEASE);
+            __atomic_fetch_add(&chains_done, 1, __ATOMIC_RELEASE);
+        }
+        if (block_hook != NULL && !block_hook(block_hook_arg)) {
+            // The run is ending: the chain keeps its solved job
+        } else if (!chain->done) {
+            publishJob(chain, threshold < SHA256_BITS ? threshold + 1 : threshold);
+        }
+    }
+    free(data_to_hash);
+    free(digest);
+}
+
+/**
+ * @brief Mining loop of one thread. Call from every thread of a parallel region.
+ *
+ * @param tid
+ * @param running - cleared to stop early
+ */
+void ChainBatch::work(int tid, unsigned char &running) {
+    BatchThread *me = &threads[tid];
+    Sha256Midstate midstate;
+    BatchJob *hashed_job = NULL;  // job the midstate was built for
+    size_t chain_idx = tid % num_chains;
+    __atomic_fetch_add(&chains[chain_idx].num_workers, 1, __ATOMIC_RELAXED);
+
+    while (running && !isDone()) {
+        BatchChain *chain = &chains[chain_idx];
+        BatchJob *job = __atomic_load_n(&chain->job, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&chain->done, __ATOMIC_ACQUIRE) || __atomic_load_n(&chain->solved_generation, __ATOMIC_ACQUIRE) == job->generation) {
+            // Chain finished or between blocks. Help the least served chain meanwhile
+            size_t next = pickChain(chain_idx);
+            if (next != chain_idx) {
+                __atomic_fetch_sub(&chain->num_workers, 1, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&chains[next].num_workers, 1, __ATOMIC_RELAXED);
+                chain_idx = next;
+                me->switches++;
+            }
+            continue;
+        }
+        if (job != hashed_job) {
+            midstate.setJob(job->block_id, job->prev_digest, job->data, job->block_threshold, chain->blockchain->getNonceFormat());
+            hashed_job = job;
+        }
+
+        const size_t begin = __atomic_fetch_add(&job->cursor, BATCH_NONCE_CHUNK, __ATOMIC_RELAXED);
+        unsigned char digest_bin[SHA256_DIGEST_LENGTH];
+        size_t hashed = BATCH_NONCE_CHUNK;
+        for (size_t nonce = begin; nonce < begin + BATCH_NONCE_CHUNK; nonce++) {
+            midstate.hash(nonce, digest_bin);
+            if (job->threshold < 2 * SHA256_DIGEST_LENGTH && ShareStats::meets(digest_bin, job->threshold)) {
+                char *digest = digest_to_hex(digest_bin);
+                if (chain->blockchain->thresholdMet((const char *)digest, job->threshold)) {
+                    blockFound(chain_idx, job, nonce, tid);
+                    free(digest);
+                    hashed = nonce - begin + 1;
+                    break;
+                }
+                free(digest);
+            }
+        }
+        // Read by the run controller while mining
+        __atomic_store_n(&me->hashes, me->hashes + hashed, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_sub(&chains[chain_idx].num_workers, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Hashes of all threads so far
+ */
+size_t ChainBatch::totalHashes() {
+    size_t total = 0;
+    for (size_t t = 0; t < num_threads; t++) {
+        total += __atomic_load_n(&threads[t].hashes, __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+/**
+ * @brief Prints per-chain results and the aggregate block and hash throughput
+ *
+ * @param t_elapsed
+ */
+void ChainBatch::printReport(double t_elapsed) {
+    size_t total_blocks = 0, total_hashes = 0, total_switches = 0;
+    printf("\nBatch of %lu chains over %lf seconds:\n", num_chains, t_elapsed);
+    for (size_t i = 0; i < num_chains; i++) {
+        BatchChain *chain = &chains[i];
+        total_blocks += chain->blocks_found;
+        if (chain->done) {
+            printf("Chain: %lu\tBlocks: %lu\tFinished: %lf seconds\tTip: %s\n", i, chain->blocks_found, chain->t_done - t_begin, chain->blockchain->getPrevDigest());
+        } else {
+            printf("Chain: %lu\tBlocks: %lu\tUnfinished\tTip: %s\n", i, chain->blocks_found, chain->blockchain->getPrevDigest());
+        }
+    }
+    for (size_t t = 0; t < num_threads; t++) {
+        total_hashes += threads[t].hashes;
+        total_switches += threads[t].switches;
+    }
+    printf("Total blocks: %lu\tBlocks/s: %.2lf\tHashes: %lu\tHashrate: %.0lf H/s\tChain switches: %lu\n", total_blocks, total_blocks / t_elapsed, total_hashes, total_hashes / t_elapsed, total_switches);
+}
+
+#endif
@@ -0,0 +1,389 @@
+// Streaming chain export. Blocks are written as they are appended, as text (the Blockchain::print() layout), JSON
+// lines or a compact binary store, through one fixed output buffer. Block data is streamed in chunks, never copied as
+// a whole, so memory use does not depend on the chain length. The binary store can be re-exported by height range.
+#ifndef CHAIN_EXPORT_CPP
+#define CHAIN_EXPORT_CPP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+#define EXPORT_BUFFER (1 << 20)  // output buffer, and read chunk of a range export
+#define EXPORT_DIRECT (1 << 16)  // pieces at least this large skip the buffer and go out with writev
+#define EXPORT_RESIDENT_BLOCKS 2  // blocks kept in memory while exporting, the tip and its parent
+#define EXPORT_MAGIC "BTCCHAIN"
+#define EXPORT_MAGIC_BYTES 8
+#define EXPORT_VERSION 1
+
+enum ExportFormat { EXPORT_TEXT, EXPORT_JSONL, EXPORT_BINARY, NUM_EXPORT_FORMATS };
+const char *EXPORT_FORMAT_NAMES[NUM_EXPORT_FORMATS] = {"text", "jsonl", "bin"};
+
+/**
+ * Fixed part of a binary store record. Followed by data_len bytes of block data. Fields are host byte order.
+ */
+struct __attribute__((packed)) ExportRecord {
+    unsigned long long block_id;
+    unsigned long long threshold;
+    unsigned long long nonce;
+    unsigned char format;
+    unsigned char prev_digest[SHA256_DIGEST_LENGTH];
+    unsigned long long data_len;
+};
+
+/**
+ * Position of a record in a binary store
+ */
+struct ExportIndexEntry {
+    unsigned long long block_id;
+    off_t offset;
+};
+
+/**
+ * @brief Looks up an export format by name
+ *
+ * @param name - text, jsonl or bin
+ * @return int - ExportFormat, -1 if unknown
+ */
+int export_format_from_name(const char *name) {
+    for (int i = 0; i < NUM_EXPORT_FORMATS; i++) {
+        if (strcmp(name, EXPORT_FORMAT_NAMES[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * ChainExporter class. Writes blocks to a file or stdout in one of the export formats.
+ */
+class ChainExporter {
+   public:
+    ChainExporter();
+    ~ChainExporter();
+    int open(const char *path, int format);
+    void close();
+    void write(const Blockchain::Block *block);
+    void beginBlock(const ExportRecord &record);
+    void writeData(const char *data, size_t n);
+    void endBlock(const ExportRecord &record);
+    static void appendHook(void *arg, Blockchain::Block *block);
+
+    size_t blocks_written;
+    size_t bytes_written;
+
+   private:
+    int fd;
+    int format;
+    char *buf;
+    size_t len;
+
+    void put(const void *data, size_t n);
+    void putEscaped(const char *data, size_t n);
+    void writeAll(struct iovec *iov, int iovcnt);
+    void flush();
+};
+
+/**
+ * @brief Construct a new Chain Exporter object
+ *
+ */
+ChainExporter::ChainExporter() {
+    fd = -1;
+    format = EXPORT_TEXT;
+    buf = NULL;
+    len = 0;
+    blocks_written = bytes_written = 0;
+}
+
+/**
+ * @brief Destroy the Chain Exporter object. Flushes what is left.
+ *
+ */
+ChainExporter::~ChainExporter() { close(); }
+
+/**
+ * @brief Opens the output and writes the binary store header if needed
+ *
+ * @param path - "-" for stdout
+ * @param format - ExportFormat
+ * @return int - 0 on success, -1 if the file cannot be created
+ */
+int ChainExporter::open(const char *path, int format) {
+    this->format = format;
+    fd = (strcmp(path, "-") == 0) ? STDOUT_FILENO : ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Cannot open export file %s\n", path);
+        return -1;
+    }
+    buf = (char *)malloc(EXPORT_BUFFER);
+    len = 0;
+    if (format == EXPORT_BINARY) {
+        unsigned int version = EXPORT_VERSION;
+        put(EXPORT_MAGIC, EXPORT_MAGIC_BYTES);
+        put(&version, sizeof(version));
+    }
+    return 0;
+}
+
+/**
+ * @brief Flushes the buffer and closes the output
+ *
+ */
+void ChainExporter::close() {
+    if (fd < 0) {
+        return;
+    }
+    flush();
+    if (fd != STDOUT_FILENO) {
+        ::close(fd);
+    }
+    fd = -1;
+    free(buf);
+    buf = NULL;
+}
+
+/**
+ * @brief Writes every iovec completely, retrying partial writes
+ *
+ * @param iov - advanced in place
+ * @param iovcnt
+ */
+void ChainExporter::writeAll(struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("ERROR: export write failed: %s\n", strerror(errno));
+            return;
+        }
+        bytes_written += n;
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+void ChainExporter::flush() {
+    if (len > 0) {
+        struct iovec iov = {buf, len};
+        writeAll(&iov, 1);
+        len = 0;
+    }
+}
+
+/**
+ * @brief Appends to the buffer. A large piece goes out in the same writev as the buffered bytes instead of being
+ * copied.
+ */
+void ChainExporter::put(const void *data, size_t n) {
+    if (n >= EXPORT_DIRECT) {
+        struct iovec iov[2] = {{buf, len}, {(void *)data, n}};
+        writeAll(len > 0 ? iov : iov + 1, len > 0 ? 2 : 1);
+        len = 0;
+        return;
+    }
+    if (len + n > EXPORT_BUFFER) {
+        flush();
+    }
+    memcpy(buf + len, data, n);
+    len += n;
+}
+
+/**
+ * @brief Appends data as the inside of a JSON string. Runs without special characters go to put() unchanged
+ */
+void ChainExporter::putEscaped(const char *data, size_t n) {
+    const char *run = data;
+    for (const char *p = data; p < data + n; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c == '"' || c == '\\' || c < 0x20) {
+            put(run, p - run);
+            char esc[8];
+            int k = (c == '"' || c == '\\') ? snprintf(esc, sizeof(esc), "\\%c", c) : snprintf(esc, sizeof(esc), "\\u%04x", c);
+            put(esc, k);
+            run = p + 1;
+        }
+    }
+    put(run, data + n - run);
+}
+
+/**
+ * @brief Writes everything of a block before its data
+ *
+ * @param record - data_len must be set
+ */
+void ChainExporter::beginBlock(const ExportRecord &record) {
+    char prev_digest[2 * SHA256_DIGEST_LENGTH + 1];
+    hex_encode(record.prev_digest, SHA256_DIGEST_LENGTH, prev_digest);
+    prev_digest[2 * SHA256_DIGEST_LENGTH] = '\0';
+    char head[256];
+    int n = 0;
+    switch (format) {
+        case EXPORT_TEXT:
+            n = snprintf(head, sizeof(head), "[%llu|%s|", record.block_id, prev_digest);
+            put(head, n);
+            break;
+        case EXPORT_JSONL:
+            n = snprintf(head, sizeof(head), "{\"block_id\":%llu,\"prev_digest\":\"%s\",\"threshold\":%llu,\"nonce\":%llu,\"format\":%u,\"data\":\"", record.block_id, prev_digest, record.threshold, record.nonce, record.format);
+            put(head, n);
+            break;
+        case EXPORT_BINARY:
+            put(&record, sizeof(record));
+            break;
+    }
+}
+
+/**
+ * @brief Writes a chunk of the block data. Call any number of times between beginBlock() and endBlock().
+ */
+void ChainExporter::writeData(const char *data, size_t n) {
+    if (format == EXPORT_JSONL) {
+        putEscaped(data, n);
+    } else {
+        put(data, n);
+    }
+}
+
+/**
+ * @brief Writes everything of a block after its data
+ *
+ * @param record
+ */
+void ChainExporter::endBlock(const ExportRecord &record) {
+    char tail[128];
+    int n = 0;
+    switch (format) {
+        case EXPORT_TEXT:
+            // Same layout as Blockchain::print()
+            if (record.format == NONCE_FORMAT_ASCII) {
+                n = snprintf(tail, sizeof(tail), "|%llu|%llu]\n\n", record.threshold, record.nonce);
+            } else {
+                n = snprintf(tail, sizeof(tail), "|%llu|%llu] v%u\n\n", record.threshold, record.nonce, record.format);
+            }
+            put(tail, n);
+            break;
+        case EXPORT_JSONL:
+            put("\"}\n", 3);
+            break;
+    }
+    blocks_written++;
+}
+
+/**
+ * @brief Writes one block of the chain
+ *
+ * @param block
+ */
+void ChainExporter::write(const Blockchain::Block *block) {
+    ExportRecord record;
+    record.block_id = block->block_id;
+    record.threshold = block->threshold;
+    record.nonce = block->nonce;
+    record.format = block->format;
+    memcpy(record.prev_digest, block->prev_digest, SHA256_DIGEST_LENGTH);
+    record.data_len = strlen(block->data);
+    beginBlock(record);
+    writeData(block->data, record.data_len);
+    endBlock(record);
+}
+
+/**
+ * @brief Blockchain append hook. Exports every block as it is appended.
+ *
+ * @param arg - ChainExporter*
+ * @param block
+ */
+void ChainExporter::appendHook(void *arg, Blockchain::Block *block) { ((ChainExporter *)arg)->write(block); }
+
+/**
+ * @brief Re-exports the blocks of a binary store with from <= block_id <= to. A reorg appends the new branch after the
+ * blocks it replaces, so a record at some height supersedes every earlier record at that height or above. The first
+ * pass finds the surviving record of each height in the range, the second copies them in chunks. Memory use depends on
+ * the range, not on the block data.
+ *
+ * @param store_path - binary store written by a ChainExporter
+ * @param out
+ * @param from
+ * @param to
+ * @return int - 0 on success, -1 if the store cannot be read
+ */
+int chain_export_range(const char *store_path, ChainExporter &out, size_t from, size_t to) {
+    FILE *f = fopen(store_path, "rb");
+    if (f == NULL) {
+        printf("Cannot open chain store %s\n", store_path);
+        return -1;
+    }
+    char magic[EXPORT_MAGIC_BYTES];
+    unsigned int version = 0;
+    if (fread(magic, 1, EXPORT_MAGIC_BYTES, f) != EXPORT_MAGIC_BYTES || memcmp(magic, EXPORT_MAGIC, EXPORT_MAGIC_BYTES) != 0 || fread(&version, sizeof(version), 1, f) != 1 || version != EXPORT_VERSION) {
+        printf("%s is not a version %d chain store\n", store_path, EXPORT_VERSION);
+        fclose(f);
+        return -1;
+    }
+
+    // Records in the range that are on the chain written so far, by increasing height
+    ExportIndexEntry *chain = NULL;
+    size_t chain_len = 0, capacity = 0;
+    ExportRecord record;
+    int status = 0;
+    off_t offset = ftello(f);
+    while (fread(&record, sizeof(record), 1, f) == 1) {
+        while (chain_len > 0 && chain[chain_len - 1].block_id >= record.block_id) {
+            chain_len--;
+        }
+        if (record.block_id >= from && record.block_id <= to) {
+            if (chain_len == capacity) {
+                capacity = capacity > 0 ? 2 * capacity : 1024;
+                chain = (ExportIndexEntry *)realloc(chain, sizeof(ExportIndexEntry) * capacity);
+            }
+            chain[chain_len].block_id = record.block_id;
+            chain[chain_len].offset = offset;
+            chain_len++;
+        }
+        if (fseeko(f, record.data_len, SEEK_CUR) != 0) {
+            status = -1;
+            break;
+        }
+        offset = ftello(f);
+    }
+
+    char *chunk = (char *)malloc(EXPORT_BUFFER);
+    for (size_t i = 0; status == 0 && i < chain_len; i++) {
+        if (fseeko(f, chain[i].offset, SEEK_SET) != 0 || fread(&record, sizeof(record), 1, f) != 1) {
+            status = -1;
+            break;
+        }
+        out.beginBlock(record);
+        size_t left = record.data_len;
+        while (left > 0) {
+            size_t n = fread(chunk, 1, left < EXPORT_BUFFER ? left : EXPORT_BUFFER, f);
+            if (n == 0) {
+                break;
+            }
+            out.writeData(chunk, n);
+            left -= n;
+        }
+        out.endBlock(record);
+        if (left > 0) {
+            printf("ERROR: chain store %s is truncated in block %llu\n", store_path, record.block_id);
+            status = -1;
+        }
+    }
+    free(chunk);
+    free(chain);
+    fclose(f);
+    return status;
+}
+
+#endif
@@ -0,0 +1,306 @@
+// Checkpointed search progress. A background thread periodically collects the nonce ranges the mining threads have
+// fully hashed for the current job and writes them, together with the job's chain tip, to disk. A restarted miner
+// resumes that job and its scheduler skips the covered ranges. The mining threads only record finished batches on the
+// scheduler's refill path, so hashing itself is unchanged.
+#ifndef CHECKPOINT_CPP
+#define CHECKPOINT_CPP
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "interval_set.cpp"
+#include "trace.cpp"
+#include "utils.h"
+#include "work_stealing.cpp"
+
+#define CHECKPOINT_MAGIC "BTC_CHECKPOINT"
+#define CHECKPOINT_VERSION 1
+
+/**
+ * NonceCheckpoint class. Owns the checkpoint file of one chain mined by the local miner.
+ */
+class NonceCheckpoint {
+   public:
+    NonceCheckpoint(const char *path, double interval, Blockchain &blockchain, WorkStealingScheduler &scheduler);
+    ~NonceCheckpoint();
+    int resume(size_t &threshold);
+    void start(size_t generation, size_t threshold);
+    void stop();
+    void jobPublished(size_t generation, size_t threshold);
+    static void publishHook(void *arg, size_t generation, size_t threshold) { ((NonceCheckpoint *)arg)->jobPublished(generation, threshold); }
+    void printStats();
+
+    IntervalSet restored;  // covered nonces of the resumed job, read by the scheduler
+
+   private:
+    const char *path;
+    double interval;
+    Blockchain &blockchain;
+    WorkStealingScheduler &scheduler;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int running;
+
+    // snapshot of the job being mined, taken by the thread that changes the chain
+    size_t generation;
+    size_t threshold;
+    size_t block_id;
+    size_t block_threshold;
+    size_t nonce;
+    unsigned char nonce_format;
+    char prev_digest[2 * SHA256_DIGEST_LENGTH + 1];
+    char *data;
+    IntervalSet covered;
+
+    size_t writes;
+    double total_write_time;
+    double max_write_time;
+
+    void snapshot(size_t generation, size_t threshold);
+    void save(int final);  // not thread safe with itself, only called by the checkpoint thread and after it
+    static void *checkpointLoop(void *arg);
+};
+
+/**
+ * @brief Construct a new Nonce Checkpoint object
+ *
+ * @param path - checkpoint file, replaced atomically on every write
+ * @param interval - seconds between writes
+ * @param blockchain
+ * @param scheduler
+ */
+NonceCheckpoint::NonceCheckpoint(const char *path, double interval, Blockchain &blockchain, WorkStealingScheduler &scheduler) : blockchain(blockchain), scheduler(scheduler) {
+    this->path = path;
+    this->interval = interval;
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&wake, NULL);
+    running = 0;
+    generation = threshold = block_id = block_threshold = nonce = 0;
+    nonce_format = NONCE_FORMAT_ASCII;
+    prev_digest[0] = '\0';
+    data = NULL;
+    writes = 0;
+    total_write_time = max_write_time = 0.0;
+}
+
+/**
+ * @brief Destroy the Nonce Checkpoint object
+ *
+ */
+NonceCheckpoint::~NonceCheckpoint() {
+    free(data);
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&wake);
+}
+
+/**
+ * @brief Loads the checkpoint file, if there is one, and makes its job the chain tip
+ *
+ * @param threshold - set to the resumed job's threshold
+ * @return int - 1 if a job was resumed, 0 otherwise
+ */
+int NonceCheckpoint::resume(size_t &threshold) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+    char magic[32];
+    unsigned int version = 0, format = 0;
+    size_t id, block_thr, tip_nonce, job_thr, data_len, num_ranges;
+    char digest[2 * SHA256_DIGEST_LENGTH + 1];
+    int ok = fscanf(f, "%31s %u\n", magic, &version) == 2 && strcmp(magic, CHECKPOINT_MAGIC) == 0 && version == CHECKPOINT_VERSION;
+    ok = ok && fscanf(f, "block_id %lu\nblock_threshold %lu\nnonce %lu\nthreshold %lu\nnonce_format %u\nprev_digest %64s\ndata %lu", &id, &block_thr, &tip_nonce, &job_thr, &format, digest, &data_len) == 7;
+    ok = ok && fgetc(f) == '\n';
+    char *tip_data = ok ? (char *)malloc(data_len + 1) : NULL;
+    ok = ok && fread(tip_data, 1, data_len, f) == data_len;
+    ok = ok && fscanf(f, "\nranges %lu\n", &num_ranges) == 1;
+    for (size_t i = 0; ok && i < num_ranges; i++) {
+        size_t begin, end;
+        ok = fscanf(f, "%lu %lu\n", &begin, &end) == 2;
+        restored.add(begin, end);
+    }
+    fclose(f);
+    if (!ok) {
+        printf("Checkpoint %s is damaged, starting over\n", path);
+        free(tip_data);
+        restored.clear();
+        return 0;
+    }
+    if (format != blockchain.getNonceFormat()) {
+        printf("Checkpoint %s is for chain format v%u, starting over\n", path, format);
+        free(tip_data);
+        restored.clear();
+        return 0;
+    }
+    tip_data[data_len] = '\0';
+    // The job is fully described by its tip, so append it with its original height. The genesis block is already there
+    if (id > 0) {
+        blockchain.block_counter = id;
+        blockchain.appendBlock(digest, tip_data, block_thr, tip_nonce);
+    }
+    free(tip_data);
+    threshold = job_thr;
+    printf("Resuming block %lu from %s: %lu nonces covered in %lu ranges\n", id, path, restored.covered(), restored.count);
+    return 1;
+}
+
+/**
+ * @brief Copies the chain tip as the job being mined. Caller holds the lock and owns the chain.
+ */
+void NonceCheckpoint::snapshot(size_t generation, size_t threshold) {
+    Blockchain::Block *tip = blockchain.getCurrentBlock();
+    this->generation = generation;
+    this->threshold = threshold;
+    block_id = tip->block_id;
+    block_threshold = tip->threshold;
+    nonce = tip->nonce;
+    nonce_format = blockchain.getNonceFormat();
+    hex_encode(tip->prev_digest, SHA256_DIGEST_LENGTH, prev_digest);
+    prev_digest[2 * SHA256_DIGEST_LENGTH] = '\0';
+    free(data);
+    data = strdup(tip->data);
+    covered.clear();
+}
+
+/**
+ * @brief Starts the checkpoint thread on the first job. Ranges restored by resume() stay covered.
+ *
+ * @param generation - first job generation
+ * @param threshold
+ */
+void NonceCheckpoint::start(size_t generation, size_t threshold) {
+    snapshot(generation, threshold);
+    for (size_t i = 0; i < restored.count; i++) {
+        covered.add(restored.ranges[i].begin, restored.ranges[i].end);
+    }
+    running = 1;
+    pthread_create(&thread, NULL, checkpointLoop, this);
+}
+
+/**
+ * @brief Joins the checkpoint thread and writes the final checkpoint. Call after the mining threads have stopped.
+ *
+ */
+void NonceCheckpoint::stop() {
+    pthread_mutex_lock(&lock);
+    running = 0;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+    save(1);
+}
+
+/**
+ * @brief Switches the checkpoint to a new job. Called by the thread that appended its tip, before miners see it.
+ *
+ * @param generation
+ * @param threshold
+ */
+void NonceCheckpoint::jobPublished(size_t generation, size_t threshold) {
+    pthread_mutex_lock(&lock);
+    snapshot(generation, threshold);
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Collects the finished ranges and replaces the checkpoint file through a rename. The lock is only held to
+ * copy the job, so a new job is never held up by disk I/O.
+ *
+ * @param final - also count the partly hashed batches, the miners have stopped
+ */
+void NonceCheckpoint::save(int final) {
+    double t_start = omp_get_wtime();
+    TRACE_SCOPE("checkpoint save");
+    pthread_mutex_lock(&lock);
+    scheduler.drainCovered(generation, covered, final);
+    size_t id = block_id, block_thr = block_threshold, tip_nonce = nonce, job_thr = threshold;
+    unsigned char format = nonce_format;
+    char digest[2 * SHA256_DIGEST_LENGTH + 1];
+    memcpy(digest, prev_digest, sizeof(digest));
+    char *tip_data = strdup(data);
+    size_t num_ranges = covered.count;
+    NonceRange *ranges = (NonceRange *)malloc(sizeof(NonceRange) * (num_ranges + 1));
+    memcpy(ranges, covered.ranges, sizeof(NonceRange) * num_ranges);
+    pthread_mutex_unlock(&lock);
+
+    size_t tmp_len = strlen(path) + 5;
+    char *tmp_path = (char *)malloc(tmp_len);
+    snprintf(tmp_path, tmp_len, "%s.tmp", path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (f == NULL) {
+        printf("Cannot write checkpoint %s: %s\n", tmp_path, strerror(errno));
+    } else {
+        fprintf(f, "%s %d\n", CHECKPOINT_MAGIC, CHECKPOINT_VERSION);
+        fprintf(f, "block_id %lu\nblock_threshold %lu\nnonce %lu\nthreshold %lu\nnonce_format %u\nprev_digest %s\ndata %lu\n", id, block_thr, tip_nonce, job_thr, format, digest, strlen(tip_data));
+        fwrite(tip_data, 1, strlen(tip_data), f);
+        fprintf(f, "\nranges %lu\n", num_ranges);
+        for (size_t i = 0; i < num_ranges; i++) {
+            fprintf(f, "%lu %lu\n", ranges[i].begin, ranges[i].end);
+        }
+        // Durable before it replaces the previous checkpoint
+        fflush(f);
+        fsync(fileno(f));
+        fclose(f);
+        if (rename(tmp_path, path) != 0) {
+            printf("Cannot replace checkpoint %s: %s\n", path, strerror(errno));
+        }
+    }
+    free(tmp_path);
+    free(tip_data);
+    free(ranges);
+
+    double t_write = omp_get_wtime() - t_start;
+    writes++;
+    total_write_time += t_write;
+    if (t_write > max_write_time) {
+        max_write_time = t_write;
+    }
+}
+
+/**
+ * @brief Checkpoint thread. Writes a checkpoint every interval seconds until stopped.
+ *
+ * @param arg - NonceCheckpoint*
+ * @return void* - NULL
+ */
+void *NonceCheckpoint::checkpointLoop(void *arg) {
+    NonceCheckpoint *checkpoint = (NonceCheckpoint *)arg;
+    TRACE_THREAD("checkpoint", -1);
+    pthread_mutex_lock(&checkpoint->lock);
+    while (checkpoint->running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        double secs = checkpoint->interval;
+        deadline.tv_sec += (time_t)secs;
+        deadline.tv_nsec += (long)((secs - (time_t)secs) * 1e9);
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        int rc = 0;
+        while (checkpoint->running && rc != ETIMEDOUT) {
+            rc = pthread_cond_timedwait(&checkpoint->wake, &checkpoint->lock, &deadline);
+        }
+        if (checkpoint->running) {
+            pthread_mutex_unlock(&checkpoint->lock);
+            checkpoint->save(0);
+            pthread_mutex_lock(&checkpoint->lock);
+        }
+    }
+    pthread_mutex_unlock(&checkpoint->lock);
+    return NULL;
+}
+
+/**
+ * @brief Prints how much of the current job is covered and what the checkpoints cost
+ *
+ */
+void NonceCheckpoint::printStats() {
+    printf("\nCheckpoint %s: block %lu, %lu nonces covered in %lu ranges\tWrites: %lu\tAvg write: %.1lf us\tMax write: %.1lf us\n", path, block_id, covered.covered(), covered.count, writes, writes ? total_write_time / writes * 1e6 : 0.0, max_write_time * 1e6);
+}
+
+#endif
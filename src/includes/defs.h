@@ -12,6 +12,11 @@
 #define SIZE_T_STR_BYTES 40
 typedef unsigned int WORD;  // 4 Bytes
 
+// Chain format versions. The version decides how the nonce is written into the block preimage.
+#define NONCE_FORMAT_ASCII 0  // shortest decimal, the original format
+#define NONCE_FORMAT_FIXED 1  // zero padded to NONCE_FIXED_DIGITS so the preimage length is the same for every nonce
+#define NONCE_FIXED_DIGITS 20
+
 // * Define on target as well:
 #pragma omp declare target
 #define SHA256_DIGEST_LENGTH 32
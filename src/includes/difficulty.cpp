@@ -0,0 +1,47 @@
+// Difficulty policy of the local chain: the threshold (leading zero hex digits) each block must meet, given the one
+// the previous block met. Every backend asks the same policy, so runs with different backends mine the same sequence.
+#ifndef DIFFICULTY_CPP
+#define DIFFICULTY_CPP
+
+#include <string.h>
+
+#include "defs.h"
+
+enum DifficultyKind { DIFFICULTY_INCREMENT, DIFFICULTY_FIXED, NUM_DIFFICULTY_KINDS };
+const char *DIFFICULTY_NAMES[NUM_DIFFICULTY_KINDS] = {"increment", "fixed"};
+
+/**
+ * @brief Difficulty kind from its name
+ *
+ * @param name - increment or fixed
+ * @return int - DifficultyKind, -1 if unknown
+ */
+int difficulty_from_name(const char *name) {
+    for (int i = 0; i < NUM_DIFFICULTY_KINDS; i++) {
+        if (strcmp(name, DIFFICULTY_NAMES[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * DifficultyPolicy struct. increment: one more leading zero per block up to max_threshold. fixed: every block
+ * needs the first threshold.
+ */
+struct DifficultyPolicy {
+    int kind;              // DifficultyKind
+    size_t max_threshold;  // the increment stops here
+
+    /**
+     * @brief Threshold of the block after one that met threshold
+     */
+    size_t next(size_t threshold) const {
+        if (kind == DIFFICULTY_FIXED || threshold >= max_threshold) {
+            return threshold;
+        }
+        return threshold + 1;
+    }
+};
+
+#endif
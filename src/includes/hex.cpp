@@ -0,0 +1,224 @@
+// Hex encoding of digests. Blocks keep their digests in binary; hex is only produced where a digest enters a preimage
+// or is printed, and parsed where one comes in as text. The x86 paths convert 16 (SSSE3) or 32 (AVX2) bytes per step
+// with a shuffle table lookup and are picked at runtime, so the build needs no -march flag.
+#ifndef HEX_CPP
+#define HEX_CPP
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HEX_X86 1
+#endif
+
+#if RUN_ON_TARGET
+#pragma omp declare target
+#endif
+/**
+ * @brief Scalar encoder, also usable on the target device
+ *
+ * @param bin
+ * @param len - bytes
+ * @param hex - 2 * len lowercase characters, not null terminated
+ */
+inline void hex_encode_scalar(const unsigned char *bin, size_t len, char *hex) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned char top = bin[i] >> 4;
+        unsigned char bottom = bin[i] & 0x0f;
+        // 'a' - '0' - 10 = 39
+        hex[2 * i] = '0' + top + (top > 9) * 39;
+        hex[2 * i + 1] = '0' + bottom + (bottom > 9) * 39;
+    }
+}
+
+/**
+ * @brief Scalar decoder. Accepts upper and lower case.
+ *
+ * @param hex - 2 * len characters
+ * @param len - bytes
+ * @param bin
+ * @return int - 1 on success, 0 on a character that is not a hex digit
+ */
+inline int hex_decode_scalar(const char *hex, size_t len, unsigned char *bin) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned char nibbles[2];
+        for (int j = 0; j < 2; j++) {
+            unsigned char c = hex[2 * i + j];
+            unsigned char lower = c | 0x20;
+            if (c >= '0' && c <= '9') {
+                nibbles[j] = c - '0';
+            } else if (lower >= 'a' && lower <= 'f') {
+                nibbles[j] = lower - 'a' + 10;
+            } else {
+                return 0;
+            }
+        }
+        bin[i] = (nibbles[0] << 4) | nibbles[1];
+    }
+    return 1;
+}
+#if RUN_ON_TARGET
+#pragma omp end declare target
+#endif
+
+#ifdef HEX_X86
+/**
+ * @brief Nibble values of 16 characters, in place, and a mask of the characters that are hex digits
+ */
+__attribute__((target("ssse3"))) static inline __m128i hex_nibbles_ssse3(__m128i chars, int &valid) {
+    const __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+    const __m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), chars));
+    const __m128i is_alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+    valid &= _mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha)) == 0xFFFF;
+    const __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    const __m128i alpha = _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10));
+    return _mm_or_si128(_mm_and_si128(is_digit, digit), _mm_andnot_si128(is_digit, alpha));
+}
+
+__attribute__((target("ssse3"))) static void hex_encode_ssse3(const unsigned char *bin, size_t len, char *hex) {
+    const __m128i table = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(bin + i));
+        __m128i top = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(bytes, 4), low_mask));
+        __m128i bottom = _mm_shuffle_epi8(table, _mm_and_si128(bytes, low_mask));
+        _mm_storeu_si128((__m128i *)(hex + 2 * i), _mm_unpacklo_epi8(top, bottom));
+        _mm_storeu_si128((__m128i *)(hex + 2 * i + 16), _mm_unpackhi_epi8(top, bottom));
+    }
+    hex_encode_scalar(bin + i, len - i, hex + 2 * i);
+}
+
+__attribute__((target("ssse3"))) static int hex_decode_ssse3(const char *hex, size_t len, unsigned char *bin) {
+    // maddubs pairs the nibbles: top * 16 + bottom
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    int valid = 1;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i first = hex_nibbles_ssse3(_mm_loadu_si128((const __m128i *)(hex + 2 * i)), valid);
+        __m128i second = hex_nibbles_ssse3(_mm_loadu_si128((const __m128i *)(hex + 2 * i + 16)), valid);
+        __m128i bytes = _mm_packus_epi16(_mm_maddubs_epi16(first, weights), _mm_maddubs_epi16(second, weights));
+        _mm_storeu_si128((__m128i *)(bin + i), bytes);
+    }
+    return valid && hex_decode_scalar(hex + 2 * i, len - i, bin + i);
+}
+
+__attribute__((target("avx2"))) static inline __m256i hex_nibbles_avx2(__m256i chars, int &valid) {
+    const __m256i lower = _mm256_or_si256(chars, _mm256_set1_epi8(0x20));
+    const __m256i is_digit = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), chars));
+    const __m256i is_alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+    valid &= _mm256_movemask_epi8(_mm256_or_si256(is_digit, is_alpha)) == -1;
+    const __m256i digit = _mm256_sub_epi8(chars, _mm256_set1_epi8('0'));
+    const __m256i alpha = _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10));
+    return _mm256_blendv_epi8(alpha, digit, is_digit);
+}
+
+__attribute__((target("avx2"))) static void hex_encode_avx2(const unsigned char *bin, size_t len, char *hex) {
+    const __m256i table = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+                                           '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(bin + i));
+        __m256i top = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), low_mask));
+        __m256i bottom = _mm256_shuffle_epi8(table, _mm256_and_si256(bytes, low_mask));
+        // unpack works per 128 bit lane: lo holds bytes 0-7 and 16-23, hi holds 8-15 and 24-31
+        __m256i lo = _mm256_unpacklo_epi8(top, bottom);
+        __m256i hi = _mm256_unpackhi_epi8(top, bottom);
+        _mm256_storeu_si256((__m256i *)(hex + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(hex + 2 * i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    hex_encode_ssse3(bin + i, len - i, hex + 2 * i);
+}
+
+__attribute__((target("avx2"))) static int hex_decode_avx2(const char *hex, size_t len, unsigned char *bin) {
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    int valid = 1;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i first = hex_nibbles_avx2(_mm256_loadu_si256((const __m256i *)(hex + 2 * i)), valid);
+        __m256i second = hex_nibbles_avx2(_mm256_loadu_si256((const __m256i *)(hex + 2 * i + 32)), valid);
+        // pack works per lane too: 64 bit quarters come out as first.0, second.0, first.1, second.1
+        __m256i bytes = _mm256_packus_epi16(_mm256_maddubs_epi16(first, weights), _mm256_maddubs_epi16(second, weights));
+        _mm256_storeu_si256((__m256i *)(bin + i), _mm256_permute4x64_epi64(bytes, 0xD8));
+    }
+    return valid && hex_decode_ssse3(hex + 2 * i, len - i, bin + i);
+}
+#endif
+
+enum HexLevel { HEX_UNRESOLVED, HEX_SCALAR, HEX_SSSE3, HEX_AVX2 };
+static int hex_level = HEX_UNRESOLVED;
+
+/**
+ * @brief Picks the widest instruction set the CPU supports, once
+ *
+ * @return int - HexLevel
+ */
+static inline int hex_resolve_level() {
+    int level = __atomic_load_n(&hex_level, __ATOMIC_RELAXED);
+    if (level == HEX_UNRESOLVED) {
+        level = HEX_SCALAR;
+#ifdef HEX_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            level = HEX_AVX2;
+        } else if (__builtin_cpu_supports("ssse3")) {
+            level = HEX_SSSE3;
+        }
+#endif
+        __atomic_store_n(&hex_level, level, __ATOMIC_RELAXED);
+    }
+    return level;
+}
+
+/**
+ * @brief Writes 2 * len lowercase hex characters, not null terminated
+ *
+ * @param bin
+ * @param len - bytes
+ * @param hex
+ */
+void hex_encode(const unsigned char *bin, size_t len, char *hex) {
+#ifdef HEX_X86
+    switch (hex_resolve_level()) {
+        case HEX_AVX2: hex_encode_avx2(bin, len, hex); return;
+        case HEX_SSSE3: hex_encode_ssse3(bin, len, hex); return;
+    }
+#endif
+    hex_encode_scalar(bin, len, hex);
+}
+
+/**
+ * @brief Parses 2 * len hex characters of either case
+ *
+ * @param hex
+ * @param len - bytes to write
+ * @param bin
+ * @return int - 1 on success, 0 if a character is not a hex digit
+ */
+int hex_decode(const char *hex, size_t len, unsigned char *bin) {
+#ifdef HEX_X86
+    switch (hex_resolve_level()) {
+        case HEX_AVX2: return hex_decode_avx2(hex, len, bin);
+        case HEX_SSSE3: return hex_decode_ssse3(hex, len, bin);
+    }
+#endif
+    return hex_decode_scalar(hex, len, bin);
+}
+
+/**
+ * @brief Null terminated hex string of a binary buffer
+ *
+ * @param bin
+ * @param len - bytes
+ * @return char* - 2 * len + 1 bytes, free() after use
+ */
+char *hex_string(const unsigned char *bin, size_t len) {
+    char *hex = (char *)malloc(2 * len + 1);
+    hex_encode(bin, len, hex);
+    hex[2 * len] = '\0';
+    return hex;
+}
+
+#endif
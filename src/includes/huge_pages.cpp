@@ -0,0 +1,293 @@
+// Huge page backed memory for the hot per-thread and chain structures. A region is tried as explicit 2MB pages
+// (hugetlbfs, needs vm.nr_hugepages), then as transparent huge pages advised with madvise, then as plain 4K pages, so
+// it always succeeds where mmap does. Regions can be bound to a NUMA node and are touched on allocation, so placement
+// and backing are settled before the hot loop. The page type each use actually got is recorded for the run report and
+// telemetry; transparent huge pages are only counted once the kernel shows them in /proc/self/smaps.
+#ifndef HUGE_PAGES_CPP
+#define HUGE_PAGES_CPP
+
+#include <linux/mempolicy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << 26)  // MAP_HUGE_SHIFT 26, log2 of 2MB
+#endif
+
+#define HUGE_PAGE_BYTES (2UL << 20)
+#define HUGE_MAX_USES 16
+#define HUGE_MAX_NODE_BITS 1024
+
+enum PageKind { PAGES_4K, PAGES_TRANSPARENT, PAGES_EXPLICIT, NUM_PAGE_KINDS };
+const char *PAGE_KIND_NAMES[NUM_PAGE_KINDS] = {"4K", "transparent 2M", "explicit 2M"};
+
+/**
+ * Regions of one use (scratch, chain, ...) by the page type they got
+ */
+struct HugeUsage {
+    const char *use;  // string literal
+    size_t regions[NUM_PAGE_KINDS];
+    size_t bytes[NUM_PAGE_KINDS];
+};
+
+static int huge_pages_enabled = 1;  // 0 keeps every region on 4K pages, for comparisons
+static HugeUsage huge_usage[HUGE_MAX_USES];
+static size_t huge_num_uses = 0;
+
+/**
+ * @brief Turns huge pages on or off for regions allocated from now on
+ */
+void huge_pages_set_enabled(int enabled) { huge_pages_enabled = enabled; }
+
+/**
+ * @brief Bytes mapped for a region: whole huge pages whatever the page type, untouched 4K pages cost nothing
+ */
+inline size_t huge_region_bytes(size_t bytes) { return (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES; }
+
+/**
+ * @brief Whether the mapping containing addr is backed by transparent huge pages, from /proc/self/smaps
+ */
+static int huge_thp_backed(void *addr) {
+    FILE *f = fopen("/proc/self/smaps", "r");
+    if (f == NULL) {
+        return 0;
+    }
+    char line[256];
+    int inside = 0;
+    int backed = 0;
+    const unsigned long target = (unsigned long)addr;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        unsigned long start, end;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2 && strchr(line, '-') == line + strspn(line, "0123456789abcdef")) {
+            if (inside) {
+                break;
+            }
+            inside = start <= target && target < end;
+        } else if (inside) {
+            unsigned long kb;
+            if (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+                backed = kb > 0;
+                break;
+            }
+        }
+    }
+    fclose(f);
+    return backed;
+}
+
+static void huge_record(const char *use, int kind, size_t bytes) {
+#pragma omp critical(huge_pages)
+    {
+        size_t i = 0;
+        while (i < huge_num_uses && strcmp(huge_usage[i].use, use) != 0) {
+            i++;
+        }
+        if (i == huge_num_uses && huge_num_uses < HUGE_MAX_USES) {
+            memset(&huge_usage[i], 0, sizeof(HugeUsage));
+            huge_usage[i].use = use;
+            huge_num_uses++;
+        }
+        if (i < huge_num_uses) {
+            huge_usage[i].regions[kind]++;
+            huge_usage[i].bytes[kind] += bytes;
+        }
+    }
+}
+
+/**
+ * @brief Maps a zeroed region, on huge pages where the system has them
+ *
+ * @param bytes - mapped rounded up to whole huge pages
+ * @param node - NUMA node to place the pages on, -1 for the default policy
+ * @param use - string literal naming the region in the report
+ * @return void* - aligned to its page size, NULL if even 4K pages cannot be mapped. Release with huge_free().
+ */
+void *huge_alloc(size_t bytes, int node, const char *use) {
+    const size_t size = huge_region_bytes(bytes);
+    void *mem = MAP_FAILED;
+    int kind = PAGES_4K;
+    if (huge_pages_enabled) {
+        mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+        kind = PAGES_EXPLICIT;
+    }
+    if (mem == MAP_FAILED && huge_pages_enabled) {
+        // Over-map by a page to cut out a 2MB aligned range, the only kind THP can back
+        unsigned char *raw = (unsigned char *)mmap(NULL, size + HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw != MAP_FAILED) {
+            unsigned char *aligned = (unsigned char *)(((unsigned long)raw + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1));
+            if (aligned > raw) {
+                munmap(raw, aligned - raw);
+            }
+            munmap(aligned + size, raw + HUGE_PAGE_BYTES - aligned);
+            mem = aligned;
+            kind = madvise(mem, size, MADV_HUGEPAGE) == 0 ? PAGES_TRANSPARENT : PAGES_4K;
+        }
+    }
+    if (mem == MAP_FAILED) {
+        mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        kind = PAGES_4K;
+        if (mem == MAP_FAILED) {
+            return NULL;
+        }
+    }
+    if (node >= 0 && node < HUGE_MAX_NODE_BITS) {
+        // Preferred, not bound: a full node still falls back to another one instead of failing the fault
+        unsigned long mask[HUGE_MAX_NODE_BITS / (8 * sizeof(unsigned long))];
+        memset(mask, 0, sizeof(mask));
+        mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+        syscall(SYS_mbind, mem, size, MPOL_PREFERRED, mask, HUGE_MAX_NODE_BITS, 0);
+    }
+    // First touch places and backs the pages now rather than in the hot loop
+    memset(mem, 0, bytes);
+    if (kind == PAGES_TRANSPARENT && !huge_thp_backed(mem)) {
+        kind = PAGES_4K;
+    }
+    huge_record(use, kind, size);
+    return mem;
+}
+
+/**
+ * @brief Unmaps a region from huge_alloc()
+ *
+ * @param mem
+ * @param bytes - as passed to huge_alloc()
+ */
+void huge_free(void *mem, size_t bytes) {
+    if (mem != NULL) {
+        munmap(mem, huge_region_bytes(bytes));
+    }
+}
+
+/**
+ * @brief Prints the page type every use got
+ *
+ */
+void huge_pages_report() {
+    printf("\nMemory pages:");
+    if (huge_num_uses == 0) {
+        printf(" none recorded");
+    }
+    for (size_t i = 0; i < huge_num_uses; i++) {
+        printf("%s %s:", i > 0 ? "," : "", huge_usage[i].use);
+        for (int k = 0; k < NUM_PAGE_KINDS; k++) {
+            if (huge_usage[i].regions[k] > 0) {
+                printf(" %lu x %s (%.1lf MB)", huge_usage[i].regions[k], PAGE_KIND_NAMES[k], huge_usage[i].bytes[k] / 1048576.0);
+            }
+        }
+    }
+    printf("\n");
+}
+
+/**
+ * @brief Writes the page types as one JSON line, e.g. for the telemetry log
+ *
+ * @param f
+ */
+void huge_pages_json(FILE *f) {
+    fprintf(f, "{\"memory\":[");
+    const char *separator = "";
+    for (size_t i = 0; i < huge_num_uses; i++) {
+        for (int k = 0; k < NUM_PAGE_KINDS; k++) {
+            if (huge_usage[i].regions[k] > 0) {
+                fprintf(f, "%s{\"use\":\"%s\",\"pages\":\"%s\",\"regions\":%lu,\"bytes\":%lu}", separator, huge_usage[i].use, PAGE_KIND_NAMES[k], huge_usage[i].regions[k], huge_usage[i].bytes[k]);
+                separator = ",";
+            }
+        }
+    }
+    fprintf(f, "],\"huge_pages\":%s}\n", huge_pages_enabled ? "true" : "false");
+}
+
+/**
+ * HugeSlab class. Fixed size objects carved from huge page regions, with a free list, so many small long-lived objects
+ * share a few TLB entries instead of being spread over the malloc heap.
+ */
+class HugeSlab {
+   public:
+    HugeSlab(size_t object_bytes, const char *use);
+    ~HugeSlab();
+    void *take();
+    void give(void *object);
+
+   private:
+    size_t object_bytes;
+    const char *use;
+    void *free_list;  // freed objects, linked through their first word
+    unsigned char *next;
+    unsigned char *end;
+    void **regions;
+    size_t num_regions;
+    size_t regions_cap;
+};
+
+/**
+ * @brief Construct a new Huge Slab object. Nothing is mapped until the first take().
+ *
+ * @param object_bytes - rounded up to pointer alignment
+ * @param use - string literal for the report
+ */
+HugeSlab::HugeSlab(size_t object_bytes, const char *use) {
+    this->object_bytes = (object_bytes + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+    this->use = use;
+    free_list = NULL;
+    next = end = NULL;
+    regions = NULL;
+    num_regions = regions_cap = 0;
+}
+
+/**
+ * @brief Destroy the Huge Slab object and every object in it. Safe to run twice, like the owners' destructors.
+ *
+ */
+HugeSlab::~HugeSlab() {
+    for (size_t i = 0; i < num_regions; i++) {
+        huge_free(regions[i], HUGE_PAGE_BYTES);
+    }
+    free(regions);
+    regions = NULL;
+    num_regions = regions_cap = 0;
+    free_list = NULL;
+    next = end = NULL;
+}
+
+/**
+ * @brief Takes an object, zeroed only if it is new
+ *
+ * @return void* - NULL if no region can be mapped
+ */
+void *HugeSlab::take() {
+    if (free_list != NULL) {
+        void *object = free_list;
+        free_list = *(void **)object;
+        return object;
+    }
+    if (next == NULL || next + object_bytes > end) {
+        unsigned char *region = (unsigned char *)huge_alloc(HUGE_PAGE_BYTES, -1, use);
+        if (region == NULL) {
+            return NULL;
+        }
+        if (num_regions == regions_cap) {
+            regions_cap = regions_cap ? 2 * regions_cap : 8;
+            regions = (void **)realloc(regions, sizeof(void *) * regions_cap);
+        }
+        regions[num_regions++] = region;
+        next = region;
+        end = region + huge_region_bytes(HUGE_PAGE_BYTES);
+    }
+    void *object = next;
+    next += object_bytes;
+    return object;
+}
+
+/**
+ * @brief Returns an object from take()
+ */
+void HugeSlab::give(void *object) {
+    *(void **)object = free_list;
+    free_list = object;
+}
+
+#endif
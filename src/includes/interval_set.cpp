@@ -0,0 +1,145 @@
+// Sorted set of disjoint nonce intervals. Tracks which nonces of a job were searched already.
+#ifndef INTERVAL_SET_CPP
+#define INTERVAL_SET_CPP
+
+#include "utils.h"
+
+#define INTERVAL_SET_INIT 64
+
+struct NonceRange {
+    size_t begin;
+    size_t end;  // exclusive
+};
+
+/**
+ * IntervalSet class. Intervals are kept sorted, disjoint and non-adjacent, so touching ranges merge into one.
+ */
+class IntervalSet {
+   public:
+    IntervalSet();
+    ~IntervalSet();
+    void add(size_t begin, size_t end);
+    void clear() { count = 0; }
+    size_t uncovered(const NonceRange &range, NonceRange *out, size_t max) const;
+    size_t covered() const;
+
+    size_t count;
+    NonceRange *ranges;
+
+   private:
+    size_t cap;
+    size_t firstEndingAfter(size_t nonce) const;
+};
+
+/**
+ * @brief Construct a new Interval Set object
+ *
+ */
+IntervalSet::IntervalSet() {
+    count = 0;
+    cap = INTERVAL_SET_INIT;
+    ranges = (NonceRange *)malloc(sizeof(NonceRange) * cap);
+}
+
+/**
+ * @brief Destroy the Interval Set object
+ *
+ */
+IntervalSet::~IntervalSet() { free(ranges); }
+
+/**
+ * @brief Index of the first interval whose end is past nonce, count if none
+ */
+size_t IntervalSet::firstEndingAfter(size_t nonce) const {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (ranges[mid].end <= nonce) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief Adds [begin, end), merging it with every interval it overlaps or touches
+ *
+ * @param begin
+ * @param end - exclusive
+ */
+void IntervalSet::add(size_t begin, size_t end) {
+    if (begin >= end) {
+        return;
+    }
+    // first interval that could merge: ends at or after begin
+    size_t first = firstEndingAfter(begin > 0 ? begin - 1 : 0);
+    size_t last = first;
+    while (last < count && ranges[last].begin <= end) {
+        if (ranges[last].begin < begin) {
+            begin = ranges[last].begin;
+        }
+        if (ranges[last].end > end) {
+            end = ranges[last].end;
+        }
+        last++;
+    }
+    if (last == first) {
+        // nothing merged, insert
+        if (count == cap) {
+            cap *= 2;
+            ranges = (NonceRange *)realloc(ranges, sizeof(NonceRange) * cap);
+        }
+        memmove(&ranges[first + 1], &ranges[first], sizeof(NonceRange) * (count - first));
+        count++;
+    } else {
+        // intervals first..last-1 collapse into first
+        memmove(&ranges[first + 1], &ranges[last], sizeof(NonceRange) * (count - last));
+        count -= last - first - 1;
+    }
+    ranges[first].begin = begin;
+    ranges[first].end = end;
+}
+
+/**
+ * @brief Splits range into the pieces not covered by the set
+ *
+ * @param range
+ * @param out - uncovered pieces in order
+ * @param max - capacity of out. Pieces beyond it are left out
+ * @return size_t - number of pieces
+ */
+size_t IntervalSet::uncovered(const NonceRange &range, NonceRange *out, size_t max) const {
+    size_t n = 0;
+    size_t at = range.begin;
+    for (size_t i = firstEndingAfter(range.begin); i < count && ranges[i].begin < range.end && at < range.end; i++) {
+        if (ranges[i].begin > at && n < max) {
+            out[n].begin = at;
+            out[n].end = ranges[i].begin;
+            n++;
+        }
+        at = ranges[i].end;
+    }
+    if (at < range.end && n < max) {
+        out[n].begin = at;
+        out[n].end = range.end;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @brief Total number of nonces in the set
+ *
+ * @return size_t
+ */
+size_t IntervalSet::covered() const {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += ranges[i].end - ranges[i].begin;
+    }
+    return total;
+}
+
+#endif
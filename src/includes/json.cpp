@@ -0,0 +1,318 @@
+// Minimal JSON reader/writer for the newline-delimited Stratum messages exchanged between miners and the pool.
+#ifndef JSON_CPP
+#define JSON_CPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum JsonType { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+/**
+ * JSON value tree. Numbers are kept as their source text so 64-bit nonces survive without going through a double.
+ */
+struct JsonValue {
+    JsonType type;
+    char *key;    // member name when the value lives inside an object, NULL otherwise
+    char *text;   // string contents or number text
+    int boolean;  // value of a JSON_BOOL
+    size_t num_children;
+    JsonValue *children;
+};
+
+static const char *json_skip_ws(const char *s) {
+    while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n') {
+        s++;
+    }
+    return s;
+}
+
+static const char *json_parse_value(const char *s, JsonValue *out);
+
+/**
+ * @brief Parses a quoted JSON string starting at s. Handles the simple escapes and \u00XX.
+ *
+ * @param s
+ * @param out - malloc'd unescaped string
+ * @return const char* - position after the closing quote, NULL on error
+ */
+static const char *json_parse_string(const char *s, char **out) {
+    if (*s != '"') {
+        return NULL;
+    }
+    s++;
+    size_t cap = 16, len = 0;
+    char *buf = (char *)malloc(cap);
+    while (*s && *s != '"') {
+        char c = *s++;
+        if (c == '\\') {
+            c = *s++;
+            switch (c) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'u': {
+                    unsigned int code = 0;
+                    for (int i = 0; i < 4; i++) {
+                        char h = *s++;
+                        code <<= 4;
+                        if (h >= '0' && h <= '9') code |= h - '0';
+                        else if (h >= 'a' && h <= 'f') code |= h - 'a' + 10;
+                        else if (h >= 'A' && h <= 'F') code |= h - 'A' + 10;
+                        else {
+                            free(buf);
+                            return NULL;
+                        }
+                    }
+                    c = (char)(code & 0xff);
+                    break;
+                }
+                case '\0':
+                    free(buf);
+                    return NULL;
+                default: break;  // '"', '\\' and '/' map to themselves
+            }
+        }
+        if (len + 1 >= cap) {
+            cap *= 2;
+            buf = (char *)realloc(buf, cap);
+        }
+        buf[len++] = c;
+    }
+    if (*s != '"') {
+        free(buf);
+        return NULL;
+    }
+    buf[len] = '\0';
+    *out = buf;
+    return s + 1;
+}
+
+static void json_push_child(JsonValue *parent, JsonValue *child) {
+    parent->children = (JsonValue *)realloc(parent->children, sizeof(JsonValue) * (parent->num_children + 1));
+    parent->children[parent->num_children++] = *child;
+}
+
+static const char *json_parse_value(const char *s, JsonValue *out) {
+    memset(out, 0, sizeof(JsonValue));
+    s = json_skip_ws(s);
+    if (*s == '{' || *s == '[') {
+        const char close = (*s == '{') ? '}' : ']';
+        out->type = (*s == '{') ? JSON_OBJECT : JSON_ARRAY;
+        s = json_skip_ws(s + 1);
+        if (*s == close) {
+            return s + 1;
+        }
+        while (1) {
+            JsonValue child;
+            char *key = NULL;
+            if (out->type == JSON_OBJECT) {
+                s = json_parse_string(json_skip_ws(s), &key);
+                if (s == NULL) {
+                    return NULL;
+                }
+                s = json_skip_ws(s);
+                if (*s != ':') {
+                    free(key);
+                    return NULL;
+                }
+                s++;
+            }
+            s = json_parse_value(s, &child);
+            if (s == NULL) {
+                free(key);
+                return NULL;
+            }
+            child.key = key;
+            json_push_child(out, &child);
+            s = json_skip_ws(s);
+            if (*s == ',') {
+                s++;
+            } else if (*s == close) {
+                return s + 1;
+            } else {
+                return NULL;
+            }
+        }
+    } else if (*s == '"') {
+        out->type = JSON_STRING;
+        return json_parse_string(s, &out->text);
+    } else if (strncmp(s, "true", 4) == 0) {
+        out->type = JSON_BOOL;
+        out->boolean = 1;
+        return s + 4;
+    } else if (strncmp(s, "false", 5) == 0) {
+        out->type = JSON_BOOL;
+        return s + 5;
+    } else if (strncmp(s, "null", 4) == 0) {
+        out->type = JSON_NULL;
+        return s + 4;
+    } else if (*s == '-' || (*s >= '0' && *s <= '9')) {
+        const char *start = s;
+        s++;
+        while ((*s >= '0' && *s <= '9') || *s == '.' || *s == 'e' || *s == 'E' || *s == '+' || *s == '-') {
+            s++;
+        }
+        out->type = JSON_NUMBER;
+        out->text = (char *)calloc(s - start + 1, sizeof(char));
+        memcpy(out->text, start, s - start);
+        return s;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Frees the contents of a JSON value (not the value itself)
+ *
+ * @param value
+ */
+void json_clear(JsonValue *value) {
+    for (size_t i = 0; i < value->num_children; i++) {
+        json_clear(&value->children[i]);
+    }
+    free(value->children);
+    free(value->key);
+    free(value->text);
+    memset(value, 0, sizeof(JsonValue));
+}
+
+/**
+ * @brief Parses a complete JSON document
+ *
+ * @param str
+ * @return JsonValue* - heap allocated tree (release with json_free), NULL on malformed input
+ */
+JsonValue *json_parse(const char *str) {
+    JsonValue *root = (JsonValue *)malloc(sizeof(JsonValue));
+    const char *end = json_parse_value(str, root);
+    if (end == NULL || *json_skip_ws(end) != '\0') {
+        json_clear(root);
+        free(root);
+        return NULL;
+    }
+    return root;
+}
+
+void json_free(JsonValue *value) {
+    if (value != NULL) {
+        json_clear(value);
+        free(value);
+    }
+}
+
+/**
+ * @brief Looks up a member of an object
+ *
+ * @param object
+ * @param key
+ * @return JsonValue* - NULL if object is not an object or the key is missing
+ */
+JsonValue *json_get(JsonValue *object, const char *key) {
+    if (object == NULL || object->type != JSON_OBJECT) {
+        return NULL;
+    }
+    for (size_t i = 0; i < object->num_children; i++) {
+        if (strcmp(object->children[i].key, key) == 0) {
+            return &object->children[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Returns the element at index of an array, NULL when out of range
+ */
+JsonValue *json_at(JsonValue *array, size_t index) {
+    if (array == NULL || array->type != JSON_ARRAY || index >= array->num_children) {
+        return NULL;
+    }
+    return &array->children[index];
+}
+
+const char *json_string(JsonValue *value) {
+    return (value != NULL && value->type == JSON_STRING) ? value->text : NULL;
+}
+
+size_t json_size_t(JsonValue *value) {
+    if (value == NULL || (value->type != JSON_NUMBER && value->type != JSON_STRING)) {
+        return 0;
+    }
+    return strtoull(value->text, NULL, 10);
+}
+
+double json_double(JsonValue *value) {
+    if (value == NULL || value->type != JSON_NUMBER) {
+        return 0.0;
+    }
+    return strtod(value->text, NULL);
+}
+
+int json_true(JsonValue *value) {
+    return (value != NULL && value->type == JSON_BOOL && value->boolean);
+}
+
+/**
+ * Growable output buffer used to build outgoing messages.
+ */
+struct JsonWriter {
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+void json_writer_init(JsonWriter *w) {
+    w->cap = 256;
+    w->len = 0;
+    w->buf = (char *)malloc(w->cap);
+    w->buf[0] = '\0';
+}
+
+void json_writer_free(JsonWriter *w) {
+    free(w->buf);
+    w->buf = NULL;
+    w->len = w->cap = 0;
+}
+
+void json_write_raw(JsonWriter *w, const char *str, size_t n) {
+    if (w->len + n + 1 > w->cap) {
+        while (w->len + n + 1 > w->cap) {
+            w->cap *= 2;
+        }
+        w->buf = (char *)realloc(w->buf, w->cap);
+    }
+    memcpy(w->buf + w->len, str, n);
+    w->len += n;
+    w->buf[w->len] = '\0';
+}
+
+void json_write(JsonWriter *w, const char *str) { json_write_raw(w, str, strlen(str)); }
+
+void json_write_size_t(JsonWriter *w, size_t num) {
+    char tmp[32];
+    int n = snprintf(tmp, sizeof(tmp), "%lu", num);
+    json_write_raw(w, tmp, n);
+}
+
+/**
+ * @brief Appends str as a quoted, escaped JSON string
+ */
+void json_write_string(JsonWriter *w, const char *str) {
+    json_write_raw(w, "\"", 1);
+    const char *run = str;
+    for (const char *p = str; *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c == '"' || c == '\\' || c < 0x20) {
+            json_write_raw(w, run, p - run);
+            char esc[8];
+            int n = (c == '"' || c == '\\') ? snprintf(esc, sizeof(esc), "\\%c", c) : snprintf(esc, sizeof(esc), "\\u%04x", c);
+            json_write_raw(w, esc, n);
+            run = p + 1;
+        }
+    }
+    json_write_raw(w, run, strlen(run));
+    json_write_raw(w, "\"", 1);
+}
+
+#endif
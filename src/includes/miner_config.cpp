@@ -0,0 +1,417 @@
+// Run configuration of the miner. Every setting has one long option name, used on the command line and as the key of a
+// config file line ("name = value", # starts a comment), so a config file can describe any run a command line can.
+// Options apply in order: settings given after --config override the file.
+#ifndef MINER_CONFIG_CPP
+#define MINER_CONFIG_CPP
+
+#include <getopt.h>
+
+#include "autotune.cpp"
+#include "chain_export.cpp"
+#include "difficulty.cpp"
+#include "nonce_hasher.cpp"
+#include "teams_kernel.cpp"
+#include "utils.h"
+
+#define CONFIG_LINE_BYTES 1024
+
+enum MinerBackend { BACKEND_SERIAL, BACKEND_THREADS, BACKEND_PROCESSES, BACKEND_TEAMS, NUM_MINER_BACKENDS };
+const char *MINER_BACKEND_NAMES[NUM_MINER_BACKENDS] = {"serial", "threads", "processes", "teams"};
+
+/**
+ * Everything a run needs. Strings point into argv or into copies made by the config file reader.
+ */
+struct MinerConfig {
+    // engine
+    int backend;               // MinerBackend
+    size_t threads;            // mining threads, 0: tuned or all cores but 2
+    int hasher;                // HasherBackend of the threads backend, -1: tuned
+    size_t validations;        // recomputations of a found digest (serial and teams backends)
+    // chain
+    const char *genesis_data;
+    size_t start_threshold;    // leading zeros of the first mined block
+    DifficultyPolicy difficulty;
+    unsigned char nonce_format;
+    // budget
+    double time_limit;         // seconds of mining, 0: until interrupted
+    size_t max_blocks;         // mined blocks, 0: no limit
+    size_t max_hashes;         // hashes, 0: no limit
+    // pool and shares
+    char *pool_url;
+    const char *worker;
+    size_t share_threshold;
+    const char *share_log;
+    // processes and batch modes
+    size_t num_processes;
+    size_t num_chains;
+    size_t blocks_per_chain;
+    // validation
+    size_t num_verifiers;
+    size_t quorum;
+    int mixed_backends;
+    // output sinks
+    const char *export_path;
+    int export_format;
+    const char *import_path;
+    size_t export_from;
+    size_t export_to;
+    const char *checkpoint_path;
+    double checkpoint_interval;
+    const char *telemetry_path;
+    const char *summary_path;
+    const char *trace_path;
+    int use_perf;
+    // tuning and memory
+    int tune;
+    int force_tune;
+    double tune_time;
+    const char *tune_profile;
+    int huge_pages;
+    // teams backend
+    int teams_backend;         // TeamsBackend
+    int num_teams;             // 0: TeamsEngine default
+    int threads_per_team;
+    size_t tile_size;
+    size_t tiles_per_team;
+};
+
+enum MinerOptionId {
+    OPT_CONFIG = 256, OPT_BACKEND, OPT_THREADS, OPT_HASHER, OPT_VALIDATIONS, OPT_GENESIS_DATA, OPT_START_THRESHOLD,
+    OPT_DIFFICULTY, OPT_MAX_THRESHOLD, OPT_FIXED_NONCES, OPT_TIME_LIMIT, OPT_BLOCKS, OPT_HASHES, OPT_POOL, OPT_WORKER,
+    OPT_SHARE_THRESHOLD, OPT_SHARE_LOG, OPT_PROCESSES, OPT_CHAINS, OPT_BLOCKS_PER_CHAIN, OPT_VERIFIERS, OPT_QUORUM,
+    OPT_MIXED_VERIFIERS, OPT_EXPORT, OPT_EXPORT_FORMAT, OPT_IMPORT, OPT_FROM, OPT_TO, OPT_CHECKPOINT,
+    OPT_CHECKPOINT_INTERVAL, OPT_TELEMETRY, OPT_SUMMARY, OPT_TRACE, OPT_PERF, OPT_TUNE, OPT_NO_TUNE, OPT_TUNE_TIME,
+    OPT_TUNE_PROFILE, OPT_NO_HUGE_PAGES, OPT_TEAMS_BACKEND, OPT_TEAMS, OPT_TEAM_THREADS, OPT_TILE_SIZE, OPT_TILES_PER_TEAM, OPT_HELP
+};
+
+/**
+ * One setting: its option and config file name, short option if any, and usage line
+ */
+struct MinerOption {
+    int id;  // MinerOptionId
+    const char *name;
+    int has_arg;
+    char short_name;
+    const char *arg;
+    const char *help;
+};
+
+const MinerOption MINER_OPTIONS[] = {
+    {OPT_CONFIG, "config", required_argument, 0, "path", "read options from a config file"},
+    {OPT_BACKEND, "backend", required_argument, 0, "serial|threads|processes|teams", "execution backend (default: threads)"},
+    {OPT_THREADS, "threads", required_argument, 0, "n", "mining threads (default: tuned, else all cores but 2)"},
+    {OPT_HASHER, "hasher", required_argument, 0, "midstate|openssl|teams", "nonce hasher of the threads backend (default: tuned)"},
+    {OPT_VALIDATIONS, "validations", required_argument, 0, "n", "recomputations of a found digest, serial and teams backends (default: 1)"},
+    {OPT_GENESIS_DATA, "genesis-data", required_argument, 0, "string", "data of the genesis block"},
+    {OPT_START_THRESHOLD, "start-threshold", required_argument, 0, "n", "leading zeros of the first mined block (default: 1)"},
+    {OPT_DIFFICULTY, "difficulty", required_argument, 0, "increment|fixed", "threshold of the following blocks (default: increment)"},
+    {OPT_MAX_THRESHOLD, "max-threshold", required_argument, 0, "n", "where the increment stops"},
+    {OPT_FIXED_NONCES, "fixed-nonces", no_argument, 'f', NULL, "fixed width nonces (chain format v1)"},
+    {OPT_TIME_LIMIT, "time-limit", required_argument, 0, "s", "stop after s seconds of mining, then drain"},
+    {OPT_BLOCKS, "blocks", required_argument, 0, "n", "stop after n mined blocks"},
+    {OPT_HASHES, "hashes", required_argument, 0, "n", "stop after n hashes"},
+    {OPT_POOL, "pool", required_argument, 'o', "host:port", "mine jobs from a Stratum pool (threads backend)"},
+    {OPT_WORKER, "worker", required_argument, 'u', "name", "worker name at the pool"},
+    {OPT_SHARE_THRESHOLD, "share-threshold", required_argument, 'd', "n", "leading zeros of a share (default: 4)"},
+    {OPT_SHARE_LOG, "share-log", required_argument, 'S', "path", "CSV log of the shares found"},
+    {OPT_PROCESSES, "processes", required_argument, 'P', "n", "worker processes, selects the processes backend"},
+    {OPT_CHAINS, "chains", required_argument, 'B', "n", "mine a batch of independent chains (threads backend)"},
+    {OPT_BLOCKS_PER_CHAIN, "blocks-per-chain", required_argument, 'b', "n", "blocks of each chain in the batch (default: 5)"},
+    {OPT_VERIFIERS, "verifiers", required_argument, 'V', "n", "quorum validation of found blocks by n verifiers"},
+    {OPT_QUORUM, "quorum", required_argument, 'Q', "n", "verifiers that must accept (default: all)"},
+    {OPT_MIXED_VERIFIERS, "mixed-verifiers", no_argument, 'M', NULL, "mix the OpenSSL and scalar hashers among the verifiers"},
+    {OPT_EXPORT, "export", required_argument, 0, "path", "stream every appended block to path"},
+    {OPT_EXPORT_FORMAT, "export-format", required_argument, 0, "text|jsonl|bin", "format of the export (default: text)"},
+    {OPT_IMPORT, "import", required_argument, 0, "store.bin", "re-export a binary store by height instead of mining"},
+    {OPT_FROM, "from", required_argument, 0, "N", "first height of the re-export"},
+    {OPT_TO, "to", required_argument, 0, "N", "last height of the re-export"},
+    {OPT_CHECKPOINT, "checkpoint", required_argument, 0, "path", "save search progress and resume it on restart"},
+    {OPT_CHECKPOINT_INTERVAL, "checkpoint-interval", required_argument, 0, "s", "seconds between checkpoints (default: 5)"},
+    {OPT_TELEMETRY, "telemetry", required_argument, 0, "path", "one JSON line per accepted block, for btc_results"},
+    {OPT_SUMMARY, "summary", required_argument, 0, "path", "append the run summary to path as a JSON line"},
+    {OPT_TRACE, "trace", required_argument, 0, "path", "Chrome trace JSON of the run (make TRACE=1)"},
+    {OPT_PERF, "perf", no_argument, 0, NULL, "per-thread hardware counters"},
+    {OPT_TUNE, "tune", no_argument, 0, NULL, "recalibrate even if a tuned profile exists"},
+    {OPT_NO_TUNE, "no-tune", no_argument, 0, NULL, "skip the startup tuning"},
+    {OPT_TUNE_TIME, "tune-time", required_argument, 0, "s", "calibration time"},
+    {OPT_TUNE_PROFILE, "tune-profile", required_argument, 0, "path", "tuned profile cache"},
+    {OPT_NO_HUGE_PAGES, "no-huge-pages", no_argument, 0, NULL, "keep every region on 4K pages"},
+    {OPT_TEAMS_BACKEND, "teams-backend", required_argument, 0, "target|host", "where the teams kernel runs (default: target)"},
+    {OPT_TEAMS, "teams", required_argument, 0, "n", "teams of the teams kernel"},
+    {OPT_TEAM_THREADS, "team-threads", required_argument, 0, "n", "threads per team"},
+    {OPT_TILE_SIZE, "tile-size", required_argument, 0, "n", "nonces per tile"},
+    {OPT_TILES_PER_TEAM, "tiles-per-team", required_argument, 0, "n", "tiles each team hashes per batch"},
+    {OPT_HELP, "help", no_argument, 'h', NULL, "print this help"},
+};
+const size_t NUM_MINER_OPTIONS = sizeof(MINER_OPTIONS) / sizeof(MINER_OPTIONS[0]);
+
+/**
+ * @brief Default run: threads backend, the original genesis block and difficulty increment, no budget
+ *
+ * @param config
+ */
+void miner_config_defaults(MinerConfig &config) {
+    memset(&config, 0, sizeof(MinerConfig));
+    config.backend = BACKEND_THREADS;
+    config.hasher = -1;
+    config.validations = 1;
+    config.genesis_data = "[BLOCK ID|PREVIOUS DIGEST|DATA|THRESHOLD|NONCE]";
+    config.start_threshold = 1;
+    config.difficulty.kind = DIFFICULTY_INCREMENT;
+    config.difficulty.max_threshold = SHA256_BITS;
+    config.nonce_format = NONCE_FORMAT_ASCII;
+    config.worker = "worker";
+    config.share_threshold = 4;
+    config.blocks_per_chain = 5;
+    config.export_format = EXPORT_TEXT;
+    config.export_to = MAX_SIZE_T;
+    config.checkpoint_interval = 5.0;
+    config.tune = 1;
+    config.tune_time = TUNE_DEFAULT_TIME;
+    config.huge_pages = 1;
+    config.teams_backend = TEAMS_BACKEND_TARGET;
+}
+
+/**
+ * @brief Looks up an option by name
+ *
+ * @return const MinerOption* - NULL if unknown
+ */
+const MinerOption *miner_option_find(const char *name) {
+    for (size_t i = 0; i < NUM_MINER_OPTIONS; i++) {
+        if (strcmp(MINER_OPTIONS[i].name, name) == 0) {
+            return &MINER_OPTIONS[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Prints every option
+ *
+ * @param name - program name
+ */
+void miner_print_usage(const char *name) {
+    printf("Usage: %s [options]\n", name);
+    for (size_t i = 0; i < NUM_MINER_OPTIONS; i++) {
+        const MinerOption &option = MINER_OPTIONS[i];
+        char flags[96];
+        snprintf(flags, sizeof(flags), "%c%c%s--%s%s%s", option.short_name ? '-' : ' ', option.short_name ? option.short_name : ' ', option.short_name ? ", " : "  ", option.name, option.arg ? " " : "", option.arg ? option.arg : "");
+        printf("  %-46s %s\n", flags, option.help);
+    }
+    printf("A config file holds one \"option = value\" per line, with the long option names. Flags take no value.\n");
+}
+
+int miner_config_load(MinerConfig &config, const char *path);
+
+/**
+ * @brief Applies one setting
+ *
+ * @param config
+ * @param id - MinerOptionId
+ * @param value - NULL for flags. Must outlive the run
+ * @return int - 0 on success, -1 if the value is invalid (reported)
+ */
+int miner_config_set(MinerConfig &config, int id, const char *value) {
+    switch (id) {
+        case OPT_CONFIG: return miner_config_load(config, value);
+        case OPT_BACKEND:
+            config.backend = -1;
+            for (int i = 0; i < NUM_MINER_BACKENDS; i++) {
+                if (strcmp(value, MINER_BACKEND_NAMES[i]) == 0) {
+                    config.backend = i;
+                }
+            }
+            if (config.backend < 0) {
+                printf("Backend must be one of serial, threads, processes, teams\n");
+                return -1;
+            }
+            break;
+        case OPT_THREADS: config.threads = strtoull(value, NULL, 10); break;
+        case OPT_HASHER:
+            config.hasher = hasher_backend_from_name(value);
+            if (config.hasher < 0) {
+                printf("Hasher must be one of midstate, openssl, teams\n");
+                return -1;
+            }
+            break;
+        case OPT_VALIDATIONS: config.validations = strtoull(value, NULL, 10); break;
+        case OPT_GENESIS_DATA: config.genesis_data = value; break;
+        case OPT_START_THRESHOLD: config.start_threshold = strtoull(value, NULL, 10); break;
+        case OPT_DIFFICULTY:
+            config.difficulty.kind = difficulty_from_name(value);
+            if (config.difficulty.kind < 0) {
+                printf("Difficulty must be one of increment, fixed\n");
+                return -1;
+            }
+            break;
+        case OPT_MAX_THRESHOLD: config.difficulty.max_threshold = strtoull(value, NULL, 10); break;
+        case OPT_FIXED_NONCES: config.nonce_format = NONCE_FORMAT_FIXED; break;
+        case OPT_TIME_LIMIT: config.time_limit = strtod(value, NULL); break;
+        case OPT_BLOCKS: config.max_blocks = strtoull(value, NULL, 10); break;
+        case OPT_HASHES: config.max_hashes = strtoull(value, NULL, 10); break;
+        case OPT_POOL: config.pool_url = (char *)value; break;
+        case OPT_WORKER: config.worker = value; break;
+        case OPT_SHARE_THRESHOLD: config.share_threshold = strtoull(value, NULL, 10); break;
+        case OPT_SHARE_LOG: config.share_log = value; break;
+        case OPT_PROCESSES:
+            config.num_processes = strtoull(value, NULL, 10);
+            config.backend = BACKEND_PROCESSES;
+            break;
+        case OPT_CHAINS: config.num_chains = strtoull(value, NULL, 10); break;
+        case OPT_BLOCKS_PER_CHAIN: config.blocks_per_chain = strtoull(value, NULL, 10); break;
+        case OPT_VERIFIERS: config.num_verifiers = strtoull(value, NULL, 10); break;
+        case OPT_QUORUM: config.quorum = strtoull(value, NULL, 10); break;
+        case OPT_MIXED_VERIFIERS: config.mixed_backends = 1; break;
+        case OPT_EXPORT: config.export_path = value; break;
+        case OPT_EXPORT_FORMAT:
+            config.export_format = export_format_from_name(value);
+            if (config.export_format < 0) {
+                printf("Export format must be one of text, jsonl, bin\n");
+                return -1;
+            }
+            break;
+        case OPT_IMPORT: config.import_path = value; break;
+        case OPT_FROM: config.export_from = strtoull(value, NULL, 10); break;
+        case OPT_TO: config.export_to = strtoull(value, NULL, 10); break;
+        case OPT_CHECKPOINT: config.checkpoint_path = value; break;
+        case OPT_CHECKPOINT_INTERVAL: config.checkpoint_interval = strtod(value, NULL); break;
+        case OPT_TELEMETRY: config.telemetry_path = value; break;
+        case OPT_SUMMARY: config.summary_path = value; break;
+        case OPT_TRACE: config.trace_path = value; break;
+        case OPT_PERF: config.use_perf = 1; break;
+        case OPT_TUNE: config.force_tune = 1; break;
+        case OPT_NO_TUNE: config.tune = 0; break;
+        case OPT_TUNE_TIME: config.tune_time = strtod(value, NULL); break;
+        case OPT_TUNE_PROFILE: config.tune_profile = value; break;
+        case OPT_NO_HUGE_PAGES: config.huge_pages = 0; break;
+        case OPT_TEAMS_BACKEND:
+            config.teams_backend = teams_backend_from_name(value);
+            if (config.teams_backend < 0) {
+                printf("Teams backend must be one of target, host\n");
+                return -1;
+            }
+            break;
+        case OPT_TEAMS: config.num_teams = atoi(value); break;
+        case OPT_TEAM_THREADS: config.threads_per_team = atoi(value); break;
+        case OPT_TILE_SIZE: config.tile_size = strtoull(value, NULL, 10); break;
+        case OPT_TILES_PER_TEAM: config.tiles_per_team = strtoull(value, NULL, 10); break;
+        default: return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Applies the settings of a config file. A flag may be written alone or as "flag = true"; "false" skips it.
+ *
+ * @param config
+ * @param path
+ * @return int - 0 on success, -1 on an unreadable file or a bad line (reported with its line number)
+ */
+int miner_config_load(MinerConfig &config, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        printf("Cannot read config %s\n", path);
+        return -1;
+    }
+    char line[CONFIG_LINE_BYTES];
+    size_t line_no = 0;
+    int status = 0;
+    while (status == 0 && fgets(line, sizeof(line), f) != NULL) {
+        line_no++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        // Trim, then split at the first '=' or blank
+        char *key = line + strspn(line, " \t\r\n");
+        char *end = key + strlen(key);
+        while (end > key && strchr(" \t\r\n", end[-1]) != NULL) {
+            *--end = '\0';
+        }
+        if (*key == '\0') {
+            continue;
+        }
+        char *value = key + strcspn(key, " \t=");
+        if (*value != '\0') {
+            *value++ = '\0';
+            value += strspn(value, " \t=");
+        }
+        const MinerOption *option = miner_option_find(key);
+        if (option == NULL || option->id == OPT_CONFIG || option->id == OPT_HELP) {
+            printf("%s:%lu: unknown option %s\n", path, line_no, key);
+            status = -1;
+        } else if (option->has_arg == no_argument) {
+            if (*value == '\0' || strcmp(value, "true") == 0 || strcmp(value, "1") == 0 || strcmp(value, "yes") == 0) {
+                status = miner_config_set(config, option->id, NULL);
+            } else if (strcmp(value, "false") != 0 && strcmp(value, "0") != 0 && strcmp(value, "no") != 0) {
+                printf("%s:%lu: %s is a flag, use true or false\n", path, line_no, key);
+                status = -1;
+            }
+        } else if (*value == '\0') {
+            printf("%s:%lu: %s needs a value\n", path, line_no, key);
+            status = -1;
+        } else {
+            // The strings are kept by the config for the whole run
+            status = miner_config_set(config, option->id, strdup(value));
+        }
+    }
+    fclose(f);
+    return status;
+}
+
+/**
+ * @brief Applies the command line
+ *
+ * @param config - holds the caller's defaults
+ * @param argc
+ * @param argv
+ * @return int - 0 to run, 1 if help was printed, -1 on a bad option (usage printed)
+ */
+int miner_config_parse(MinerConfig &config, int argc, char *argv[]) {
+    struct option long_options[NUM_MINER_OPTIONS + 1];
+    char short_options[2 * NUM_MINER_OPTIONS + 1];
+    size_t num_short = 0;
+    for (size_t i = 0; i < NUM_MINER_OPTIONS; i++) {
+        long_options[i].name = MINER_OPTIONS[i].name;
+        long_options[i].has_arg = MINER_OPTIONS[i].has_arg;
+        long_options[i].flag = NULL;
+        long_options[i].val = MINER_OPTIONS[i].id;
+        if (MINER_OPTIONS[i].short_name) {
+            short_options[num_short++] = MINER_OPTIONS[i].short_name;
+            if (MINER_OPTIONS[i].has_arg == required_argument) {
+                short_options[num_short++] = ':';
+            }
+        }
+    }
+    memset(&long_options[NUM_MINER_OPTIONS], 0, sizeof(struct option));
+    short_options[num_short] = '\0';
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
+        int id = -1;
+        for (size_t i = 0; i < NUM_MINER_OPTIONS && id < 0; i++) {
+            if (MINER_OPTIONS[i].id == opt || (opt < 256 && MINER_OPTIONS[i].short_name == opt)) {
+                id = MINER_OPTIONS[i].id;
+            }
+        }
+        if (id == OPT_HELP) {
+            miner_print_usage(argv[0]);
+            return 1;
+        }
+        if (id < 0) {
+            miner_print_usage(argv[0]);
+            return -1;
+        }
+        if (miner_config_set(config, id, optarg) != 0) {
+            return -1;
+        }
+    }
+    if (optind < argc) {
+        printf("Unexpected argument %s\n", argv[optind]);
+        return -1;
+    }
+    return 0;
+}
+
+#endif
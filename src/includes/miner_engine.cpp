@@ -0,0 +1,707 @@
+// Miner engine. One run loop with the execution backend chosen at runtime: serial (one thread, OpenSSL strings, the
+// baseline), threads (OpenMP threads behind the block pipeline, or a pool or chain batch), processes (forked workers
+// on a shared region) and teams (the teams/distribute kernel on a device or the host). Every backend mines the same
+// genesis block with the same difficulty policy, stops on the same run controller budgets and writes the same sinks,
+// so backends and performance features can be compared inside one binary. The per-mode executables are presets of
+// this engine.
+#ifndef MINER_ENGINE_CPP
+#define MINER_ENGINE_CPP
+
+#include <new>
+#include <signal.h>
+#include <unistd.h>
+
+#include "autotune.cpp"
+#include "block_pipeline.cpp"
+#include "chain_batch.cpp"
+#include "chain_export.cpp"
+#include "checkpoint.cpp"
+#include "miner_config.cpp"
+#include "nonce_hasher.cpp"
+#include "numa.cpp"
+#include "perf_counters.cpp"
+#include "run_controller.cpp"
+#include "sha256_midstate.cpp"
+#include "sha256_openssl.cpp"
+#include "shares.cpp"
+#include "shm_mining.cpp"
+#include "stratum.cpp"
+#include "teams_kernel.cpp"
+#include "trace.cpp"
+#include "utils.h"
+#include "verifier_pool.cpp"
+#include "work_stealing.cpp"
+
+unsigned char running = 1;
+
+void exit_handler(int signal) {
+    printf("\nCPU: Caught signal: %d. Exiting...\n", signal);
+    RunController::interrupt();
+    running = 0;
+#pragma omp flush(running)
+}
+
+/**
+ * @brief Mines jobs pulled from a Stratum pool instead of inventing them locally. Every thread polls the client's job
+ * generation once per attempt and switches to a new job as soon as the network thread publishes it.
+ *
+ * @param client
+ * @param blockchain - local record of the blocks this miner found
+ * @param shares - local share accounting
+ * @param NUM_THREADS_MINER
+ * @param controller - counts the hashes and the blocks this miner found
+ */
+void mine_stratum(StratumClient& client, Blockchain& blockchain, ShareStats& shares, const size_t NUM_THREADS_MINER, RunController& controller) {
+    double t_start = omp_get_wtime();
+    const double T_START_GLOBAL = t_start;
+
+#pragma omp parallel num_threads(NUM_THREADS_MINER)
+    {
+        StratumClient::Job job;
+        memset(&job, 0, sizeof(job));
+        Sha256Midstate midstate;
+        size_t generation = 0;
+        size_t private_nonce = 0;
+        size_t nonce_end = 0;
+
+        while (running && client.isConnected()) {
+            if (client.getJobGeneration() != generation) {
+                // New job from the pool. Drop the rest of the current chunk
+                generation = client.copyJob(&job);
+                midstate.setJob(job.block_id, job.prev_digest, job.data, job.block_threshold);
+                private_nonce = nonce_end = 0;
+                if (omp_get_thread_num() == 0) {
+#pragma omp critical(print)
+                    printf("\nJOB: %s\tBLOCK ID: %lu\tThreshold: %lu\tNonces: [%lu, %lu)\n", job.job_id, job.block_id, job.threshold, job.nonce_start, job.nonce_end);
+                }
+            }
+            if (client.isSolved(generation) || (private_nonce == nonce_end && !client.claimNonces(generation, private_nonce, nonce_end))) {
+                // Job solved or its nonce range is exhausted. Wait for the pool to send the next one
+                usleep(50);
+                continue;
+            }
+
+            unsigned char digest_bin[SHA256_DIGEST_LENGTH];
+            midstate.hash(private_nonce, digest_bin);
+            controller.countHash(omp_get_thread_num());
+            if (shares.isShare(digest_bin)) {
+                shares.record(omp_get_thread_num(), omp_get_wtime(), private_nonce);
+            }
+            // Only digests with enough leading zero nibbles can meet the threshold. Build the strings for those only
+            char* data_to_hash = NULL;
+            char* digest = NULL;
+            if (job.threshold < 2 * SHA256_DIGEST_LENGTH && ShareStats::meets(digest_bin, job.threshold)) {
+                data_to_hash = blockchain.t_makeString(private_nonce, job.block_id, job.prev_digest, job.data, job.block_threshold);
+                digest = digest_to_hex(digest_bin);
+            }
+
+            if (digest != NULL && blockchain.thresholdMet((const char*)digest, job.threshold)) {
+                // The pool verifies the solution and broadcasts the next job
+                client.markSolved(generation);
+                client.submit(job.job_id, private_nonce);
+#pragma omp critical(print)
+                {
+                    print_new_block_info(t_start, T_START_GLOBAL, digest, private_nonce, data_to_hash);
+                    blockchain.appendBlock((const char*)digest, (const char*)data_to_hash, job.threshold, private_nonce);
+                    controller.blockDone();
+                    t_start = omp_get_wtime();
+                }
+            } else {
+                // Low-difficulty shares let the pool measure our hashrate
+                const size_t share_threshold = client.getShareThreshold();
+                if (share_threshold > 0 && ShareStats::meets(digest_bin, share_threshold)) {
+                    client.submit(job.job_id, private_nonce);
+                }
+            }
+            private_nonce++;
+
+            // free memory
+            free(data_to_hash);
+            free(digest);
+        }
+        StratumClient::freeJob(&job);
+    }
+    printf("Stratum: %lu accepted, %lu rejected\n", client.accepted, client.rejected);
+}
+
+static size_t shm_hash_source(void* arg) { return shm_total_hashes((ShmRegion*)arg); }
+
+/**
+ * @brief Mines the local chain with forked worker processes instead of OpenMP threads. Workers coordinate through the
+ * shared region; this (parent) process verifies every solution, appends it and publishes the next job. A solution a
+ * worker reported before the stop is still verified.
+ *
+ * @param region
+ * @param blockchain
+ * @param global_threshold
+ * @param NUM_WORKERS
+ * @param topology - worker i is pinned like OpenMP thread i would be
+ * @param config - difficulty policy
+ * @param controller - started here, counts the blocks
+ */
+void mine_processes(ShmRegion* region, Blockchain& blockchain, size_t& global_threshold, const size_t NUM_WORKERS, NumaTopology& topology, const MinerConfig& config, RunController& controller) {
+    double t_start = omp_get_wtime();
+    const double T_START_GLOBAL = t_start;
+    shm_publish_job(region, blockchain.getCurrentBlock(), global_threshold, blockchain.getNonceFormat());
+    const size_t NUM_STARTED = shm_spawn_workers(region, NUM_WORKERS, &topology);
+    controller.setHashSource(shm_hash_source, region);
+    controller.start(&running, 1);
+
+    while (1) {
+        const int draining = !__atomic_load_n(&running, __ATOMIC_ACQUIRE);
+        const size_t generation = __atomic_load_n(&region->job_generation, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&region->found_ready, __ATOMIC_ACQUIRE) != generation) {
+            if (draining) {
+                break;
+            }
+            usleep(10);
+            continue;
+        }
+        size_t valid_nonce = region->found_nonce;
+        char* data_to_hash = blockchain.getString(valid_nonce);
+        char* digest = double_sha256((const char*)data_to_hash);
+        if (blockchain.thresholdMet((const char*)digest, global_threshold)) {
+            printf("Digest accepted: \t\t%s\tNonce: %lu\tWorker: %lu\n", digest, valid_nonce, region->found_worker);
+            print_new_block_info(t_start, T_START_GLOBAL, digest, valid_nonce, data_to_hash);
+            printf("Process hashrate: \t\t%.0lf H/s\n", shm_total_hashes(region) / (omp_get_wtime() - T_START_GLOBAL));
+            blockchain.appendBlock((const char*)digest, (const char*)data_to_hash, global_threshold, valid_nonce);
+            global_threshold = config.difficulty.next(global_threshold);
+            print_current_block_info(blockchain, valid_nonce);
+            t_start = omp_get_wtime();
+            // The found flag stays set for the solved job, so stop here rather than on the next pass
+            if (!controller.blockDone() || draining) {
+                free(data_to_hash);
+                free(digest);
+                break;
+            }
+            if (shm_publish_job(region, blockchain.getCurrentBlock(), global_threshold, blockchain.getNonceFormat()) != 0) {
+                running = 0;
+            }
+        } else {
+            printf("ERROR: Digest rejected: %s\tNonce: %lu\tWorker: %lu\n", digest, valid_nonce, region->found_worker);
+            // Reopen the job so the workers keep searching
+            __atomic_store_n(&region->found_ready, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&region->found_generation, 0, __ATOMIC_RELEASE);
+        }
+        free(data_to_hash);
+        free(digest);
+    }
+
+    shm_stop_workers(region, NUM_STARTED);
+    shm_print_stats(region, omp_get_wtime() - T_START_GLOBAL);
+}
+
+/**
+ * @brief Mines the local chain on the calling thread, one OpenSSL hash of the full preimage string per nonce. The
+ * baseline the other backends are measured against. A nonce that is part way through its validations when the run
+ * stops is still validated and appended.
+ *
+ * @param blockchain
+ * @param global_threshold
+ * @param config - validations and difficulty policy
+ * @param controller - started here, counts the hashes and blocks
+ */
+void mine_serial(Blockchain& blockchain, size_t& global_threshold, const MinerConfig& config, RunController& controller) {
+    size_t global_nonce = 0;
+    size_t valid_nonce = 0;
+    size_t validation_counter = 0;
+
+    print_current_block_info(blockchain, global_nonce);
+
+    // Start the timer
+    double t_start = omp_get_wtime();
+    const double T_START_GLOBAL = t_start;
+    controller.start(&running, 1);
+
+    while (running || validation_counter > 0) {
+        char* data_to_hash = blockchain.getString(global_nonce);
+        char* digest = double_sha256((const char*)data_to_hash);
+        controller.countHash(0);
+
+        if (blockchain.thresholdMet((const char*)digest, global_threshold)) {
+            // Found a valid nonce that provides a digest that meets the threshold requirement.
+            valid_nonce = global_nonce;
+            validation_counter++;
+            if (validation_counter >= config.validations) {
+                // Record time
+                print_new_block_info(t_start, T_START_GLOBAL, digest, valid_nonce, data_to_hash);
+                // Append the block to the blockchain
+                blockchain.appendBlock((const char*)digest, (const char*)data_to_hash, global_threshold, valid_nonce);
+                // Reset nonce and validation counter. Next threshold
+                global_nonce = 0;
+                validation_counter = 0;
+                global_threshold = config.difficulty.next(global_threshold);
+
+                print_current_block_info(blockchain, global_nonce);
+
+                // Reset the timer
+                t_start = omp_get_wtime();
+                controller.blockDone();
+            }
+        } else {
+            // Invalid nonce. Increment and try again
+            global_nonce++;
+        }
+        // free memory
+        free(data_to_hash);
+        free(digest);
+    }
+}
+
+/**
+ * @brief Verifies the block by checking the digest against the threshold and appends it if valid
+ *
+ * @param blockchain
+ * @param valid_nonce
+ * @param global_threshold - moved to the next threshold if the block is appended
+ * @param team
+ * @param tid
+ * @param config - validations and difficulty policy
+ * @param t_start
+ * @param T_START_GLOBAL
+ * @return int - 1 if the block was appended
+ */
+int teams_verify_append(Blockchain& blockchain, size_t valid_nonce, size_t& global_threshold, int team, int tid, const MinerConfig& config, double t_start, const double T_START_GLOBAL) {
+    char* data_to_hash = blockchain.getString(valid_nonce);
+    char* digest = double_sha256((const char*)data_to_hash);
+    int accepted = 1;
+    for (size_t validation = 0; validation < config.validations && accepted; validation++) {
+        if (validation > 0) {
+            free(data_to_hash);
+            free(digest);
+            data_to_hash = blockchain.getString(valid_nonce);
+            digest = double_sha256((const char*)data_to_hash);
+        }
+        if (blockchain.thresholdMet((const char*)digest, global_threshold)) {
+            printf("Digest accepted: \t\t%s\tNonce: %lu\tTeam: %d\tTID: %d\n", digest, valid_nonce, team, tid);
+        } else {
+            printf("ERROR. Digest rejected: %s\tNonce: %lu\tTeam: %d\tTID: %d\n", digest, valid_nonce, team, tid);
+            accepted = 0;
+        }
+    }
+
+    if (accepted) {
+        print_new_block_info(t_start, T_START_GLOBAL, digest, valid_nonce, data_to_hash);
+        blockchain.appendBlock((const char*)digest, (const char*)data_to_hash, global_threshold, valid_nonce);
+        global_threshold = config.difficulty.next(global_threshold);
+        print_current_block_info(blockchain, valid_nonce);
+    }
+    // free memory
+    free(data_to_hash);
+    free(digest);
+    return accepted;
+}
+
+/**
+ * @brief Mines the local chain with the teams kernel. The host hands out fixed size batches and verifies the nonce a
+ * batch returns; the running flag is checked between batches, so no flag has to be updated on the device while a
+ * kernel runs. A nonce found by the batch that was running at the stop is still verified.
+ *
+ * @param blockchain
+ * @param global_threshold
+ * @param config - teams kernel shape, validations and difficulty policy
+ * @param controller - started here, counts the hashes and blocks
+ */
+void mine_teams(Blockchain& blockchain, size_t& global_threshold, const MinerConfig& config, RunController& controller) {
+    TeamsEngine engine(config.teams_backend, config.num_teams, config.threads_per_team, config.tile_size, config.tiles_per_team);
+    printf("Teams kernel: %s backend, %d teams x %d threads, %lu nonces per batch\n", TEAMS_BACKEND_NAMES[engine.backend], engine.num_teams, engine.threads_per_team, engine.batchSize());
+    size_t first_nonce = 0;
+
+    print_current_block_info(blockchain, first_nonce);
+
+    // Start the timer
+    double t_start = omp_get_wtime();
+    const double T_START_GLOBAL = t_start;
+    controller.start(&running, 1);
+
+    while (running) {
+        Blockchain::Block* block = blockchain.getCurrentBlock();
+        char b_prev_digest[2 * SHA256_DIGEST_LENGTH + 1];
+        hex_encode(block->prev_digest, SHA256_DIGEST_LENGTH, b_prev_digest);
+        b_prev_digest[2 * SHA256_DIGEST_LENGTH] = '\0';
+
+        // Hash fixed size batches until one holds a valid nonce
+        engine.setJob(block->block_id, b_prev_digest, block->data, block->threshold, global_threshold, blockchain.getNonceFormat());
+        TeamsResult result;
+        result.nonce = MAX_SIZE_T;
+        size_t batch_base = 0;
+        while (running && result.nonce == MAX_SIZE_T) {
+            result = engine.mineBatch(batch_base);
+            batch_base += engine.batchSize();
+            controller.countHashes(0, result.hashed);
+        }
+
+        if (result.nonce != MAX_SIZE_T) {
+            // The CPU verifies the digest and appends the block to the blockchain
+            if (teams_verify_append(blockchain, result.nonce, global_threshold, result.team, result.tid, config, t_start, T_START_GLOBAL)) {
+                controller.blockDone();
+            }
+            t_start = omp_get_wtime();
+        }
+    }
+
+    engine.printStats();
+}
+
+/**
+ * @brief Ends a drained run: finishes the export, if any, closes the run and prints the blocks of the local chain still
+ * in memory, if the run mined into it, and the run summary. The summary also goes to the telemetry and the summary log.
+ *
+ * @param controller
+ * @param config
+ * @param exporter
+ * @param tip - what the run ended on
+ * @param telemetry - NULL if none
+ */
+void finish_run(RunController& controller, const MinerConfig& config, ChainExporter& exporter, const RunTip& tip, FILE* telemetry) {
+    if (exporter.blocks_written > 0) {
+        exporter.close();
+        printf("\nExported %lu blocks, %lu bytes\n", exporter.blocks_written, exporter.bytes_written);
+    }
+    fflush(stdout);
+    controller.finish();
+    if (tip.chain != NULL) {
+        tip.chain->print();
+    }
+
+    const char* backend = config.num_chains > 0 ? "batch" : (config.pool_url != NULL ? "pool" : MINER_BACKEND_NAMES[config.backend]);
+    controller.printSummary(backend, tip);
+    if (telemetry != NULL) {
+        controller.writeSummary(telemetry, backend, tip);
+    }
+    if (config.summary_path != NULL) {
+        FILE* f = fopen(config.summary_path, "a");
+        if (f == NULL) {
+            printf("Cannot write summary %s\n", config.summary_path);
+        } else {
+            controller.writeSummary(f, backend, tip);
+            fclose(f);
+        }
+    }
+}
+
+/**
+ * @brief Runs the miner as configured until interrupted (SIGINT) or out of budget, then drains it and prints the run
+ * summary
+ *
+ * @param config
+ * @return int - exit status
+ */
+int miner_run(MinerConfig& config) {
+    // Create interrupt handling variables. Exit on a keyboard ctrl-c interrupt
+    struct sigaction sigIntHandler;
+    sigIntHandler.sa_handler = exit_handler;
+    sigemptyset(&sigIntHandler.sa_mask);
+    sigIntHandler.sa_flags = 0;
+    sigaction(SIGINT, &sigIntHandler, NULL);
+
+    huge_pages_set_enabled(config.huge_pages);
+    if (config.import_path != NULL) {
+        // Range export from a binary store. Nothing is mined
+        ChainExporter exporter;
+        if (exporter.open(config.export_path != NULL ? config.export_path : "-", config.export_format) != 0) {
+            return 1;
+        }
+        int status = chain_export_range(config.import_path, exporter, config.export_from, config.export_to);
+        exporter.close();
+        return status == 0 ? 0 : 1;
+    }
+    if (config.pool_url != NULL && config.backend != BACKEND_THREADS) {
+        printf("Pool mining needs the threads backend\n");
+        return 1;
+    }
+
+    // Initialize the blockchain
+    const char* INIT_DATA = config.genesis_data;
+    const char* INIT_PREV_DIGEST = double_sha256(INIT_DATA);
+    printf("Backend: %s\tDifficulty: %s from %lu\n", MINER_BACKEND_NAMES[config.backend], DIFFICULTY_NAMES[config.difficulty.kind], config.start_threshold);
+
+    Blockchain blockchain;
+    ChainExporter exporter;
+    if (config.export_path != NULL) {
+        // Blocks go to the export as they are appended; only the tip and its parent stay in memory
+        if (exporter.open(config.export_path, config.export_format) != 0) {
+            return 1;
+        }
+        blockchain.setAppendHook(ChainExporter::appendHook, &exporter);
+        blockchain.setMaxResident(EXPORT_RESIDENT_BLOCKS);
+        printf("Exporting blocks to %s as %s\n", config.export_path, EXPORT_FORMAT_NAMES[config.export_format]);
+    }
+    if (config.pool_url == NULL) {
+        // Pool jobs keep the original format, the pool builds the preimages it verifies
+        blockchain.setNonceFormat(config.nonce_format);
+    }
+    size_t global_threshold = 0;
+    size_t global_nonce = 0;
+    blockchain.appendBlock(INIT_PREV_DIGEST, INIT_DATA, global_threshold, global_nonce);
+    global_threshold = config.start_threshold;
+    // Budgets count from the start of mining, after the backend's setup
+    RunController controller(config.time_limit, config.max_blocks, config.max_hashes);
+
+    if (config.backend == BACKEND_SERIAL) {
+        mine_serial(blockchain, global_threshold, config, controller);
+        finish_run(controller, config, exporter, run_tip_chain(blockchain, global_threshold), NULL);
+        blockchain.~Blockchain();
+        return 0;
+    }
+
+    // Set the number of threads to use
+    // Leave 2 cores for the OS and the printing thread, but always mine with at least 1. The tuner may pick another count
+    const size_t NUM_THREADS_DEFAULT = omp_get_max_threads() > 2 ? omp_get_max_threads() - 2 : 1;
+    TuneProfile profile = {HASHER_MIDSTATE, WS_BATCH, NUM_THREADS_DEFAULT, 1, 0.0};
+    if (config.tune && config.backend == BACKEND_THREADS && config.pool_url == NULL && config.num_chains == 0) {
+        // Local mode only: the other modes hash with their own loops
+        Autotuner tuner(config.tune_profile, config.tune_time, NUM_THREADS_DEFAULT);
+        tuner.select(profile, config.force_tune, INIT_PREV_DIGEST, INIT_DATA, config.nonce_format);
+        tuner.printProfile(profile);
+    }
+    // Explicit settings win over the tuned ones
+    if (config.threads > 0) {
+        profile.threads = config.threads;
+    }
+    if (config.hasher >= 0) {
+        profile.backend = config.hasher;
+    }
+    const size_t NUM_THREADS_MINER = profile.threads;
+    const size_t NUM_DEVICES = omp_get_num_devices();
+    // omp_set_num_threads(NUM_THREADS_MINER);
+    printf("Number of CPU threads: %lu\n", NUM_THREADS_MINER);
+    printf("Number of devices: %lu\n", NUM_DEVICES);
+
+    if (config.backend == BACKEND_TEAMS) {
+        mine_teams(blockchain, global_threshold, config, controller);
+        finish_run(controller, config, exporter, run_tip_chain(blockchain, global_threshold), NULL);
+        blockchain.~Blockchain();
+        return 0;
+    }
+
+    if (config.backend == BACKEND_THREADS) {
+        printf("Hasher: %s\n", HASHER_BACKEND_NAMES[profile.backend]);
+    }
+    printf("Share threshold: %lu\n", config.share_threshold);
+    ShareStats shares(NUM_THREADS_MINER, config.share_threshold);
+    const size_t num_processes = config.backend == BACKEND_PROCESSES ? (config.num_processes > 0 ? config.num_processes : NUM_THREADS_MINER) : 0;
+
+    // Initialize the print lock
+    omp_lock_t lock_print;
+    omp_init_lock(&lock_print);
+
+    // Place the threads on the NUMA nodes. Each node gets its own job copy and nonce dispenser
+    NumaTopology topology;
+    topology.discover();
+    if (!profile.smt) {
+        topology.dropSiblings();
+    }
+    topology.place(num_processes > 0 ? num_processes : NUM_THREADS_MINER);
+    topology.printPlacement();
+    // Each mining thread's hasher lives in its node's huge page region
+    topology.setScratch(sizeof(NonceHasher));
+    WorkStealingScheduler scheduler(topology, NUM_THREADS_MINER);
+    scheduler.setBatch(profile.batch);
+
+    if (config.pool_url != NULL) {
+        // Work comes from the pool, not from the local chain
+        char* pool_url = config.pool_url;
+        char* port = strrchr(pool_url, ':');
+        if (port == NULL) {
+            printf("Pool address must be host:port\n");
+            return 1;
+        }
+        *port++ = '\0';
+        StratumClient client(pool_url, port, config.worker);
+        if (client.connectToPool() != 0) {
+            return 1;
+        }
+        client.start();
+        if (client.waitForJob(10.0) == 0) {
+            printf("Stratum: no job received from %s:%s\n", pool_url, port);
+            return 1;
+        }
+        double t_mine = omp_get_wtime();
+        controller.start(&running, NUM_THREADS_MINER);
+        mine_stratum(client, blockchain, shares, NUM_THREADS_MINER, controller);
+        client.stop();
+        shares.printReport(t_mine, omp_get_wtime());
+        if (config.share_log != NULL) {
+            shares.writeLog(config.share_log, t_mine);
+        }
+        // The pool's chain, not the local one, is what the run extended
+        StratumClient::Job last_job;
+        memset(&last_job, 0, sizeof(last_job));
+        client.copyJob(&last_job);
+        finish_run(controller, config, exporter, run_tip_job(last_job.job_id, last_job.block_id, last_job.threshold), NULL);
+        StratumClient::freeJob(&last_job);
+        return 0;
+    }
+
+    if (config.num_chains > 0) {
+        // Many scenarios at once. Threads move between chains instead of waiting out each block handoff
+        printf("Number of chains: %lu\tBlocks per chain: %lu\n", config.num_chains, config.blocks_per_chain);
+        ChainBatch batch(config.num_chains, config.blocks_per_chain, NUM_THREADS_MINER, config.nonce_format);
+        double t_batch = omp_get_wtime();
+        controller.setHashSource(ChainBatch::hashSource, &batch);
+        batch.setBlockHook(RunController::blockHook, &controller);
+        controller.start(&running, 1);
+#pragma omp parallel num_threads(NUM_THREADS_MINER)
+        {
+            const int tid = omp_get_thread_num();
+            topology.pinThread(tid);
+            batch.work(tid, running);
+        }
+        batch.printReport(omp_get_wtime() - t_batch);
+        finish_run(controller, config, exporter, run_tip_batch(batch.num_chains, batch.chainsDone()), NULL);
+        return 0;
+    }
+
+    // Pick up the job of an interrupted run. Its searched ranges are skipped by the scheduler
+    NonceCheckpoint checkpoint(config.checkpoint_path, config.checkpoint_interval, blockchain, scheduler);
+    if (config.checkpoint_path != NULL && num_processes == 0 && checkpoint.resume(global_threshold)) {
+        scheduler.setCovered(1, &checkpoint.restored);
+    }
+
+    print_current_block_info(blockchain, global_nonce);
+
+    if (num_processes > 0) {
+        if (num_processes > SHM_MAX_WORKERS) {
+            printf("At most %d worker processes\n", SHM_MAX_WORKERS);
+            return 1;
+        }
+        ShmRegion* region = shm_region_create(num_processes, config.share_threshold);
+        if (region == NULL) {
+            return 1;
+        }
+        printf("Number of worker processes: %lu\n", num_processes);
+        mine_processes(region, blockchain, global_threshold, num_processes, topology, config, controller);
+        // The summary still reads the workers' hash counters
+        finish_run(controller, config, exporter, run_tip_chain(blockchain, global_threshold), NULL);
+        shm_region_destroy(region);
+        return 0;
+    }
+
+    // Start the timer. Found blocks are verified, appended, published and logged by the pipeline's executor thread
+    const double T_START_GLOBAL = omp_get_wtime();
+    BlockPipeline pipeline(blockchain, topology, scheduler, shares, global_threshold, &lock_print);
+    pipeline.setDifficulty(config.difficulty);
+    pipeline.setBlockHook(RunController::blockHook, &controller);
+    size_t quorum = config.quorum;
+    VerifierPool verifiers(config.num_verifiers, config.mixed_backends);
+    if (config.num_verifiers > 0) {
+        // Default quorum: all verifiers must agree
+        if (quorum == 0 || quorum > verifiers.num_verifiers) {
+            quorum = verifiers.num_verifiers;
+        }
+        printf("Verifiers: %lu\tQuorum: %lu\tBackends: %s\n", verifiers.num_verifiers, quorum, config.mixed_backends ? "mixed" : "openssl");
+        verifiers.start(BlockPipeline::notifyExecutor, &pipeline);
+        pipeline.setVerifiers(&verifiers, quorum);
+    }
+    // Slots 0..NUM_THREADS_MINER-1 count the mining threads, the last one the pipeline executor
+    PerfCounters perf(NUM_THREADS_MINER + 1);
+    perf.enabled = config.use_perf;
+    if (config.use_perf) {
+        pipeline.setPerf(&perf, NUM_THREADS_MINER);
+    }
+    FILE* telemetry = NULL;
+    if (config.telemetry_path != NULL) {
+        telemetry = fopen(config.telemetry_path, "w");
+        if (telemetry == NULL) {
+            printf("Cannot write telemetry %s\n", config.telemetry_path);
+            return 1;
+        }
+        pipeline.setTelemetry(telemetry, NUM_THREADS_MINER);
+    }
+    if (config.checkpoint_path != NULL) {
+        pipeline.setPublishHook(NonceCheckpoint::publishHook, &checkpoint);
+        checkpoint.start(pipeline.getGeneration(), global_threshold);
+    }
+    pipeline.start(T_START_GLOBAL);
+    controller.start(&running, NUM_THREADS_MINER);
+    const unsigned char NONCE_FORMAT = blockchain.getNonceFormat();
+
+#pragma omp parallel num_threads(NUM_THREADS_MINER)
+    {
+        // Pin the thread and set up its node's state from a thread on that node (first touch)
+        const int tid = omp_get_thread_num();
+        TRACE_THREAD("miner", tid);
+        topology.pinThread(tid);
+        topology.initNode(tid);
+        // Wait for all nodes to be initialized
+#pragma omp barrier
+        NumaNode* node = topology.nodeOf(tid);
+        NonceHasher* hasher = new (topology.threadScratch(tid)) NonceHasher(profile.backend);
+        size_t hashes = 0;
+        perf.openThread(tid);
+
+        while (running) {
+            // Hash from the node-local copy of the published job. Its prefix is hashed once per job
+            NumaJob* job = topology.refreshJob(node, pipeline.getJob());
+            const size_t generation = job->generation;
+            const size_t threshold = job->threshold;
+            if (hasher->generation != job->generation) {
+                // The hashing phase of the previous job ends here
+                if (hashes > 0) {
+                    perf.end(tid, PERF_PHASE_HASH, hashes);
+                    hashes = 0;
+                }
+                TRACE_SCOPE_ARG("job switch", job->generation);
+                hasher->setJob(job->block_id, job->prev_digest, job->data, job->block_threshold, NONCE_FORMAT);
+                hasher->generation = job->generation;
+                perf.end(tid, PERF_PHASE_SWITCH, 0);
+            }
+            // Nonces come from this thread's range
+            const size_t private_nonce = scheduler.nextNonce(tid, generation);
+            unsigned char digest_bin[SHA256_DIGEST_LENGTH];
+            hasher->hash(private_nonce, digest_bin);
+            hashes++;
+            controller.countHash(tid);
+            if (shares.isShare(digest_bin)) {
+                shares.record(tid, omp_get_wtime(), private_nonce);
+            }
+            // Exactly threshold leading zero nibbles, like Blockchain::thresholdMet, checked on the binary digest
+            if (threshold < 2 * SHA256_DIGEST_LENGTH && ShareStats::meets(digest_bin, threshold) && !ShareStats::meets(digest_bin, threshold + 1)) {
+                // Hand the nonce and the block it extends to the pipeline and keep mining until the next job is published
+                pipeline.submit(generation, job->prev_digest, private_nonce, tid);
+            }
+        }
+        if (hashes > 0) {
+            perf.end(tid, PERF_PHASE_HASH, hashes);
+        }
+        // Placed in the scratch slot, so destroyed by hand
+        hasher->~NonceHasher();
+    }
+    // Drain: the pipeline finishes the blocks already found and waits for outstanding verdicts, so the verifiers stop
+    // after it
+    pipeline.stop();
+    pipeline.printStats();
+    if (config.checkpoint_path != NULL) {
+        // Last write after the miners stopped, with their partly hashed batches
+        checkpoint.stop();
+        checkpoint.printStats();
+    }
+    if (config.num_verifiers > 0) {
+        verifiers.stop();
+        verifiers.printStats();
+    }
+
+    scheduler.printTelemetry();
+    huge_pages_report();
+    if (config.use_perf) {
+        perf.printReport(NUM_THREADS_MINER);
+    }
+    if (config.trace_path != NULL) {
+        TRACE_WRITE(config.trace_path);
+    }
+
+    // Print then delete the blockchain
+    if (telemetry != NULL) {
+        huge_pages_json(telemetry);
+    }
+    finish_run(controller, config, exporter, run_tip_chain(blockchain, pipeline.getThreshold()), telemetry);
+    if (telemetry != NULL) {
+        fclose(telemetry);
+    }
+    blockchain.~Blockchain();
+    omp_destroy_lock(&lock_print);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,588 @@
+// Discrete-event simulation of miners competing on one network. Every virtual miner mines on the tip it knows, finds
+// blocks at its own hashrate and announces them to the others, which see them after both ends' propagation latencies.
+// A miner switches to a block with more work than its tip, reorganizing if the block is on another branch. Block times
+// are drawn from the exponential distribution (Poisson mode) or come from the real hasher run on each miner's preimage
+// at a reduced threshold (hash mode). Hash mode hashes in chunks paced by simulated time, so a job cut short by a new
+// block costs only the hashes the miner would have done. One seed drives every draw, so a run is reproducible. Blocks are kept in flat
+// columns and pending events in a binary heap, so a run of millions of blocks stays within a minute and a few hundred MB.
+#ifndef NETWORK_SIM_CPP
+#define NETWORK_SIM_CPP
+
+#include <math.h>
+
+#include "nonce_hasher.cpp"
+#include "shares.cpp"
+
+#define SIM_NONE ((size_t)-1)
+#define SIM_INITIAL_BLOCKS 1024
+#define SIM_INITIAL_EVENTS 1024
+#define SIM_DATA_BYTES 32
+#define SIM_HASH_CHUNK 256  // nonces hashed per hash mode event
+
+enum SimEventKind { SIM_FIND, SIM_ARRIVE, SIM_HASH };
+
+/**
+ * A find of a miner, the arrival of a block at a miner, or the next chunk of a miner's nonces
+ */
+struct SimEvent {
+    double time;
+    size_t seq;    // order of scheduling, breaks ties so runs are deterministic
+    size_t miner;
+    size_t block;  // arriving block, or the job epoch of a find or chunk
+    int kind;      // SimEventKind
+};
+
+/**
+ * SimEventQueue class. Binary min-heap on (time, seq).
+ */
+class SimEventQueue {
+   public:
+    SimEventQueue() {
+        cap = SIM_INITIAL_EVENTS;
+        events = (SimEvent *)malloc(sizeof(SimEvent) * cap);
+        count = 0;
+        next_seq = 0;
+    }
+    ~SimEventQueue() { free(events); }
+    void push(double time, int kind, size_t miner, size_t block);
+    int pop(SimEvent &event);
+    size_t size() { return count; }
+
+   private:
+    SimEvent *events;
+    size_t count;
+    size_t cap;
+    size_t next_seq;
+
+    static inline int before(const SimEvent &a, const SimEvent &b) { return a.time < b.time || (a.time == b.time && a.seq < b.seq); }
+};
+
+void SimEventQueue::push(double time, int kind, size_t miner, size_t block) {
+    if (count == cap) {
+        cap *= 2;
+        events = (SimEvent *)realloc(events, sizeof(SimEvent) * cap);
+    }
+    SimEvent event = {time, next_seq++, miner, block, kind};
+    size_t i = count++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!before(event, events[parent])) {
+            break;
+        }
+        events[i] = events[parent];
+        i = parent;
+    }
+    events[i] = event;
+}
+
+/**
+ * @brief Takes the earliest event
+ *
+ * @param event - output
+ * @return int - 0 if the queue is empty
+ */
+int SimEventQueue::pop(SimEvent &event) {
+    if (count == 0) {
+        return 0;
+    }
+    event = events[0];
+    SimEvent last = events[--count];
+    size_t i = 0;
+    while (1) {
+        size_t child = 2 * i + 1;
+        if (child >= count) {
+            break;
+        }
+        if (child + 1 < count && before(events[child + 1], events[child])) {
+            child++;
+        }
+        if (!before(events[child], last)) {
+            break;
+        }
+        events[i] = events[child];
+        i = child;
+    }
+    events[i] = last;
+    return 1;
+}
+
+/**
+ * One virtual miner
+ */
+struct SimMiner {
+    double hashrate;  // hashes per second
+    double latency;   // one way between the miner and the network, seconds
+    size_t tip;
+    size_t epoch;     // bumped on every tip change, events scheduled for an older epoch are void in hash mode
+    size_t found;
+    size_t reorgs;
+    // hash mode: next nonce of the job, and the solution of the pending find
+    size_t next_nonce;
+    unsigned char pending_digest[SHA256_DIGEST_LENGTH];
+};
+
+/**
+ * NetworkSim class. Blocks are columns indexed by block, block 0 is the genesis block. With one threshold for every
+ * block, the chain with the most work is the highest one; a miner keeps its tip on ties (first seen).
+ */
+class NetworkSim {
+   public:
+    NetworkSim(size_t threshold, int hash_mode, unsigned long long seed);
+    ~NetworkSim();
+    void addMiner(double hashrate, double latency);
+    void setJitter(double jitter) { this->jitter = jitter; }
+    void run(size_t blocks);
+    void printReport(size_t confirmations);
+    int appendCsv(const char *path, size_t confirmations);
+
+    size_t threshold;
+    int hash_mode;
+    size_t num_miners;
+    size_t num_blocks;  // including the genesis block
+    size_t num_events;
+    size_t hashes;      // hash mode: digests computed
+    double t_wall;      // seconds the run took
+
+   private:
+    unsigned long long seed;
+    unsigned long long rng;
+    double jitter;  // mean of an exponential extra delay per delivery, seconds
+    SimMiner *miners;
+    size_t miners_cap;
+    SimEventQueue queue;
+
+    size_t blocks_cap;
+    size_t *block_parent;
+    size_t *block_height;
+    size_t *block_miner;
+    double *block_time;
+    unsigned char *block_digest;  // hash mode only
+    NonceHasher *hashers;  // hash mode, one job per miner
+
+    size_t *reorg_depths;  // count by depth
+    size_t max_reorg_depth;
+
+    double uniform();
+    double exponential(double mean) { return -mean * log(uniform()); }
+    size_t addBlock(size_t parent, size_t miner, double time);
+    void scheduleFind(size_t m, double now);
+    void hashChunk(size_t m, double now);
+    void adopt(size_t m, size_t block, double now);
+    size_t commonAncestor(size_t a, size_t b);
+    size_t bestTip();
+    void summarize(size_t confirmations, size_t &settled, size_t &stale, double *finality, size_t &num_finality, size_t *main_by_miner);
+};
+
+/**
+ * @brief Construct a new Network Sim object with the genesis block and no miners
+ *
+ * @param threshold - leading zero hex digits a block needs
+ * @param hash_mode - 1 to hash real preimages, 0 for exponential block times
+ * @param seed
+ */
+NetworkSim::NetworkSim(size_t threshold, int hash_mode, unsigned long long seed) {
+    this->threshold = threshold;
+    this->hash_mode = hash_mode;
+    this->seed = seed;
+    rng = seed;
+    jitter = 0.0;
+    num_miners = 0;
+    miners_cap = 16;
+    miners = (SimMiner *)malloc(sizeof(SimMiner) * miners_cap);
+    num_blocks = 0;
+    num_events = 0;
+    hashes = 0;
+    t_wall = 0.0;
+    blocks_cap = SIM_INITIAL_BLOCKS;
+    block_parent = (size_t *)malloc(sizeof(size_t) * blocks_cap);
+    block_height = (size_t *)malloc(sizeof(size_t) * blocks_cap);
+    block_miner = (size_t *)malloc(sizeof(size_t) * blocks_cap);
+    block_time = (double *)malloc(sizeof(double) * blocks_cap);
+    block_digest = hash_mode ? (unsigned char *)malloc(SHA256_DIGEST_LENGTH * blocks_cap) : NULL;
+    hashers = NULL;
+    reorg_depths = (size_t *)calloc(SIM_INITIAL_BLOCKS, sizeof(size_t));
+    max_reorg_depth = 0;
+    addBlock(SIM_NONE, SIM_NONE, 0.0);
+    if (hash_mode) {
+        // The genesis digest only has to differ between seeds
+        for (size_t i = 0; i < SHA256_DIGEST_LENGTH; i++) {
+            block_digest[i] = (unsigned char)(uniform() * 255.0);
+        }
+    }
+}
+
+/**
+ * @brief Destroy the Network Sim object
+ *
+ */
+NetworkSim::~NetworkSim() {
+    free(miners);
+    free(block_parent);
+    free(block_height);
+    free(block_miner);
+    free(block_time);
+    free(block_digest);
+    free(reorg_depths);
+    delete[] hashers;
+}
+
+/**
+ * @brief Uniform in (0, 1] from splitmix64
+ */
+double NetworkSim::uniform() {
+    unsigned long long z = (rng += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return ((z >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * @brief Adds a miner that starts on the genesis block
+ *
+ * @param hashrate - hashes per second
+ * @param latency - one way between the miner and the network, seconds
+ */
+void NetworkSim::addMiner(double hashrate, double latency) {
+    if (num_miners == miners_cap) {
+        miners_cap *= 2;
+        miners = (SimMiner *)realloc(miners, sizeof(SimMiner) * miners_cap);
+    }
+    SimMiner *miner = &miners[num_miners++];
+    memset(miner, 0, sizeof(SimMiner));
+    miner->hashrate = hashrate;
+    miner->latency = latency;
+}
+
+size_t NetworkSim::addBlock(size_t parent, size_t miner, double time) {
+    if (num_blocks == blocks_cap) {
+        blocks_cap *= 2;
+        block_parent = (size_t *)realloc(block_parent, sizeof(size_t) * blocks_cap);
+        block_height = (size_t *)realloc(block_height, sizeof(size_t) * blocks_cap);
+        block_miner = (size_t *)realloc(block_miner, sizeof(size_t) * blocks_cap);
+        block_time = (double *)realloc(block_time, sizeof(double) * blocks_cap);
+        if (hash_mode) {
+            block_digest = (unsigned char *)realloc(block_digest, SHA256_DIGEST_LENGTH * blocks_cap);
+        }
+    }
+    size_t block = num_blocks++;
+    block_parent[block] = parent;
+    block_height[block] = (parent == SIM_NONE) ? 0 : block_height[parent] + 1;
+    block_miner[block] = miner;
+    block_time[block] = time;
+    return block;
+}
+
+/**
+ * @brief Starts a miner on its tip. Poisson mode draws the time of the next find; hash mode starts hashing the miner's
+ * preimage from nonce 0.
+ *
+ * @param m
+ * @param now
+ */
+void NetworkSim::scheduleFind(size_t m, double now) {
+    SimMiner *miner = &miners[m];
+    if (!hash_mode) {
+        // Exactly threshold leading zeros: 15/16 of the digests with at least that many
+        const double p = ldexp(15.0 / 16.0, -4 * (int)threshold);
+        queue.push(now + exponential(1.0 / (miner->hashrate * p)), SIM_FIND, m, miner->epoch);
+        return;
+    }
+    char prev_digest[2 * SHA256_DIGEST_LENGTH + 1];
+    hex_encode(&block_digest[SHA256_DIGEST_LENGTH * miner->tip], SHA256_DIGEST_LENGTH, prev_digest);
+    prev_digest[2 * SHA256_DIGEST_LENGTH] = '\0';
+    char data[SIM_DATA_BYTES];
+    snprintf(data, SIM_DATA_BYTES, "miner %lu", m);
+    hashers[m].setJob(block_height[miner->tip] + 1, prev_digest, data, threshold);
+    miner->next_nonce = 0;
+    hashChunk(m, now);
+}
+
+/**
+ * @brief Hashes the next SIM_HASH_CHUNK nonces of a miner's job. A digest with exactly threshold leading zeros is
+ * found after the hashes before it at the miner's hashrate; without one the next chunk starts when this one would end.
+ *
+ * @param m
+ * @param now - simulated time the chunk starts
+ */
+void NetworkSim::hashChunk(size_t m, double now) {
+    SimMiner *miner = &miners[m];
+    for (size_t i = 1; i <= SIM_HASH_CHUNK; i++) {
+        hashers[m].hash(miner->next_nonce++, miner->pending_digest);
+        hashes++;
+        if (ShareStats::meets(miner->pending_digest, threshold) && !ShareStats::meets(miner->pending_digest, threshold + 1)) {
+            queue.push(now + i / miner->hashrate, SIM_FIND, m, miner->epoch);
+            return;
+        }
+    }
+    queue.push(now + SIM_HASH_CHUNK / miner->hashrate, SIM_HASH, m, miner->epoch);
+}
+
+/**
+ * @brief Deepest block that both blocks descend from. O(depth of the fork).
+ */
+size_t NetworkSim::commonAncestor(size_t a, size_t b) {
+    while (block_height[a] > block_height[b]) {
+        a = block_parent[a];
+    }
+    while (block_height[b] > block_height[a]) {
+        b = block_parent[b];
+    }
+    while (a != b) {
+        a = block_parent[a];
+        b = block_parent[b];
+    }
+    return a;
+}
+
+/**
+ * @brief Moves a miner to a new tip and counts the reorg if its old tip is not an ancestor
+ *
+ * @param m
+ * @param block
+ * @param now
+ */
+void NetworkSim::adopt(size_t m, size_t block, double now) {
+    SimMiner *miner = &miners[m];
+    size_t fork = commonAncestor(miner->tip, block);
+    if (fork != miner->tip) {
+        size_t depth = block_height[miner->tip] - block_height[fork];
+        if (depth >= SIM_INITIAL_BLOCKS) {
+            depth = SIM_INITIAL_BLOCKS - 1;
+        }
+        reorg_depths[depth]++;
+        if (depth > max_reorg_depth) {
+            max_reorg_depth = depth;
+        }
+        miner->reorgs++;
+    }
+    miner->tip = block;
+    miner->epoch++;
+    // An exponential wait has no memory, so a pending Poisson find stays valid on the new tip
+    if (hash_mode) {
+        scheduleFind(m, now);
+    }
+}
+
+/**
+ * @brief Runs until the miners found the given number of blocks
+ *
+ * @param blocks
+ */
+void NetworkSim::run(size_t blocks) {
+    double t_start = omp_get_wtime();
+    if (hash_mode && hashers == NULL) {
+        hashers = new NonceHasher[num_miners];
+    }
+    for (size_t m = 0; m < num_miners; m++) {
+        scheduleFind(m, 0.0);
+    }
+    const size_t target = num_blocks + blocks;
+    SimEvent event;
+    while (num_blocks < target && queue.pop(event)) {
+        num_events++;
+        SimMiner *miner = &miners[event.miner];
+        if (event.kind == SIM_HASH) {
+            if (event.block == miner->epoch) {
+                hashChunk(event.miner, event.time);
+            }
+        } else if (event.kind == SIM_FIND) {
+            if (hash_mode && event.block != miner->epoch) {
+                continue;
+            }
+            size_t block = addBlock(miner->tip, event.miner, event.time);
+            if (hash_mode) {
+                memcpy(&block_digest[SHA256_DIGEST_LENGTH * block], miner->pending_digest, SHA256_DIGEST_LENGTH);
+            }
+            miner->found++;
+            miner->tip = block;
+            miner->epoch++;
+            scheduleFind(event.miner, event.time);
+            for (size_t j = 0; j < num_miners; j++) {
+                if (j != event.miner) {
+                    double delay = miner->latency + miners[j].latency;
+                    if (jitter > 0.0) {
+                        delay += exponential(jitter);
+                    }
+                    queue.push(event.time + delay, SIM_ARRIVE, j, block);
+                }
+            }
+        } else if (block_height[event.block] > block_height[miner->tip]) {
+            // Missing ancestors come along with the block, so a block that overtakes its parent is still taken
+            adopt(event.miner, event.block, event.time);
+        }
+    }
+    t_wall = omp_get_wtime() - t_start;
+}
+
+/**
+ * @brief Tip of the best chain over all blocks: the highest, the first found on ties
+ */
+size_t NetworkSim::bestTip() {
+    size_t best = 0;
+    for (size_t b = 1; b < num_blocks; b++) {
+        if (block_height[b] > block_height[best]) {
+            best = b;
+        }
+    }
+    return best;
+}
+
+static int sim_compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Settles the run against the best chain. Only blocks at least confirmations below its tip count, the newer
+ * ones could still be orphaned.
+ *
+ * @param confirmations
+ * @param settled - output, blocks at settled heights
+ * @param stale - output, settled blocks off the best chain
+ * @param finality - output, per settled best chain block: seconds from its find until every miner has seen the block
+ * confirmations above it, sorted
+ * @param num_finality - output
+ * @param main_by_miner - output, settled best chain blocks per miner
+ */
+void NetworkSim::summarize(size_t confirmations, size_t &settled, size_t &stale, double *finality, size_t &num_finality, size_t *main_by_miner) {
+    size_t tip = bestTip();
+    size_t height = block_height[tip];
+    size_t settled_height = height > confirmations ? height - confirmations : 0;
+    // Best chain by height
+    size_t *main = (size_t *)malloc(sizeof(size_t) * (height + 1));
+    for (size_t b = tip; b != SIM_NONE; b = block_parent[b]) {
+        main[block_height[b]] = b;
+    }
+    double max_latency = 0.0;
+    for (size_t m = 0; m < num_miners; m++) {
+        main_by_miner[m] = 0;
+        if (miners[m].latency > max_latency) {
+            max_latency = miners[m].latency;
+        }
+    }
+    settled = stale = 0;
+    for (size_t b = 1; b < num_blocks; b++) {
+        if (block_height[b] <= settled_height) {
+            settled++;
+            if (main[block_height[b]] != b) {
+                stale++;
+            } else {
+                main_by_miner[block_miner[b]]++;
+            }
+        }
+    }
+    num_finality = 0;
+    for (size_t h = 1; h <= settled_height; h++) {
+        size_t confirm = main[h + confirmations];
+        double seen = block_time[confirm] + miners[block_miner[confirm]].latency + max_latency;
+        finality[num_finality++] = seen - block_time[main[h]];
+    }
+    qsort(finality, num_finality, sizeof(double), sim_compare_doubles);
+    free(main);
+}
+
+/**
+ * @brief Prints orphan rates, the fork depth distribution and time to finality
+ *
+ * @param confirmations - blocks on top of a block before it counts as final
+ */
+void NetworkSim::printReport(size_t confirmations) {
+    size_t settled, stale, num_finality;
+    double *finality = (double *)malloc(sizeof(double) * num_blocks);
+    size_t *main_by_miner = (size_t *)malloc(sizeof(size_t) * num_miners);
+    summarize(confirmations, settled, stale, finality, num_finality, main_by_miner);
+    size_t tip = bestTip();
+    double total_hashrate = 0.0;
+    for (size_t m = 0; m < num_miners; m++) {
+        total_hashrate += miners[m].hashrate;
+    }
+
+    printf("Mode: %s\tThreshold: %lu\tMiners: %lu\tSeed: %llu\n", hash_mode ? "hash" : "poisson", threshold, num_miners, seed);
+    printf("Blocks: %lu\tHeight: %lu\tSimulated time: %.3lf s\tMean block interval: %.4lf s\n", num_blocks - 1, block_height[tip], block_time[tip], block_height[tip] > 0 ? block_time[tip] / block_height[tip] : 0.0);
+    printf("Events: %lu\tWall time: %.3lf s\tBlocks per minute: %.0lf", num_events, t_wall, t_wall > 0.0 ? (num_blocks - 1) / t_wall * 60.0 : 0.0);
+    if (hash_mode) {
+        printf("\tHashes: %lu", hashes);
+    }
+    printf("\n");
+    printf("Orphan rate: %.4lf%% (%lu of %lu blocks at least %lu deep)\n", settled > 0 ? 100.0 * stale / settled : 0.0, stale, settled, confirmations);
+    if (num_finality > 0) {
+        double mean = 0.0;
+        for (size_t i = 0; i < num_finality; i++) {
+            mean += finality[i];
+        }
+        printf("Time to finality (%lu confirmations seen by all): mean %.4lf s, p50 %.4lf s, p90 %.4lf s, p99 %.4lf s, max %.4lf s\n", confirmations, mean / num_finality, finality[num_finality / 2], finality[(size_t)(0.9 * (num_finality - 1))], finality[(size_t)(0.99 * (num_finality - 1))], finality[num_finality - 1]);
+    }
+
+    size_t total_reorgs = 0;
+    for (size_t d = 1; d <= max_reorg_depth; d++) {
+        total_reorgs += reorg_depths[d];
+    }
+    printf("Reorgs: %lu\tDeepest: %lu\n", total_reorgs, max_reorg_depth);
+    for (size_t d = 1; d <= max_reorg_depth; d++) {
+        if (reorg_depths[d] > 0) {
+            printf("  depth %3lu%s: %10lu  %8.4lf%%%s\n", d, d == SIM_INITIAL_BLOCKS - 1 ? "+" : " ", reorg_depths[d], 100.0 * reorg_depths[d] / total_reorgs, d >= confirmations ? "  undid a final block" : "");
+        }
+    }
+
+    size_t settled_main = 0;
+    for (size_t m = 0; m < num_miners; m++) {
+        settled_main += main_by_miner[m];
+    }
+    printf("\n%6s %12s %9s %9s %10s %10s %9s %9s %8s\n", "Miner", "Hashrate", "Share", "Latency", "Found", "Main", "Main %", "Orphan %", "Reorgs");
+    for (size_t m = 0; m < num_miners; m++) {
+        SimMiner *miner = &miners[m];
+        printf("%6lu %12.4g %8.3lf%% %9.4lf %10lu %10lu %8.3lf%% %8.3lf%% %8lu\n", m, miner->hashrate, 100.0 * miner->hashrate / total_hashrate, miner->latency, miner->found, main_by_miner[m], settled_main > 0 ? 100.0 * main_by_miner[m] / settled_main : 0.0, miner->found > 0 ? 100.0 * (1.0 - (double)main_by_miner[m] / miner->found) : 0.0, miner->reorgs);
+    }
+    free(finality);
+    free(main_by_miner);
+}
+
+/**
+ * @brief Appends the run's summary as one CSV row, with a header if the file is new, so sweeps collect in one file
+ *
+ * @param path
+ * @param confirmations
+ * @return int - 0 on success, -1 if the file cannot be written
+ */
+int NetworkSim::appendCsv(const char *path, size_t confirmations) {
+    FILE *f = fopen(path, "a");
+    if (f == NULL) {
+        printf("Cannot write %s\n", path);
+        return -1;
+    }
+    size_t settled, stale, num_finality;
+    double *finality = (double *)malloc(sizeof(double) * num_blocks);
+    size_t *main_by_miner = (size_t *)malloc(sizeof(size_t) * num_miners);
+    summarize(confirmations, settled, stale, finality, num_finality, main_by_miner);
+    double total_hashrate = 0.0, max_latency = 0.0, mean_finality = 0.0;
+    for (size_t m = 0; m < num_miners; m++) {
+        total_hashrate += miners[m].hashrate;
+        if (miners[m].latency > max_latency) {
+            max_latency = miners[m].latency;
+        }
+    }
+    for (size_t i = 0; i < num_finality; i++) {
+        mean_finality += finality[i];
+    }
+    size_t total_reorgs = 0;
+    for (size_t d = 1; d <= max_reorg_depth; d++) {
+        total_reorgs += reorg_depths[d];
+    }
+    fseek(f, 0, SEEK_END);
+    if (ftell(f) == 0) {
+        fprintf(f, "mode,threshold,miners,hashrate,max_latency,jitter,seed,blocks,confirmations,orphan_rate,reorgs,max_reorg_depth,finality_mean,finality_p50,finality_p99\n");
+    }
+    fprintf(f, "%s,%lu,%lu,%.6g,%.6g,%.6g,%llu,%lu,%lu,%.6lf,%lu,%lu", hash_mode ? "hash" : "poisson", threshold, num_miners, total_hashrate, max_latency, jitter, seed, num_blocks - 1, confirmations, settled > 0 ? (double)stale / settled : 0.0, total_reorgs, max_reorg_depth);
+    if (num_finality > 0) {
+        fprintf(f, ",%.6lf,%.6lf,%.6lf\n", mean_finality / num_finality, finality[num_finality / 2], finality[(size_t)(0.99 * (num_finality - 1))]);
+    } else {
+        fprintf(f, ",,,\n");
+    }
+    fclose(f);
+    free(finality);
+    free(main_by_miner);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,152 @@
+// Per-nonce block hashers behind one interface, so the backend can be picked at runtime. Every backend hashes the nonce
+// independent prefix of the preimage once per job: midstate keeps precomputed tails and skips the constant rounds,
+// openssl copies a hashed EVP digest context (and gets SHA-NI where OpenSSL finds it), teams runs the offload kernel's routine.
+#ifndef NONCE_HASHER_CPP
+#define NONCE_HASHER_CPP
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include "sha256_midstate.cpp"
+#include "teams_kernel.cpp"
+#include "utils.h"
+
+enum HasherBackend { HASHER_MIDSTATE, HASHER_OPENSSL, HASHER_TEAMS, NUM_HASHER_BACKENDS };
+const char *HASHER_BACKEND_NAMES[NUM_HASHER_BACKENDS] = {"midstate", "openssl", "teams"};
+
+/**
+ * @brief Looks up a hasher backend by name
+ *
+ * @param name - midstate, openssl or teams
+ * @return int - HasherBackend, -1 if unknown
+ */
+int hasher_backend_from_name(const char *name) {
+    for (int i = 0; i < NUM_HASHER_BACKENDS; i++) {
+        if (strcmp(name, HASHER_BACKEND_NAMES[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * NonceHasher class. Double SHA-256 of one job's preimage for any nonce, with the backend chosen at construction.
+ */
+class NonceHasher {
+   public:
+    NonceHasher(int backend = HASHER_MIDSTATE);
+    ~NonceHasher();
+    NonceHasher(const NonceHasher &) = delete;
+    NonceHasher &operator=(const NonceHasher &) = delete;
+    void setJob(size_t block_id, const char *prev_digest, const char *data, size_t threshold, unsigned char format = NONCE_FORMAT_ASCII);
+    /**
+     * @brief Double SHA-256 of the job's preimage with the given nonce
+     *
+     * @param nonce
+     * @param digest - 32 byte binary output
+     */
+    inline void hash(size_t nonce, unsigned char *digest) {
+        switch (backend) {
+            case HASHER_OPENSSL: hashOpenssl(nonce, digest); break;
+            case HASHER_TEAMS: hashTeams(nonce, digest); break;
+            default: midstate.hash(nonce, digest); break;
+        }
+    }
+
+    int backend;
+    size_t generation;  // job generation the hasher was set up for, kept by the caller
+
+   private:
+    Sha256Midstate midstate;
+    EVP_MD_CTX *prefix_ctx;  // openssl: the hashed prefix, copied into ctx for each nonce
+    EVP_MD_CTX *ctx;
+    size_t min_digits;
+    TeamsJob teams_job;
+
+    void hashOpenssl(size_t nonce, unsigned char *digest);
+    void hashTeams(size_t nonce, unsigned char *digest);
+};
+
+/**
+ * @brief Construct a new Nonce Hasher object
+ *
+ * @param backend - HasherBackend
+ */
+NonceHasher::NonceHasher(int backend) {
+    this->backend = backend;
+    generation = 0;
+    min_digits = 1;
+    prefix_ctx = NULL;
+    ctx = NULL;
+    memset(&teams_job, 0, sizeof(teams_job));
+}
+
+/**
+ * @brief Destroy the Nonce Hasher object
+ *
+ */
+NonceHasher::~NonceHasher() {
+    EVP_MD_CTX_free(prefix_ctx);
+    EVP_MD_CTX_free(ctx);
+}
+
+/**
+ * @brief Hashes the nonce independent prefix "[block_id|prev_digest|data|threshold|" for the selected backend
+ *
+ * @param block_id
+ * @param prev_digest
+ * @param data
+ * @param threshold - threshold stored in the block, as in the preimage
+ * @param format - chain format version of the nonce
+ */
+void NonceHasher::setJob(size_t block_id, const char *prev_digest, const char *data, size_t threshold, unsigned char format) {
+    switch (backend) {
+        case HASHER_OPENSSL: {
+            size_t len = strlen(prev_digest) + strlen(data) + 2 * SIZE_T_STR_BYTES + 8;
+            char *prefix = (char *)malloc(len);
+            size_t prefix_len = snprintf(prefix, len, "[%lu|%s|%s|%lu|", block_id, prev_digest, data, threshold);
+            if (prefix_ctx == NULL) {
+                prefix_ctx = EVP_MD_CTX_new();
+                ctx = EVP_MD_CTX_new();
+            }
+            EVP_DigestInit_ex(prefix_ctx, EVP_sha256(), NULL);
+            EVP_DigestUpdate(prefix_ctx, prefix, prefix_len);
+            free(prefix);
+            min_digits = (format == NONCE_FORMAT_FIXED) ? NONCE_FIXED_DIGITS : 1;
+            break;
+        }
+        case HASHER_TEAMS:
+            // The kernel's threshold check is not used, callers test the digest themselves
+            teams_job_init(teams_job, block_id, prev_digest, data, threshold, 0, format);
+            break;
+        default:
+            midstate.setJob(block_id, prev_digest, data, threshold, format);
+            break;
+    }
+}
+
+void NonceHasher::hashOpenssl(size_t nonce, unsigned char *digest) {
+    // Decimal digits of the nonce and the closing bracket, most significant first
+    char tail[MIDSTATE_MAX_DIGITS + 1];
+    size_t num_digits = 0;
+    tail[MIDSTATE_MAX_DIGITS] = ']';
+    do {
+        tail[MIDSTATE_MAX_DIGITS - 1 - num_digits++] = '0' + (nonce % 10);
+        nonce /= 10;
+    } while (nonce > 0 || num_digits < min_digits);
+
+    EVP_MD_CTX_copy_ex(ctx, prefix_ctx);
+    EVP_DigestUpdate(ctx, tail + MIDSTATE_MAX_DIGITS - num_digits, num_digits + 1);
+    EVP_DigestFinal_ex(ctx, digest, NULL);
+    SHA256(digest, SHA256_DIGEST_LENGTH, digest);
+}
+
+void NonceHasher::hashTeams(size_t nonce, unsigned char *digest) {
+    WORD state[8];
+    teams_hash_nonce(&teams_job, nonce, state);
+    for (unsigned char i = 0; i < 8; i++) {
+        WORDTOCHAR(state[i], &digest[i << 2]);
+    }
+}
+
+#endif
@@ -0,0 +1,460 @@
+// NUMA topology discovery from sysfs, thread pinning and per-node job copies, nonce dispensers and thread scratch.
+#ifndef NUMA_CPP
+#define NUMA_CPP
+
+#include <sched.h>
+#include <unistd.h>
+
+#include "trace.cpp"
+#include "utils.h"
+
+#define NUMA_MAX_NODES 64
+#define NUMA_MAX_CPUS 1024
+#ifndef CACHE_LINE_BYTES
+#define CACHE_LINE_BYTES 64
+#endif
+
+/**
+ * Immutable job: the chain tip fields and the threshold to mine them with. The pipeline publishes one per generation
+ * and each node keeps its own copy of the latest. Replaced, never modified, when a block is appended. Old copies stay
+ * on a retired list until exit, like old blocks stay in the chain.
+ */
+struct NumaJob {
+    size_t generation;
+    size_t threshold;  // leading zeros the job's nonces must meet
+    size_t block_id;
+    size_t block_threshold;
+    size_t nonce;  // nonce the tip was mined with, only kept to rebuild the tip
+    char *prev_digest;
+    char *data;
+    NumaJob *retired;
+};
+
+/**
+ * Per-node state. Allocated on huge pages preferring that node and first touched by a thread of that node, so it lives
+ * in node-local memory, followed by the scratch slots of the node's threads. Nonce ranges are interleaved across the
+ * nodes in use: node k of N hands out ranges k, k + N, k + 2N, ... from its cursor.
+ */
+struct alignas(CACHE_LINE_BYTES) NumaNode {
+    size_t cursor;
+    char pad0[CACHE_LINE_BYTES - sizeof(size_t)];
+    NumaJob *job;
+    omp_lock_t refresh_lock;
+    int node_id;
+    size_t index;  // rank among the nodes in use
+    size_t num_cpus;
+    int cpus[NUMA_MAX_CPUS];
+    size_t region_bytes;     // the node and its scratch slots
+    unsigned char *scratch;  // slot i belongs to the node's i-th thread
+};
+
+/**
+ * NumaTopology class. NUMA nodes and their CPUs, and the thread to CPU placement derived from them.
+ */
+class NumaTopology {
+   public:
+    NumaTopology();
+    ~NumaTopology();
+    void discover();
+    void place(size_t num_threads);
+    size_t numCpus() const;
+    size_t dropSiblings();
+    void pinThread(int tid);
+    NumaNode *initNode(int tid);
+    void setScratch(size_t bytes);
+    /**
+     * @brief The calling thread's scratch slot, on its node's huge pages. Valid after initNode() and the barrier.
+     */
+    void *threadScratch(int tid) { return nodes[thread_node[tid]]->scratch + thread_slot[tid] * scratch_bytes; }
+    NumaNode *nodeOf(int tid) { return nodes[thread_node[tid]]; }
+    NumaJob *refreshJob(NumaNode *node, const NumaJob *published);
+    void resetCursors();
+    /**
+     * @brief Takes the node's next range of span nonces. Ranges are interleaved across the nodes in use.
+     */
+    void nextRange(NumaNode *node, size_t span, size_t &begin, size_t &end) {
+        size_t index = node->index + num_active_nodes * __atomic_fetch_add(&node->cursor, 1, __ATOMIC_RELAXED);
+        begin = index * span;
+        end = begin + span;
+    }
+    void printPlacement();
+
+    size_t num_nodes;
+    size_t num_active_nodes;
+    size_t num_threads;
+    int pinning;
+
+   private:
+    int node_ids[NUMA_MAX_NODES];
+    size_t node_num_cpus[NUMA_MAX_NODES];
+    size_t node_rank[NUMA_MAX_NODES];
+    int *node_cpus[NUMA_MAX_NODES];
+    NumaNode *nodes[NUMA_MAX_NODES];
+    size_t *thread_node;
+    int *thread_cpu;
+    size_t *thread_slot;  // index among the threads of its node
+    size_t node_threads[NUMA_MAX_NODES];
+    size_t scratch_bytes;  // per thread, a multiple of the cache line
+};
+
+/**
+ * @brief Parses a sysfs cpulist such as "0-17,36-53"
+ *
+ * @param list
+ * @param cpus - output
+ * @param max
+ * @return size_t - number of CPUs
+ */
+size_t numa_parse_cpulist(const char *list, int *cpus, size_t max) {
+    size_t n = 0;
+    const char *p = list;
+    while (*p && *p != '\n' && n < max) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p) {
+            break;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+        for (long cpu = first; cpu <= last && n < max; cpu++) {
+            cpus[n++] = (int)cpu;
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return n;
+}
+
+/**
+ * @brief Reads a small sysfs file into buf
+ *
+ * @return int - 0 on success, -1 if the file does not exist
+ */
+int numa_read_sysfs(const char *path, char *buf, size_t len) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    size_t n = fread(buf, 1, len - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+    return 0;
+}
+
+/**
+ * @brief Checks if cpu is the first hardware thread of its core
+ *
+ * @param cpu
+ * @return int - 1 if it is, or if the sibling list cannot be read
+ */
+int numa_is_primary_thread(int cpu) {
+    char path[128];
+    char buf[256];
+    int siblings[NUMA_MAX_CPUS];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    if (numa_read_sysfs(path, buf, sizeof(buf)) != 0 || numa_parse_cpulist(buf, siblings, NUMA_MAX_CPUS) == 0) {
+        return 1;
+    }
+    return siblings[0] == cpu;
+}
+
+/**
+ * @brief Construct a new Numa Topology object
+ *
+ */
+NumaTopology::NumaTopology() {
+    num_nodes = 0;
+    num_active_nodes = 0;
+    num_threads = 0;
+    pinning = 1;
+    thread_node = NULL;
+    thread_cpu = NULL;
+    thread_slot = NULL;
+    scratch_bytes = 0;
+    for (size_t i = 0; i < NUMA_MAX_NODES; i++) {
+        node_cpus[i] = NULL;
+        nodes[i] = NULL;
+        node_threads[i] = 0;
+    }
+}
+
+/**
+ * @brief Destroy the Numa Topology object
+ *
+ */
+NumaTopology::~NumaTopology() {
+    for (size_t i = 0; i < num_nodes; i++) {
+        free(node_cpus[i]);
+        if (nodes[i] != NULL) {
+            NumaJob *job = nodes[i]->job;
+            while (job != NULL) {
+                NumaJob *retired = job->retired;
+                free(job->prev_digest);
+                free(job->data);
+                free(job);
+                job = retired;
+            }
+            omp_destroy_lock(&nodes[i]->refresh_lock);
+            huge_free(nodes[i], nodes[i]->region_bytes);
+        }
+    }
+    free(thread_node);
+    free(thread_cpu);
+    free(thread_slot);
+}
+
+/**
+ * @brief Discovers the NUMA nodes from /sys/devices/system/node. Falls back to one node holding every online CPU.
+ *
+ */
+void NumaTopology::discover() {
+    char path[128];
+    char buf[4096];
+    int cpus[NUMA_MAX_CPUS];
+    num_nodes = 0;
+    for (int node = 0; node < NUMA_MAX_NODES; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (numa_read_sysfs(path, buf, sizeof(buf)) != 0) {
+            continue;
+        }
+        size_t n = numa_parse_cpulist(buf, cpus, NUMA_MAX_CPUS);
+        if (n == 0) {
+            continue;  // memory-only node
+        }
+        node_ids[num_nodes] = node;
+        node_num_cpus[num_nodes] = n;
+        node_cpus[num_nodes] = (int *)malloc(sizeof(int) * n);
+        memcpy(node_cpus[num_nodes], cpus, sizeof(int) * n);
+        num_nodes++;
+    }
+
+    if (num_nodes == 0) {
+        size_t n = 0;
+        if (numa_read_sysfs("/sys/devices/system/cpu/online", buf, sizeof(buf)) == 0) {
+            n = numa_parse_cpulist(buf, cpus, NUMA_MAX_CPUS);
+        }
+        if (n == 0) {
+            n = sysconf(_SC_NPROCESSORS_ONLN);
+            for (size_t i = 0; i < n && i < NUMA_MAX_CPUS; i++) {
+                cpus[i] = (int)i;
+            }
+        }
+        node_ids[0] = 0;
+        node_num_cpus[0] = n;
+        node_cpus[0] = (int *)malloc(sizeof(int) * n);
+        memcpy(node_cpus[0], cpus, sizeof(int) * n);
+        num_nodes = 1;
+    }
+    // Respect an explicit OpenMP binding policy instead of overriding it
+    if (getenv("OMP_PROC_BIND") != NULL || getenv("OMP_PLACES") != NULL) {
+        pinning = 0;
+    }
+}
+
+/**
+ * @brief Number of CPUs threads can be placed on
+ *
+ * @return size_t
+ */
+size_t NumaTopology::numCpus() const {
+    size_t total = 0;
+    for (size_t i = 0; i < num_nodes; i++) {
+        total += node_num_cpus[i];
+    }
+    return total;
+}
+
+/**
+ * @brief Keeps only the first hardware thread of every core, so each placed thread gets a core of its own (SMT off).
+ * Call after discover() and before place().
+ *
+ * @return size_t - CPUs left
+ */
+size_t NumaTopology::dropSiblings() {
+    for (size_t i = 0; i < num_nodes; i++) {
+        size_t kept = 0;
+        for (size_t j = 0; j < node_num_cpus[i]; j++) {
+            if (numa_is_primary_thread(node_cpus[i][j])) {
+                node_cpus[i][kept++] = node_cpus[i][j];
+            }
+        }
+        if (kept > 0) {
+            node_num_cpus[i] = kept;
+        }
+    }
+    return numCpus();
+}
+
+/**
+ * @brief Assigns threads to nodes in contiguous blocks proportional to each node's CPU count. Within a node the
+ * threads take the first hardware thread of every core before any SMT sibling. Threads beyond the CPU count wrap
+ * around.
+ *
+ * @param num_threads
+ */
+void NumaTopology::place(size_t num_threads) {
+    this->num_threads = num_threads;
+    thread_node = (size_t *)realloc(thread_node, sizeof(size_t) * num_threads);
+    thread_cpu = (int *)realloc(thread_cpu, sizeof(int) * num_threads);
+    thread_slot = (size_t *)realloc(thread_slot, sizeof(size_t) * num_threads);
+    for (size_t i = 0; i < NUMA_MAX_NODES; i++) {
+        node_threads[i] = 0;
+    }
+    // Primary threads first, siblings last, each in discovery order
+    for (size_t i = 0; i < num_nodes; i++) {
+        int siblings[NUMA_MAX_CPUS];
+        size_t kept = 0;
+        size_t num_siblings = 0;
+        for (size_t j = 0; j < node_num_cpus[i]; j++) {
+            if (numa_is_primary_thread(node_cpus[i][j])) {
+                node_cpus[i][kept++] = node_cpus[i][j];
+            } else {
+                siblings[num_siblings++] = node_cpus[i][j];
+            }
+        }
+        memcpy(node_cpus[i] + kept, siblings, sizeof(int) * num_siblings);
+    }
+    size_t total_cpus = numCpus();
+    for (size_t t = 0; t < num_threads; t++) {
+        // Spread the threads over every node first so small thread counts still use every socket
+        size_t slot = (num_threads < total_cpus) ? t * total_cpus / num_threads : t % total_cpus;
+        size_t node = 0;
+        while (slot >= node_num_cpus[node]) {
+            slot -= node_num_cpus[node];
+            node++;
+        }
+        thread_node[t] = node;
+        thread_cpu[t] = node_cpus[node][node_threads[node] % node_num_cpus[node]];
+        thread_slot[t] = node_threads[node]++;
+    }
+    // Only nodes that got threads take part in the nonce interleaving
+    num_active_nodes = 0;
+    for (size_t i = 0; i < num_nodes; i++) {
+        node_rank[i] = num_active_nodes;
+        for (size_t t = 0; t < num_threads; t++) {
+            if (thread_node[t] == i) {
+                num_active_nodes++;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Pins the calling thread to its CPU. Call from inside the parallel region.
+ *
+ * @param tid
+ */
+void NumaTopology::pinThread(int tid) {
+    if (!pinning) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(thread_cpu[tid], &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+/**
+ * @brief Allocates the node's state and its threads' scratch slots on first use. The first thread placed on each node
+ * calls this after pinning, so first-touch puts the pages on that node. Call once per thread before a barrier.
+ *
+ * @param tid
+ * @return NumaNode* - NULL if the node was already initialized by another thread
+ */
+NumaNode *NumaTopology::initNode(int tid) {
+    size_t node = thread_node[tid];
+    NumaNode *mine = NULL;
+#pragma omp critical(numa_init)
+    {
+        if (nodes[node] == NULL) {
+            const size_t region_bytes = sizeof(NumaNode) + node_threads[node] * scratch_bytes;
+            void *mem = huge_alloc(region_bytes, pinning ? node_ids[node] : -1, "node and scratch");
+            if (mem != NULL) {
+                mine = (NumaNode *)mem;
+                mine->region_bytes = region_bytes;
+                mine->scratch = (unsigned char *)mem + sizeof(NumaNode);
+                mine->node_id = node_ids[node];
+                mine->index = node_rank[node];
+                mine->num_cpus = node_num_cpus[node];
+                memcpy(mine->cpus, node_cpus[node], sizeof(int) * (node_num_cpus[node] < NUMA_MAX_CPUS ? node_num_cpus[node] : NUMA_MAX_CPUS));
+                omp_init_lock(&mine->refresh_lock);
+                nodes[node] = mine;
+            }
+        }
+    }
+    return mine;
+}
+
+/**
+ * @brief Sets the size of every thread's scratch slot. Call after place() and before the threads call initNode().
+ *
+ * @param bytes - rounded up to whole cache lines
+ */
+void NumaTopology::setScratch(size_t bytes) { scratch_bytes = (bytes + CACHE_LINE_BYTES - 1) / CACHE_LINE_BYTES * CACHE_LINE_BYTES; }
+
+/**
+ * @brief Returns the node's copy of the job, making a new node-local copy of the published job if its generation moved.
+ * Only reads the published snapshot, never the chain, which the pipeline executor changes concurrently.
+ *
+ * @param node
+ * @param published - the pipeline's current job
+ * @return NumaJob*
+ */
+NumaJob *NumaTopology::refreshJob(NumaNode *node, const NumaJob *published) {
+    NumaJob *job = __atomic_load_n(&node->job, __ATOMIC_ACQUIRE);
+    if (job != NULL && job->generation == published->generation) {
+        return job;
+    }
+    TRACE_LOCK(omp_set_lock(&node->refresh_lock), "job refresh lock wait");
+    job = node->job;
+    if (job == NULL || job->generation != published->generation) {
+        NumaJob *fresh = (NumaJob *)malloc(sizeof(NumaJob));
+        fresh->generation = published->generation;
+        fresh->threshold = published->threshold;
+        fresh->block_id = published->block_id;
+        fresh->block_threshold = published->block_threshold;
+        fresh->nonce = published->nonce;
+        fresh->prev_digest = strdup(published->prev_digest);
+        fresh->data = strdup(published->data);
+        fresh->retired = job;
+        __atomic_store_n(&node->job, fresh, __ATOMIC_RELEASE);
+        job = fresh;
+    }
+    omp_unset_lock(&node->refresh_lock);
+    return job;
+}
+
+/**
+ * @brief Restarts every node's nonce sequence for a new block. Only called on the rare block found path.
+ *
+ */
+void NumaTopology::resetCursors() {
+    for (size_t i = 0; i < num_nodes; i++) {
+        if (nodes[i] != NULL) {
+            __atomic_store_n(&nodes[i]->cursor, 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * @brief Prints the nodes and the thread placement for the startup banner
+ *
+ */
+void NumaTopology::printPlacement() {
+    printf("NUMA nodes: %lu\n", num_nodes);
+    for (size_t i = 0; i < num_nodes; i++) {
+        printf("Node %d: %lu CPUs\tThreads:", node_ids[i], node_num_cpus[i]);
+        for (size_t t = 0; t < num_threads; t++) {
+            if (thread_node[t] == i) {
+                printf(" %lu->cpu%d", t, thread_cpu[t]);
+            }
+        }
+        printf("\n");
+    }
+    printf("Thread pinning: %s\n", pinning ? "on" : "off (OMP_PROC_BIND/OMP_PLACES set)");
+}
+
+#endif
@@ -0,0 +1,264 @@
+// Hardware performance counters through perf_event_open. Every instrumented thread opens its own counters (user space
+// only, so perf_event_paranoid up to 2 allows them) and reads them at phase boundaries: job switches of the mining
+// threads and block handoffs of the pipeline executor. Nothing is read per hash. Events the kernel or the machine does
+// not provide are left out and reported. Context switches happen in the kernel, where user-only counters cannot see
+// them, so they come from getrusage() and are always there.
+#ifndef PERF_COUNTERS_CPP
+#define PERF_COUNTERS_CPP
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+#ifndef CACHE_LINE_BYTES
+#define CACHE_LINE_BYTES 64
+#endif
+
+enum PerfEvent { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_CACHE_MISSES, PERF_BRANCH_MISSES, PERF_CONTEXT_SWITCHES, NUM_PERF_EVENTS };
+const char *PERF_EVENT_NAMES[NUM_PERF_EVENTS] = {"cycles", "instructions", "cache-misses", "branch-misses", "context-switches"};
+#define NUM_PERF_HW_EVENTS PERF_CONTEXT_SWITCHES  // events read through perf_event_open
+const unsigned long long PERF_EVENT_CONFIGS[NUM_PERF_HW_EVENTS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+enum PerfPhase { PERF_PHASE_HASH, PERF_PHASE_SWITCH, PERF_PHASE_HANDOFF, NUM_PERF_PHASES };
+const char *PERF_PHASE_NAMES[NUM_PERF_PHASES] = {"hash", "job switch", "handoff"};
+
+/**
+ * Counters of one thread. Only that thread opens and reads them.
+ */
+struct alignas(CACHE_LINE_BYTES) PerfSlot {
+    int fds[NUM_PERF_HW_EVENTS];
+    double start[NUM_PERF_EVENTS];
+    double totals[NUM_PERF_PHASES][NUM_PERF_EVENTS];
+    size_t hashes[NUM_PERF_PHASES];
+    size_t intervals[NUM_PERF_PHASES];
+    int opened;
+};
+
+/**
+ * PerfCounters class. One slot per instrumented thread.
+ */
+class PerfCounters {
+   public:
+    PerfCounters(size_t num_slots);
+    ~PerfCounters();
+    int openThread(size_t slot);
+    void closeThread(size_t slot);
+    void begin(size_t slot);
+    void end(size_t slot, int phase, size_t hashes);
+    void printReport(size_t num_miners);
+
+    int enabled;
+
+   private:
+    size_t num_slots;
+    PerfSlot *slots;
+    int available[NUM_PERF_EVENTS];  // opened on at least one thread
+    int open_errno[NUM_PERF_EVENTS];  // first failure, if the event never opened
+
+    double read(int fd);
+    static double contextSwitches();
+};
+
+/**
+ * @brief Construct a new Perf Counters object. Counters are only opened by threads that call openThread().
+ *
+ * @param num_slots - mining threads plus any helper threads
+ */
+PerfCounters::PerfCounters(size_t num_slots) {
+    this->num_slots = num_slots;
+    enabled = 1;
+    slots = new PerfSlot[num_slots];
+    memset(slots, 0, sizeof(PerfSlot) * num_slots);
+    for (size_t i = 0; i < num_slots; i++) {
+        for (int e = 0; e < NUM_PERF_HW_EVENTS; e++) {
+            slots[i].fds[e] = -1;
+        }
+    }
+    memset(available, 0, sizeof(available));
+    memset(open_errno, 0, sizeof(open_errno));
+}
+
+/**
+ * @brief Destroy the Perf Counters object
+ *
+ */
+PerfCounters::~PerfCounters() {
+    for (size_t i = 0; i < num_slots; i++) {
+        closeThread(i);
+    }
+    delete[] slots;
+}
+
+/**
+ * @brief Opens the counters of the calling thread
+ *
+ * @param slot
+ * @return int - number of hardware events opened
+ */
+int PerfCounters::openThread(size_t slot) {
+    if (!enabled || slot >= num_slots) {
+        return 0;
+    }
+    PerfSlot *s = &slots[slot];
+    int opened = 0;
+    for (int e = 0; e < NUM_PERF_HW_EVENTS; e++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_EVENT_CONFIGS[e];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        // Scaled by enabled / running time when the PMU multiplexes more events than it has counters
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        s->fds[e] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (s->fds[e] >= 0) {
+            __atomic_store_n(&available[e], 1, __ATOMIC_RELAXED);
+            opened++;
+        } else {
+            int expected = 0;
+            __atomic_compare_exchange_n(&open_errno[e], &expected, errno, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_store_n(&available[PERF_CONTEXT_SWITCHES], 1, __ATOMIC_RELAXED);
+    s->opened = 1;
+    begin(slot);
+    return opened;
+}
+
+/**
+ * @brief Closes the counters of a slot
+ *
+ * @param slot
+ */
+void PerfCounters::closeThread(size_t slot) {
+    for (int e = 0; e < NUM_PERF_HW_EVENTS; e++) {
+        if (slots[slot].fds[e] >= 0) {
+            close(slots[slot].fds[e]);
+            slots[slot].fds[e] = -1;
+        }
+    }
+    slots[slot].opened = 0;
+}
+
+/**
+ * @brief Current value of a counter, scaled for multiplexing
+ */
+double PerfCounters::read(int fd) {
+    unsigned long long values[3];  // value, time enabled, time running
+    if (::read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) {
+        return 0.0;
+    }
+    return (double)values[0] * values[1] / values[2];
+}
+
+/**
+ * @brief Voluntary and involuntary context switches of the calling thread so far
+ */
+double PerfCounters::contextSwitches() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) != 0) {
+        return 0.0;
+    }
+    return (double)(usage.ru_nvcsw + usage.ru_nivcsw);
+}
+
+/**
+ * @brief Starts a phase of the calling thread
+ *
+ * @param slot
+ */
+void PerfCounters::begin(size_t slot) {
+    PerfSlot *s = &slots[slot];
+    if (!s->opened) {
+        return;
+    }
+    for (int e = 0; e < NUM_PERF_HW_EVENTS; e++) {
+        if (s->fds[e] >= 0) {
+            s->start[e] = read(s->fds[e]);
+        }
+    }
+    s->start[PERF_CONTEXT_SWITCHES] = contextSwitches();
+}
+
+/**
+ * @brief Ends the phase of the calling thread started by the last begin() and adds it to the phase's totals
+ *
+ * @param slot
+ * @param phase - PerfPhase
+ * @param hashes - hashes computed in the phase
+ */
+void PerfCounters::end(size_t slot, int phase, size_t hashes) {
+    PerfSlot *s = &slots[slot];
+    if (!s->opened) {
+        return;
+    }
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+        if (e == PERF_CONTEXT_SWITCHES || s->fds[e] >= 0) {
+            double now = (e == PERF_CONTEXT_SWITCHES) ? contextSwitches() : read(s->fds[e]);
+            s->totals[phase][e] += now - s->start[e];
+            s->start[e] = now;
+        }
+    }
+    s->hashes[phase] += hashes;
+    s->intervals[phase]++;
+}
+
+/**
+ * @brief Prints IPC and per hash (or per interval) counts of every thread and phase. Slots from num_miners on are
+ * helper threads.
+ *
+ * @param num_miners
+ */
+void PerfCounters::printReport(size_t num_miners) {
+    int any = 0;
+    for (int e = 0; e < NUM_PERF_HW_EVENTS; e++) {
+        any |= available[e];
+    }
+    printf("\nPerf counters:");
+    if (!any) {
+        int paranoid = -1;
+        FILE *f = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+        if (f != NULL) {
+            if (fscanf(f, "%d", &paranoid) != 1) {
+                paranoid = -1;
+            }
+            fclose(f);
+        }
+        printf(" hardware events unavailable (%s, perf_event_paranoid %d)", strerror(open_errno[PERF_CYCLES]), paranoid);
+    }
+    for (int e = 0; any && e < NUM_PERF_HW_EVENTS; e++) {
+        if (!available[e]) {
+            printf(" no %s (%s)", PERF_EVENT_NAMES[e], strerror(open_errno[e]));
+        }
+    }
+    printf("\n");
+    for (size_t i = 0; i < num_slots; i++) {
+        PerfSlot *s = &slots[i];
+        for (int p = 0; p < NUM_PERF_PHASES; p++) {
+            if (s->intervals[p] == 0) {
+                continue;
+            }
+            const double *t = s->totals[p];
+            // Hashing phases are normalized per hash, the others per interval
+            const double per = s->hashes[p] > 0 ? (double)s->hashes[p] : (double)s->intervals[p];
+            if (i < num_miners) {
+                printf("TID: %lu\t", i);
+            } else {
+                printf("Helper: %lu\t", i - num_miners);
+            }
+            printf("%-10s\tIntervals: %lu\tHashes: %lu\tContext switches: %.0lf", PERF_PHASE_NAMES[p], s->intervals[p], s->hashes[p], t[PERF_CONTEXT_SWITCHES]);
+            if (any) {
+                const char *unit = s->hashes[p] > 0 ? "hash" : "interval";
+                printf("\tIPC: %.2lf\tCycles/%s: %.0lf\tInstr/%s: %.0lf\tCache misses/%s: %.3lf\tBranch misses/%s: %.3lf", t[PERF_CYCLES] > 0 ? t[PERF_INSTRUCTIONS] / t[PERF_CYCLES] : 0.0, unit, t[PERF_CYCLES] / per, unit, t[PERF_INSTRUCTIONS] / per, unit, t[PERF_CACHE_MISSES] / per, unit, t[PERF_BRANCH_MISSES] / per);
+            }
+            printf("\n");
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,362 @@
+// Columnar table of mined blocks read from run logs: the text the miners print per block (old logs in results/ and new
+// runs alike) and the JSON lines written with --telemetry. One row per completed block, tagged with its run (file) and
+// configuration, so block times can be grouped by configuration and threshold without re-reading the logs.
+#ifndef RESULTS_TABLE_CPP
+#define RESULTS_TABLE_CPP
+
+#include <dirent.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include "json.cpp"
+
+#define RESULTS_NAME_BYTES 128
+#define RESULTS_INITIAL_ROWS 256
+
+enum RunKind { RUN_SERIAL, RUN_PARALLEL, RUN_GPU, RUN_OTHER, NUM_RUN_KINDS };
+const char *RUN_KIND_NAMES[NUM_RUN_KINDS] = {"serial", "parallel", "gpu", "other"};
+
+/**
+ * Runs of the same setup, named after their log files without the run number (hpc_parallel16_2 -> hpc_parallel16)
+ */
+struct ResultsConfig {
+    char name[RESULTS_NAME_BYTES];
+    int kind;  // RunKind
+    size_t threads;
+    size_t runs;
+};
+
+/**
+ * One log file
+ */
+struct ResultsRun {
+    char name[RESULTS_NAME_BYTES];
+    size_t config;
+    size_t blocks;
+};
+
+/**
+ * ResultsTable class. Columns are separate arrays indexed by row.
+ */
+class ResultsTable {
+   public:
+    ResultsTable();
+    ~ResultsTable();
+    long ingest(const char *path, const char *config_name);
+    static void configName(const char *path, char *name);
+    static double expectedHashes(size_t threshold);
+
+    size_t num_rows;
+    size_t *row_run;
+    size_t *row_config;
+    size_t *row_block_id;
+    size_t *row_threshold;
+    size_t *row_nonce;
+    double *row_block_time;   // seconds from the job to the accepted nonce
+    double *row_total_time;   // seconds since the start of the run
+
+    size_t num_runs;
+    ResultsRun *runs;
+    size_t num_configs;
+    ResultsConfig *configs;
+
+   private:
+    size_t row_capacity;
+
+    long ingestFile(const char *path, const char *config_name);
+    long ingestText(FILE *f, size_t run);
+    long ingestJsonLines(FILE *f, size_t run);
+    size_t addRun(const char *path, const char *config_name);
+    void addRow(size_t run, size_t block_id, size_t threshold, size_t nonce, double block_time, double total_time);
+};
+
+ResultsTable::ResultsTable() {
+    num_rows = num_runs = num_configs = 0;
+    row_capacity = RESULTS_INITIAL_ROWS;
+    row_run = (size_t *)malloc(sizeof(size_t) * row_capacity);
+    row_config = (size_t *)malloc(sizeof(size_t) * row_capacity);
+    row_block_id = (size_t *)malloc(sizeof(size_t) * row_capacity);
+    row_threshold = (size_t *)malloc(sizeof(size_t) * row_capacity);
+    row_nonce = (size_t *)malloc(sizeof(size_t) * row_capacity);
+    row_block_time = (double *)malloc(sizeof(double) * row_capacity);
+    row_total_time = (double *)malloc(sizeof(double) * row_capacity);
+    runs = NULL;
+    configs = NULL;
+}
+
+ResultsTable::~ResultsTable() {
+    free(row_run);
+    free(row_config);
+    free(row_block_id);
+    free(row_threshold);
+    free(row_nonce);
+    free(row_block_time);
+    free(row_total_time);
+    free(runs);
+    free(configs);
+}
+
+/**
+ * @brief Configuration a log belongs to: the file name without directory, extension and trailing run number
+ * (hpc_serial3.txt -> hpc_serial, hpc_gpu1-4443489.txt -> hpc_gpu1, local_parallel4_10m.txt stays local_parallel4_10m).
+ * Names that do not say which miner ran keep their directory (results/gpu/Dsha256_out2.txt -> gpu/Dsha256_out).
+ *
+ * @param path
+ * @param name - RESULTS_NAME_BYTES output
+ */
+void ResultsTable::configName(const char *path, char *name) {
+    const char *base = strrchr(path, '/');
+    base = (base == NULL) ? path : base + 1;
+    snprintf(name, RESULTS_NAME_BYTES, "%s", base);
+    char *dot = strrchr(name, '.');
+    if (dot != NULL && dot != name) {
+        *dot = '\0';
+    }
+    size_t len = strlen(name);
+    size_t end = len;
+    while (end > 0 && name[end - 1] >= '0' && name[end - 1] <= '9') {
+        end--;
+    }
+    if (end > 0 && end < len) {
+        name[end] = '\0';
+        if (name[end - 1] == '_' || name[end - 1] == '-') {
+            name[end - 1] = '\0';
+        }
+    }
+    for (int k = 0; k < RUN_OTHER; k++) {
+        if (strstr(name, RUN_KIND_NAMES[k]) != NULL) {
+            return;
+        }
+    }
+    if (base == path) {
+        return;
+    }
+    const char *dir = base - 1;  // the slash before the file name
+    while (dir > path && dir[-1] != '/') {
+        dir--;
+    }
+    if (base - dir > 1) {
+        // The directory goes first, the stem keeps what is left of the buffer
+        size_t dir_len = (base - dir < RESULTS_NAME_BYTES - 1) ? (size_t)(base - dir) : RESULTS_NAME_BYTES - 1;
+        size_t stem_len = strlen(name);
+        if (stem_len > RESULTS_NAME_BYTES - 1 - dir_len) {
+            stem_len = RESULTS_NAME_BYTES - 1 - dir_len;
+        }
+        memmove(name + dir_len, name, stem_len);
+        memcpy(name, dir, dir_len);
+        name[dir_len + stem_len] = '\0';
+    }
+}
+
+/**
+ * @brief Expected number of hashes to find a digest with exactly threshold leading zero hex digits
+ */
+double ResultsTable::expectedHashes(size_t threshold) {
+    if (threshold >= 2 * 32) {
+        return pow(16.0, 64);
+    }
+    return pow(16.0, (double)threshold) * 16.0 / 15.0;
+}
+
+/**
+ * @brief Reads a log file, or every .txt and .jsonl file below a directory
+ *
+ * @param path
+ * @param config_name - configuration of the runs, NULL to name it after each file
+ * @return long - rows added, -1 if path cannot be read
+ */
+long ResultsTable::ingest(const char *path, const char *config_name) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        printf("Cannot read %s\n", path);
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return ingestFile(path, config_name);
+    }
+    struct dirent **entries;
+    int n = scandir(path, &entries, NULL, alphasort);
+    if (n < 0) {
+        printf("Cannot list %s\n", path);
+        return -1;
+    }
+    long added = 0;
+    for (int i = 0; i < n; i++) {
+        const char *name = entries[i]->d_name;
+        size_t len = strlen(name);
+        if (name[0] != '.') {
+            size_t child_len = strlen(path) + len + 2;
+            char *child = (char *)malloc(child_len);
+            snprintf(child, child_len, "%s/%s", path, name);
+            struct stat child_st;
+            int is_log = (len > 4 && strcmp(name + len - 4, ".txt") == 0) || (len > 6 && strcmp(name + len - 6, ".jsonl") == 0);
+            if (stat(child, &child_st) == 0 && (S_ISDIR(child_st.st_mode) || is_log)) {
+                long rows = ingest(child, config_name);
+                added += rows > 0 ? rows : 0;
+            }
+            free(child);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+    return added;
+}
+
+long ResultsTable::ingestFile(const char *path, const char *config_name) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        printf("Cannot read %s\n", path);
+        return -1;
+    }
+    size_t run = addRun(path, config_name);
+    // JSON lines start with an object, the text logs never do
+    int c = fgetc(f);
+    ungetc(c, f);
+    long added = (c == '{') ? ingestJsonLines(f, run) : ingestText(f, run);
+    fclose(f);
+    runs[run].blocks = added;
+    return added;
+}
+
+/**
+ * @brief Parses the block info printed by the miners. A row is added at every "Block runtime" line, with the id of the
+ * last "BLOCK ID" line, the nonce at the end of the last "Data" line and the leading zeros of the last "Digest" line as
+ * the threshold (the preimage holds the parent's threshold). The interrupted last block has no runtime line and is
+ * left out.
+ */
+long ResultsTable::ingestText(FILE *f, size_t run) {
+    ResultsConfig *config = &configs[runs[run].config];
+    char *line = NULL;
+    size_t cap = 0;
+    size_t block_id = 0, threshold = 0, nonce = 0;
+    long added = 0;
+    while (getline(&line, &cap, f) != -1) {
+        size_t value;
+        double block_time, total_time;
+        char digest[65];
+        if (sscanf(line, "Number of CPU threads: %lu", &value) == 1) {
+            config->threads = value;
+        } else if (sscanf(line, "BLOCK ID: %lu", &value) == 1) {
+            block_id = value;
+        } else if (sscanf(line, "Digest: %64s", digest) == 1) {
+            threshold = 0;
+            while (digest[threshold] == '0') {
+                threshold++;
+            }
+        } else if (strncmp(line, "Data:", 5) == 0) {
+            // Preimage "[block_id|prev_digest|data|threshold|nonce]": the nonce is the last field
+            char *close = strrchr(line, ']');
+            if (close == NULL) {
+                continue;
+            }
+            *close = '\0';
+            char *bar = strrchr(line, '|');
+            if (bar != NULL) {
+                nonce = strtoull(bar + 1, NULL, 10);
+            }
+        } else if (sscanf(line, "Block runtime: %lf seconds Total runtime: %lf", &block_time, &total_time) == 2) {
+            addRow(run, block_id, threshold, nonce, block_time, total_time);
+            added++;
+        } else if (config->kind == RUN_OTHER) {
+            // Build lines at the top of the HPC logs name the miner
+            if (strstr(line, "btc_miner_serial") != NULL) {
+                config->kind = RUN_SERIAL;
+            } else if (strstr(line, "btc_miner_gpu") != NULL) {
+                config->kind = RUN_GPU;
+            } else if (strstr(line, "btc_miner_parallel") != NULL) {
+                config->kind = RUN_PARALLEL;
+            }
+        }
+    }
+    free(line);
+    return added;
+}
+
+/**
+ * @brief Parses --telemetry output, one object per accepted block. Other JSON lines, such as a JSONL chain export, have
+ * no block_time and are skipped.
+ */
+long ResultsTable::ingestJsonLines(FILE *f, size_t run) {
+    ResultsConfig *config = &configs[runs[run].config];
+    char *line = NULL;
+    size_t cap = 0;
+    long added = 0;
+    while (getline(&line, &cap, f) != -1) {
+        JsonValue *record = json_parse(line);
+        if (record == NULL) {
+            continue;
+        }
+        JsonValue *block_time = json_get(record, "block_time");
+        if (block_time != NULL) {
+            if (json_get(record, "threads") != NULL) {
+                config->threads = json_size_t(json_get(record, "threads"));
+            }
+            addRow(run, json_size_t(json_get(record, "block_id")), json_size_t(json_get(record, "threshold")), json_size_t(json_get(record, "nonce")), json_double(block_time), json_double(json_get(record, "total_time")));
+            added++;
+        }
+        json_free(record);
+    }
+    free(line);
+    return added;
+}
+
+/**
+ * @brief Registers a log file under its configuration, creating the configuration on its first run
+ *
+ * @return size_t - run index
+ */
+size_t ResultsTable::addRun(const char *path, const char *config_name) {
+    char name[RESULTS_NAME_BYTES];
+    if (config_name != NULL) {
+        snprintf(name, RESULTS_NAME_BYTES, "%s", config_name);
+    } else {
+        configName(path, name);
+    }
+    size_t config = 0;
+    while (config < num_configs && strcmp(configs[config].name, name) != 0) {
+        config++;
+    }
+    if (config == num_configs) {
+        configs = (ResultsConfig *)realloc(configs, sizeof(ResultsConfig) * (num_configs + 1));
+        ResultsConfig *c = &configs[num_configs++];
+        memset(c, 0, sizeof(ResultsConfig));
+        memcpy(c->name, name, RESULTS_NAME_BYTES);
+        c->kind = RUN_OTHER;
+        for (int k = 0; k < RUN_OTHER; k++) {
+            if (strstr(name, RUN_KIND_NAMES[k]) != NULL) {
+                c->kind = k;
+            }
+        }
+        c->threads = 1;
+    }
+    configs[config].runs++;
+    runs = (ResultsRun *)realloc(runs, sizeof(ResultsRun) * (num_runs + 1));
+    ResultsRun *r = &runs[num_runs];
+    snprintf(r->name, RESULTS_NAME_BYTES, "%s", path);
+    r->config = config;
+    r->blocks = 0;
+    return num_runs++;
+}
+
+void ResultsTable::addRow(size_t run, size_t block_id, size_t threshold, size_t nonce, double block_time, double total_time) {
+    if (num_rows == row_capacity) {
+        row_capacity *= 2;
+        row_run = (size_t *)realloc(row_run, sizeof(size_t) * row_capacity);
+        row_config = (size_t *)realloc(row_config, sizeof(size_t) * row_capacity);
+        row_block_id = (size_t *)realloc(row_block_id, sizeof(size_t) * row_capacity);
+        row_threshold = (size_t *)realloc(row_threshold, sizeof(size_t) * row_capacity);
+        row_nonce = (size_t *)realloc(row_nonce, sizeof(size_t) * row_capacity);
+        row_block_time = (double *)realloc(row_block_time, sizeof(double) * row_capacity);
+        row_total_time = (double *)realloc(row_total_time, sizeof(double) * row_capacity);
+    }
+    row_run[num_rows] = run;
+    row_config[num_rows] = runs[run].config;
+    row_block_id[num_rows] = block_id;
+    row_threshold[num_rows] = threshold;
+    row_nonce[num_rows] = nonce;
+    row_block_time[num_rows] = block_time;
+    row_total_time[num_rows] = total_time;
+    num_rows++;
+}
+
+#endif
@@ -0,0 +1,361 @@
+// Run controller. Ends a run on a wall-clock, block-count or hash-count budget instead of an external kill. A small
+// monitor thread watches the deadline and the hash counters; blocks are counted by whoever appends them. Reaching a
+// budget only clears the miners' running flag: the backend then drains (a found nonce is still verified and appended,
+// the pipeline empties its queue, exports, telemetry and checkpoints are flushed) and the controller closes the run
+// with one summary record, so runs with the same budget end at the same point and report the same fields.
+#ifndef RUN_CONTROLLER_CPP
+#define RUN_CONTROLLER_CPP
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "hex.cpp"
+#include "numa.cpp"
+#include "utils.h"
+
+#define RUN_MAX_SLOTS 1024
+#define RUN_HASH_TICK 0.001  // seconds between hash budget checks
+#define RUN_IDLE_TICK 1.0    // without a hash budget the monitor only waits for the deadline
+
+enum RunStop { STOP_NONE, STOP_INTERRUPT, STOP_TIME, STOP_BLOCKS, STOP_HASHES, STOP_FINISHED, NUM_RUN_STOPS };
+const char *RUN_STOP_NAMES[NUM_RUN_STOPS] = {"running", "interrupt", "time", "blocks", "hashes", "finished"};
+
+/**
+ * Hashes of one mining thread, written by that thread only
+ */
+struct alignas(CACHE_LINE_BYTES) RunCounter {
+    size_t hashes;
+};
+
+/**
+ * What a run ended on, for its summary. Runs on the local chain name its tip. Batch and pool runs mine other chains, so
+ * they name the batch aggregate or the pool's last job instead and have no tip.
+ */
+struct RunTip {
+    Blockchain *chain;    // local chain, NULL if the run did not mine into it
+    int has_threshold;    // threshold is of the job the run ended on (local chain or pool job)
+    size_t threshold;
+    size_t num_chains;    // batch: chains mined, chains_done of them finished. 0 otherwise
+    size_t chains_done;
+    const char *job_id;   // pool: last job, NULL otherwise
+    size_t job_block_id;
+};
+
+/**
+ * @brief Tip of the local chain and the threshold of the job the run ended on
+ */
+RunTip run_tip_chain(Blockchain &chain, size_t threshold) {
+    RunTip tip;
+    memset(&tip, 0, sizeof(tip));
+    tip.chain = &chain;
+    tip.has_threshold = 1;
+    tip.threshold = threshold;
+    return tip;
+}
+
+/**
+ * @brief Aggregate of a chain batch
+ */
+RunTip run_tip_batch(size_t num_chains, size_t chains_done) {
+    RunTip tip;
+    memset(&tip, 0, sizeof(tip));
+    tip.num_chains = num_chains;
+    tip.chains_done = chains_done;
+    return tip;
+}
+
+/**
+ * @brief Last job of a pool run
+ *
+ * @param job_id - NULL if no job was received
+ * @param block_id
+ * @param threshold
+ */
+RunTip run_tip_job(const char *job_id, size_t block_id, size_t threshold) {
+    RunTip tip;
+    memset(&tip, 0, sizeof(tip));
+    tip.job_id = job_id;
+    tip.job_block_id = block_id;
+    tip.has_threshold = job_id != NULL;
+    tip.threshold = threshold;
+    return tip;
+}
+
+/**
+ * RunController class. Budgets of 0 are unlimited.
+ */
+class RunController {
+   public:
+    RunController(double time_limit, size_t max_blocks, size_t max_hashes);
+    ~RunController();
+    void start(unsigned char *running, size_t num_slots);
+    void finish();
+    int blockDone();
+    static int blockHook(void *arg) { return ((RunController *)arg)->blockDone(); }
+    static void interrupt();
+    void requestStop(int reason);
+    int isStopping() { return __atomic_load_n(&reason, __ATOMIC_ACQUIRE) != STOP_NONE; }
+
+    /**
+     * @brief Counts one hash of the thread in slot. Only that thread may call it
+     */
+    inline void countHash(size_t slot) { __atomic_store_n(&counters[slot].hashes, counters[slot].hashes + 1, __ATOMIC_RELAXED); }
+    inline void countHashes(size_t slot, size_t n) { __atomic_store_n(&counters[slot].hashes, counters[slot].hashes + n, __ATOMIC_RELAXED); }
+    void setHashSource(size_t (*source)(void *arg), void *arg) {
+        hash_source = source;
+        hash_source_arg = arg;
+    }
+    size_t totalHashes();
+    void printSummary(const char *backend, const RunTip &tip);
+    void writeSummary(FILE *f, const char *backend, const RunTip &tip);
+
+    double time_limit;
+    size_t max_blocks;
+    size_t max_hashes;
+
+   private:
+    unsigned char *running;
+    RunCounter *counters;
+    size_t num_slots;
+    size_t (*hash_source)(void *arg);  // hashes counted elsewhere, e.g. by worker processes
+    void *hash_source_arg;
+
+    int reason;  // RunStop, set once
+    size_t blocks;
+    double t_start;
+    double t_stop;  // when the budget was reached or the interrupt seen
+    double t_end;   // when the drain finished
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int monitoring;
+    static void *monitorLoop(void *arg);
+};
+
+static RunController *active_controller = NULL;  // between start() and finish(), for the signal handler
+
+/**
+ * @brief Construct a new Run Controller object
+ *
+ * @param time_limit - seconds from start(), 0: none
+ * @param max_blocks - 0: none
+ * @param max_hashes - 0: none
+ */
+RunController::RunController(double time_limit, size_t max_blocks, size_t max_hashes) {
+    this->time_limit = time_limit;
+    this->max_blocks = max_blocks;
+    this->max_hashes = max_hashes;
+    running = NULL;
+    counters = NULL;
+    num_slots = 0;
+    hash_source = NULL;
+    hash_source_arg = NULL;
+    reason = STOP_NONE;
+    blocks = 0;
+    t_start = t_stop = t_end = 0.0;
+    monitoring = 0;
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&wake, NULL);
+}
+
+/**
+ * @brief Destroy the Run Controller object
+ *
+ */
+RunController::~RunController() {
+    free(counters);
+    counters = NULL;
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&wake);
+}
+
+/**
+ * @brief Starts the budgets and the monitor thread. Call right before mining, so every backend's time budget
+ * covers mining only.
+ *
+ * @param running - cleared when a budget is reached
+ * @param num_slots - hash counters, one per mining thread
+ */
+void RunController::start(unsigned char *running, size_t num_slots) {
+    this->running = running;
+    this->num_slots = num_slots < 1 ? 1 : (num_slots > RUN_MAX_SLOTS ? RUN_MAX_SLOTS : num_slots);
+    counters = (RunCounter *)aligned_alloc(CACHE_LINE_BYTES, sizeof(RunCounter) * this->num_slots);
+    memset(counters, 0, sizeof(RunCounter) * this->num_slots);
+    t_start = omp_get_wtime();
+    monitoring = 1;
+    pthread_create(&thread, NULL, monitorLoop, this);
+    __atomic_store_n(&active_controller, this, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Joins the monitor thread and closes the run. Call after the backend has drained.
+ *
+ */
+void RunController::finish() {
+    __atomic_store_n(&active_controller, (RunController *)NULL, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&lock);
+    monitoring = 0;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+    // Stopped without a budget: interrupted, or the backend ran out of work (batch done, pool closed)
+    requestStop(__atomic_load_n(running, __ATOMIC_RELAXED) ? STOP_FINISHED : STOP_INTERRUPT);
+    t_end = omp_get_wtime();
+}
+
+/**
+ * @brief Records an interrupt (SIGINT) as the end of the running run, if any. Called from the signal handler, so the
+ * drain is timed from the interrupt rather than from when the backend noticed it.
+ *
+ */
+void RunController::interrupt() {
+    RunController *controller = __atomic_load_n(&active_controller, __ATOMIC_ACQUIRE);
+    if (controller != NULL) {
+        controller->requestStop(STOP_INTERRUPT);
+    }
+}
+
+/**
+ * @brief Ends the run for reason and stops the miners. Only the first reason counts.
+ *
+ * @param reason - RunStop
+ */
+void RunController::requestStop(int reason) {
+    int none = STOP_NONE;
+    if (!__atomic_compare_exchange_n(&this->reason, &none, reason, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    t_stop = omp_get_wtime();
+    switch (reason) {
+        case STOP_TIME: printf("\nRun controller: time limit of %.3lf s reached. Draining...\n", time_limit); break;
+        case STOP_BLOCKS: printf("\nRun controller: block limit of %lu reached. Draining...\n", max_blocks); break;
+        case STOP_HASHES: printf("\nRun controller: hash limit of %lu reached. Draining...\n", max_hashes); break;
+        default: break;
+    }
+    __atomic_store_n(running, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Counts a block appended to the chain. Called by the thread that appended it, before the next job goes out.
+ *
+ * @return int - 1 to publish the next job, 0 if the run is ending
+ */
+int RunController::blockDone() {
+    const size_t done = __atomic_add_fetch(&blocks, 1, __ATOMIC_RELAXED);
+    if (max_blocks > 0 && done >= max_blocks) {
+        requestStop(STOP_BLOCKS);
+    }
+    return !isStopping();
+}
+
+/**
+ * @brief Hashes of every slot and of the hash source
+ */
+size_t RunController::totalHashes() {
+    size_t total = hash_source != NULL ? hash_source(hash_source_arg) : 0;
+    for (size_t i = 0; i < num_slots; i++) {
+        total += __atomic_load_n(&counters[i].hashes, __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+/**
+ * @brief Watches the deadline and the hash budget
+ *
+ * @param arg - RunController*
+ * @return void*
+ */
+void *RunController::monitorLoop(void *arg) {
+    RunController *self = (RunController *)arg;
+    const double tick = self->max_hashes > 0 ? RUN_HASH_TICK : RUN_IDLE_TICK;
+    pthread_mutex_lock(&self->lock);
+    while (self->monitoring && !self->isStopping()) {
+        const double now = omp_get_wtime();
+        if (self->time_limit > 0 && now - self->t_start >= self->time_limit) {
+            self->requestStop(STOP_TIME);
+            break;
+        }
+        if (self->max_hashes > 0 && self->totalHashes() >= self->max_hashes) {
+            self->requestStop(STOP_HASHES);
+            break;
+        }
+        // Sleep a tick, or exactly to the deadline if it is closer
+        double wait = tick;
+        if (self->time_limit > 0 && self->t_start + self->time_limit - now < wait) {
+            wait = self->t_start + self->time_limit - now;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        long nsec = deadline.tv_nsec + (long)(wait * 1e9);
+        deadline.tv_sec += nsec / 1000000000L;
+        deadline.tv_nsec = nsec % 1000000000L;
+        pthread_cond_timedwait(&self->wake, &self->lock, &deadline);
+    }
+    pthread_mutex_unlock(&self->lock);
+    return NULL;
+}
+
+/**
+ * @brief Prints the summary of a finished run
+ *
+ * @param backend - name for the record
+ * @param tip - what the run ended on
+ */
+void RunController::printSummary(const char *backend, const RunTip &tip) {
+    const double elapsed = t_stop - t_start;
+    const size_t hashes = totalHashes();
+    printf("\nRun summary: %s backend, stopped by %s after %.6lf s, drained in %.3lf ms\n", backend, RUN_STOP_NAMES[reason], elapsed, (t_end - t_stop) * 1e3);
+    printf("Blocks: %lu\tHashes: %lu\tHashrate: %.0lf H/s\t", blocks, hashes, elapsed > 0 ? hashes / elapsed : 0.0);
+    if (tip.chain != NULL) {
+        char digest[2 * SHA256_DIGEST_LENGTH + 1];
+        hex_encode(tip.chain->getCurrentBlock()->prev_digest, SHA256_DIGEST_LENGTH, digest);
+        digest[2 * SHA256_DIGEST_LENGTH] = '\0';
+        printf("Threshold: %lu\tTip: %lu %s\n", tip.threshold, tip.chain->getCurrentBlock()->block_id, digest);
+    } else if (tip.num_chains > 0) {
+        printf("Chains: %lu\tFinished: %lu\tTip: none\n", tip.num_chains, tip.chains_done);
+    } else if (tip.job_id != NULL) {
+        printf("Job: %s\tBlock: %lu\tThreshold: %lu\tTip: none\n", tip.job_id, tip.job_block_id, tip.threshold);
+    } else {
+        printf("Tip: none\n");
+    }
+}
+
+/**
+ * @brief Writes the summary as one JSON line, after the telemetry blocks or to a summary log. Every record has the
+ * same fields; the ones that do not apply to the run are null.
+ *
+ * @param f
+ * @param backend
+ * @param tip
+ */
+void RunController::writeSummary(FILE *f, const char *backend, const RunTip &tip) {
+    const double elapsed = t_stop - t_start;
+    const size_t hashes = totalHashes();
+    char threshold[24] = "null", tip_height[24] = "null", tip_digest[2 * SHA256_DIGEST_LENGTH + 3] = "null";
+    char chains[24] = "null", chains_done[24] = "null", job_id[96] = "null", job_block_id[24] = "null";
+    if (tip.has_threshold) {
+        snprintf(threshold, sizeof(threshold), "%lu", tip.threshold);
+    }
+    if (tip.chain != NULL) {
+        snprintf(tip_height, sizeof(tip_height), "%lu", tip.chain->getCurrentBlock()->block_id);
+        tip_digest[0] = '"';
+        hex_encode(tip.chain->getCurrentBlock()->prev_digest, SHA256_DIGEST_LENGTH, tip_digest + 1);
+        tip_digest[2 * SHA256_DIGEST_LENGTH + 1] = '"';
+        tip_digest[2 * SHA256_DIGEST_LENGTH + 2] = '\0';
+    }
+    if (tip.num_chains > 0) {
+        snprintf(chains, sizeof(chains), "%lu", tip.num_chains);
+        snprintf(chains_done, sizeof(chains_done), "%lu", tip.chains_done);
+    }
+    if (tip.job_id != NULL) {
+        snprintf(job_id, sizeof(job_id), "\"%.*s\"", (int)sizeof(job_id) - 3, tip.job_id);
+        snprintf(job_block_id, sizeof(job_block_id), "%lu", tip.job_block_id);
+    }
+    fprintf(f, "{\"summary\":{\"backend\":\"%s\",\"stop\":\"%s\",\"elapsed\":%.6lf,\"drain\":%.6lf,\"blocks\":%lu,\"hashes\":%lu,\"hashrate\":%.0lf,\"threshold\":%s,\"tip_height\":%s,\"tip_digest\":%s,\"chains\":%s,\"chains_done\":%s,\"job_id\":%s,\"job_block_id\":%s,\"time_limit\":%.6lf,\"max_blocks\":%lu,\"max_hashes\":%lu}}\n",
+            backend, RUN_STOP_NAMES[reason], elapsed, t_end - t_stop, blocks, hashes, elapsed > 0 ? hashes / elapsed : 0.0, threshold, tip_height, tip_digest, chains, chains_done, job_id, job_block_id, time_limit, max_blocks, max_hashes);
+    fflush(f);
+}
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef SHA256_CPP
+#define SHA256_CPP
+
 #include "utils.h"
 
 #pragma warning(disable : 4996)
@@ -24,106 +27,117 @@
     {                                                                                                                              \
         *(x) = ((WORD) * ((str) + 3)) | ((WORD) * ((str) + 2) << 8) | ((WORD) * ((str) + 1) << 16) | ((WORD) * ((str) + 0) << 24); \
     }
+
+// Round constants. constexpr so every unrolled round folds its constant into an immediate operand.
+constexpr WORD SHA256_K[64] = {0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                               0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                               0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                               0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                               0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                               0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                               0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                               0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+constexpr WORD SHA256_IV[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+#define SHA256_INLINE inline __attribute__((always_inline))
+
+/**
+ * Message schedule word R, computed in place in a 16 word ring so the schedule never needs a 64 word array.
+ */
+template <int R, bool EXPAND = (R >= 16)>
+struct Sha256Schedule {
+    static SHA256_INLINE WORD get(WORD* w) { return w[R]; }
+};
+
+template <int R>
+struct Sha256Schedule<R, true> {
+    static SHA256_INLINE WORD get(WORD* w) {
+        w[R & 15] += SIGMA1(w[(R - 2) & 15]) + w[(R - 7) & 15] + SIGMA0(w[(R - 15) & 15]);
+        return w[R & 15];
+    }
+};
+
+/**
+ * Rounds R..63, fully unrolled at compile time. Instead of shifting a..h through memory after every round, the next
+ * round is instantiated with the roles rotated by one, so only d and h are written and all eight stay in registers.
+ * Starting at R > 0 resumes from a state precomputed for the first R rounds. With PRESCHEDULED, w holds K[t] + W[t]
+ * for all 64 rounds instead of the 16 word ring.
+ */
+template <int R, bool PRESCHEDULED = false>
+struct Sha256Rounds {
+    static SHA256_INLINE void run(WORD* w, WORD* sha256H, WORD& a, WORD& b, WORD& c, WORD& d, WORD& e, WORD& f, WORD& g, WORD& h) {
+        WORD temp1 = h + SUM1(e) + CH(e, f, g) + (PRESCHEDULED ? w[R] : SHA256_K[R] + Sha256Schedule<R>::get(w));
+        WORD temp2 = SUM0(a) + MAJ(a, b, c);
+        d += temp1;
+        h = temp1 + temp2;
+        Sha256Rounds<R + 1, PRESCHEDULED>::run(w, sha256H, h, a, b, c, d, e, f, g);
+    }
+};
+
+/**
+ * After the last round the roles are back in order, whatever round the block was started from. Adds the working
+ * variables into the state.
+ */
+template <bool PRESCHEDULED>
+struct Sha256Rounds<64, PRESCHEDULED> {
+    static SHA256_INLINE void run(WORD*, WORD* sha256H, WORD& a, WORD& b, WORD& c, WORD& d, WORD& e, WORD& f, WORD& g, WORD& h) {
+        sha256H[0] += a;
+        sha256H[1] += b;
+        sha256H[2] += c;
+        sha256H[3] += d;
+        sha256H[4] += e;
+        sha256H[5] += f;
+        sha256H[6] += g;
+        sha256H[7] += h;
+    }
+};
+
+/**
+ * @brief Compresses one 64 byte block into the state
+ *
+ * @param sha256H - state, updated in place
+ * @param w - the block as 16 big-endian words. Overwritten by the schedule
+ */
+SHA256_INLINE void sha256_compress(WORD* sha256H, WORD* w) {
+    WORD a = sha256H[0], b = sha256H[1], c = sha256H[2], d = sha256H[3];
+    WORD e = sha256H[4], f = sha256H[5], g = sha256H[6], h = sha256H[7];
+    Sha256Rounds<0>::run(w, sha256H, a, b, c, d, e, f, g, h);
+}
+
+/**
+ * @brief SHA-256 of a 32 byte digest given as 8 words, i.e. the second hash of a double SHA-256. The padding words
+ * 8..15 are compile-time constants, so the compiler folds the schedule terms and round inputs built from them.
+ *
+ * @param words - first hash state
+ * @param sha256H - output state
+ */
+SHA256_INLINE void sha256_digest_block(const WORD* words, WORD* sha256H) {
+    WORD w[16] = {words[0], words[1], words[2], words[3], words[4], words[5], words[6], words[7], 0x80000000, 0, 0, 0, 0, 0, 0, 256};
+    for (unsigned char i = 0; i < 8; i++) {
+        sha256H[i] = SHA256_IV[i];
+    }
+    sha256_compress(sha256H, w);
+}
 #if RUN_ON_TARGET
 #pragma omp end declare target
 #endif
 
+/**
+ * @brief Returns a heap copy of the round constants, for code that maps them to a device explicitly
+ *
+ * @return WORD*
+ */
 WORD* InitializeK() {
     WORD* k = (WORD*)malloc(sizeof(WORD) * 64);
-    k[0] = 0x428a2f98;
-    k[1] = 0x71374491;
-    k[2] = 0xb5c0fbcf;
-    k[3] = 0xe9b5dba5;
-    k[4] = 0x3956c25b;
-    k[5] = 0x59f111f1;
-    k[6] = 0x923f82a4;
-    k[7] = 0xab1c5ed5;
-    k[8] = 0xd807aa98;
-    k[9] = 0x12835b01;
-    k[10] = 0x243185be;
-    k[11] = 0x550c7dc3;
-    k[12] = 0x72be5d74;
-    k[13] = 0x80deb1fe;
-    k[14] = 0x9bdc06a7;
-    k[15] = 0xc19bf174;
-    k[16] = 0xe49b69c1;
-    k[17] = 0xefbe4786;
-    k[18] = 0x0fc19dc6;
-    k[19] = 0x240ca1cc;
-    k[20] = 0x2de92c6f;
-    k[21] = 0x4a7484aa;
-    k[22] = 0x5cb0a9dc;
-    k[23] = 0x76f988da;
-    k[24] = 0x983e5152;
-    k[25] = 0xa831c66d;
-    k[26] = 0xb00327c8;
-    k[27] = 0xbf597fc7;
-    k[28] = 0xc6e00bf3;
-    k[29] = 0xd5a79147;
-    k[30] = 0x06ca6351;
-    k[31] = 0x14292967;
-    k[32] = 0x27b70a85;
-    k[33] = 0x2e1b2138;
-    k[34] = 0x4d2c6dfc;
-    k[35] = 0x53380d13;
-    k[36] = 0x650a7354;
-    k[37] = 0x766a0abb;
-    k[38] = 0x81c2c92e;
-    k[39] = 0x92722c85;
-    k[40] = 0xa2bfe8a1;
-    k[41] = 0xa81a664b;
-    k[42] = 0xc24b8b70;
-    k[43] = 0xc76c51a3;
-    k[44] = 0xd192e819;
-    k[45] = 0xd6990624;
-    k[46] = 0xf40e3585;
-    k[47] = 0x106aa070;
-    k[48] = 0x19a4c116;
-    k[49] = 0x1e376c08;
-    k[50] = 0x2748774c;
-    k[51] = 0x34b0bcb5;
-    k[52] = 0x391c0cb3;
-    k[53] = 0x4ed8aa4a;
-    k[54] = 0x5b9cca4f;
-    k[55] = 0x682e6ff3;
-    k[56] = 0x748f82ee;
-    k[57] = 0x78a5636f;
-    k[58] = 0x84c87814;
-    k[59] = 0x8cc70208;
-    k[60] = 0x90befffa;
-    k[61] = 0xa4506ceb;
-    k[62] = 0xbef9a3f7;
-    k[63] = 0xc67178f2;
+    memcpy(k, SHA256_K, sizeof(WORD) * 64);
     return k;
 }
 
 #if RUN_ON_TARGET
 #pragma omp declare target
 #endif
-void WordExtend(WORD* words) {
-    for (unsigned char i = 16; i < 64; i++)
-        words[i] = SIGMA1(words[i - 2]) + words[i - 7] + SIGMA0(words[i - 15]) + words[i - 16];
-}
-
-void WordCompress(WORD* abcdefgh, const WORD* sha256K, WORD* expandedWords) {
-    WORD temp1, temp2;
-    for (unsigned char i = 0; i < 64; i++) {
-        temp1 = abcdefgh[7] + SUM1(abcdefgh[4]) + CH(abcdefgh[4], abcdefgh[5], abcdefgh[6]) + sha256K[i] + expandedWords[i];
-        temp2 = SUM0(abcdefgh[0]) + MAJ(abcdefgh[0], abcdefgh[1], abcdefgh[2]);
-        abcdefgh[7] = abcdefgh[6];
-        abcdefgh[6] = abcdefgh[5];
-        abcdefgh[5] = abcdefgh[4];
-        abcdefgh[4] = abcdefgh[3] + temp1;
-        abcdefgh[3] = abcdefgh[2];
-        abcdefgh[2] = abcdefgh[1];
-        abcdefgh[1] = abcdefgh[0];
-        abcdefgh[0] = temp1 + temp2;
-    }
-}
-
-void Transform(const unsigned char* message, WORD blockNum, const WORD* sha256K, WORD* sha256H) {
-    WORD expandedWords[64];
-    WORD abcdefgh[8];
+void Transform(const unsigned char* message, WORD blockNum, WORD* sha256H) {
+    WORD words[16];
 
     const unsigned char* tempBlock;
     unsigned int i;
@@ -131,22 +145,13 @@ void Transform(const unsigned char* message, WORD blockNum, const WORD* sha256K,
     for (i = 0; i < (unsigned int)blockNum; i++) {
         tempBlock = message + (i << 6);
         for (j = 0; j < 16; j++) {
-            CHARTOWORD(&tempBlock[j << 2], &expandedWords[j]);
-        }
-        WordExtend(expandedWords);
-
-        for (j = 0; j < 8; j++) {
-            abcdefgh[j] = sha256H[j];
-        }
-        WordCompress(abcdefgh, sha256K, expandedWords);
-
-        for (j = 0; j < 8; j++) {
-            sha256H[j] += abcdefgh[j];
+            CHARTOWORD(&tempBlock[j << 2], &words[j]);
         }
+        sha256_compress(sha256H, words);
     }
 }
 
-void Update(const unsigned char* message, WORD len, const WORD* sha256K, WORD* sha256H, unsigned char* msgBlock, WORD& msgTotalLen,
+void Update(const unsigned char* message, WORD len, WORD* sha256H, unsigned char* msgBlock, WORD& msgTotalLen,
             WORD& msgLen) {
     WORD blockNum, remLen, tempLen;
     const unsigned char* shiftedMsg;
@@ -161,8 +166,8 @@ void Update(const unsigned char* message, WORD len, const WORD* sha256K, WORD* s
         blockNum = len / BLOCKSIZE;
         shiftedMsg = message + remLen;
 
-        Transform(msgBlock, 1, sha256K, sha256H);
-        Transform(shiftedMsg, blockNum, sha256K, sha256H);
+        Transform(msgBlock, 1, sha256H);
+        Transform(shiftedMsg, blockNum, sha256H);
         remLen = len % BLOCKSIZE;
         memcpy(msgBlock, &shiftedMsg[blockNum << 6], remLen);
         msgLen = remLen;
@@ -170,7 +175,7 @@ void Update(const unsigned char* message, WORD len, const WORD* sha256K, WORD* s
     }
 }
 
-void Final(unsigned char* digest, const WORD* sha256K, WORD* sha256H, unsigned char* msgBlock, WORD& msgTotalLen, WORD& msgLen) {
+void Final(unsigned char* digest, WORD* sha256H, unsigned char* msgBlock, WORD& msgTotalLen, WORD& msgLen) {
     WORD blockNum, tempLen, lenB;
 
     blockNum = (1 + ((BLOCKSIZE - 9) < (msgLen % BLOCKSIZE)));
@@ -182,83 +187,59 @@ void Final(unsigned char* digest, const WORD* sha256K, WORD* sha256H, unsigned c
     msgBlock[msgLen] = 0x80;
 
     WORDTOCHAR(lenB, msgBlock + tempLen - 4);
-    Transform(msgBlock, blockNum, sha256K, sha256H);
+    Transform(msgBlock, blockNum, sha256H);
 
     for (unsigned char i = 0; i < 8; i++)
         WORDTOCHAR(sha256H[i], &digest[i << 2]);
 }
 
-char* gpu_sha256(const char* input, const WORD* sha256K) {
-    unsigned char* digest = (unsigned char*)calloc(32, sizeof(unsigned char));
+char* gpu_sha256(const char* input) {
+    unsigned char digest[SHA256_DIGEST_LENGTH];
     unsigned char msgBlock[128];
     WORD msgTotalLen = 0, msgLen = 0;
     WORD sha256H[8]{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
 
-    Update((unsigned char*)input, strlen(input), sha256K, sha256H, msgBlock, msgTotalLen, msgLen);
-    Final(digest, sha256K, sha256H, msgBlock, msgTotalLen, msgLen);
-
-    char* buf = (char*)calloc(65, sizeof(char));
-    buf[64] = '\0';
-
-    // put each value of digest into buf as a 2 digit hex value (8 bits each)
-    for (unsigned char i = 0; i < 32; i++) {
-        unsigned char top = (digest[i] & 0xf0) >> 4;
-        unsigned char bottom = digest[i] & 0x0f;
-        buf[i * 2] = top < 10 ? top + '0' : top - 10 + 'a';
-        buf[i * 2 + 1] = bottom < 10 ? bottom + '0' : bottom - 10 + 'a';
-    }
-
-    // * using sprintf
-    // for (unsigned char i = 0; i < 32; i++)
-    //     sprintf(buf + i * 2, "%02x", digest[i]);
+    Update((unsigned char*)input, strlen(input), sha256H, msgBlock, msgTotalLen, msgLen);
+    Final(digest, sha256H, msgBlock, msgTotalLen, msgLen);
 
-    free(digest);
+    char* buf = (char*)malloc(2 * SHA256_DIGEST_LENGTH + 1);
+    hex_encode_scalar(digest, SHA256_DIGEST_LENGTH, buf);
+    buf[2 * SHA256_DIGEST_LENGTH] = '\0';
     return buf;
 }
 
-char* gpu_double_sha256(const char* input, const WORD* sha256K) {
-    unsigned char* digest = (unsigned char*)calloc(32, sizeof(unsigned char));
+/**
+ * @brief Double SHA-256 into a 32 byte binary digest, without heap allocations
+ *
+ * @param input - null terminated
+ * @param digest - output
+ */
+void gpu_double_sha256_digest(const char* input, unsigned char* digest) {
     unsigned char msgBlock[128];
     WORD msgTotalLen = 0, msgLen = 0;
     WORD sha256H[8]{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
 
-    Update((unsigned char*)input, strlen(input), sha256K, sha256H, msgBlock, msgTotalLen, msgLen);
-    Final(digest, sha256K, sha256H, msgBlock, msgTotalLen, msgLen);
-
-    // clear msgBlock, msgTotalLen, msgLen, sha256H for second hash
-    memset(msgBlock, 0, 128);
-    msgTotalLen = 0;
-    msgLen = 0;
-    sha256H[0] = 0x6a09e667;
-    sha256H[1] = 0xbb67ae85;
-    sha256H[2] = 0x3c6ef372;
-    sha256H[3] = 0xa54ff53a;
-    sha256H[4] = 0x510e527f;
-    sha256H[5] = 0x9b05688c;
-    sha256H[6] = 0x1f83d9ab;
-    sha256H[7] = 0x5be0cd19;
-
-    Update(digest, 32, sha256K, sha256H, msgBlock, msgTotalLen, msgLen);
-    Final(digest, sha256K, sha256H, msgBlock, msgTotalLen, msgLen);
-
-    char* buf = (char*)calloc(65, sizeof(char));
-    buf[64] = '\0';
-
-    // put each value of digest into buf as a 2 digit hex value (8 bits each)
-    for (unsigned char i = 0; i < 32; i++) {
-        unsigned char top = (digest[i] & 0xf0) >> 4;
-        unsigned char bottom = digest[i] & 0x0f;
-        buf[i * 2] = top < 10 ? top + '0' : top - 10 + 'a';
-        buf[i * 2 + 1] = bottom < 10 ? bottom + '0' : bottom - 10 + 'a';
-    }
+    Update((unsigned char*)input, strlen(input), sha256H, msgBlock, msgTotalLen, msgLen);
+    Final(digest, sha256H, msgBlock, msgTotalLen, msgLen);
 
-    // * using sprintf
-    // for (unsigned char i = 0; i < 32; i++)
-    //     sprintf(buf + i * 2, "%02x", digest[i]);
+    // Second hash straight from the first hash's state words, with the padding of a 32 byte message built in
+    WORD secondH[8];
+    sha256_digest_block(sha256H, secondH);
+    for (unsigned char i = 0; i < 8; i++)
+        WORDTOCHAR(secondH[i], &digest[i << 2]);
+}
 
-    free(digest);
+char* gpu_double_sha256(const char* input) {
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    gpu_double_sha256_digest(input, digest);
+
+    char* buf = (char*)malloc(2 * SHA256_DIGEST_LENGTH + 1);
+    hex_encode_scalar(digest, SHA256_DIGEST_LENGTH, buf);
+    buf[2 * SHA256_DIGEST_LENGTH] = '\0';
     return buf;
 }
 #if RUN_ON_TARGET
 #pragma omp end declare target
 #endif
+
+#endif
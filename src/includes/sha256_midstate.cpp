@@ -0,0 +1,221 @@
+// Midstate hashing of block preimages. The preimage "[block_id|prev_digest|data|threshold|nonce]" only changes in the
+// nonce digits near its end, so everything before them is hashed once per job and each attempt only runs the rounds
+// that depend on the nonce.
+#ifndef SHA256_MIDSTATE_CPP
+#define SHA256_MIDSTATE_CPP
+
+#include "sha256.cpp"
+#include "utils.h"
+
+#define MIDSTATE_MAX_DIGITS 20  // decimal digits of the largest size_t
+
+/**
+ * Layout of the last one or two blocks of the preimage for one nonce width. Everything here is nonce independent.
+ */
+struct Sha256Tail {
+    unsigned char num_blocks;
+    unsigned char first_word;     // first word of the tail holding a nonce digit
+    unsigned char last_word;      // last word of the tail holding a nonce digit
+    unsigned char constant_last;  // the second block holds no nonce digit, so its schedule is precomputed
+    WORD words[32];               // tail blocks with the nonce digits zeroed
+    WORD state[8];                // working variables after the first_word rounds of the first tail block
+    WORD kw[64];                  // K + W of the second tail block if constant_last
+};
+
+/**
+ * Sha256Midstate class. Holds the midstate of one job and the precomputed tails of every nonce width.
+ */
+class Sha256Midstate {
+   public:
+    Sha256Midstate();
+    ~Sha256Midstate();
+    void setJob(size_t block_id, const char *prev_digest, const char *data, size_t threshold, unsigned char format = NONCE_FORMAT_ASCII);
+    void hash(size_t nonce, unsigned char *digest);
+    size_t generation;  // job generation the midstate was built for, kept by the caller
+
+   private:
+    WORD midstate[8];
+    unsigned char rem[64];  // prefix bytes after the last full block
+    size_t rem_len;
+    size_t prefix_len;
+    size_t min_digits;  // NONCE_FIXED_DIGITS for fixed width nonces, which only ever use one tail
+    Sha256Tail tails[MIDSTATE_MAX_DIGITS + 1];
+
+    void buildTail(size_t num_digits);
+};
+
+/**
+ * @brief Construct a new Sha256 Midstate object
+ *
+ */
+Sha256Midstate::Sha256Midstate() {
+    generation = 0;
+    rem_len = 0;
+    prefix_len = 0;
+    min_digits = 1;
+    memcpy(midstate, SHA256_IV, sizeof(midstate));
+}
+
+/**
+ * @brief Destroy the Sha256 Midstate object
+ *
+ */
+Sha256Midstate::~Sha256Midstate() {}
+
+/**
+ * @brief Hashes the nonce independent prefix "[block_id|prev_digest|data|threshold|" and precomputes the tails
+ *
+ * @param block_id
+ * @param prev_digest
+ * @param data
+ * @param threshold - threshold stored in the block, as in the preimage
+ * @param format - chain format version of the nonce
+ */
+void Sha256Midstate::setJob(size_t block_id, const char *prev_digest, const char *data, size_t threshold, unsigned char format) {
+    size_t len = strlen(prev_digest) + strlen(data) + 2 * SIZE_T_STR_BYTES + 8;
+    char *prefix = (char *)malloc(len);
+    prefix_len = snprintf(prefix, len, "[%lu|%s|%s|%lu|", block_id, prev_digest, data, threshold);
+
+    memcpy(midstate, SHA256_IV, sizeof(midstate));
+    const size_t num_blocks = prefix_len / BLOCKSIZE;
+    Transform((const unsigned char *)prefix, num_blocks, midstate);
+    rem_len = prefix_len - num_blocks * BLOCKSIZE;
+    memcpy(rem, prefix + num_blocks * BLOCKSIZE, rem_len);
+    free(prefix);
+
+    min_digits = (format == NONCE_FORMAT_FIXED) ? NONCE_FIXED_DIGITS : 1;
+    for (size_t num_digits = min_digits; num_digits <= MIDSTATE_MAX_DIGITS; num_digits++) {
+        buildTail(num_digits);
+    }
+}
+
+/**
+ * @brief Lays out the padded tail for nonces of num_digits digits and runs the rounds that do not depend on them
+ *
+ * @param num_digits
+ */
+void Sha256Midstate::buildTail(size_t num_digits) {
+    Sha256Tail *tail = &tails[num_digits];
+    unsigned char bytes[2 * BLOCKSIZE];
+    const size_t tail_len = rem_len + num_digits + 1;  // + ']'
+    tail->num_blocks = (tail_len + 9 > BLOCKSIZE) ? 2 : 1;
+
+    memset(bytes, 0, sizeof(bytes));
+    memcpy(bytes, rem, rem_len);
+    bytes[tail_len - 1] = ']';
+    bytes[tail_len] = 0x80;
+    const size_t len_bits = (prefix_len + num_digits + 1) << 3;
+    unsigned char *len_at = bytes + tail->num_blocks * BLOCKSIZE - 8;
+    for (int i = 0; i < 8; i++) {
+        len_at[i] = (unsigned char)(len_bits >> (56 - 8 * i));
+    }
+    for (int j = 0; j < 32; j++) {
+        CHARTOWORD(&bytes[j << 2], &tail->words[j]);
+    }
+    tail->first_word = rem_len >> 2;
+    tail->last_word = (rem_len + num_digits - 1) >> 2;
+    tail->constant_last = (tail->num_blocks == 2 && tail->last_word < 16);
+
+    // Rounds of the first tail block before the first nonce word only see constant words
+    WORD a = midstate[0], b = midstate[1], c = midstate[2], d = midstate[3];
+    WORD e = midstate[4], f = midstate[5], g = midstate[6], h = midstate[7];
+    for (int t = 0; t < tail->first_word; t++) {
+        WORD temp1 = h + SUM1(e) + CH(e, f, g) + SHA256_K[t] + tail->words[t];
+        WORD temp2 = SUM0(a) + MAJ(a, b, c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+    }
+    WORD state[8] = {a, b, c, d, e, f, g, h};
+    memcpy(tail->state, state, sizeof(state));
+
+    // A second block made only of padding has the same schedule for every nonce
+    if (tail->constant_last) {
+        WORD w[64];
+        memcpy(w, &tail->words[16], sizeof(WORD) * 16);
+        for (int t = 16; t < 64; t++) {
+            w[t] = SIGMA1(w[t - 2]) + w[t - 7] + SIGMA0(w[t - 15]) + w[t - 16];
+        }
+        for (int t = 0; t < 64; t++) {
+            tail->kw[t] = SHA256_K[t] + w[t];
+        }
+    }
+}
+
+#define MIDSTATE_RESUME(R)                                      \
+    case R:                                                     \
+        Sha256Rounds<R>::run(w, sha256H, a, b, c, d, e, f, g, h); \
+        break;
+
+/**
+ * @brief Double SHA-256 of the job's preimage with the given nonce. Only the nonce dependent rounds are computed.
+ *
+ * @param nonce
+ * @param digest - 32 byte binary output
+ */
+void Sha256Midstate::hash(size_t nonce, unsigned char *digest) {
+    // Decimal digits of the nonce, most significant first
+    char digits[MIDSTATE_MAX_DIGITS];
+    size_t num_digits = 0;
+    do {
+        digits[MIDSTATE_MAX_DIGITS - 1 - num_digits++] = '0' + (nonce % 10);
+        nonce /= 10;
+    } while (nonce > 0 || num_digits < min_digits);
+    const char *first_digit = digits + MIDSTATE_MAX_DIGITS - num_digits;
+    const Sha256Tail *tail = &tails[num_digits];
+
+    WORD words[32];
+    memcpy(words, tail->words, sizeof(WORD) * 16 * tail->num_blocks);
+    for (size_t i = 0; i < num_digits; i++) {
+        size_t at = rem_len + i;
+        words[at >> 2] |= (WORD)(unsigned char)first_digit[i] << (24 - 8 * (at & 3));
+    }
+
+    // First tail block, resumed after its constant rounds
+    WORD sha256H[8];
+    memcpy(sha256H, midstate, sizeof(sha256H));
+    WORD a = tail->state[0], b = tail->state[1], c = tail->state[2], d = tail->state[3];
+    WORD e = tail->state[4], f = tail->state[5], g = tail->state[6], h = tail->state[7];
+    WORD *w = words;
+    switch (tail->first_word) {
+        MIDSTATE_RESUME(0)
+        MIDSTATE_RESUME(1)
+        MIDSTATE_RESUME(2)
+        MIDSTATE_RESUME(3)
+        MIDSTATE_RESUME(4)
+        MIDSTATE_RESUME(5)
+        MIDSTATE_RESUME(6)
+        MIDSTATE_RESUME(7)
+        MIDSTATE_RESUME(8)
+        MIDSTATE_RESUME(9)
+        MIDSTATE_RESUME(10)
+        MIDSTATE_RESUME(11)
+        MIDSTATE_RESUME(12)
+        MIDSTATE_RESUME(13)
+        MIDSTATE_RESUME(14)
+        MIDSTATE_RESUME(15)
+    }
+
+    // Second tail block, if any
+    if (tail->num_blocks == 2) {
+        if (tail->constant_last) {
+            a = sha256H[0], b = sha256H[1], c = sha256H[2], d = sha256H[3];
+            e = sha256H[4], f = sha256H[5], g = sha256H[6], h = sha256H[7];
+            Sha256Rounds<0, true>::run((WORD *)tail->kw, sha256H, a, b, c, d, e, f, g, h);
+        } else {
+            sha256_compress(sha256H, &words[16]);
+        }
+    }
+
+    WORD secondH[8];
+    sha256_digest_block(sha256H, secondH);
+    for (unsigned char i = 0; i < 8; i++)
+        WORDTOCHAR(secondH[i], &digest[i << 2]);
+}
+
+#endif
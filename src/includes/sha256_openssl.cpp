@@ -1,3 +1,6 @@
+#ifndef SHA256_OPENSSL_CPP
+#define SHA256_OPENSSL_CPP
+
 #include <openssl/sha.h>
 
 #include "utils.h"
@@ -12,17 +15,11 @@ char* sha256(const char* str) {
     SHA256_Update(&sha256, str, strlen(str));
     SHA256_Final(digest, &sha256);
 
-    char* buf = (char*)calloc(SHA256_DIGEST_LENGTH * 2 + 1, sizeof(char));
-    buf[SHA256_DIGEST_LENGTH * 2] = '\0';
-    for (unsigned char i = 0; i < SHA256_DIGEST_LENGTH; i++)
-        sprintf(buf + i * 2, "%02x", digest[i]);
-
-    return buf;
+    return hex_string(digest, SHA256_DIGEST_LENGTH);
 }
 
-// Function for taking the double SHA-256 hash of a string
-char* double_sha256(const char* str) {
-    unsigned char digest[SHA256_DIGEST_LENGTH];
+// Function for taking the double SHA-256 hash of a string. Writes the 32 byte binary digest.
+void double_sha256_digest(const char* str, unsigned char* digest) {
     SHA256_CTX sha256;
     SHA256_Init(&sha256);
     SHA256_Update(&sha256, str, strlen(str));
@@ -31,11 +28,18 @@ char* double_sha256(const char* str) {
     SHA256_Init(&sha256);
     SHA256_Update(&sha256, digest, SHA256_DIGEST_LENGTH);
     SHA256_Final(digest, &sha256);
+}
 
-    char* buf = (char*)calloc(SHA256_DIGEST_LENGTH * 2 + 1, sizeof(char));
-    buf[SHA256_DIGEST_LENGTH * 2] = '\0';
-    for (unsigned char i = 0; i < SHA256_DIGEST_LENGTH; i++)
-        sprintf(buf + i * 2, "%02x", digest[i]);
+// Function for converting a binary digest to a hex string
+char* digest_to_hex(const unsigned char* digest) {
+    return hex_string(digest, SHA256_DIGEST_LENGTH);
+}
 
-    return buf;
+// Function for taking the double SHA-256 hash of a string
+char* double_sha256(const char* str) {
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    double_sha256_digest(str, digest);
+    return digest_to_hex(digest);
 }
+
+#endif
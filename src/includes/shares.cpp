@@ -0,0 +1,210 @@
+// Share accounting. Shares are digests meeting a much easier target than the block threshold, so they arrive often
+// enough to estimate hashrate within seconds.
+#ifndef SHARES_CPP
+#define SHARES_CPP
+
+#include <math.h>
+
+#include "utils.h"
+
+#define CACHE_LINE_BYTES 64
+#define SHARE_LOG_INIT 1024
+
+/**
+ * Per-thread share record. Aligned to a cache line so threads never write to the same line.
+ */
+struct alignas(CACHE_LINE_BYTES) ThreadShares {
+    size_t count;
+    size_t cap;
+    double *times;
+    size_t *nonces;
+};
+
+/**
+ * ShareStats class. Counts shares per thread with timestamps and turns share rates into hashrate estimates.
+ */
+class ShareStats {
+   public:
+    ShareStats(size_t num_threads, size_t share_threshold);
+    ~ShareStats();
+    /**
+     * @brief Checks that the binary digest starts with share_threshold zero hex digits, without converting it to hex
+     */
+    static inline int meets(const unsigned char *digest, size_t share_threshold) {
+        size_t i = 0;
+        for (; i < share_threshold / 2; i++) {
+            if (digest[i] != 0) {
+                return 0;
+            }
+        }
+        return (share_threshold & 1) ? (digest[i] >> 4) == 0 : 1;
+    }
+    inline int isShare(const unsigned char *digest) { return share_threshold > 0 && meets(digest, share_threshold); }
+    void record(int tid, double t, size_t nonce);
+    size_t getTotal();
+    size_t getThreshold() { return share_threshold; }
+    double hashesPerShare();
+    void estimate(size_t num_shares, double t_elapsed, double &rate, double &lower, double &upper);
+    void printEstimate(const char *label, double t_begin, double t_end);
+    void printReport(double t_begin, double t_end);
+    int writeLog(const char *path, double t_origin);
+
+    size_t num_threads;
+
+   private:
+    size_t share_threshold;
+    ThreadShares *threads;
+};
+
+/**
+ * @brief Construct a new Share Stats object
+ *
+ * @param num_threads
+ * @param share_threshold - leading zero hex digits for a share, 0 disables share accounting
+ */
+ShareStats::ShareStats(size_t num_threads, size_t share_threshold) {
+    this->num_threads = num_threads;
+    this->share_threshold = share_threshold;
+    threads = new ThreadShares[num_threads];
+    for (size_t i = 0; i < num_threads; i++) {
+        threads[i].count = 0;
+        threads[i].cap = SHARE_LOG_INIT;
+        threads[i].times = (double *)malloc(sizeof(double) * SHARE_LOG_INIT);
+        threads[i].nonces = (size_t *)malloc(sizeof(size_t) * SHARE_LOG_INIT);
+    }
+}
+
+/**
+ * @brief Destroy the Share Stats object
+ *
+ */
+ShareStats::~ShareStats() {
+    for (size_t i = 0; i < num_threads; i++) {
+        free(threads[i].times);
+        free(threads[i].nonces);
+    }
+    delete[] threads;
+}
+
+/**
+ * @brief Records a share found by thread tid. Only touches the thread's own record.
+ *
+ * @param tid
+ * @param t - omp_get_wtime() of the share
+ * @param nonce
+ */
+void ShareStats::record(int tid, double t, size_t nonce) {
+    ThreadShares *ts = &threads[tid];
+    if (ts->count == ts->cap) {
+        ts->cap *= 2;
+        ts->times = (double *)realloc(ts->times, sizeof(double) * ts->cap);
+        ts->nonces = (size_t *)realloc(ts->nonces, sizeof(size_t) * ts->cap);
+    }
+    ts->times[ts->count] = t;
+    ts->nonces[ts->count] = nonce;
+    // Publish the count last so readers on other threads only see filled entries
+    __atomic_store_n(&ts->count, ts->count + 1, __ATOMIC_RELEASE);
+}
+
+size_t ShareStats::getTotal() {
+    size_t total = 0;
+    for (size_t i = 0; i < num_threads; i++) {
+        total += __atomic_load_n(&threads[i].count, __ATOMIC_ACQUIRE);
+    }
+    return total;
+}
+
+/**
+ * @brief Expected number of attempts per share: 16^share_threshold
+ *
+ * @return double
+ */
+double ShareStats::hashesPerShare() { return pow(16.0, (double)share_threshold); }
+
+/**
+ * @brief Estimates the hashrate from num_shares shares seen in t_elapsed seconds. Shares are a Poisson process, so the
+ * 95% interval uses the Wilson-Hilferty approximation of the exact Poisson bounds on the count.
+ *
+ * @param num_shares
+ * @param t_elapsed
+ * @param rate - H/s
+ * @param lower - H/s
+ * @param upper - H/s
+ */
+void ShareStats::estimate(size_t num_shares, double t_elapsed, double &rate, double &lower, double &upper) {
+    const double Z = 1.959964;
+    double n = (double)num_shares;
+    double scale = (t_elapsed > 0.0) ? hashesPerShare() / t_elapsed : 0.0;
+    double lo = 0.0;
+    if (num_shares > 0) {
+        lo = n * pow(1.0 - 1.0 / (9.0 * n) - Z / (3.0 * sqrt(n)), 3);
+    }
+    double hi = (n + 1.0) * pow(1.0 - 1.0 / (9.0 * (n + 1.0)) + Z / (3.0 * sqrt(n + 1.0)), 3);
+    rate = n * scale;
+    lower = (lo > 0.0 ? lo : 0.0) * scale;
+    upper = hi * scale;
+}
+
+/**
+ * @brief Prints the share-based hashrate of all shares seen since t_begin. Safe to call while threads are mining since
+ * it only reads the per-thread counts.
+ *
+ * @param label
+ * @param t_begin
+ * @param t_end
+ */
+void ShareStats::printEstimate(const char *label, double t_begin, double t_end) {
+    if (share_threshold == 0) {
+        return;
+    }
+    double rate, lower, upper;
+    size_t num_shares = getTotal();
+    estimate(num_shares, t_end - t_begin, rate, lower, upper);
+    printf("%s \t\t%.0lf H/s\t95%% CI: [%.0lf, %.0lf]\tShares: %lu\n", label, rate, lower, upper, num_shares);
+}
+
+/**
+ * @brief Prints the per-thread and total share counts and hashrates over the run
+ *
+ * @param t_begin
+ * @param t_end
+ */
+void ShareStats::printReport(double t_begin, double t_end) {
+    if (share_threshold == 0) {
+        return;
+    }
+    double rate, lower, upper;
+    double t_elapsed = t_end - t_begin;
+    printf("\nShares (threshold %lu, %.0lf hashes/share) over %lf seconds:\n", share_threshold, hashesPerShare(), t_elapsed);
+    for (size_t i = 0; i < num_threads; i++) {
+        estimate(threads[i].count, t_elapsed, rate, lower, upper);
+        printf("TID: %lu\tShares: %lu\tHashrate: %.0lf H/s\t95%% CI: [%.0lf, %.0lf]\n", i, threads[i].count, rate, lower, upper);
+    }
+    estimate(getTotal(), t_elapsed, rate, lower, upper);
+    printf("Total\tShares: %lu\tHashrate: %.0lf H/s\t95%% CI: [%.0lf, %.0lf]\n", getTotal(), rate, lower, upper);
+}
+
+/**
+ * @brief Writes every recorded share as CSV: tid,time,nonce. Times are relative to t_origin.
+ *
+ * @param path
+ * @param t_origin
+ * @return int - 0 on success, -1 on failure
+ */
+int ShareStats::writeLog(const char *path, double t_origin) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        printf("Cannot open share log %s\n", path);
+        return -1;
+    }
+    fprintf(f, "tid,time,nonce\n");
+    for (size_t i = 0; i < num_threads; i++) {
+        for (size_t j = 0; j < threads[i].count; j++) {
+            fprintf(f, "%lu,%.6lf,%lu\n", i, threads[i].times[j] - t_origin, threads[i].nonces[j]);
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,326 @@
+// Multi-process mining. Worker processes forked by the miner share one shm_open/mmap region holding the current job,
+// the nonce cursor, the found-solution slot and per-worker stats. The parent verifies solutions and owns the chain.
+#ifndef SHM_MINING_CPP
+#define SHM_MINING_CPP
+
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "numa.cpp"
+#include "sha256_midstate.cpp"
+#include "shares.cpp"
+#include "utils.h"
+
+#define SHM_MAX_WORKERS 256
+#define SHM_JOB_BYTES (4 << 20)  // prev digest + data of the tip. Data grows by ~100 bytes per block
+#define SHM_NONCE_CHUNK 256
+#define SHM_CURSOR_SLOTS 4
+#ifndef CACHE_LINE_BYTES
+#define CACHE_LINE_BYTES 64
+#endif
+
+/**
+ * Per-worker counters. Each worker writes only its own cache line, the parent only reads.
+ */
+struct alignas(CACHE_LINE_BYTES) ShmWorkerStats {
+    size_t hashes;
+    size_t shares;
+    size_t solutions;
+    pid_t pid;
+};
+
+/**
+ * Layout of the shared region. The job is published seqlock style: job_generation is odd while the parent rewrites the
+ * job and even once it is consistent. Each job takes its nonces from its own cursor slot so a worker still finishing a
+ * chunk of the previous job can never advance the cursor of the new one.
+ */
+struct ShmRegion {
+    alignas(CACHE_LINE_BYTES) size_t job_generation;
+    int running;
+    size_t num_workers;
+    size_t share_threshold;
+    size_t block_id;
+    size_t block_threshold;
+    size_t threshold;
+    unsigned char nonce_format;
+    size_t prev_digest_len;
+    size_t data_len;
+
+    alignas(CACHE_LINE_BYTES) size_t nonce_cursor[SHM_CURSOR_SLOTS][CACHE_LINE_BYTES / sizeof(size_t)];
+
+    // Found-solution slot. A worker claims it by CASing found_generation to the job generation.
+    alignas(CACHE_LINE_BYTES) size_t found_generation;
+    size_t found_ready;
+    size_t found_nonce;
+    size_t found_worker;
+
+    ShmWorkerStats stats[SHM_MAX_WORKERS];
+
+    alignas(CACHE_LINE_BYTES) char job_text[SHM_JOB_BYTES];  // prev_digest '\0' data '\0'
+};
+
+/**
+ * @brief Creates and maps the shared region. The name is unlinked right away; forked children inherit the mapping.
+ *
+ * @param num_workers
+ * @param share_threshold
+ * @return ShmRegion* - NULL on failure
+ */
+ShmRegion *shm_region_create(size_t num_workers, size_t share_threshold) {
+    char name[64];
+    snprintf(name, sizeof(name), "/btc_miner_%d", getpid());
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_EXCL, 0600);
+    if (fd < 0) {
+        perror("shm_open");
+        return NULL;
+    }
+    shm_unlink(name);
+    if (ftruncate(fd, sizeof(ShmRegion)) != 0) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+    ShmRegion *region = (ShmRegion *)mmap(NULL, sizeof(ShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    // ftruncate zero-fills, only set the non-zero fields
+    region->running = 1;
+    region->num_workers = num_workers;
+    region->share_threshold = share_threshold;
+    return region;
+}
+
+void shm_region_destroy(ShmRegion *region) { munmap(region, sizeof(ShmRegion)); }
+
+/**
+ * @brief Publishes a new job to the workers. Called by the parent only.
+ *
+ * @param region
+ * @param block - chain tip whose fields get hashed
+ * @param threshold - leading zeros the digest must have
+ * @param nonce_format - chain format version the preimage is built with
+ * @return int - 0 on success, -1 if the job does not fit in the region
+ */
+int shm_publish_job(ShmRegion *region, Blockchain::Block *block, size_t threshold, unsigned char nonce_format) {
+    size_t prev_digest_len = 2 * SHA256_DIGEST_LENGTH;
+    size_t data_len = strlen(block->data);
+    if (prev_digest_len + data_len + 2 > SHM_JOB_BYTES) {
+        printf("ERROR: job of %lu bytes does not fit in the shared region\n", prev_digest_len + data_len + 2);
+        return -1;
+    }
+    size_t generation = __atomic_load_n(&region->job_generation, __ATOMIC_RELAXED);
+    __atomic_store_n(&region->job_generation, generation + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    region->block_id = block->block_id;
+    region->block_threshold = block->threshold;
+    region->threshold = threshold;
+    region->nonce_format = nonce_format;
+    region->prev_digest_len = prev_digest_len;
+    region->data_len = data_len;
+    hex_encode(block->prev_digest, SHA256_DIGEST_LENGTH, region->job_text);
+    region->job_text[prev_digest_len] = '\0';
+    memcpy(region->job_text + prev_digest_len + 1, block->data, data_len + 1);
+
+    const size_t next_generation = generation + 2;
+    __atomic_store_n(&region->nonce_cursor[(next_generation / 2) % SHM_CURSOR_SLOTS][0], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&region->found_ready, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&region->job_generation, next_generation, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * Worker-private copy of the job.
+ */
+struct ShmJob {
+    size_t generation;
+    size_t block_id;
+    size_t block_threshold;
+    size_t threshold;
+    unsigned char nonce_format;
+    char *prev_digest;
+    char *data;
+    size_t cap;
+};
+
+/**
+ * @brief Copies the published job into the worker's buffers. Retries while the parent is rewriting it.
+ *
+ * @param region
+ * @param job
+ * @return int - 1 if a new consistent job was copied, 0 if the job has not changed
+ */
+int shm_copy_job(ShmRegion *region, ShmJob *job) {
+    while (1) {
+        size_t generation = __atomic_load_n(&region->job_generation, __ATOMIC_ACQUIRE);
+        if (generation == job->generation) {
+            return 0;
+        }
+        if (generation & 1) {
+            continue;  // parent is writing
+        }
+        size_t prev_digest_len = region->prev_digest_len;
+        size_t data_len = region->data_len;
+        if (prev_digest_len + data_len + 2 > SHM_JOB_BYTES) {
+            continue;  // torn read of the lengths
+        }
+        if (prev_digest_len + data_len + 2 > job->cap) {
+            job->cap = prev_digest_len + data_len + 2;
+            job->prev_digest = (char *)realloc(job->prev_digest, job->cap);
+        }
+        memcpy(job->prev_digest, region->job_text, prev_digest_len + data_len + 2);
+        job->data = job->prev_digest + prev_digest_len + 1;
+        job->block_id = region->block_id;
+        job->block_threshold = region->block_threshold;
+        job->threshold = region->threshold;
+        job->nonce_format = region->nonce_format;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&region->job_generation, __ATOMIC_RELAXED) == generation) {
+            job->prev_digest[prev_digest_len] = '\0';
+            job->data[data_len] = '\0';
+            job->generation = generation;
+            return 1;
+        }
+    }
+}
+
+/**
+ * @brief Worker process main loop. Claims chunks of nonces from the shared cursor and reports the first valid nonce of
+ * each job through the found slot.
+ *
+ * @param region
+ * @param worker_id
+ */
+void shm_worker_loop(ShmRegion *region, size_t worker_id) {
+    Blockchain blockchain;  // only used for its string and threshold helpers
+    ShmWorkerStats *stats = &region->stats[worker_id];
+    ShmJob job;
+    memset(&job, 0, sizeof(job));
+    Sha256Midstate midstate;
+    size_t nonce = 0, nonce_end = 0;
+    size_t chunk_begin = 0;
+
+    while (__atomic_load_n(&region->running, __ATOMIC_RELAXED)) {
+        if (shm_copy_job(region, &job)) {
+            midstate.setJob(job.block_id, job.prev_digest, job.data, job.block_threshold, job.nonce_format);
+            // Chunks are counted when left. The last one of a solved job stops short
+            __atomic_fetch_add(&stats->hashes, nonce - chunk_begin, __ATOMIC_RELAXED);
+            nonce = nonce_end = chunk_begin = 0;
+        }
+        if (job.generation == 0 || __atomic_load_n(&region->found_generation, __ATOMIC_RELAXED) == job.generation) {
+            // No job yet, or it is solved and the parent is verifying. Wait for the next one
+            usleep(20);
+            continue;
+        }
+        if (nonce == nonce_end) {
+            __atomic_fetch_add(&stats->hashes, nonce - chunk_begin, __ATOMIC_RELAXED);
+            size_t *cursor = &region->nonce_cursor[(job.generation / 2) % SHM_CURSOR_SLOTS][0];
+            nonce = __atomic_fetch_add(cursor, SHM_NONCE_CHUNK, __ATOMIC_RELAXED);
+            nonce_end = nonce + SHM_NONCE_CHUNK;
+            chunk_begin = nonce;
+        }
+
+        unsigned char digest_bin[SHA256_DIGEST_LENGTH];
+        midstate.hash(nonce, digest_bin);
+        // Skip the hex conversion unless the digest has enough leading zero nibbles for a share or a solution
+        size_t zeros_needed = (region->share_threshold > 0 && region->share_threshold < job.threshold) ? region->share_threshold : job.threshold;
+        if (zeros_needed >= 2 * SHA256_DIGEST_LENGTH || !ShareStats::meets(digest_bin, zeros_needed)) {
+            nonce++;
+            continue;
+        }
+        char *digest = digest_to_hex(digest_bin);
+        if (blockchain.thresholdMet((const char *)digest, job.threshold)) {
+            size_t seen = __atomic_load_n(&region->found_generation, __ATOMIC_RELAXED);
+            if (seen != job.generation && __atomic_compare_exchange_n(&region->found_generation, &seen, job.generation, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                region->found_nonce = nonce;
+                region->found_worker = worker_id;
+                __atomic_store_n(&region->found_ready, job.generation, __ATOMIC_RELEASE);
+                stats->solutions++;
+            }
+        } else if (region->share_threshold > 0 && blockchain.shareMet((const char *)digest, region->share_threshold)) {
+            __atomic_fetch_add(&stats->shares, 1, __ATOMIC_RELAXED);
+        }
+        nonce++;
+        free(digest);
+    }
+    __atomic_fetch_add(&stats->hashes, nonce - chunk_begin, __ATOMIC_RELAXED);
+    free(job.prev_digest);
+}
+
+/**
+ * @brief Forks num_workers worker processes. Children ignore SIGINT and exit when the parent clears region->running.
+ *
+ * @param region
+ * @param num_workers
+ * @param topology - if not NULL, worker i is pinned to the CPU placed for thread i
+ * @return int - number of workers started
+ */
+int shm_spawn_workers(ShmRegion *region, size_t num_workers, NumaTopology *topology) {
+    fflush(stdout);
+    for (size_t i = 0; i < num_workers; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return i;
+        }
+        if (pid == 0) {
+            signal(SIGINT, SIG_IGN);
+            if (topology != NULL) {
+                topology->pinThread(i);
+            }
+            region->stats[i].pid = getpid();
+            shm_worker_loop(region, i);
+            _exit(0);
+        }
+    }
+    return num_workers;
+}
+
+/**
+ * @brief Stops the workers and reaps them
+ *
+ * @param region
+ * @param num_workers
+ */
+void shm_stop_workers(ShmRegion *region, size_t num_workers) {
+    __atomic_store_n(&region->running, 0, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < num_workers; i++) {
+        wait(NULL);
+    }
+}
+
+/**
+ * @brief Sums the hash counters of all workers
+ */
+size_t shm_total_hashes(ShmRegion *region) {
+    size_t total = 0;
+    for (size_t i = 0; i < region->num_workers; i++) {
+        total += __atomic_load_n(&region->stats[i].hashes, __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+/**
+ * @brief Prints the per-worker stats
+ *
+ * @param region
+ * @param t_elapsed
+ */
+void shm_print_stats(ShmRegion *region, double t_elapsed) {
+    printf("\nWorker processes over %lf seconds:\n", t_elapsed);
+    for (size_t i = 0; i < region->num_workers; i++) {
+        ShmWorkerStats *stats = &region->stats[i];
+        printf("Worker: %lu\tPID: %d\tHashes: %lu\tShares: %lu\tSolutions: %lu\tHashrate: %.0lf H/s\n", i, stats->pid, stats->hashes, stats->shares, stats->solutions, stats->hashes / t_elapsed);
+    }
+    printf("Total hashrate: %.0lf H/s\n", shm_total_hashes(region) / t_elapsed);
+}
+
+#endif
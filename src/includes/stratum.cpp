@@ -0,0 +1,468 @@
+// Stratum v1 style mining client. Newline-delimited JSON over TCP with the network I/O on its own thread.
+#ifndef STRATUM_CPP
+#define STRATUM_CPP
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "json.cpp"
+#include "utils.h"
+
+#define STRATUM_AGENT "btc_miner_omp/1.0"
+#define STRATUM_RECV_BYTES 65536
+// Nonces handed to a mining thread per claim. Small enough that a job switch wastes almost nothing.
+#define STRATUM_NONCE_CHUNK 64
+
+/**
+ * Stratum client. Methods used: mining.subscribe, mining.authorize, mining.notify, mining.set_difficulty and
+ * mining.submit. Since the simulated block is the "[BLOCK ID|PREVIOUS DIGEST|DATA|THRESHOLD|NONCE]" string rather than
+ * a Bitcoin header, mining.notify carries the fields of the chain tip that get hashed, the threshold the digest must
+ * meet and this worker's nonce range:
+ *     params: [job_id, block_id, prev_digest, data, block_threshold, threshold, nonce_start, nonce_end, clean_jobs]
+ * and mining.submit sends [worker, job_id, nonce].
+ */
+class StratumClient {
+   public:
+    // Job class. Local copy of the job the pool asked us to work on.
+    class Job {
+       public:
+        char *job_id;
+        size_t block_id;
+        char *prev_digest;
+        char *data;
+        size_t block_threshold;  // threshold field of the tip, part of the hashed string
+        size_t threshold;        // leading zeros the digest must have
+        size_t nonce_start;
+        size_t nonce_end;  // exclusive
+    };
+
+    StratumClient(const char *host, const char *port, const char *worker);
+    ~StratumClient();
+    int connectToPool();
+    void start();
+    void stop();
+    int isConnected() { return __atomic_load_n(&connected, __ATOMIC_ACQUIRE); }
+    size_t getJobGeneration() { return __atomic_load_n(&job_generation, __ATOMIC_ACQUIRE); }
+    int isSolved(size_t generation) { return __atomic_load_n(&solved_generation, __ATOMIC_RELAXED) == generation; }
+    size_t getShareThreshold() { return __atomic_load_n(&share_threshold, __ATOMIC_RELAXED); }
+    size_t waitForJob(double timeout);
+    size_t copyJob(Job *dst);
+    int claimNonces(size_t generation, size_t &start, size_t &end);
+    void markSolved(size_t generation);
+    void submit(const char *job_id, size_t nonce);
+    static void freeJob(Job *job);
+
+    size_t accepted;
+    size_t rejected;
+    char *extranonce1;
+
+   private:
+    char *host;
+    char *port;
+    char *worker;
+    int sock;
+    int running;
+    int connected;
+    pthread_t thread;
+    pthread_mutex_t job_lock;
+    pthread_mutex_t send_lock;
+    Job job;
+    size_t job_generation;
+    size_t job_cursor;
+    size_t solved_generation;
+    size_t share_threshold;
+    size_t next_id;
+    size_t subscribe_id;
+    size_t authorize_id;
+
+    int sendLine(const char *line, size_t len);
+    size_t sendRequest(const char *method, JsonWriter *params);
+    void handleLine(const char *line);
+    void handleNotify(JsonValue *params);
+    static void *networkLoop(void *arg);
+};
+
+/**
+ * @brief Construct a new Stratum Client object. Does not connect.
+ *
+ * @param host
+ * @param port
+ * @param worker - worker name sent with mining.authorize and mining.submit
+ */
+StratumClient::StratumClient(const char *host, const char *port, const char *worker) {
+    this->host = strdup(host);
+    this->port = strdup(port);
+    this->worker = strdup(worker);
+    sock = -1;
+    running = 0;
+    connected = 0;
+    memset(&job, 0, sizeof(Job));
+    job_generation = 0;
+    job_cursor = 0;
+    solved_generation = 0;
+    share_threshold = 0;
+    next_id = 1;
+    subscribe_id = 0;
+    authorize_id = 0;
+    accepted = 0;
+    rejected = 0;
+    extranonce1 = NULL;
+    pthread_mutex_init(&job_lock, NULL);
+    pthread_mutex_init(&send_lock, NULL);
+}
+
+/**
+ * @brief Destroy the Stratum Client object
+ *
+ */
+StratumClient::~StratumClient() {
+    stop();
+    freeJob(&job);
+    free(extranonce1);
+    free(host);
+    free(port);
+    free(worker);
+    pthread_mutex_destroy(&job_lock);
+    pthread_mutex_destroy(&send_lock);
+}
+
+void StratumClient::freeJob(Job *job) {
+    free(job->job_id);
+    free(job->prev_digest);
+    free(job->data);
+    memset(job, 0, sizeof(Job));
+}
+
+/**
+ * @brief Opens the TCP connection and sends mining.subscribe and mining.authorize. The replies are handled by the
+ * network thread once start() is called.
+ *
+ * @return int - 0 on success, -1 on failure
+ */
+int StratumClient::connectToPool() {
+    struct addrinfo hints, *res, *rp;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err != 0) {
+        printf("Stratum: cannot resolve %s:%s (%s)\n", host, port, gai_strerror(err));
+        return -1;
+    }
+    for (rp = res; rp != NULL; rp = rp->ai_next) {
+        sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (sock < 0) {
+            continue;
+        }
+        if (connect(sock, rp->ai_addr, rp->ai_addrlen) == 0) {
+            break;
+        }
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    if (sock < 0) {
+        printf("Stratum: cannot connect to %s:%s\n", host, port);
+        return -1;
+    }
+    // Jobs and submits are tiny, don't let Nagle hold them back
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    __atomic_store_n(&connected, 1, __ATOMIC_RELEASE);
+
+    JsonWriter params;
+    json_writer_init(&params);
+    json_write(&params, "[");
+    json_write_string(&params, STRATUM_AGENT);
+    json_write(&params, "]");
+    subscribe_id = sendRequest("mining.subscribe", &params);
+
+    params.len = 0;
+    json_write(&params, "[");
+    json_write_string(&params, worker);
+    json_write(&params, ",\"x\"]");
+    authorize_id = sendRequest("mining.authorize", &params);
+    json_writer_free(&params);
+    return 0;
+}
+
+/**
+ * @brief Starts the network thread
+ *
+ */
+void StratumClient::start() {
+    running = 1;
+    pthread_create(&thread, NULL, networkLoop, this);
+}
+
+/**
+ * @brief Stops the network thread and closes the connection
+ *
+ */
+void StratumClient::stop() {
+    if (running) {
+        __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+        pthread_join(thread, NULL);
+    }
+    if (sock >= 0) {
+        close(sock);
+        sock = -1;
+    }
+    __atomic_store_n(&connected, 0, __ATOMIC_RELEASE);
+}
+
+int StratumClient::sendLine(const char *line, size_t len) {
+    pthread_mutex_lock(&send_lock);
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n = send(sock, line + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            pthread_mutex_unlock(&send_lock);
+            __atomic_store_n(&connected, 0, __ATOMIC_RELEASE);
+            return -1;
+        }
+        sent += n;
+    }
+    pthread_mutex_unlock(&send_lock);
+    return 0;
+}
+
+/**
+ * @brief Sends {"id":N,"method":method,"params":params}\n
+ *
+ * @param method
+ * @param params - already serialized JSON array
+ * @return size_t - request id
+ */
+size_t StratumClient::sendRequest(const char *method, JsonWriter *params) {
+    size_t id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    JsonWriter w;
+    json_writer_init(&w);
+    json_write(&w, "{\"id\":");
+    json_write_size_t(&w, id);
+    json_write(&w, ",\"method\":");
+    json_write_string(&w, method);
+    json_write(&w, ",\"params\":");
+    json_write_raw(&w, params->buf, params->len);
+    json_write(&w, "}\n");
+    sendLine(w.buf, w.len);
+    json_writer_free(&w);
+    return id;
+}
+
+/**
+ * @brief Submits a solution for job_id. Safe to call from any mining thread.
+ *
+ * @param job_id
+ * @param nonce
+ */
+void StratumClient::submit(const char *job_id, size_t nonce) {
+    JsonWriter params;
+    json_writer_init(&params);
+    json_write(&params, "[");
+    json_write_string(&params, worker);
+    json_write(&params, ",");
+    json_write_string(&params, job_id);
+    json_write(&params, ",");
+    json_write_size_t(&params, nonce);
+    json_write(&params, "]");
+    sendRequest("mining.submit", &params);
+    json_writer_free(&params);
+}
+
+/**
+ * @brief Blocks until the first job arrives
+ *
+ * @param timeout - seconds
+ * @return size_t - job generation, 0 on timeout or disconnect
+ */
+size_t StratumClient::waitForJob(double timeout) {
+    double t_end = omp_get_wtime() + timeout;
+    while (getJobGeneration() == 0 && isConnected() && omp_get_wtime() < t_end) {
+        usleep(1000);
+    }
+    return getJobGeneration();
+}
+
+/**
+ * @brief Copies the current job into dst. Buffers in dst are reused/reallocated.
+ *
+ * @param dst
+ * @return size_t - generation of the copied job
+ */
+size_t StratumClient::copyJob(Job *dst) {
+    pthread_mutex_lock(&job_lock);
+    freeJob(dst);
+    dst->job_id = strdup(job.job_id);
+    dst->block_id = job.block_id;
+    dst->prev_digest = strdup(job.prev_digest);
+    dst->data = strdup(job.data);
+    dst->block_threshold = job.block_threshold;
+    dst->threshold = job.threshold;
+    dst->nonce_start = job.nonce_start;
+    dst->nonce_end = job.nonce_end;
+    size_t generation = job_generation;
+    pthread_mutex_unlock(&job_lock);
+    return generation;
+}
+
+/**
+ * @brief Claims the next chunk of nonces of the current job for a mining thread
+ *
+ * @param generation - job generation the caller is working on
+ * @param start - first nonce of the chunk
+ * @param end - one past the last nonce of the chunk
+ * @return int - 1 on success, 0 if the job changed, is solved or its range is exhausted
+ */
+int StratumClient::claimNonces(size_t generation, size_t &start, size_t &end) {
+    int ok = 0;
+    pthread_mutex_lock(&job_lock);
+    if (generation == job_generation && solved_generation != generation && job_cursor < job.nonce_end) {
+        start = job_cursor;
+        end = (job.nonce_end - job_cursor > STRATUM_NONCE_CHUNK) ? job_cursor + STRATUM_NONCE_CHUNK : job.nonce_end;
+        job_cursor = end;
+        ok = 1;
+    }
+    pthread_mutex_unlock(&job_lock);
+    return ok;
+}
+
+/**
+ * @brief Stops all threads working on a job once a block has been submitted for it
+ *
+ * @param generation
+ */
+void StratumClient::markSolved(size_t generation) {
+    pthread_mutex_lock(&job_lock);
+    if (generation == job_generation) {
+        __atomic_store_n(&solved_generation, generation, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&job_lock);
+}
+
+void StratumClient::handleNotify(JsonValue *params) {
+    const char *job_id = json_string(json_at(params, 0));
+    const char *prev_digest = json_string(json_at(params, 2));
+    const char *data = json_string(json_at(params, 3));
+    if (job_id == NULL || prev_digest == NULL || data == NULL) {
+        printf("Stratum: malformed mining.notify ignored\n");
+        return;
+    }
+    Job next;
+    next.job_id = strdup(job_id);
+    next.block_id = json_size_t(json_at(params, 1));
+    next.prev_digest = strdup(prev_digest);
+    next.data = strdup(data);
+    next.block_threshold = json_size_t(json_at(params, 4));
+    next.threshold = json_size_t(json_at(params, 5));
+    next.nonce_start = json_size_t(json_at(params, 6));
+    next.nonce_end = json_at(params, 7) ? json_size_t(json_at(params, 7)) : MAX_SIZE_T;
+
+    // Swap the job in and publish the new generation. Mining threads poll the generation every attempt.
+    pthread_mutex_lock(&job_lock);
+    Job old = job;
+    job = next;
+    job_cursor = job.nonce_start;
+    __atomic_store_n(&job_generation, job_generation + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&job_lock);
+    freeJob(&old);
+}
+
+void StratumClient::handleLine(const char *line) {
+    JsonValue *msg = json_parse(line);
+    if (msg == NULL) {
+        printf("Stratum: unparsable line from pool ignored\n");
+        return;
+    }
+    const char *method = json_string(json_get(msg, "method"));
+    if (method != NULL) {
+        JsonValue *params = json_get(msg, "params");
+        if (strcmp(method, "mining.notify") == 0) {
+            handleNotify(params);
+        } else if (strcmp(method, "mining.set_difficulty") == 0) {
+            __atomic_store_n(&share_threshold, json_size_t(json_at(params, 0)), __ATOMIC_RELAXED);
+        }
+    } else {
+        // Response to one of our requests
+        size_t id = json_size_t(json_get(msg, "id"));
+        JsonValue *result = json_get(msg, "result");
+        if (id == subscribe_id) {
+            const char *en1 = json_string(json_at(result, 1));
+            if (en1 != NULL) {
+                extranonce1 = strdup(en1);
+            }
+        } else if (id == authorize_id) {
+            if (!json_true(result)) {
+                printf("Stratum: worker %s not authorized\n", worker);
+            }
+        } else if (json_true(result)) {
+            __atomic_fetch_add(&accepted, 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_fetch_add(&rejected, 1, __ATOMIC_RELAXED);
+        }
+    }
+    json_free(msg);
+}
+
+/**
+ * @brief Network thread. Reads newline-delimited messages and dispatches them until stop() or disconnect.
+ *
+ * @param arg - StratumClient
+ * @return void*
+ */
+void *StratumClient::networkLoop(void *arg) {
+    StratumClient *client = (StratumClient *)arg;
+    size_t cap = STRATUM_RECV_BYTES, len = 0;
+    char *buf = (char *)malloc(cap);
+    struct pollfd pfd;
+    pfd.fd = client->sock;
+    pfd.events = POLLIN;
+
+    while (__atomic_load_n(&client->running, __ATOMIC_ACQUIRE)) {
+        int ready = poll(&pfd, 1, 50);
+        if (ready <= 0) {
+            continue;
+        }
+        if (len + 1 >= cap) {
+            // Job lines grow with the chain data so the buffer does too
+            cap *= 2;
+            buf = (char *)realloc(buf, cap);
+        }
+        ssize_t n = recv(client->sock, buf + len, cap - len - 1, 0);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            printf("Stratum: connection closed by pool\n");
+            __atomic_store_n(&client->connected, 0, __ATOMIC_RELEASE);
+            break;
+        }
+        len += n;
+        buf[len] = '\0';
+
+        char *line = buf;
+        char *newline;
+        while ((newline = strchr(line, '\n')) != NULL) {
+            *newline = '\0';
+            if (newline > line) {
+                client->handleLine(line);
+            }
+            line = newline + 1;
+        }
+        len -= line - buf;
+        memmove(buf, line, len);
+    }
+    free(buf);
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,271 @@
+// Batched teams/distribute mining kernel. The nonce independent prefix of the preimage is hashed once on the host and
+// mapped as a small fixed size job, so the kernel hashes each nonce with a stack buffer and never allocates. A batch is
+// split into fixed size tiles, one per team at a time, and the same code runs as a target region on a device, on the
+// host when offloading is disabled (OMP_TARGET_OFFLOAD=disabled or no device), or as a host teams region.
+#ifndef TEAMS_KERNEL_CPP
+#define TEAMS_KERNEL_CPP
+
+#include "sha256.cpp"
+#include "utils.h"
+
+#define TEAMS_MAX_DIGITS 20           // decimal digits of the largest size_t
+#define TEAMS_DEFAULT_TILE 4096       // nonces per tile
+#define TEAMS_DEFAULT_TILES_PER_TEAM 4  // tiles each team hashes per batch
+
+enum TeamsBackend { TEAMS_BACKEND_TARGET, TEAMS_BACKEND_HOST, NUM_TEAMS_BACKENDS };
+const char *TEAMS_BACKEND_NAMES[NUM_TEAMS_BACKENDS] = {"target", "host"};
+
+/**
+ * @brief Looks up a teams backend by name
+ *
+ * @param name - target or host
+ * @return int - TeamsBackend, -1 if unknown
+ */
+int teams_backend_from_name(const char *name) {
+    for (int i = 0; i < NUM_TEAMS_BACKENDS; i++) {
+        if (strcmp(name, TEAMS_BACKEND_NAMES[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#if RUN_ON_TARGET
+#pragma omp declare target
+#endif
+/**
+ * Everything the kernel needs about one job. Plain data, mapped to the device as is.
+ */
+struct TeamsJob {
+    WORD midstate[8];          // state after the full blocks of the prefix
+    unsigned char rem[64];     // prefix bytes after the last full block
+    unsigned long rem_len;
+    unsigned long prefix_len;  // length of "[block_id|prev_digest|data|threshold|"
+    unsigned long min_digits;  // NONCE_FIXED_DIGITS for fixed width nonces
+    unsigned long threshold;   // leading zero hex digits the digest must have, exactly
+};
+
+/**
+ * @brief Number of leading zero hex digits of a digest given as 8 state words
+ */
+inline unsigned int teams_leading_zeros(const WORD *state) {
+    unsigned int zeros = 0;
+    for (unsigned int i = 0; i < 8; i++) {
+        WORD word = state[i];
+        for (int shift = 28; shift >= 0; shift -= 4) {
+            if ((word >> shift) & 0xf) {
+                return zeros;
+            }
+            zeros++;
+        }
+    }
+    return zeros;
+}
+
+/**
+ * @brief Double SHA-256 of the job's preimage with the given nonce, finished from the midstate in at most two blocks
+ *
+ * @param job
+ * @param nonce
+ * @param state - second hash as 8 big-endian words
+ */
+inline void teams_hash_nonce(const TeamsJob *job, size_t nonce, WORD *state) {
+    char digits[TEAMS_MAX_DIGITS];
+    unsigned long num_digits = 0;
+    do {
+        digits[TEAMS_MAX_DIGITS - 1 - num_digits++] = '0' + (nonce % 10);
+        nonce /= 10;
+    } while (nonce > 0 || num_digits < job->min_digits);
+
+    unsigned char block[2 * BLOCKSIZE];
+    unsigned long at = job->rem_len;
+    memcpy(block, job->rem, at);
+    memcpy(block + at, digits + TEAMS_MAX_DIGITS - num_digits, num_digits);
+    at += num_digits;
+    block[at++] = ']';
+    const unsigned long num_blocks = (at + 9 <= BLOCKSIZE) ? 1 : 2;
+    memset(block + at, 0, num_blocks * BLOCKSIZE - at);
+    block[at] = 0x80;
+    const unsigned long bits = (job->prefix_len + num_digits + 1) << 3;
+    WORDTOCHAR((WORD)(bits >> 32), block + num_blocks * BLOCKSIZE - 8);
+    WORDTOCHAR((WORD)bits, block + num_blocks * BLOCKSIZE - 4);
+
+    WORD first[8];
+    for (unsigned int i = 0; i < 8; i++) {
+        first[i] = job->midstate[i];
+    }
+    Transform(block, num_blocks, first);
+    sha256_digest_block(first, state);
+}
+#if RUN_ON_TARGET
+#pragma omp end declare target
+#endif
+
+/**
+ * @brief Hashes the nonce independent prefix of a block to mine on the host
+ *
+ * @param job - output
+ * @param block_id
+ * @param prev_digest - hex
+ * @param data
+ * @param block_threshold - threshold stored in the block, as in the preimage
+ * @param threshold - leading zeros the digest must have
+ * @param format - chain format version of the nonce
+ */
+void teams_job_init(TeamsJob &job, size_t block_id, const char *prev_digest, const char *data, size_t block_threshold, size_t threshold, unsigned char format) {
+    size_t len = strlen(prev_digest) + strlen(data) + 2 * SIZE_T_STR_BYTES + 8;
+    char *prefix = (char *)malloc(len);
+    job.prefix_len = snprintf(prefix, len, "[%lu|%s|%s|%lu|", block_id, prev_digest, data, block_threshold);
+    memcpy(job.midstate, SHA256_IV, sizeof(job.midstate));
+    const size_t num_blocks = job.prefix_len / BLOCKSIZE;
+    Transform((const unsigned char *)prefix, num_blocks, job.midstate);
+    job.rem_len = job.prefix_len - num_blocks * BLOCKSIZE;
+    memcpy(job.rem, prefix + num_blocks * BLOCKSIZE, job.rem_len);
+    free(prefix);
+    job.min_digits = (format == NONCE_FORMAT_FIXED) ? NONCE_FIXED_DIGITS : 1;
+    job.threshold = threshold;
+}
+
+/**
+ * Where and how a batch found its nonce, and how much of the batch was hashed
+ */
+struct TeamsResult {
+    size_t nonce;  // MAX_SIZE_T if none was found
+    int team;
+    int tid;
+    size_t hashed;  // nonces actually hashed, fewer than the batch after a find
+};
+
+/**
+ * TeamsEngine class. Hashes batches of num_teams * tiles_per_team tiles of tile_size nonces each.
+ */
+class TeamsEngine {
+   public:
+    TeamsEngine(int backend, int num_teams, int threads_per_team, size_t tile_size, size_t tiles_per_team);
+    void setJob(size_t block_id, const char *prev_digest, const char *data, size_t block_threshold, size_t threshold, unsigned char format = NONCE_FORMAT_ASCII);
+    TeamsResult mineBatch(size_t base);
+    size_t batchSize() const { return (size_t)num_teams * tiles_per_team * tile_size; }
+    void printStats();
+
+    int backend;
+    int num_teams;
+    int threads_per_team;
+    size_t tile_size;
+    size_t tiles_per_team;
+
+   private:
+    TeamsJob job;
+    size_t batches;
+    size_t nonces;  // nonces hashed, not counting the rest of a batch skipped after a find
+    double total_time;
+};
+
+/**
+ * @brief Construct a new Teams Engine object
+ *
+ * @param backend - TeamsBackend
+ * @param num_teams - 0 for the implementation default
+ * @param threads_per_team - 0 for the implementation default
+ * @param tile_size - nonces per tile
+ * @param tiles_per_team - tiles each team hashes per batch
+ */
+TeamsEngine::TeamsEngine(int backend, int num_teams, int threads_per_team, size_t tile_size, size_t tiles_per_team) {
+    this->backend = backend;
+    this->num_teams = num_teams > 0 ? num_teams : (backend == TEAMS_BACKEND_HOST ? omp_get_num_procs() : 1);
+    this->threads_per_team = threads_per_team > 0 ? threads_per_team : (backend == TEAMS_BACKEND_HOST ? 1 : omp_get_max_threads());
+    this->tile_size = tile_size > 0 ? tile_size : TEAMS_DEFAULT_TILE;
+    this->tiles_per_team = tiles_per_team > 0 ? tiles_per_team : TEAMS_DEFAULT_TILES_PER_TEAM;
+    memset(&job, 0, sizeof(job));
+    batches = nonces = 0;
+    total_time = 0.0;
+}
+
+/**
+ * @brief Sets the block to mine
+ *
+ * @param block_id
+ * @param prev_digest - hex
+ * @param data
+ * @param block_threshold - threshold stored in the block, as in the preimage
+ * @param threshold - leading zeros the digest must have
+ * @param format - chain format version of the nonce
+ */
+void TeamsEngine::setJob(size_t block_id, const char *prev_digest, const char *data, size_t block_threshold, size_t threshold, unsigned char format) {
+    teams_job_init(job, block_id, prev_digest, data, block_threshold, threshold, format);
+}
+
+/**
+ * @brief Hashes the batch starting at base. Tile t covers [base + t * tile_size, base + (t + 1) * tile_size) and is
+ * hashed by one team. Once a nonce is found the remaining nonces of the batch are skipped.
+ *
+ * @param base - first nonce of the batch
+ * @return TeamsResult - the nonce found, MAX_SIZE_T if none, and the number of nonces hashed
+ */
+TeamsResult TeamsEngine::mineBatch(size_t base) {
+    const double t_start = omp_get_wtime();
+    const TeamsJob job = this->job;
+    const size_t num_tiles = (size_t)num_teams * tiles_per_team;
+    const size_t tile_size = this->tile_size;
+    const int num_teams = this->num_teams;
+    const int threads_per_team = this->threads_per_team;
+    size_t found_nonce = MAX_SIZE_T;
+    int found_team = 0;
+    int found_tid = 0;
+    size_t hashed = 0;
+
+    // One body for both backends, so the host teams path measures exactly what a device would run. Each tile adds the
+    // nonces it hashed once, not per nonce
+#define TEAMS_TILE_BODY                                                                  \
+    for (size_t tile = 0; tile < num_tiles; tile++) {                                    \
+        const size_t tile_base = base + tile * tile_size;                                \
+        size_t tile_hashed = 0;                                                          \
+        _Pragma("omp parallel for num_threads(threads_per_team) schedule(static) reduction(+ : tile_hashed)") \
+        for (size_t i = 0; i < tile_size; i++) {                                         \
+            size_t found;                                                                \
+            _Pragma("omp atomic read")                                                   \
+            found = found_nonce;                                                         \
+            if (found != MAX_SIZE_T) {                                                   \
+                continue;                                                                \
+            }                                                                            \
+            WORD state[8];                                                               \
+            teams_hash_nonce(&job, tile_base + i, state);                                \
+            tile_hashed++;                                                               \
+            if (teams_leading_zeros(state) == job.threshold) {                           \
+                _Pragma("omp critical(teams_found)")                                     \
+                if (found_nonce == MAX_SIZE_T || tile_base + i < found_nonce) {          \
+                    found_nonce = tile_base + i;                                         \
+                    found_team = omp_get_team_num();                                     \
+                    found_tid = omp_get_thread_num();                                    \
+                }                                                                        \
+            }                                                                            \
+        }                                                                                \
+        _Pragma("omp atomic update")                                                     \
+        hashed += tile_hashed;                                                           \
+    }
+
+    if (backend == TEAMS_BACKEND_HOST) {
+#pragma omp teams distribute num_teams(num_teams) thread_limit(threads_per_team) shared(found_nonce, found_team, found_tid, hashed)
+        TEAMS_TILE_BODY
+    } else {
+#pragma omp target teams distribute num_teams(num_teams) thread_limit(threads_per_team) map(to: job) map(tofrom: found_nonce, found_team, found_tid, hashed)
+        TEAMS_TILE_BODY
+    }
+#undef TEAMS_TILE_BODY
+
+    batches++;
+    nonces += hashed;
+    total_time += omp_get_wtime() - t_start;
+    TeamsResult result = {found_nonce, found_team, found_tid, hashed};
+    return result;
+}
+
+/**
+ * @brief Prints the kernel configuration and its hashrate
+ *
+ */
+void TeamsEngine::printStats() {
+    printf("\nTeams kernel: %s backend, %d teams x %d threads, tile %lu nonces, %lu tiles per team\n", TEAMS_BACKEND_NAMES[backend], num_teams, threads_per_team, tile_size, tiles_per_team);
+    printf("Batches: %lu\tNonces: %lu\tTime: %.3lf s\tHashrate: %.3lf MH/s\tAvg batch: %.3lf ms\n", batches, nonces, total_time, total_time > 0 ? nonces / total_time / 1e6 : 0.0, batches ? total_time / batches * 1e3 : 0.0);
+}
+
+#endif
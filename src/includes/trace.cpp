@@ -0,0 +1,192 @@
+// Timeline tracing of the mining phases. Scoped events go into a ring buffer owned by the recording thread, so recording
+// takes no lock and shares no cache line; the buffers are written as Chrome Trace Event JSON at exit, which Perfetto and
+// chrome://tracing load. Build with BTC_TRACE=1 (make TRACE=1) to record. Otherwise every TRACE_ macro expands to
+// nothing, or to the bare statement it wraps, and tracing costs nothing.
+#ifndef TRACE_CPP
+#define TRACE_CPP
+
+#include "utils.h"
+
+#ifndef BTC_TRACE
+#define BTC_TRACE 0
+#endif
+
+#if BTC_TRACE
+
+#ifndef CACHE_LINE_BYTES
+#define CACHE_LINE_BYTES 64
+#endif
+#define TRACE_MAX_THREADS 1024
+#define TRACE_RING_EVENTS (1 << 16)  // most recent events kept per thread
+#define TRACE_NAME_BYTES 32
+
+/**
+ * One complete ("X") event
+ */
+struct TraceEvent {
+    const char *name;  // string literal
+    double t_start;
+    double duration;
+    size_t arg;
+};
+
+/**
+ * Events of one thread. Only the owner writes; the exporter reads after the owner has stopped.
+ */
+struct alignas(CACHE_LINE_BYTES) TraceBuffer {
+    size_t written;  // events ever recorded, the ring keeps the last TRACE_RING_EVENTS
+    int tid;
+    char name[TRACE_NAME_BYTES];
+    TraceEvent events[TRACE_RING_EVENTS];
+};
+
+static TraceBuffer *trace_buffers[TRACE_MAX_THREADS];
+static size_t trace_num_buffers = 0;
+static double trace_t0 = omp_get_wtime();
+static __thread TraceBuffer *trace_local = NULL;
+
+/**
+ * @brief Buffer of the calling thread, registered on its first event
+ *
+ * @return TraceBuffer* - NULL once TRACE_MAX_THREADS threads have registered
+ */
+static TraceBuffer *trace_buffer() {
+    if (trace_local == NULL) {
+        size_t index = __atomic_fetch_add(&trace_num_buffers, 1, __ATOMIC_RELAXED);
+        if (index >= TRACE_MAX_THREADS) {
+            return NULL;
+        }
+        void *mem = huge_alloc(sizeof(TraceBuffer), -1, "trace");
+        if (mem == NULL) {
+            return NULL;
+        }
+        trace_local = (TraceBuffer *)mem;
+        trace_local->written = 0;
+        trace_local->tid = (int)index;
+        snprintf(trace_local->name, TRACE_NAME_BYTES, "thread %lu", index);
+        __atomic_store_n(&trace_buffers[index], trace_local, __ATOMIC_RELEASE);
+    }
+    return trace_local;
+}
+
+/**
+ * @brief Names the calling thread in the timeline
+ *
+ * @param name
+ * @param index - appended to the name if not negative
+ */
+void trace_thread_name(const char *name, long index) {
+    TraceBuffer *buffer = trace_buffer();
+    if (buffer == NULL) {
+        return;
+    }
+    if (index >= 0) {
+        snprintf(buffer->name, TRACE_NAME_BYTES, "%s %ld", name, index);
+    } else {
+        snprintf(buffer->name, TRACE_NAME_BYTES, "%s", name);
+    }
+}
+
+/**
+ * @brief Records an event of the calling thread that started at t_start and ends now
+ *
+ * @param name - string literal
+ * @param t_start - omp_get_wtime() at the start
+ * @param arg - shown as args.n
+ */
+inline void trace_complete(const char *name, double t_start, size_t arg) {
+    TraceBuffer *buffer = trace_buffer();
+    if (buffer == NULL) {
+        return;
+    }
+    TraceEvent *event = &buffer->events[buffer->written % TRACE_RING_EVENTS];
+    event->name = name;
+    event->t_start = t_start;
+    event->duration = omp_get_wtime() - t_start;
+    event->arg = arg;
+    __atomic_store_n(&buffer->written, buffer->written + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Records the enclosing scope as one event
+ */
+struct TraceScope {
+    const char *name;
+    double t_start;
+    size_t arg;
+    TraceScope(const char *name, size_t arg = 0) : name(name), t_start(omp_get_wtime()), arg(arg) {}
+    ~TraceScope() { trace_complete(name, t_start, arg); }
+};
+
+/**
+ * @brief Writes every thread's events as Chrome Trace Event JSON. Call once the traced threads have stopped.
+ *
+ * @param path
+ * @return int - 0 on success, -1 if the file cannot be written
+ */
+int trace_write(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        printf("Cannot write trace %s\n", path);
+        return -1;
+    }
+    const size_t num_buffers = __atomic_load_n(&trace_num_buffers, __ATOMIC_RELAXED);
+    size_t total = 0;
+    size_t dropped = 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"btc_miner\"}}");
+    for (size_t i = 0; i < num_buffers && i < TRACE_MAX_THREADS; i++) {
+        TraceBuffer *buffer = __atomic_load_n(&trace_buffers[i], __ATOMIC_ACQUIRE);
+        if (buffer == NULL) {
+            continue;
+        }
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", buffer->tid, buffer->name);
+        const size_t written = __atomic_load_n(&buffer->written, __ATOMIC_ACQUIRE);
+        const size_t first = written > TRACE_RING_EVENTS ? written - TRACE_RING_EVENTS : 0;
+        for (size_t k = first; k < written; k++) {
+            const TraceEvent *event = &buffer->events[k % TRACE_RING_EVENTS];
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3lf,\"dur\":%.3lf,\"args\":{\"n\":%lu}}", event->name, buffer->tid, (event->t_start - trace_t0) * 1e6, event->duration * 1e6, event->arg);
+        }
+        total += written - first;
+        dropped += first;
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    printf("\nTrace: %lu events from %lu threads written to %s", total, num_buffers, path);
+    if (dropped > 0) {
+        printf(" (%lu older events overwritten)", dropped);
+    }
+    printf("\n");
+    return 0;
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, arg) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, arg)
+#define TRACE_LOCK(statement, name)       \
+    do {                                  \
+        double trace_t = omp_get_wtime(); \
+        statement;                        \
+        trace_complete(name, trace_t, 0); \
+    } while (0)
+#define TRACE_TIME(var) double var = omp_get_wtime()
+#define TRACE_MARK(var) var = omp_get_wtime()
+#define TRACE_COMPLETE(name, t_start, arg) trace_complete(name, t_start, arg)
+#define TRACE_THREAD(name, index) trace_thread_name(name, index)
+#define TRACE_WRITE(path) trace_write(path)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_ARG(name, arg)
+#define TRACE_LOCK(statement, name) statement
+#define TRACE_TIME(var)
+#define TRACE_MARK(var)
+#define TRACE_COMPLETE(name, t_start, arg)
+#define TRACE_THREAD(name, index)
+#define TRACE_WRITE(path) (printf("Tracing is compiled out, rebuild with make TRACE=1 to write %s\n", path), -1)
+
+#endif
+
+#endif
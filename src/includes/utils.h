@@ -28,14 +28,15 @@ void print_current_block_info(Blockchain& blockchain, size_t& nonce) {
  * @param digest
  * @param nonce
  * @param data_to_hash
+ * @param tid - thread that found the block, when it is not the calling thread
  */
-void print_new_block_info(double& t_start, const double& t_start_global, char* digest, size_t& nonce, char* data_to_hash) {
+void print_new_block_info(double& t_start, const double& t_start_global, char* digest, size_t& nonce, char* data_to_hash, int tid = omp_get_thread_num()) {
     // Record time
     double t_end = omp_get_wtime();
     double t_elapsed = t_end - t_start;
     double t_global_elapsed = t_end - t_start_global;
     // Print the block info
-    printf("Digest: \t\t\t\t%s\tNonce: %lu\tTID: %d\n", digest, nonce, omp_get_thread_num());
+    printf("Digest: \t\t\t\t%s\tNonce: %lu\tTID: %d\n", digest, nonce, tid);
     printf("Data: \t\t\t\t\t%s\n", data_to_hash);
     printf("Block runtime: \t\t\t%lf seconds\tTotal runtime: %lf seconds\n", t_elapsed, t_global_elapsed);
 }
@@ -0,0 +1,314 @@
+// Dedicated verifier threads. Every block candidate is recomputed once by each verifier, optionally with different
+// hasher backends, and the verdicts come back through a lock-free completion queue.
+#ifndef VERIFIER_POOL_CPP
+#define VERIFIER_POOL_CPP
+
+#include <pthread.h>
+
+#include "sha256.cpp"
+#include "sha256_openssl.cpp"
+#include "trace.cpp"
+#include "utils.h"
+
+#define VERIFIER_MAX 16
+#define VERIFIER_QUEUE 64
+#define COMPLETION_QUEUE 256
+#ifndef CACHE_LINE_BYTES
+#define CACHE_LINE_BYTES 64
+#endif
+
+enum VerifierBackend { BACKEND_OPENSSL, BACKEND_SCALAR, NUM_BACKENDS };
+const char *VERIFIER_BACKEND_NAMES[NUM_BACKENDS] = {"openssl", "scalar"};
+
+struct VerifyRequest {
+    size_t tag;
+    const char *data_to_hash;  // owned by the submitter until every verifier has answered
+    size_t threshold;
+    double t_submit;
+};
+
+struct VerifyResult {
+    size_t tag;
+    int verifier;
+    int backend;
+    int accepted;
+    double t_submit;
+    double t_done;
+    char digest[2 * SHA256_DIGEST_LENGTH + 1];
+};
+
+/**
+ * Bounded multi-producer multi-consumer queue of results. Each slot carries a sequence number that says whether it is
+ * free for the producer of that lap or full for the consumer, so push and pop only need one CAS on the position.
+ */
+class CompletionQueue {
+   public:
+    CompletionQueue();
+    int push(const VerifyResult &result);
+    int pop(VerifyResult &result);
+
+   private:
+    struct Slot {
+        size_t sequence;
+        VerifyResult result;
+    };
+    Slot slots[COMPLETION_QUEUE];
+    alignas(CACHE_LINE_BYTES) size_t enqueue_pos;
+    alignas(CACHE_LINE_BYTES) size_t dequeue_pos;
+};
+
+CompletionQueue::CompletionQueue() {
+    for (size_t i = 0; i < COMPLETION_QUEUE; i++) {
+        slots[i].sequence = i;
+    }
+    enqueue_pos = 0;
+    dequeue_pos = 0;
+}
+
+/**
+ * @brief Adds a result without locking
+ *
+ * @return int - 1 on success, 0 if the queue is full
+ */
+int CompletionQueue::push(const VerifyResult &result) {
+    size_t pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    while (1) {
+        Slot *slot = &slots[pos % COMPLETION_QUEUE];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)sequence - (long)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->result = result;
+                __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;
+        } else {
+            pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * @brief Takes the oldest result without locking
+ *
+ * @return int - 1 on success, 0 if the queue is empty
+ */
+int CompletionQueue::pop(VerifyResult &result) {
+    size_t pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+    while (1) {
+        Slot *slot = &slots[pos % COMPLETION_QUEUE];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)sequence - (long)(pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                result = slot->result;
+                __atomic_store_n(&slot->sequence, pos + COMPLETION_QUEUE, __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;
+        } else {
+            pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * Request queue and counters of one verifier thread.
+ */
+struct alignas(CACHE_LINE_BYTES) Verifier {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    VerifyRequest requests[VERIFIER_QUEUE];
+    size_t head;
+    size_t count;
+    int backend;
+    size_t verified;
+    size_t rejected;
+    double total_latency;
+};
+
+/**
+ * VerifierPool class. num_verifiers threads, each recomputing every submitted candidate independently.
+ */
+class VerifierPool {
+   public:
+    VerifierPool(size_t num_verifiers, int mixed_backends);
+    ~VerifierPool();
+    void start(void (*notify)(void *), void *notify_arg);
+    void stop();
+    void submit(size_t tag, const char *data_to_hash, size_t threshold);
+    int poll(VerifyResult &result) { return completions.pop(result); }
+    void printStats();
+
+    size_t num_verifiers;
+
+   private:
+    Verifier verifiers[VERIFIER_MAX];
+    CompletionQueue completions;
+    int running;
+    void (*notify)(void *);
+    void *notify_arg;
+
+    struct ThreadArg {
+        VerifierPool *pool;
+        int id;
+    } args[VERIFIER_MAX];
+    static void *verifierLoop(void *arg);
+};
+
+/**
+ * @brief Construct a new Verifier Pool object
+ *
+ * @param num_verifiers - at most VERIFIER_MAX
+ * @param mixed_backends - if set, verifiers alternate between the OpenSSL and the scalar SHA-256 backends
+ */
+VerifierPool::VerifierPool(size_t num_verifiers, int mixed_backends) {
+    this->num_verifiers = num_verifiers < VERIFIER_MAX ? num_verifiers : VERIFIER_MAX;
+    running = 0;
+    notify = NULL;
+    notify_arg = NULL;
+    for (size_t i = 0; i < this->num_verifiers; i++) {
+        Verifier *v = &verifiers[i];
+        pthread_mutex_init(&v->lock, NULL);
+        pthread_cond_init(&v->ready, NULL);
+        v->head = v->count = 0;
+        v->backend = mixed_backends ? (int)(i % NUM_BACKENDS) : BACKEND_OPENSSL;
+        v->verified = v->rejected = 0;
+        v->total_latency = 0.0;
+    }
+}
+
+/**
+ * @brief Destroy the Verifier Pool object
+ *
+ */
+VerifierPool::~VerifierPool() {
+    for (size_t i = 0; i < num_verifiers; i++) {
+        pthread_mutex_destroy(&verifiers[i].lock);
+        pthread_cond_destroy(&verifiers[i].ready);
+    }
+}
+
+/**
+ * @brief Starts the verifier threads
+ *
+ * @param notify - called by a verifier after it pushed a result, to wake the consumer
+ * @param notify_arg
+ */
+void VerifierPool::start(void (*notify)(void *), void *notify_arg) {
+    this->notify = notify;
+    this->notify_arg = notify_arg;
+    running = 1;
+    for (size_t i = 0; i < num_verifiers; i++) {
+        args[i].pool = this;
+        args[i].id = i;
+        pthread_create(&verifiers[i].thread, NULL, verifierLoop, &args[i]);
+    }
+}
+
+/**
+ * @brief Finishes the queued requests, then joins the verifier threads
+ *
+ */
+void VerifierPool::stop() {
+    for (size_t i = 0; i < num_verifiers; i++) {
+        pthread_mutex_lock(&verifiers[i].lock);
+        running = 0;
+        pthread_cond_signal(&verifiers[i].ready);
+        pthread_mutex_unlock(&verifiers[i].lock);
+    }
+    for (size_t i = 0; i < num_verifiers; i++) {
+        pthread_join(verifiers[i].thread, NULL);
+    }
+}
+
+/**
+ * @brief Queues the candidate on every verifier. Each one answers with its own result under the same tag.
+ *
+ * @param tag
+ * @param data_to_hash - must stay valid until num_verifiers results with this tag came back
+ * @param threshold
+ */
+void VerifierPool::submit(size_t tag, const char *data_to_hash, size_t threshold) {
+    VerifyRequest request = {tag, data_to_hash, threshold, omp_get_wtime()};
+    for (size_t i = 0; i < num_verifiers; i++) {
+        Verifier *v = &verifiers[i];
+        pthread_mutex_lock(&v->lock);
+        if (v->count < VERIFIER_QUEUE) {
+            v->requests[(v->head + v->count) % VERIFIER_QUEUE] = request;
+            v->count++;
+        }
+        pthread_cond_signal(&v->ready);
+        pthread_mutex_unlock(&v->lock);
+    }
+}
+
+/**
+ * @brief Verifier thread. Recomputes the digest with its backend and checks the threshold.
+ *
+ * @param arg - ThreadArg*
+ * @return void* - NULL
+ */
+void *VerifierPool::verifierLoop(void *arg) {
+    VerifierPool *pool = ((ThreadArg *)arg)->pool;
+    const int id = ((ThreadArg *)arg)->id;
+    Verifier *v = &pool->verifiers[id];
+    Blockchain checker;  // only used for thresholdMet
+    TRACE_THREAD("verifier", id);
+    while (1) {
+        pthread_mutex_lock(&v->lock);
+        while (v->count == 0 && pool->running) {
+            pthread_cond_wait(&v->ready, &v->lock);
+        }
+        if (v->count == 0) {
+            pthread_mutex_unlock(&v->lock);
+            break;
+        }
+        VerifyRequest request = v->requests[v->head];
+        v->head = (v->head + 1) % VERIFIER_QUEUE;
+        v->count--;
+        pthread_mutex_unlock(&v->lock);
+
+        TRACE_TIME(t_verify);
+        char *digest = (v->backend == BACKEND_SCALAR) ? gpu_double_sha256(request.data_to_hash) : double_sha256(request.data_to_hash);
+        VerifyResult result;
+        result.tag = request.tag;
+        result.verifier = id;
+        result.backend = v->backend;
+        result.accepted = checker.thresholdMet((const char *)digest, request.threshold);
+        result.t_submit = request.t_submit;
+        result.t_done = omp_get_wtime();
+        memcpy(result.digest, digest, sizeof(result.digest));
+        free(digest);
+        TRACE_COMPLETE("quorum verify", t_verify, request.tag);
+
+        v->verified++;
+        v->rejected += !result.accepted;
+        v->total_latency += result.t_done - result.t_submit;
+        while (!pool->completions.push(result)) {
+            usleep(10);  // consumer is behind
+        }
+        if (pool->notify != NULL) {
+            pool->notify(pool->notify_arg);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Prints the per-verifier counters
+ *
+ */
+void VerifierPool::printStats() {
+    printf("\nVerifiers:\n");
+    for (size_t i = 0; i < num_verifiers; i++) {
+        Verifier *v = &verifiers[i];
+        printf("Verifier: %lu\tBackend: %s\tVerified: %lu\tRejected: %lu\tAvg latency: %.1lf us\n", i, VERIFIER_BACKEND_NAMES[v->backend], v->verified, v->rejected, v->verified ? v->total_latency / v->verified * 1e6 : 0.0);
+    }
+}
+
+#endif
@@ -0,0 +1,347 @@
+// Work-stealing nonce scheduler. Every thread owns a deque of nonce ranges; a thread that runs dry steals half of a
+// victim's remaining range before it takes fresh nonces from its node's dispenser.
+#ifndef WORK_STEALING_CPP
+#define WORK_STEALING_CPP
+
+#include "interval_set.cpp"
+#include "numa.cpp"
+#include "trace.cpp"
+#include "utils.h"
+
+#define WS_SEGMENT (1 << 16)  // nonces per fresh range taken from the node dispenser
+#define WS_BATCH 64           // default nonces a thread takes out of its deque at a time
+#define WS_MIN_STEAL_BATCHES 4  // a range is only split if both halves hold at least two batches
+#define WS_MAX_RANGES 16
+#define WS_MAX_FINISHED 64  // finished runs kept per thread between two drains
+
+/**
+ * Per-thread deque of nonce ranges. The owner pops batches from the front; thieves split the back range. The lock is
+ * only taken once per batch by the owner and on steals, so it is almost never contended.
+ */
+struct alignas(CACHE_LINE_BYTES) WorkDeque {
+    omp_lock_t lock;
+    size_t generation;
+    size_t count;
+    NonceRange ranges[WS_MAX_RANGES];
+    // owner-only: the batch being hashed, already out of the deque
+    size_t batch_begin;
+    size_t batch_next;
+    size_t batch_end;
+    size_t batch_generation;
+#if BTC_TRACE
+    double trace_batch_start;
+#endif
+    // fully hashed nonces of the current generation: the growing run and older runs, drained by drainCovered()
+    NonceRange run;
+    size_t num_finished;
+    NonceRange finished[WS_MAX_FINISHED];
+    // telemetry
+    size_t steals;
+    size_t stolen_nonces;
+    size_t victimized;
+    size_t segments;
+    double max_switch_latency;
+};
+
+/**
+ * WorkStealingScheduler class. Hands out nonces to the mining threads of one job generation at a time.
+ */
+class WorkStealingScheduler {
+   public:
+    WorkStealingScheduler(NumaTopology &topology, size_t num_threads);
+    ~WorkStealingScheduler();
+    /**
+     * @brief Returns the next nonce for thread tid. Hot path: one compare and increment on the thread's own line.
+     */
+    inline size_t nextNonce(int tid, size_t generation) {
+        WorkDeque *dq = &deques[tid];
+        if (dq->batch_next < dq->batch_end && dq->batch_generation == generation) {
+            return dq->batch_next++;
+        }
+        refill(tid, generation);
+        return dq->batch_next++;
+    }
+    void setBatch(size_t batch);
+    void jobStarted(size_t generation, double t);
+    void setCovered(size_t generation, const IntervalSet *covered);
+    void drainCovered(size_t generation, IntervalSet &set, int include_batches);
+    void printTelemetry();
+
+   private:
+    NumaTopology &topology;
+    size_t num_threads;
+    size_t batch;
+    WorkDeque *deques;
+    size_t started_generation;
+    double t_job_start;
+    size_t covered_generation;
+    const IntervalSet *covered;  // nonces of covered_generation searched before a restart
+
+    void refill(int tid, size_t generation);
+    void recordBatch(WorkDeque *dq);
+    int popBatch(WorkDeque *dq, size_t generation);
+    int steal(int tid, size_t generation, NonceRange &loot);
+};
+
+/**
+ * @brief Construct a new Work Stealing Scheduler object
+ *
+ * @param topology - nodes must be initialized before the first nextNonce()
+ * @param num_threads
+ */
+WorkStealingScheduler::WorkStealingScheduler(NumaTopology &topology, size_t num_threads) : topology(topology) {
+    this->num_threads = num_threads;
+    batch = WS_BATCH;
+    // Read on every nonce, so the deques share huge pages
+    deques = (WorkDeque *)huge_alloc(sizeof(WorkDeque) * num_threads, -1, "scheduler");
+    for (size_t i = 0; i < num_threads; i++) {
+        memset(&deques[i], 0, sizeof(WorkDeque));
+        omp_init_lock(&deques[i].lock);
+    }
+    started_generation = 0;
+    t_job_start = omp_get_wtime();
+    covered_generation = 0;
+    covered = NULL;
+}
+
+/**
+ * @brief Destroy the Work Stealing Scheduler object
+ *
+ */
+WorkStealingScheduler::~WorkStealingScheduler() {
+    for (size_t i = 0; i < num_threads; i++) {
+        omp_destroy_lock(&deques[i].lock);
+    }
+    huge_free(deques, sizeof(WorkDeque) * num_threads);
+}
+
+/**
+ * @brief Sets how many nonces a thread takes out of its deque at a time. Call before mining starts.
+ *
+ * @param batch - clamped to [1, WS_SEGMENT / WS_MIN_STEAL_BATCHES]
+ */
+void WorkStealingScheduler::setBatch(size_t batch) {
+    if (batch < 1) {
+        batch = 1;
+    } else if (batch > WS_SEGMENT / WS_MIN_STEAL_BATCHES) {
+        batch = WS_SEGMENT / WS_MIN_STEAL_BATCHES;
+    }
+    this->batch = batch;
+}
+
+/**
+ * @brief Records when a job generation was published, to measure how long threads take to pick it up
+ *
+ * @param generation
+ * @param t
+ */
+void WorkStealingScheduler::jobStarted(size_t generation, double t) {
+    t_job_start = t;
+    __atomic_store_n(&started_generation, generation, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Fresh ranges of the given generation leave out the covered nonces. Used to resume a job from a checkpoint.
+ *
+ * @param generation
+ * @param covered - must stay valid and unchanged while that generation is mined
+ */
+void WorkStealingScheduler::setCovered(size_t generation, const IntervalSet *covered) {
+    this->covered = covered;
+    covered_generation = generation;
+}
+
+/**
+ * @brief Adds the batch the owner is leaving to its finished runs. Every nonce below batch_next was hashed. Caller
+ * holds the lock.
+ */
+void WorkStealingScheduler::recordBatch(WorkDeque *dq) {
+    if (dq->batch_generation != dq->generation || dq->batch_next <= dq->batch_begin) {
+        return;
+    }
+    if (dq->run.end == dq->batch_begin && dq->run.end > dq->run.begin) {
+        dq->run.end = dq->batch_next;
+    } else {
+        // Not contiguous. A full list only means the run is searched again after a restart
+        if (dq->run.end > dq->run.begin && dq->num_finished < WS_MAX_FINISHED) {
+            dq->finished[dq->num_finished++] = dq->run;
+        }
+        dq->run.begin = dq->batch_begin;
+        dq->run.end = dq->batch_next;
+    }
+    dq->batch_begin = dq->batch_next;
+}
+
+/**
+ * @brief Moves the finished runs of every thread for the given generation into set
+ *
+ * @param generation
+ * @param set
+ * @param include_batches - also the partly hashed batches. Only once the mining threads have stopped
+ */
+void WorkStealingScheduler::drainCovered(size_t generation, IntervalSet &set, int include_batches) {
+    for (size_t i = 0; i < num_threads; i++) {
+        WorkDeque *dq = &deques[i];
+        omp_set_lock(&dq->lock);
+        if (include_batches) {
+            recordBatch(dq);
+        }
+        if (dq->generation == generation) {
+            for (size_t j = 0; j < dq->num_finished; j++) {
+                set.add(dq->finished[j].begin, dq->finished[j].end);
+            }
+            dq->num_finished = 0;
+            // The run keeps growing, it is added again next time
+            set.add(dq->run.begin, dq->run.end);
+        }
+        omp_unset_lock(&dq->lock);
+    }
+}
+
+/**
+ * @brief Moves up to batch nonces from the front of the deque into the owner's batch. Caller holds the lock.
+ *
+ * @return int - 1 on success, 0 if the deque is empty
+ */
+int WorkStealingScheduler::popBatch(WorkDeque *dq, size_t generation) {
+    while (dq->count > 0) {
+        NonceRange *front = &dq->ranges[0];
+        if (front->begin < front->end) {
+            dq->batch_begin = dq->batch_next = front->begin;
+            dq->batch_end = (front->end - front->begin > batch) ? front->begin + batch : front->end;
+            dq->batch_generation = generation;
+            front->begin = dq->batch_end;
+            TRACE_MARK(dq->trace_batch_start);
+            return 1;
+        }
+        // front range used up
+        memmove(&dq->ranges[0], &dq->ranges[1], sizeof(NonceRange) * (dq->count - 1));
+        dq->count--;
+    }
+    return 0;
+}
+
+/**
+ * @brief Steals the back half of the last range of another thread on the same job, preferring threads on
+ * the same NUMA node
+ *
+ * @param tid - thief
+ * @param generation
+ * @param loot - the stolen range
+ * @return int - 1 if something was stolen
+ */
+int WorkStealingScheduler::steal(int tid, size_t generation, NonceRange &loot) {
+    NumaNode *home = topology.nodeOf(tid);
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t k = 1; k < num_threads; k++) {
+            size_t victim_tid = (tid + k) % num_threads;
+            if ((topology.nodeOf(victim_tid) == home) != (pass == 0)) {
+                continue;
+            }
+            WorkDeque *victim = &deques[victim_tid];
+            if (__atomic_load_n(&victim->generation, __ATOMIC_RELAXED) != generation || __atomic_load_n(&victim->count, __ATOMIC_RELAXED) == 0) {
+                continue;  // cheap pre-check without the lock
+            }
+            loot.begin = loot.end = 0;
+            TRACE_LOCK(omp_set_lock(&victim->lock), "steal lock wait");
+            if (victim->generation == generation && victim->count > 0) {
+                NonceRange *back = &victim->ranges[victim->count - 1];
+                size_t remaining = back->end - back->begin;
+                if (remaining >= WS_MIN_STEAL_BATCHES * batch) {
+                    loot.begin = back->begin + remaining / 2;
+                    loot.end = back->end;
+                    back->end = loot.begin;
+                    victim->victimized++;
+                }
+            }
+            omp_unset_lock(&victim->lock);
+            if (loot.end > loot.begin) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Slow path of nextNonce(): resets the deque on a new job, then refills the batch from the deque, by stealing,
+ * or from the node's dispenser, in that order
+ *
+ * @param tid
+ * @param generation
+ */
+void WorkStealingScheduler::refill(int tid, size_t generation) {
+    WorkDeque *dq = &deques[tid];
+#if BTC_TRACE
+    if (dq->batch_next > dq->batch_begin) {
+        trace_complete("hash batch", dq->trace_batch_start, dq->batch_next - dq->batch_begin);
+    }
+#endif
+    TRACE_SCOPE("refill");
+    TRACE_LOCK(omp_set_lock(&dq->lock), "deque lock wait");
+    recordBatch(dq);
+    if (dq->generation != generation) {
+        dq->count = 0;
+        dq->num_finished = 0;
+        dq->run.begin = dq->run.end = 0;
+        __atomic_store_n(&dq->generation, generation, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&started_generation, __ATOMIC_ACQUIRE) == generation) {
+            double latency = omp_get_wtime() - t_job_start;
+            if (latency > dq->max_switch_latency) {
+                dq->max_switch_latency = latency;
+            }
+        }
+    }
+    if (popBatch(dq, generation)) {
+        omp_unset_lock(&dq->lock);
+        return;
+    }
+    omp_unset_lock(&dq->lock);
+
+    // Own deque is empty. Help a slower thread first so the covered nonces stay contiguous
+    NonceRange pieces[WS_MAX_RANGES];
+    size_t num_pieces = 1;
+    if (steal(tid, generation, pieces[0])) {
+        dq->steals++;
+        dq->stolen_nonces += pieces[0].end - pieces[0].begin;
+    } else {
+        NonceRange range;
+        do {
+            topology.nextRange(topology.nodeOf(tid), WS_SEGMENT, range.begin, range.end);
+            dq->segments++;
+            if (covered != NULL && generation == covered_generation) {
+                // Resumed job: skip what was searched before the restart
+                num_pieces = covered->uncovered(range, pieces, WS_MAX_RANGES);
+            } else {
+                pieces[0] = range;
+            }
+        } while (num_pieces == 0);
+    }
+    TRACE_LOCK(omp_set_lock(&dq->lock), "deque lock wait");
+    for (size_t i = 0; i < num_pieces && dq->count < WS_MAX_RANGES; i++) {
+        dq->ranges[dq->count++] = pieces[i];
+    }
+    popBatch(dq, generation);
+    omp_unset_lock(&dq->lock);
+}
+
+/**
+ * @brief Prints the per-thread scheduler counters
+ *
+ */
+void WorkStealingScheduler::printTelemetry() {
+    size_t total_steals = 0;
+    double max_latency = 0.0;
+    printf("\nWork stealing (segment %d, batch %lu):\n", WS_SEGMENT, batch);
+    for (size_t i = 0; i < num_threads; i++) {
+        WorkDeque *dq = &deques[i];
+        printf("TID: %lu\tSegments: %lu\tSteals: %lu\tStolen nonces: %lu\tStolen from: %lu\tMax job switch: %.1lf us\n", i, dq->segments, dq->steals, dq->stolen_nonces, dq->victimized, dq->max_switch_latency * 1e6);
+        total_steals += dq->steals;
+        if (dq->max_switch_latency > max_latency) {
+            max_latency = dq->max_switch_latency;
+        }
+    }
+    printf("Total steals: %lu\tMax job switch latency: %.1lf us\n", total_steals, max_latency * 1e6);
+}
+
+#endif
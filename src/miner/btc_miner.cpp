@@ -0,0 +1,15 @@
+#include "../includes/miner_engine.cpp"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+    // One binary for every backend: --backend serial|threads|processes|teams, settings from the command line and/or
+    // --config file. See --help, or includes/miner_config.cpp, for every option
+    MinerConfig config;
+    miner_config_defaults(config);
+    int status = miner_config_parse(config, argc, argv);
+    if (status != 0) {
+        return status < 0 ? 1 : 0;
+    }
+    return miner_run(config);
+}
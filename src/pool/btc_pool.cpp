@@ -0,0 +1,395 @@
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../includes/json.cpp"
+#include "../includes/sha256_openssl.cpp"
+
+using namespace std;
+
+#define MAX_WORKERS 64
+#define RECV_BYTES 65536
+
+unsigned char running = 1;
+
+void exit_handler(int signal) {
+    printf("\nPOOL: Caught signal: %d. Exiting...\n", signal);
+    running = 0;
+}
+
+/**
+ * Connected miner process. Each worker owns a disjoint slice of the nonce space for the current job.
+ */
+struct Worker {
+    int sock;
+    int authorized;
+    char name[64];
+    char* recv_buf;
+    size_t recv_len;
+    size_t recv_cap;
+    size_t nonce_start;
+    size_t nonce_end;
+    size_t shares;
+    size_t blocks;
+    size_t rejected;
+    double t_connect;
+};
+
+/**
+ * Pool state: the authoritative chain, the current job and the connected workers.
+ */
+struct Pool {
+    Blockchain blockchain;
+    Worker workers[MAX_WORKERS];
+    size_t num_workers;
+    size_t global_threshold;
+    size_t share_threshold;
+    size_t job_id;
+    double t_start;
+    double t_start_global;
+};
+
+void send_line(Worker* worker, JsonWriter* w) {
+    json_write(w, "\n");
+    size_t sent = 0;
+    while (sent < w->len) {
+        ssize_t n = send(worker->sock, w->buf + sent, w->len - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return;  // the poll loop notices the closed socket
+        }
+        sent += n;
+    }
+}
+
+void send_result(Worker* worker, size_t id, const char* result, const char* error) {
+    JsonWriter w;
+    json_writer_init(&w);
+    json_write(&w, "{\"id\":");
+    json_write_size_t(&w, id);
+    json_write(&w, ",\"result\":");
+    json_write(&w, result);
+    json_write(&w, ",\"error\":");
+    if (error != NULL) {
+        json_write_string(&w, error);
+    } else {
+        json_write(&w, "null");
+    }
+    json_write(&w, "}");
+    send_line(worker, &w);
+    json_writer_free(&w);
+}
+
+void send_difficulty(Pool& pool, Worker* worker) {
+    JsonWriter w;
+    json_writer_init(&w);
+    json_write(&w, "{\"id\":null,\"method\":\"mining.set_difficulty\",\"params\":[");
+    json_write_size_t(&w, pool.share_threshold);
+    json_write(&w, "]}");
+    send_line(worker, &w);
+    json_writer_free(&w);
+}
+
+void send_notify(Pool& pool, Worker* worker) {
+    Blockchain::Block* block = pool.blockchain.getCurrentBlock();
+    char job_str[32];
+    snprintf(job_str, sizeof(job_str), "%lx", pool.job_id);
+    JsonWriter w;
+    char prev_digest[2 * SHA256_DIGEST_LENGTH + 1];
+    hex_encode(block->prev_digest, SHA256_DIGEST_LENGTH, prev_digest);
+    prev_digest[2 * SHA256_DIGEST_LENGTH] = '\0';
+    json_writer_init(&w);
+    json_write(&w, "{\"id\":null,\"method\":\"mining.notify\",\"params\":[");
+    json_write_string(&w, job_str);
+    json_write(&w, ",");
+    json_write_size_t(&w, block->block_id);
+    json_write(&w, ",");
+    json_write_string(&w, prev_digest);
+    json_write(&w, ",");
+    json_write_string(&w, block->data);
+    json_write(&w, ",");
+    json_write_size_t(&w, block->threshold);
+    json_write(&w, ",");
+    json_write_size_t(&w, pool.global_threshold);
+    json_write(&w, ",");
+    json_write_size_t(&w, worker->nonce_start);
+    json_write(&w, ",");
+    json_write_size_t(&w, worker->nonce_end);
+    json_write(&w, ",true]}");
+    send_line(worker, &w);
+    json_writer_free(&w);
+}
+
+/**
+ * @brief Splits the nonce space across the authorized workers and sends everyone a fresh job. Same partitioning as the
+ * GPU miner's teams: worker i starts at (MAX_SIZE_T / num_workers) * i.
+ *
+ * @param pool
+ */
+void broadcast_job(Pool& pool) {
+    size_t num_active = 0;
+    for (size_t i = 0; i < pool.num_workers; i++) {
+        num_active += pool.workers[i].authorized;
+    }
+    if (num_active == 0) {
+        return;
+    }
+    pool.job_id++;
+    const size_t RANGE = MAX_SIZE_T / num_active;
+    size_t slot = 0;
+    for (size_t i = 0; i < pool.num_workers; i++) {
+        Worker* worker = &pool.workers[i];
+        if (!worker->authorized) {
+            continue;
+        }
+        worker->nonce_start = RANGE * slot;
+        worker->nonce_end = (slot == num_active - 1) ? MAX_SIZE_T : RANGE * (slot + 1);
+        slot++;
+        send_notify(pool, worker);
+    }
+    printf("\nJOB: %lx\tBLOCK ID: %lu\tThreshold: %lu\tWorkers: %lu\n", pool.job_id, pool.blockchain.getCurrentBlockId(), pool.global_threshold, num_active);
+}
+
+/**
+ * @brief Prints the hashrate estimate of every worker. A share at threshold s takes 16^s attempts on average.
+ *
+ * @param pool
+ */
+void print_worker_stats(Pool& pool) {
+    double t_now = omp_get_wtime();
+    double hashes_per_share = 1.0;
+    for (size_t i = 0; i < pool.share_threshold; i++) {
+        hashes_per_share *= 16.0;
+    }
+    double total = 0.0;
+    printf("\nWorker stats (share threshold %lu):\n", pool.share_threshold);
+    for (size_t i = 0; i < pool.num_workers; i++) {
+        Worker* worker = &pool.workers[i];
+        double t_elapsed = t_now - worker->t_connect;
+        double hashrate = (pool.share_threshold > 0 && t_elapsed > 0.0) ? worker->shares * hashes_per_share / t_elapsed : 0.0;
+        total += hashrate;
+        printf("%-16s\tShares: %lu\tBlocks: %lu\tRejected: %lu\tHashrate: %.0lf H/s\n", worker->name, worker->shares, worker->blocks, worker->rejected, hashrate);
+    }
+    printf("Pool hashrate: %.0lf H/s\n", total);
+}
+
+/**
+ * @brief Verifies a mining.submit. A digest meeting the block threshold extends the chain and triggers a new job for
+ * every worker; a digest meeting only the share threshold counts towards the worker's hashrate.
+ *
+ * @param pool
+ * @param worker
+ * @param id
+ * @param params - [worker, job_id, nonce]
+ */
+void handle_submit(Pool& pool, Worker* worker, size_t id, JsonValue* params) {
+    char job_str[32];
+    snprintf(job_str, sizeof(job_str), "%lx", pool.job_id);
+    const char* job_id = json_string(json_at(params, 1));
+    size_t nonce = json_size_t(json_at(params, 2));
+    if (job_id == NULL || strcmp(job_id, job_str) != 0) {
+        worker->rejected++;
+        send_result(worker, id, "false", "stale job");
+        return;
+    }
+    if (nonce < worker->nonce_start || nonce >= worker->nonce_end) {
+        worker->rejected++;
+        send_result(worker, id, "false", "nonce outside assigned range");
+        return;
+    }
+
+    char* data_to_hash = pool.blockchain.getString(nonce);
+    char* digest = double_sha256((const char*)data_to_hash);
+    if (pool.blockchain.thresholdMet((const char*)digest, pool.global_threshold)) {
+        worker->blocks++;
+        worker->shares++;
+        send_result(worker, id, "true", NULL);
+        printf("Worker: \t\t\t\t%s\n", worker->name);
+        print_new_block_info(pool.t_start, pool.t_start_global, digest, nonce, data_to_hash);
+        pool.blockchain.appendBlock((const char*)digest, (const char*)data_to_hash, pool.global_threshold, nonce);
+        if (pool.global_threshold < SHA256_BITS) {
+            pool.global_threshold++;
+        }
+        pool.t_start = omp_get_wtime();
+        broadcast_job(pool);
+    } else if (pool.share_threshold > 0 && pool.blockchain.shareMet((const char*)digest, pool.share_threshold)) {
+        worker->shares++;
+        send_result(worker, id, "true", NULL);
+    } else {
+        worker->rejected++;
+        send_result(worker, id, "false", "low difficulty");
+    }
+    free(data_to_hash);
+    free(digest);
+}
+
+void handle_line(Pool& pool, Worker* worker, const char* line) {
+    JsonValue* msg = json_parse(line);
+    if (msg == NULL) {
+        return;
+    }
+    const char* method = json_string(json_get(msg, "method"));
+    size_t id = json_size_t(json_get(msg, "id"));
+    JsonValue* params = json_get(msg, "params");
+    if (method == NULL) {
+        // miners do not send responses
+    } else if (strcmp(method, "mining.subscribe") == 0) {
+        // extranonce1 identifies the worker's slot
+        char result[96];
+        snprintf(result, sizeof(result), "[[[\"mining.notify\",\"%x\"]],\"%08lx\",4]", worker->sock, (size_t)(worker - pool.workers));
+        send_result(worker, id, result, NULL);
+    } else if (strcmp(method, "mining.authorize") == 0) {
+        const char* name = json_string(json_at(params, 0));
+        snprintf(worker->name, sizeof(worker->name), "%s", name ? name : "anonymous");
+        worker->authorized = 1;
+        worker->t_connect = omp_get_wtime();
+        send_result(worker, id, "true", NULL);
+        printf("POOL: worker %s authorized\n", worker->name);
+        send_difficulty(pool, worker);
+        // Re-shard the nonce space so the new worker gets its own slice
+        broadcast_job(pool);
+    } else if (strcmp(method, "mining.submit") == 0) {
+        handle_submit(pool, worker, id, params);
+    } else {
+        send_result(worker, id, "null", "unknown method");
+    }
+    json_free(msg);
+}
+
+void remove_worker(Pool& pool, size_t index) {
+    Worker* worker = &pool.workers[index];
+    printf("POOL: worker %s disconnected\n", worker->name);
+    int was_authorized = worker->authorized;
+    close(worker->sock);
+    free(worker->recv_buf);
+    pool.workers[index] = pool.workers[pool.num_workers - 1];
+    pool.num_workers--;
+    if (was_authorized) {
+        // The departed worker's slice would otherwise never be searched
+        broadcast_job(pool);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    // Create interrupt handling variables. Exit on a keyboard ctrl-c interrupt
+    struct sigaction sigIntHandler;
+    sigIntHandler.sa_handler = exit_handler;
+    sigemptyset(&sigIntHandler.sa_mask);
+    sigIntHandler.sa_flags = 0;
+    sigaction(SIGINT, &sigIntHandler, NULL);
+
+    int port = 3333;
+    size_t max_blocks = 0;
+    const double STATS_INTERVAL = 10.0;
+    Pool pool;
+    pool.num_workers = 0;
+    pool.global_threshold = 0;
+    pool.share_threshold = 4;
+    pool.job_id = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:s:b:")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            case 's': pool.share_threshold = strtoull(optarg, NULL, 10); break;
+            case 'b': max_blocks = strtoull(optarg, NULL, 10); break;
+            default:
+                printf("Usage: %s [-p port] [-s share_threshold] [-b num_blocks]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, MAX_WORKERS) != 0) {
+        perror("POOL: bind/listen");
+        return 1;
+    }
+
+    // Initialize the blockchain
+    const char* INIT_DATA = "[BLOCK ID|PREVIOUS DIGEST|DATA|THRESHOLD|NONCE]";
+    char* INIT_PREV_DIGEST = double_sha256(INIT_DATA);
+    pool.blockchain.appendBlock(INIT_PREV_DIGEST, INIT_DATA, pool.global_threshold, 0);
+    free(INIT_PREV_DIGEST);
+    pool.global_threshold++;
+    printf("POOL: listening on port %d, share threshold %lu\n", port, pool.share_threshold);
+
+    pool.t_start = omp_get_wtime();
+    pool.t_start_global = pool.t_start;
+    double t_stats = pool.t_start;
+    struct pollfd pfds[MAX_WORKERS + 1];
+
+    while (running && (max_blocks == 0 || pool.blockchain.getSize() <= max_blocks)) {
+        pfds[0].fd = listener;
+        pfds[0].events = POLLIN;
+        for (size_t i = 0; i < pool.num_workers; i++) {
+            pfds[i + 1].fd = pool.workers[i].sock;
+            pfds[i + 1].events = POLLIN;
+        }
+        int ready = poll(pfds, pool.num_workers + 1, 100);
+        if (ready > 0) {
+            // Serve workers before accepting so the pfds indices still match
+            for (size_t i = pool.num_workers; i-- > 0;) {
+                if (!(pfds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+                    continue;
+                }
+                Worker* worker = &pool.workers[i];
+                if (worker->recv_len + 1 >= worker->recv_cap) {
+                    worker->recv_cap *= 2;
+                    worker->recv_buf = (char*)realloc(worker->recv_buf, worker->recv_cap);
+                }
+                ssize_t n = recv(worker->sock, worker->recv_buf + worker->recv_len, worker->recv_cap - worker->recv_len - 1, 0);
+                if (n <= 0) {
+                    remove_worker(pool, i);
+                    continue;
+                }
+                worker->recv_len += n;
+                worker->recv_buf[worker->recv_len] = '\0';
+                char* line = worker->recv_buf;
+                char* newline;
+                while ((newline = strchr(line, '\n')) != NULL) {
+                    *newline = '\0';
+                    handle_line(pool, worker, line);
+                    line = newline + 1;
+                }
+                worker->recv_len -= line - worker->recv_buf;
+                memmove(worker->recv_buf, line, worker->recv_len);
+            }
+            if ((pfds[0].revents & POLLIN) && pool.num_workers < MAX_WORKERS) {
+                int sock = accept(listener, NULL, NULL);
+                if (sock >= 0) {
+                    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    Worker* worker = &pool.workers[pool.num_workers++];
+                    memset(worker, 0, sizeof(Worker));
+                    worker->sock = sock;
+                    worker->recv_cap = RECV_BYTES;
+                    worker->recv_buf = (char*)malloc(worker->recv_cap);
+                    snprintf(worker->name, sizeof(worker->name), "unauthorized");
+                }
+            }
+        }
+
+        if (omp_get_wtime() - t_stats > STATS_INTERVAL) {
+            print_worker_stats(pool);
+            t_stats = omp_get_wtime();
+        }
+    }
+
+    print_worker_stats(pool);
+    for (size_t i = 0; i < pool.num_workers; i++) {
+        close(pool.workers[i].sock);
+        free(pool.workers[i].recv_buf);
+    }
+    close(listener);
+
+    // Print then delete the blockchain
+    pool.blockchain.print();
+    return 0;
+}
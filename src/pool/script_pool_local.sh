@@ -0,0 +1,32 @@
+#!/bin/bash
+# Runs the pool and NUM_MINERS parallel miner processes on this machine
+TIMEOUT=600   # 10 minutes
+NUM_MINERS=4
+PORT=3333
+
+echo "Start job"
+make clean
+make
+cd ../parallel
+make clean
+make
+cd ../pool
+
+./btc_pool.exe -p $PORT -s 4 > local_pool${NUM_MINERS}_10m.out 2>&1 &
+POOL_PID=$!
+sleep 1
+
+MINER_PIDS=""
+for i in $(seq 1 $NUM_MINERS); do
+    ../parallel/btc_miner_parallel.exe -o 127.0.0.1:$PORT -u miner$i --time-limit $TIMEOUT > local_pool_miner$i.out 2>&1 &
+    MINER_PIDS="$MINER_PIDS $!"
+done
+# The miners stop themselves after TIMEOUT seconds of mining, then the pool is stopped
+wait $MINER_PIDS
+kill -2 $POOL_PID
+wait
+
+make clean
+cd ../parallel
+make clean
+echo "End job after $TIMEOUT seconds"
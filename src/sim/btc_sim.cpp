@@ -0,0 +1,92 @@
+#include <unistd.h>
+
+#include "../includes/network_sim.cpp"
+
+using namespace std;
+
+#define DEFAULT_MINERS 8
+#define DEFAULT_HASHRATE 1e6
+#define DEFAULT_LATENCY 0.05
+#define DEFAULT_THRESHOLD 6
+#define DEFAULT_HASH_THRESHOLD 3
+#define DEFAULT_BLOCKS 1000000
+#define DEFAULT_HASH_BLOCKS 10000
+#define DEFAULT_CONFIRMATIONS 6
+
+int main(int argc, char* argv[]) {
+    // Simulates miners competing on one network and reports orphan rates, reorg depths and time to finality.
+    // Usage: btc_sim.exe [-n miners] [-r hashrate] [-l latency] [-m hashrate:latency]... [-t threshold] [-b blocks]
+    //                    [-k confirmations] [-j jitter] [-s seed] [-H] [-o csv]
+    // Without -m there are -n identical miners (default 8) of -r hashes per second (default 1e6) and -l seconds one way
+    // latency (default 0.05). Each -m adds one miner instead, e.g. a pool: -m 4e6:0.01. A block sent by one miner
+    // reaches another after both latencies plus an exponential delay of mean -j seconds. Blocks need exactly -t leading
+    // zero hex digits (default 6, or 3 with -H). -H hashes real preimages instead of drawing block times, at -b
+    // blocks (default 1000000, or 10000 with -H). -o appends a summary row to a CSV file, for sweeps.
+    size_t num_miners = DEFAULT_MINERS;
+    double hashrate = DEFAULT_HASHRATE;
+    double latency = DEFAULT_LATENCY;
+    double jitter = 0.0;
+    size_t threshold = 0;
+    size_t blocks = 0;
+    size_t confirmations = DEFAULT_CONFIRMATIONS;
+    unsigned long long seed = 1;
+    int hash_mode = 0;
+    const char* csv_path = NULL;
+    double* custom = NULL;  // hashrate, latency pairs
+    size_t num_custom = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:l:m:t:b:k:j:s:Ho:")) != -1) {
+        switch (opt) {
+            case 'n': num_miners = strtoull(optarg, NULL, 10); break;
+            case 'r': hashrate = strtod(optarg, NULL); break;
+            case 'l': latency = strtod(optarg, NULL); break;
+            case 'm': {
+                char* end;
+                custom = (double*)realloc(custom, sizeof(double) * 2 * (num_custom + 1));
+                custom[2 * num_custom] = strtod(optarg, &end);
+                custom[2 * num_custom + 1] = (*end == ':') ? strtod(end + 1, NULL) : DEFAULT_LATENCY;
+                num_custom++;
+                break;
+            }
+            case 't': threshold = strtoull(optarg, NULL, 10); break;
+            case 'b': blocks = strtoull(optarg, NULL, 10); break;
+            case 'k': confirmations = strtoull(optarg, NULL, 10); break;
+            case 'j': jitter = strtod(optarg, NULL); break;
+            case 's': seed = strtoull(optarg, NULL, 10); break;
+            case 'H': hash_mode = 1; break;
+            case 'o': csv_path = optarg; break;
+            default:
+                printf("Usage: %s [-n miners] [-r hashrate] [-l latency] [-m hashrate:latency]... [-t threshold] [-b blocks] [-k confirmations] [-j jitter] [-s seed] [-H] [-o csv]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (threshold == 0) {
+        threshold = hash_mode ? DEFAULT_HASH_THRESHOLD : DEFAULT_THRESHOLD;
+    }
+    if (blocks == 0) {
+        blocks = hash_mode ? DEFAULT_HASH_BLOCKS : DEFAULT_BLOCKS;
+    }
+    if (threshold >= 2 * SHA256_DIGEST_LENGTH || confirmations == 0 || (num_custom == 0 && num_miners == 0)) {
+        printf("Need a threshold below %d, at least one confirmation and at least one miner\n", 2 * SHA256_DIGEST_LENGTH);
+        return 1;
+    }
+
+    NetworkSim sim(threshold, hash_mode, seed);
+    sim.setJitter(jitter);
+    if (num_custom > 0) {
+        for (size_t i = 0; i < num_custom; i++) {
+            sim.addMiner(custom[2 * i], custom[2 * i + 1]);
+        }
+    } else {
+        for (size_t i = 0; i < num_miners; i++) {
+            sim.addMiner(hashrate, latency);
+        }
+    }
+    free(custom);
+    sim.run(blocks);
+    sim.printReport(confirmations);
+    if (csv_path != NULL && sim.appendCsv(csv_path, confirmations) < 0) {
+        return 1;
+    }
+    return 0;
+}
@@ -70,7 +70,7 @@ void test1() {
                 sprintf(sha256K_str + (i * 8), "%08x", sha256K[i]);
             }
             sprintf(data, "%lu", thread_counter);
-            char* digest = gpu_sha256((const char*)data, sha256K);
+            char* digest = gpu_sha256((const char*)data);
 
             printf("Thread = %5d, team = %5d / %5d, threads in team = %5d, max threads in team = %5d. Thread counter = %21lu, data = %s, digest = %s\n", omp_get_thread_num(), omp_get_team_num(), omp_get_num_teams(), omp_get_num_threads(), omp_get_max_threads(), thread_counter, data, digest);
         }
@@ -142,7 +142,7 @@ void test2() {
             }
             sprintf(data, "%lu", thread_counter);
 
-            char* digest = gpu_double_sha256((const char*)data, sha256K);
+            char* digest = gpu_double_sha256((const char*)data);
             printf("Thread = %5d, team = %5d / %5d, threads in team = %5d, max threads in team = %5d. Thread counter = %21lu, data = %s, digest = %s\n", omp_get_thread_num(), omp_get_team_num(), omp_get_num_teams(), omp_get_num_threads(), omp_get_max_threads(), thread_counter, data, digest);
         }
     }
@@ -0,0 +1,37 @@
+#!/bin/bash
+
+# Build the stand-in pool and the parallel BTC miner
+make clean
+make stratum_stub_server
+cd ../parallel
+make clean
+make
+cd ../tests
+
+echo "Made stub server and parallel miner, launching..."
+
+# the stub exits by itself after 4 accepted blocks
+./stratum_stub_server.exe 3333 4 &
+STUB_PID=$!
+sleep 1
+
+../parallel/btc_miner_parallel.exe -o 127.0.0.1:3333 -u test_worker > stratum_parallel.txt &
+MINER_PID=$!
+
+wait $STUB_PID
+STUB_STATUS=$?
+
+# issue a control-c to stop the miner
+kill -2 $MINER_PID
+wait $MINER_PID
+make clean
+cd ../parallel
+make clean
+
+# print done
+if [ $STUB_STATUS -eq 0 ]; then
+    echo "Done"
+else
+    echo "FAILED"
+fi
+exit $STUB_STATUS
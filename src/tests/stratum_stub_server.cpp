@@ -0,0 +1,153 @@
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../includes/json.cpp"
+#include "../includes/sha256_openssl.cpp"
+
+using namespace std;
+
+/**
+ * Local stand-in for a Stratum pool. Serves one miner on localhost, hands out a job per block, verifies submits and
+ * sends the next job with the threshold raised by one. Exits after NUM_BLOCKS accepted blocks.
+ *
+ * Usage: ./stratum_stub_server.exe [port] [num_blocks]
+ */
+
+void send_json(int sock, JsonWriter* w) {
+    json_write(w, "\n");
+    send(sock, w->buf, w->len, MSG_NOSIGNAL);
+}
+
+void send_result(int sock, size_t id, const char* result) {
+    JsonWriter w;
+    json_writer_init(&w);
+    json_write(&w, "{\"id\":");
+    json_write_size_t(&w, id);
+    json_write(&w, ",\"result\":");
+    json_write(&w, result);
+    json_write(&w, ",\"error\":null}");
+    send_json(sock, &w);
+    json_writer_free(&w);
+}
+
+void send_notify(int sock, size_t job_id, Blockchain& blockchain, size_t threshold) {
+    char job_str[32];
+    snprintf(job_str, sizeof(job_str), "%lx", job_id);
+    Blockchain::Block* block = blockchain.getCurrentBlock();
+    JsonWriter w;
+    char prev_digest[2 * SHA256_DIGEST_LENGTH + 1];
+    hex_encode(block->prev_digest, SHA256_DIGEST_LENGTH, prev_digest);
+    prev_digest[2 * SHA256_DIGEST_LENGTH] = '\0';
+    json_writer_init(&w);
+    json_write(&w, "{\"id\":null,\"method\":\"mining.notify\",\"params\":[");
+    json_write_string(&w, job_str);
+    json_write(&w, ",");
+    json_write_size_t(&w, block->block_id);
+    json_write(&w, ",");
+    json_write_string(&w, prev_digest);
+    json_write(&w, ",");
+    json_write_string(&w, block->data);
+    json_write(&w, ",");
+    json_write_size_t(&w, block->threshold);
+    json_write(&w, ",");
+    json_write_size_t(&w, threshold);
+    json_write(&w, ",0,");
+    json_write_size_t(&w, MAX_SIZE_T);
+    json_write(&w, ",true]}");
+    send_json(sock, &w);
+    json_writer_free(&w);
+    printf("Stub: sent job %s for block %lu threshold %lu\n", job_str, block->block_id, threshold);
+}
+
+int main(int argc, char* argv[]) {
+    const int PORT = argc > 1 ? atoi(argv[1]) : 3333;
+    const size_t NUM_BLOCKS = argc > 2 ? strtoull(argv[2], NULL, 10) : 3;
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(PORT);
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0) {
+        perror("Stub: bind/listen");
+        return 1;
+    }
+    printf("Stub: listening on 127.0.0.1:%d\n", PORT);
+    int sock = accept(listener, NULL, NULL);
+
+    const char* INIT_DATA = "[BLOCK ID|PREVIOUS DIGEST|DATA|THRESHOLD|NONCE]";
+    char* init_prev_digest = double_sha256(INIT_DATA);
+    Blockchain blockchain;
+    blockchain.appendBlock(init_prev_digest, INIT_DATA, 0, 0);
+    free(init_prev_digest);
+    size_t threshold = 1;
+    size_t job_id = 1;
+    size_t blocks_accepted = 0;
+
+    char buf[1 << 16];
+    size_t len = 0;
+    while (blocks_accepted < NUM_BLOCKS) {
+        ssize_t n = recv(sock, buf + len, sizeof(buf) - len - 1, 0);
+        if (n <= 0) {
+            printf("Stub: miner disconnected\n");
+            break;
+        }
+        len += n;
+        buf[len] = '\0';
+        char* line = buf;
+        char* newline;
+        while ((newline = strchr(line, '\n')) != NULL) {
+            *newline = '\0';
+            JsonValue* msg = json_parse(line);
+            line = newline + 1;
+            if (msg == NULL) {
+                continue;
+            }
+            const char* method = json_string(json_get(msg, "method"));
+            size_t id = json_size_t(json_get(msg, "id"));
+            JsonValue* params = json_get(msg, "params");
+            if (strcmp(method, "mining.subscribe") == 0) {
+                send_result(sock, id, "[[[\"mining.notify\",\"1\"]],\"00000000\",4]");
+            } else if (strcmp(method, "mining.authorize") == 0) {
+                send_result(sock, id, "true");
+                send_notify(sock, job_id, blockchain, threshold);
+            } else if (strcmp(method, "mining.submit") == 0) {
+                char job_str[32];
+                snprintf(job_str, sizeof(job_str), "%lx", job_id);
+                size_t nonce = json_size_t(json_at(params, 2));
+                const char* submitted_job = json_string(json_at(params, 1));
+                char* data_to_hash = blockchain.getString(nonce);
+                char* digest = double_sha256(data_to_hash);
+                if (submitted_job != NULL && strcmp(submitted_job, job_str) == 0 && blockchain.thresholdMet(digest, threshold)) {
+                    send_result(sock, id, "true");
+                    printf("Stub: accepted nonce %lu digest %s\n", nonce, digest);
+                    blockchain.appendBlock(digest, data_to_hash, threshold, nonce);
+                    threshold++;
+                    job_id++;
+                    blocks_accepted++;
+                    if (blocks_accepted < NUM_BLOCKS) {
+                        send_notify(sock, job_id, blockchain, threshold);
+                    }
+                } else {
+                    send_result(sock, id, "false");
+                    printf("Stub: rejected nonce %lu for job %s\n", nonce, submitted_job ? submitted_job : "?");
+                }
+                free(data_to_hash);
+                free(digest);
+            }
+            json_free(msg);
+        }
+        len -= line - buf;
+        memmove(buf, line, len);
+    }
+
+    printf("Stub: %lu blocks accepted. Closing.\n", blocks_accepted);
+    close(sock);
+    close(listener);
+    return blocks_accepted == NUM_BLOCKS ? 0 : 1;
+}